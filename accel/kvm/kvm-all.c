@@ -63,6 +63,25 @@
 
 #define KVM_MSI_HASHTAB_SIZE    256
 
+/* Definitions from Linux 5.7 <linux/kvm.h>, for builds whose headers
+ * predate manual dirty log protection.
+ */
+#ifndef KVM_CLEAR_DIRTY_LOG
+struct kvm_clear_dirty_log {
+    __u32 slot;
+    __u32 num_pages;
+    __u64 first_page;
+    union {
+        void *dirty_bitmap; /* one bit per page */
+        __u64 padding2;
+    };
+};
+
+#define KVM_CAP_MANUAL_DIRTY_LOG_PROTECT2 168
+#define KVM_CLEAR_DIRTY_LOG _IOWR(KVMIO, 0xc0, struct kvm_clear_dirty_log)
+#define KVM_DIRTY_LOG_MANUAL_PROTECT_ENABLE (1 << 0)
+#endif
+
 struct KVMParkedVcpu {
     unsigned long vcpu_id;
     int kvm_fd;
@@ -103,6 +122,8 @@ struct KVMState
 #endif
     KVMMemoryListener memory_listener;
     QLIST_HEAD(, KVMParkedVcpu) kvm_parked_vcpus;
+    /* Dirty pages stay writable after KVM_GET_DIRTY_LOG until cleared */
+    bool manual_dirty_log_protect;
 };
 
 KVMState *kvm_state;
@@ -124,6 +145,14 @@ bool kvm_ioeventfd_any_length_allowed;
 bool kvm_msi_use_devid;
 static bool kvm_immediate_exit;
 
+/* Protects the slots of all KVMMemoryListeners, since dirty logs are
+ * cleared from the migration thread without the iothread lock
+ */
+static QemuMutex kml_slots_lock;
+
+#define kvm_slots_lock()    qemu_mutex_lock(&kml_slots_lock)
+#define kvm_slots_unlock()  qemu_mutex_unlock(&kml_slots_lock)
+
 static const KVMCapabilityInfo kvm_required_capabilites[] = {
     KVM_CAP_INFO(USER_MEMORY),
     KVM_CAP_INFO(DESTROY_MEMORY_REGION_WORKS),
@@ -378,6 +407,11 @@ static int kvm_slot_update_flags(KVMMemoryListener *kml, KVMSlot *mem,
         return 0;
     }
 
+    if (!(mem->flags & KVM_MEM_LOG_DIRTY_PAGES)) {
+        g_free(mem->dirty_bmap);
+        mem->dirty_bmap = NULL;
+    }
+
     return kvm_set_user_memory_region(kml, mem);
 }
 
@@ -412,7 +446,9 @@ static void kvm_log_start(MemoryListener *listener,
         return;
     }
 
+    kvm_slots_lock();
     r = kvm_section_update_flags(kml, section);
+    kvm_slots_unlock();
     if (r < 0) {
         abort();
     }
@@ -429,7 +465,9 @@ static void kvm_log_stop(MemoryListener *listener,
         return;
     }
 
+    kvm_slots_lock();
     r = kvm_section_update_flags(kml, section);
+    kvm_slots_unlock();
     if (r < 0) {
         abort();
     }
@@ -453,7 +491,7 @@ static int kvm_get_dirty_pages_log_range(MemoryRegionSection *section,
  * kvm_physical_sync_dirty_bitmap - Grab dirty bitmap from kernel space
  * This function updates qemu's dirty bitmap using
  * memory_region_set_dirty().  This means all bits are set
- * to dirty.
+ * to dirty.  Called with the slots lock held.
  *
  * @start_add: start of logged region.
  * @end_addr: end of logged region.
@@ -486,24 +524,80 @@ static int kvm_physical_sync_dirty_bitmap(KVMMemoryListener *kml,
          * So for now, let's align to 64 instead of HOST_LONG_BITS here, in
          * a hope that sizeof(long) won't become >8 any time soon.
          */
-        size = ALIGN(((mem->memory_size) >> TARGET_PAGE_BITS),
-                     /*HOST_LONG_BITS*/ 64) / 8;
-        d.dirty_bitmap = g_malloc0(size);
+        if (!mem->dirty_bmap) {
+            size = ALIGN(((mem->memory_size) >> TARGET_PAGE_BITS),
+                         /*HOST_LONG_BITS*/ 64) / 8;
+            mem->dirty_bmap = g_malloc0(size);
+        }
+        d.dirty_bitmap = mem->dirty_bmap;
 
         d.slot = mem->slot | (kml->as_id << 16);
         if (kvm_vm_ioctl(s, KVM_GET_DIRTY_LOG, &d) == -1) {
             DPRINTF("ioctl failed %d\n", errno);
-            g_free(d.dirty_bitmap);
             return -1;
         }
 
         kvm_get_dirty_pages_log_range(section, d.dirty_bitmap);
-        g_free(d.dirty_bitmap);
     }
 
     return 0;
 }
 
+/* KVM_CLEAR_DIRTY_LOG works on ranges aligned to this many pages */
+#define KVM_CLEAR_LOG_ALIGN 64
+
+/*
+ * Re-protect the pages of [@start, @start + @size), relative to the
+ * start of @mem, that the last KVM_GET_DIRTY_LOG reported dirty.  Pages
+ * dirtied since then are left alone so that they show up in the next
+ * sync.  Called with the slots lock held.
+ */
+static int kvm_log_clear_one_slot(KVMMemoryListener *kml, KVMSlot *mem,
+                                  uint64_t start, uint64_t size)
+{
+    KVMState *s = kvm_state;
+    struct kvm_clear_dirty_log d = {};
+    uint64_t psize = qemu_real_host_page_size;
+    uint64_t first, end, page, bmap_start, bmap_npages;
+    unsigned long *bmap_clear;
+    bool dirty = false;
+    int ret = 0;
+
+    if (!mem->dirty_bmap) {
+        return 0;
+    }
+
+    first = start / psize;
+    end = DIV_ROUND_UP(start + size, psize);
+
+    /* Round out to the kernel's alignment, or to the end of the slot */
+    bmap_start = QEMU_ALIGN_DOWN(first, KVM_CLEAR_LOG_ALIGN);
+    bmap_npages = MIN(QEMU_ALIGN_UP(end, KVM_CLEAR_LOG_ALIGN),
+                      mem->memory_size / psize) - bmap_start;
+
+    bmap_clear = bitmap_new(bmap_npages);
+    for (page = find_next_bit(mem->dirty_bmap, end, first); page < end;
+         page = find_next_bit(mem->dirty_bmap, end, page + 1)) {
+        set_bit(page - bmap_start, bmap_clear);
+        clear_bit(page, mem->dirty_bmap);
+        dirty = true;
+    }
+
+    if (dirty) {
+        d.slot = mem->slot | (kml->as_id << 16);
+        d.first_page = bmap_start;
+        d.num_pages = bmap_npages;
+        d.dirty_bitmap = bmap_clear;
+        if (kvm_vm_ioctl(s, KVM_CLEAR_DIRTY_LOG, &d) < 0) {
+            DPRINTF("ioctl failed %d\n", errno);
+            ret = -1;
+        }
+    }
+
+    g_free(bmap_clear);
+    return ret;
+}
+
 static void kvm_coalesce_mmio_region(MemoryListener *listener,
                                      MemoryRegionSection *secion,
                                      hwaddr start, hwaddr size)
@@ -720,16 +814,20 @@ static void kvm_set_phys_mem(KVMMemoryListener *kml,
     ram = memory_region_get_ram_ptr(mr) + section->offset_within_region +
           (section->offset_within_address_space - start_addr);
 
+    kvm_slots_lock();
+
     mem = kvm_lookup_matching_slot(kml, start_addr, size);
     if (!add) {
         if (!mem) {
-            return;
+            goto out;
         }
         if (mem->flags & KVM_MEM_LOG_DIRTY_PAGES) {
             kvm_physical_sync_dirty_bitmap(kml, section);
         }
 
         /* unregister the slot */
+        g_free(mem->dirty_bmap);
+        mem->dirty_bmap = NULL;
         mem->memory_size = 0;
         err = kvm_set_user_memory_region(kml, mem);
         if (err) {
@@ -737,13 +835,13 @@ static void kvm_set_phys_mem(KVMMemoryListener *kml,
                     __func__, strerror(-err));
             abort();
         }
-        return;
+        goto out;
     }
 
     if (mem) {
         /* update the slot */
         kvm_slot_update_flags(kml, mem, mr);
-        return;
+        goto out;
     }
 
     /* register the new slot */
@@ -759,6 +857,9 @@ static void kvm_set_phys_mem(KVMMemoryListener *kml,
                 strerror(-err));
         abort();
     }
+
+out:
+    kvm_slots_unlock();
 }
 
 static void kvm_region_add(MemoryListener *listener,
@@ -785,7 +886,46 @@ static void kvm_log_sync(MemoryListener *listener,
     KVMMemoryListener *kml = container_of(listener, KVMMemoryListener, listener);
     int r;
 
+    kvm_slots_lock();
     r = kvm_physical_sync_dirty_bitmap(kml, section);
+    kvm_slots_unlock();
+    if (r < 0) {
+        abort();
+    }
+}
+
+static void kvm_log_clear(MemoryListener *listener,
+                          MemoryRegionSection *section)
+{
+    KVMMemoryListener *kml = container_of(listener, KVMMemoryListener, listener);
+    KVMState *s = kvm_state;
+    uint64_t start, end;
+    int i, r = 0;
+
+    if (!s->manual_dirty_log_protect) {
+        /* KVM_GET_DIRTY_LOG already re-protected everything */
+        return;
+    }
+
+    start = section->offset_within_address_space;
+    end = start + int128_get64(section->size);
+
+    kvm_slots_lock();
+    for (i = 0; i < s->nr_slots && r >= 0; i++) {
+        KVMSlot *mem = &kml->slots[i];
+        uint64_t mem_end = mem->start_addr + mem->memory_size;
+        uint64_t sec_start, sec_end;
+
+        /* The section may cover part of one or more slots */
+        sec_start = MAX(start, mem->start_addr);
+        sec_end = MIN(end, mem_end);
+        if (!mem->memory_size || sec_start >= sec_end) {
+            continue;
+        }
+        r = kvm_log_clear_one_slot(kml, mem, sec_start - mem->start_addr,
+                                   sec_end - sec_start);
+    }
+    kvm_slots_unlock();
     if (r < 0) {
         abort();
     }
@@ -877,6 +1017,7 @@ void kvm_memory_listener_register(KVMState *s, KVMMemoryListener *kml,
     kml->listener.log_start = kvm_log_start;
     kml->listener.log_stop = kvm_log_stop;
     kml->listener.log_sync = kvm_log_sync;
+    kml->listener.log_clear = kvm_log_clear;
     kml->listener.priority = 10;
 
     memory_listener_register(&kml->listener, as);
@@ -1499,6 +1640,7 @@ static int kvm_init(MachineState *ms)
     QTAILQ_INIT(&s->kvm_sw_breakpoints);
 #endif
     QLIST_INIT(&s->kvm_parked_vcpus);
+    qemu_mutex_init(&kml_slots_lock);
     s->vmfd = -1;
     s->fd = qemu_open("/dev/kvm", O_RDWR);
     if (s->fd == -1) {
@@ -1641,6 +1783,22 @@ static int kvm_init(MachineState *ms)
     kvm_ioeventfd_any_length_allowed =
         (kvm_check_extension(s, KVM_CAP_IOEVENTFD_ANY_LENGTH) > 0);
 
+    /*
+     * With manual protection, KVM_GET_DIRTY_LOG leaves dirty pages
+     * writable and users re-protect them with KVM_CLEAR_DIRTY_LOG a
+     * chunk at a time, right before they consume the pages.
+     */
+    if (kvm_check_extension(s, KVM_CAP_MANUAL_DIRTY_LOG_PROTECT2) &
+        KVM_DIRTY_LOG_MANUAL_PROTECT_ENABLE) {
+        s->manual_dirty_log_protect =
+            !kvm_vm_enable_cap(s, KVM_CAP_MANUAL_DIRTY_LOG_PROTECT2, 0,
+                               KVM_DIRTY_LOG_MANUAL_PROTECT_ENABLE);
+        if (!s->manual_dirty_log_protect) {
+            warn_report("Failed to enable manual dirty log protection, "
+                        "falling back to KVM_GET_DIRTY_LOG");
+        }
+    }
+
     kvm_state = s;
 
     ret = kvm_arch_init(ms, s);
@@ -0,0 +1,532 @@
+/*
+ * Persistent translation block cache for user mode emulation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Every process start of a user mode emulator retranslates the same
+ * guest code.  With -tb-cache, the host code of the TBs generated by a
+ * process is written to a file named after a hash of the guest executable,
+ * and the next process copies it into code_gen_buffer instead of running
+ * the translator.
+ *
+ * A cached TB is only reused if the guest code it was generated from is
+ * still mapped at the same address and byte-for-byte identical, so the
+ * contents of the file are a hint and never affect correctness.  Once
+ * loaded, the TB goes through tb_link_page() like any other, so that
+ * writes to the guest code and mprotect() invalidate it through
+ * tb_invalidate_phys_range() as usual.
+ *
+ * Host code is position dependent: calls to helpers, jumps to the
+ * epilogue and the TB pointer passed to exit_tb.  The backend records
+ * these as TCGPCacheReloc while the TB is generated, and TBs containing
+ * anything else it cannot describe (host pointers from tcg_const_ptr,
+ * out of range calls through the constant pool) are not cached.  Only
+ * the x86_64 backend implements this so far.
+ *
+ * The host code in the file is run as is, so the file must not be
+ * writable by anyone but the user running QEMU: the cache directory must
+ * belong to the user and not be writable by group or others, and a file
+ * with the wrong owner or permissions is ignored.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu-common.h"
+#include "qemu/error-report.h"
+#include "qemu/log.h"
+#include "cpu.h"
+#include "exec/exec-all.h"
+#include "exec/cpu_ldst.h"
+#include "exec/tb-hash.h"
+#include "exec/tb-pcache.h"
+#include "tcg.h"
+#include "trace.h"
+
+bool tb_pcache_enabled;
+
+#if TCG_TARGET_IMPLEMENTS_PCACHE
+
+#define PCACHE_MAGIC    "QEMUTBC"
+#define PCACHE_VERSION  1
+
+/* Sanity limit for the host code of one TB, when reading the file.  */
+#define PCACHE_MAX_CODE_SIZE  (256 * 1024)
+
+typedef struct PCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t nb_records;
+    /* The QEMU executable that generated the code.  */
+    uint64_t exe_size;
+    uint64_t exe_mtime;
+    uint64_t exe_ino;
+    /* Everything else, besides the TB key, that code generation used.  */
+    uint64_t guest_base;
+    uint32_t host_features;
+    uint32_t icache_linesize;
+    uint32_t cpu_model_hash;
+    uint32_t config;
+} PCacheHeader;
+
+#define PCACHE_CONFIG_SINGLESTEP  1
+#define PCACHE_CONFIG_NOCHAIN     2
+
+typedef struct PCacheKey {
+    uint64_t pc;
+    uint64_t cs_base;
+    uint32_t flags;
+    uint32_t cflags;
+    uint32_t parallel;
+    uint32_t pad;
+} PCacheKey;
+
+/* A record is followed by its relocations, the host code and search data,
+   and the guest code, padded to a multiple of 8 bytes.  */
+typedef struct PCacheRecord {
+    PCacheKey key;
+    uint32_t record_size;
+    uint32_t guest_size;
+    uint32_t code_size;
+    uint32_t search_size;
+    uint32_t nb_relocs;
+    uint16_t icount;
+    uint16_t jmp_reset_offset[2];
+    uint16_t pad;
+    uint32_t jmp_insn_offset[2];
+} PCacheRecord;
+
+QEMU_BUILD_BUG_ON(sizeof(PCacheHeader) % 8);
+QEMU_BUILD_BUG_ON(sizeof(PCacheRecord) % 8);
+QEMU_BUILD_BUG_ON(sizeof(TCGPCacheReloc) % 8);
+
+static struct {
+    char *path;
+    uint32_t cpu_model_hash;
+    bool opened;
+    bool dirty;
+    /* The cache file as found at startup.  */
+    void *map;
+    size_t map_size;
+    /* PCacheKey -> PCacheRecord, pointing either into the mapping or to
+       records generated by this process.  */
+    GHashTable *records;
+    /* Statistics for this process.  */
+    unsigned int nb_loaded;
+    unsigned int nb_stored;
+} pcache;
+
+static inline const TCGPCacheReloc *pcache_relocs(const PCacheRecord *rec)
+{
+    return (const void *)(rec + 1);
+}
+
+static inline const void *pcache_code(const PCacheRecord *rec)
+{
+    return pcache_relocs(rec) + rec->nb_relocs;
+}
+
+static inline const void *pcache_guest(const PCacheRecord *rec)
+{
+    return pcache_code(rec) + rec->code_size + rec->search_size;
+}
+
+static inline size_t pcache_record_size(uint32_t nb_relocs, size_t code_size,
+                                        size_t guest_size)
+{
+    return ROUND_UP(sizeof(PCacheRecord) + nb_relocs * sizeof(TCGPCacheReloc)
+                    + code_size + guest_size, 8);
+}
+
+static bool pcache_is_mapped(const PCacheRecord *rec)
+{
+    return (void *)rec >= pcache.map
+        && (void *)rec < pcache.map + pcache.map_size;
+}
+
+static guint pcache_key_hash(gconstpointer p)
+{
+    const PCacheKey *k = p;
+
+    return tb_hash_func(0, k->pc, k->flags, k->cflags) ^ k->cs_base;
+}
+
+static gboolean pcache_key_equal(gconstpointer a, gconstpointer b)
+{
+    return memcmp(a, b, sizeof(PCacheKey)) == 0;
+}
+
+static void pcache_make_key(PCacheKey *k, const TranslationBlock *tb)
+{
+    memset(k, 0, sizeof(*k));
+    k->pc = tb->pc;
+    k->cs_base = tb->cs_base;
+    k->flags = tb->flags;
+    k->cflags = tb->cflags;
+    k->parallel = parallel_cpus;
+}
+
+static void pcache_make_header(PCacheHeader *h)
+{
+    struct stat st;
+
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, PCACHE_MAGIC, sizeof(PCACHE_MAGIC));
+    h->version = PCACHE_VERSION;
+    if (stat("/proc/self/exe", &st) == 0) {
+        h->exe_size = st.st_size;
+        h->exe_mtime = st.st_mtime;
+        h->exe_ino = st.st_ino;
+    }
+    h->guest_base = guest_base;
+    h->host_features = tcg_pcache_host_features();
+    h->icache_linesize = qemu_icache_linesize;
+    h->cpu_model_hash = pcache.cpu_model_hash;
+    h->config = (singlestep ? PCACHE_CONFIG_SINGLESTEP : 0)
+        | (qemu_loglevel_mask(CPU_LOG_TB_NOCHAIN) ? PCACHE_CONFIG_NOCHAIN : 0);
+}
+
+/* Check that REC, of at most AVAIL bytes, is well formed.  */
+static bool pcache_record_valid(const PCacheRecord *rec, size_t avail)
+{
+    const TCGPCacheReloc *r;
+    uint32_t i;
+
+    if (avail < sizeof(*rec)
+        || rec->record_size > avail
+        || rec->nb_relocs > TCG_MAX_PCACHE_RELOCS
+        || rec->guest_size == 0 || rec->guest_size > UINT16_MAX
+        || rec->code_size < 4
+        || rec->code_size + (uint64_t)rec->search_size > PCACHE_MAX_CODE_SIZE
+        || rec->record_size != pcache_record_size(rec->nb_relocs,
+                                                  rec->code_size
+                                                  + rec->search_size,
+                                                  rec->guest_size)) {
+        return false;
+    }
+    r = pcache_relocs(rec);
+    for (i = 0; i < rec->nb_relocs; i++) {
+        if (r[i].kind > TCG_PCACHE_RELOC_TB
+            || r[i].offset > rec->code_size - 4) {
+            return false;
+        }
+    }
+    for (i = 0; i < 2; i++) {
+        if (rec->jmp_reset_offset[i] != TB_JMP_RESET_OFFSET_INVALID
+            && (rec->jmp_reset_offset[i] > rec->code_size
+                || rec->jmp_insn_offset[i] > rec->code_size - 4)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Map the cache file left behind by earlier processes.  Whatever is wrong
+   with it, we simply start with an empty cache, and the file is replaced
+   when this process exits.  */
+static void pcache_open(void)
+{
+    PCacheHeader expected;
+    const PCacheHeader *h;
+    struct stat st;
+    size_t ofs;
+    uint32_t i;
+    int fd;
+
+    pcache.opened = true;
+    pcache.records = g_hash_table_new(pcache_key_hash, pcache_key_equal);
+
+    fd = open(pcache.path, O_RDONLY | O_NOFOLLOW);
+    if (fd < 0) {
+        return;
+    }
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)
+        || st.st_uid != geteuid() || (st.st_mode & (S_IWGRP | S_IWOTH))
+        || st.st_size < sizeof(PCacheHeader)) {
+        close(fd);
+        return;
+    }
+    pcache.map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (pcache.map == MAP_FAILED) {
+        pcache.map = NULL;
+        return;
+    }
+    pcache.map_size = st.st_size;
+
+    h = pcache.map;
+    pcache_make_header(&expected);
+    expected.nb_records = h->nb_records;
+    if (memcmp(h, &expected, sizeof(expected)) != 0) {
+        return;
+    }
+
+    ofs = sizeof(PCacheHeader);
+    for (i = 0; i < h->nb_records; i++) {
+        const PCacheRecord *rec = pcache.map + ofs;
+
+        if (!pcache_record_valid(rec, pcache.map_size - ofs)) {
+            break;
+        }
+        g_hash_table_replace(pcache.records, (gpointer)&rec->key,
+                             (gpointer)rec);
+        ofs += rec->record_size;
+    }
+}
+
+static bool pcache_candidate(const TranslationBlock *tb)
+{
+    return !(tb->cflags & (CF_NOCACHE | CF_LAST_IO | CF_COUNT_MASK))
+        && tb->trace_vcpu_dstate == 0;
+}
+
+bool tb_pcache_load(TranslationBlock *tb, int *gen_code_size,
+                    int *search_size)
+{
+    TCGContext *s = tcg_ctx;
+    const PCacheRecord *rec;
+    const TCGPCacheReloc *r;
+    PCacheKey key;
+    uintptr_t base;
+    void *code;
+    uint32_t i;
+
+    s->pcache_record = false;
+    if (!pcache_candidate(tb)) {
+        return false;
+    }
+    if (!pcache.opened) {
+        pcache_open();
+    }
+    s->pcache_record = true;
+
+    pcache_make_key(&key, tb);
+    rec = g_hash_table_lookup(pcache.records, &key);
+    if (!rec) {
+        return false;
+    }
+    if (page_check_range(tb->pc, rec->guest_size, PAGE_READ) < 0
+        || memcmp(g2h(tb->pc), pcache_guest(rec), rec->guest_size) != 0) {
+        return false;
+    }
+    code = tb->tc.ptr;
+    if (code + rec->code_size + rec->search_size > s->code_gen_highwater) {
+        return false;
+    }
+
+    memcpy(code, pcache_code(rec), rec->code_size + rec->search_size);
+    r = pcache_relocs(rec);
+    for (i = 0; i < rec->nb_relocs; i++) {
+        void *field = code + r[i].offset;
+        intptr_t disp;
+
+        switch (r[i].kind) {
+        case TCG_PCACHE_RELOC_IMAGE:
+            base = tcg_pcache_image_base();
+            break;
+        case TCG_PCACHE_RELOC_BUFFER:
+            base = (uintptr_t)s->code_gen_prologue;
+            break;
+        default:
+            base = (uintptr_t)code;
+            break;
+        }
+        disp = base + r[i].addend - ((uintptr_t)field + 4);
+        if (disp != (int32_t)disp) {
+            /* Leave the partial copy to be overwritten by the translator.  */
+            return false;
+        }
+        stl_le_p(field, disp);
+    }
+    flush_icache_range((uintptr_t)code,
+                       (uintptr_t)code + rec->code_size);
+
+    tb->size = rec->guest_size;
+    tb->icount = rec->icount;
+    for (i = 0; i < 2; i++) {
+        tb->jmp_reset_offset[i] = rec->jmp_reset_offset[i];
+        tb->jmp_target_arg[i] = rec->jmp_insn_offset[i];
+    }
+    *gen_code_size = rec->code_size;
+    *search_size = rec->search_size;
+
+    s->pcache_record = false;
+    pcache.nb_loaded++;
+    return true;
+}
+
+void tb_pcache_store(TranslationBlock *tb, int gen_code_size, int search_size)
+{
+    TCGContext *s = tcg_ctx;
+    PCacheRecord *rec, *old;
+    size_t code_size = gen_code_size + search_size;
+    size_t size;
+    int i;
+
+    if (!s->pcache_record) {
+        return;
+    }
+    s->pcache_record = false;
+    if (s->pcache_uncacheable || tb->size == 0) {
+        return;
+    }
+
+    size = pcache_record_size(s->nb_pcache_relocs, code_size, tb->size);
+    rec = g_malloc0(size);
+    pcache_make_key(&rec->key, tb);
+    rec->record_size = size;
+    rec->guest_size = tb->size;
+    rec->code_size = gen_code_size;
+    rec->search_size = search_size;
+    rec->nb_relocs = s->nb_pcache_relocs;
+    rec->icount = tb->icount;
+    for (i = 0; i < 2; i++) {
+        rec->jmp_reset_offset[i] = tb->jmp_reset_offset[i];
+        rec->jmp_insn_offset[i] = tb->jmp_target_arg[i];
+    }
+    memcpy((void *)pcache_relocs(rec), s->pcache_relocs,
+           s->nb_pcache_relocs * sizeof(TCGPCacheReloc));
+    memcpy((void *)pcache_code(rec), tb->tc.ptr, code_size);
+    memcpy((void *)pcache_guest(rec), g2h(tb->pc), tb->size);
+
+    old = g_hash_table_lookup(pcache.records, &rec->key);
+    if (old) {
+        g_hash_table_remove(pcache.records, &old->key);
+        if (!pcache_is_mapped(old)) {
+            g_free(old);
+        }
+    }
+    g_hash_table_insert(pcache.records, &rec->key, rec);
+    pcache.dirty = true;
+    pcache.nb_stored++;
+}
+
+void tb_pcache_save(void)
+{
+    GHashTableIter iter;
+    PCacheHeader h;
+    gpointer value;
+    char *tmp;
+    FILE *f;
+    bool ok;
+    int fd;
+
+    if (!tb_pcache_enabled) {
+        return;
+    }
+    trace_tb_pcache_save(pcache.nb_loaded, pcache.nb_stored);
+    if (!pcache.dirty) {
+        return;
+    }
+
+    tb_lock();
+    pcache_make_header(&h);
+    h.nb_records = g_hash_table_size(pcache.records);
+
+    /* Write a private file and rename it over the old one, so that other
+       processes see either the old or the new cache, and keep running
+       from their mapping of the old one.  mkstemp() creates the file
+       exclusively and with mode 0600.  */
+    tmp = g_strdup_printf("%s.XXXXXX", pcache.path);
+    fd = mkstemp(tmp);
+    if (fd < 0) {
+        goto out;
+    }
+    f = fdopen(fd, "wb");
+    if (!f) {
+        close(fd);
+        unlink(tmp);
+        goto out;
+    }
+    ok = fwrite(&h, sizeof(h), 1, f) == 1;
+    g_hash_table_iter_init(&iter, pcache.records);
+    while (ok && g_hash_table_iter_next(&iter, NULL, &value)) {
+        const PCacheRecord *rec = value;
+        ok = fwrite(rec, rec->record_size, 1, f) == 1;
+    }
+    ok &= fclose(f) == 0;
+    if (ok && rename(tmp, pcache.path) == 0) {
+        pcache.dirty = false;
+    } else {
+        unlink(tmp);
+    }
+
+ out:
+    g_free(tmp);
+    tb_unlock();
+}
+
+void tb_pcache_init(const char *dir, int fd, const char *cpu_model)
+{
+    GChecksum *sum;
+    const size_t bufsize = 64 * 1024;
+    uint8_t *buf;
+    struct stat st;
+    off_t ofs = 0;
+    ssize_t len;
+
+    /* Anyone who can write to the directory can replace the cache file,
+       whose contents are run as host code.  */
+    if (stat(dir, &st) < 0) {
+        error_report("tb-cache: cannot access %s: %s", dir, strerror(errno));
+        return;
+    }
+    if (!S_ISDIR(st.st_mode) || st.st_uid != geteuid()
+        || (st.st_mode & (S_IWGRP | S_IWOTH))) {
+        error_report("tb-cache: %s must be a directory owned by the user "
+                     "and not writable by group or others, ignoring", dir);
+        return;
+    }
+
+    sum = g_checksum_new(G_CHECKSUM_SHA1);
+    buf = g_malloc(bufsize);
+    while ((len = pread(fd, buf, bufsize, ofs)) > 0) {
+        g_checksum_update(sum, buf, len);
+        ofs += len;
+    }
+    if (len == 0) {
+        pcache.path = g_strdup_printf("%s/%s.tbc", dir,
+                                      g_checksum_get_string(sum));
+        pcache.cpu_model_hash = g_str_hash(cpu_model);
+        tb_pcache_enabled = true;
+    } else {
+        error_report("tb-cache: cannot read the guest executable: %s",
+                     strerror(errno));
+    }
+    g_free(buf);
+    g_checksum_free(sum);
+}
+
+#else /* !TCG_TARGET_IMPLEMENTS_PCACHE */
+
+bool tb_pcache_load(TranslationBlock *tb, int *gen_code_size,
+                    int *search_size)
+{
+    return false;
+}
+
+void tb_pcache_store(TranslationBlock *tb, int gen_code_size, int search_size)
+{
+}
+
+void tb_pcache_save(void)
+{
+}
+
+void tb_pcache_init(const char *dir, int fd, const char *cpu_model)
+{
+    warn_report("tb-cache is not supported on this host, ignoring");
+}
+
+#endif
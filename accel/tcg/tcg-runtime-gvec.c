@@ -0,0 +1,135 @@
+/*
+ * Generic vectorized operation runtime
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/host-utils.h"
+#include "cpu.h"
+#include "exec/helper-proto.h"
+#include "tcg-gvec-desc.h"
+
+/* These helpers are the out-of-line fallback for the expansions in
+   tcg/tcg-op-gvec.c.  The operands are always multiples of 8 bytes, so
+   the loops are written over whole elements and left for the compiler
+   to vectorize.  Bytes between oprsz and maxsz are zeroed.  */
+
+static inline void clear_high(void *d, intptr_t oprsz, uint32_t desc)
+{
+    intptr_t maxsz = simd_maxsz(desc);
+
+    if (unlikely(maxsz > oprsz)) {
+        memset(d + oprsz, 0, maxsz - oprsz);
+    }
+}
+
+#define DO_3(NAME, TYPE, OP)                                            \
+void HELPER(NAME)(void *d, void *a, void *b, uint32_t desc)            \
+{                                                                       \
+    intptr_t oprsz = simd_oprsz(desc);                                  \
+    intptr_t i;                                                         \
+                                                                        \
+    for (i = 0; i < oprsz; i += sizeof(TYPE)) {                         \
+        *(TYPE *)(d + i) = *(TYPE *)(a + i) OP *(TYPE *)(b + i);        \
+    }                                                                   \
+    clear_high(d, oprsz, desc);                                         \
+}
+
+DO_3(gvec_add8, uint8_t, +)
+DO_3(gvec_add16, uint16_t, +)
+DO_3(gvec_add32, uint32_t, +)
+DO_3(gvec_add64, uint64_t, +)
+
+DO_3(gvec_sub8, uint8_t, -)
+DO_3(gvec_sub16, uint16_t, -)
+DO_3(gvec_sub32, uint32_t, -)
+DO_3(gvec_sub64, uint64_t, -)
+
+DO_3(gvec_and, uint64_t, &)
+DO_3(gvec_or, uint64_t, |)
+DO_3(gvec_xor, uint64_t, ^)
+DO_3(gvec_andc, uint64_t, & ~)
+DO_3(gvec_orc, uint64_t, | ~)
+
+#undef DO_3
+
+#define DO_2(NAME, TYPE, OP)                                            \
+void HELPER(NAME)(void *d, void *a, uint32_t desc)                     \
+{                                                                       \
+    intptr_t oprsz = simd_oprsz(desc);                                  \
+    intptr_t i;                                                         \
+                                                                        \
+    for (i = 0; i < oprsz; i += sizeof(TYPE)) {                         \
+        *(TYPE *)(d + i) = OP *(TYPE *)(a + i);                         \
+    }                                                                   \
+    clear_high(d, oprsz, desc);                                         \
+}
+
+DO_2(gvec_neg8, uint8_t, -)
+DO_2(gvec_neg16, uint16_t, -)
+DO_2(gvec_neg32, uint32_t, -)
+DO_2(gvec_neg64, uint64_t, -)
+
+DO_2(gvec_not, uint64_t, ~)
+
+#undef DO_2
+
+void HELPER(gvec_mov)(void *d, void *a, uint32_t desc)
+{
+    intptr_t oprsz = simd_oprsz(desc);
+
+    memcpy(d, a, oprsz);
+    clear_high(d, oprsz, desc);
+}
+
+void HELPER(gvec_dup64)(void *d, uint32_t desc, uint64_t c)
+{
+    intptr_t oprsz = simd_oprsz(desc);
+    intptr_t i;
+
+    if (c == 0) {
+        oprsz = 0;
+    } else {
+        for (i = 0; i < oprsz; i += sizeof(uint64_t)) {
+            *(uint64_t *)(d + i) = c;
+        }
+    }
+    clear_high(d, oprsz, desc);
+}
+
+void HELPER(gvec_dup32)(void *d, uint32_t desc, uint32_t c)
+{
+    intptr_t oprsz = simd_oprsz(desc);
+    intptr_t i;
+
+    if (c == 0) {
+        oprsz = 0;
+    } else {
+        for (i = 0; i < oprsz; i += sizeof(uint32_t)) {
+            *(uint32_t *)(d + i) = c;
+        }
+    }
+    clear_high(d, oprsz, desc);
+}
+
+void HELPER(gvec_dup16)(void *d, uint32_t desc, uint32_t c)
+{
+    HELPER(gvec_dup32)(d, desc, 0x00010001 * (c & 0xffff));
+}
+
+void HELPER(gvec_dup8)(void *d, uint32_t desc, uint32_t c)
+{
+    HELPER(gvec_dup32)(d, desc, 0x01010101 * (c & 0xff));
+}
@@ -162,16 +162,16 @@ void *HELPER(lookup_tb_ptr)(CPUArchState *env, target_ulong addr)
                    && tb->trace_vcpu_dstate == *cpu->trace_dstate))) {
         tb = tb_htable_lookup(cpu, addr, cs_base, flags);
         if (!tb) {
-            return tcg_ctx.code_gen_epilogue;
+            return tcg_ctx->code_gen_epilogue;
         }
         atomic_set(&cpu->tb_jmp_cache[addr_hash], tb);
     }
 
     qemu_log_mask_and_addr(CPU_LOG_EXEC, addr,
                            "Chain %p [%d: " TARGET_FMT_lx "] %s\n",
-                           tb->tc_ptr, cpu->cpu_index, addr,
+                           tb->tc.ptr, cpu->cpu_index, addr,
                            lookup_symbol(addr));
-    return tb->tc_ptr;
+    return tb->tc.ptr;
 }
 
 void HELPER(exit_atomic)(CPUArchState *env)
@@ -52,6 +52,7 @@
 
 #include "exec/cputlb.h"
 #include "exec/tb-hash.h"
+#include "exec/tb-pcache.h"
 #include "translate-all.h"
 #include "qemu/bitmap.h"
 #include "qemu/error-report.h"
@@ -134,8 +135,7 @@ static int v_l2_levels;
 
 static void *l1_map[V_L1_MAX_SIZE];
 
-/* code generation context */
-TCGContext tcg_ctx;
+TBContext tb_ctx;
 bool parallel_cpus;
 
 /* translation block context */
@@ -167,7 +167,7 @@ static void page_table_config_init(void)
 void tb_lock(void)
 {
     assert_tb_unlocked();
-    qemu_mutex_lock(&tcg_ctx.tb_ctx.tb_lock);
+    qemu_mutex_lock(&tb_ctx.tb_lock);
     have_tb_lock++;
 }
 
@@ -175,13 +175,13 @@ void tb_unlock(void)
 {
     assert_tb_locked();
     have_tb_lock--;
-    qemu_mutex_unlock(&tcg_ctx.tb_ctx.tb_lock);
+    qemu_mutex_unlock(&tb_ctx.tb_lock);
 }
 
 void tb_lock_reset(void)
 {
     if (have_tb_lock) {
-        qemu_mutex_unlock(&tcg_ctx.tb_ctx.tb_lock);
+        qemu_mutex_unlock(&tb_ctx.tb_lock);
         have_tb_lock = 0;
     }
 }
@@ -190,7 +190,7 @@ static TranslationBlock *tb_find_pc(uintptr_t tc_ptr);
 
 void cpu_gen_init(void)
 {
-    tcg_context_init(&tcg_ctx); 
+    tcg_context_init(&tcg_init_ctx);
 }
 
 /* Encode VAL as a signed leb128 sequence at P.
@@ -242,17 +242,17 @@ static target_long decode_sleb128(uint8_t **pp)
    which comes from the host pc of the end of the code implementing the insn.
 
    Each line of the table is encoded as sleb128 deltas from the previous
-   line.  The seed for the first line is { tb->pc, 0..., tb->tc_ptr }.
+   line.  The seed for the first line is { tb->pc, 0..., tb->tc.ptr }.
    That is, the first column is seeded with the guest pc, the last column
    with the host pc, and the middle columns with zeros.  */
 
 static int encode_search(TranslationBlock *tb, uint8_t *block)
 {
-    uint8_t *highwater = tcg_ctx.code_gen_highwater;
+    uint8_t *highwater = tcg_ctx->code_gen_highwater;
     uint8_t *p = block;
     int i, j, n;
 
-    tb->tc_search = block;
+    tb->tc.search = block;
 
     for (i = 0, n = tb->icount; i < n; ++i) {
         target_ulong prev;
@@ -261,12 +261,12 @@ static int encode_search(TranslationBlock *tb, uint8_t *block)
             if (i == 0) {
                 prev = (j == 0 ? tb->pc : 0);
             } else {
-                prev = tcg_ctx.gen_insn_data[i - 1][j];
+                prev = tcg_ctx->gen_insn_data[i - 1][j];
             }
-            p = encode_sleb128(p, tcg_ctx.gen_insn_data[i][j] - prev);
+            p = encode_sleb128(p, tcg_ctx->gen_insn_data[i][j] - prev);
         }
-        prev = (i == 0 ? 0 : tcg_ctx.gen_insn_end_off[i - 1]);
-        p = encode_sleb128(p, tcg_ctx.gen_insn_end_off[i] - prev);
+        prev = (i == 0 ? 0 : tcg_ctx->gen_insn_end_off[i - 1]);
+        p = encode_sleb128(p, tcg_ctx->gen_insn_end_off[i] - prev);
 
         /* Test for (pending) buffer overflow.  The assumption is that any
            one row beginning below the high water mark cannot overrun
@@ -287,9 +287,9 @@ static int cpu_restore_state_from_tb(CPUState *cpu, TranslationBlock *tb,
                                      uintptr_t searched_pc)
 {
     target_ulong data[TARGET_INSN_START_WORDS] = { tb->pc };
-    uintptr_t host_pc = (uintptr_t)tb->tc_ptr;
+    uintptr_t host_pc = (uintptr_t)tb->tc.ptr;
     CPUArchState *env = cpu->env_ptr;
-    uint8_t *p = tb->tc_search;
+    uint8_t *p = tb->tc.search;
     int i, j, num_insns = tb->icount;
 #ifdef CONFIG_PROFILER
     int64_t ti = profile_getclock();
@@ -326,8 +326,8 @@ static int cpu_restore_state_from_tb(CPUState *cpu, TranslationBlock *tb,
     restore_state_to_opc(env, tb, data);
 
 #ifdef CONFIG_PROFILER
-    tcg_ctx.restore_time += profile_getclock() - ti;
-    tcg_ctx.restore_count++;
+    tcg_ctx->restore_time += profile_getclock() - ti;
+    tcg_ctx->restore_count++;
 #endif
     return 0;
 }
@@ -486,6 +486,52 @@ static inline PageDesc *page_find(tb_page_addr_t index)
     return page_find_alloc(index, 0);
 }
 
+static inline int ptr_cmp_tb_tc(const void *ptr, const struct tb_tc *s)
+{
+    if (ptr >= s->ptr + s->size) {
+        return 1;
+    } else if (ptr < s->ptr) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * TBs are kept in tb_ctx.tb_tree, sorted by the address of their host code.
+ * Since each TCG thread allocates code from its own region, TBs are no longer
+ * created in increasing tc.ptr order, so a sorted array would not do.
+ */
+static gint tb_tc_cmp(gconstpointer ap, gconstpointer bp)
+{
+    const struct tb_tc *a = ap;
+    const struct tb_tc *b = bp;
+
+    /*
+     * When both sizes are set, we know this isn't a lookup.
+     * This is the most likely case: every TB must be inserted; lookups
+     * are a lot less frequent.
+     */
+    if (likely(a->size && b->size)) {
+        if (a->ptr > b->ptr) {
+            return 1;
+        } else if (a->ptr < b->ptr) {
+            return -1;
+        }
+        /* a->ptr == b->ptr should happen only on deletions */
+        g_assert(a->size == b->size);
+        return 0;
+    }
+    /*
+     * All lookups have the .size field set to 0.
+     * From the glib sources we see that @ap is always the lookup key. However
+     * the docs provide no guarantee, so we just mark this case as likely.
+     */
+    if (likely(a->size == 0)) {
+        return ptr_cmp_tb_tc(a->ptr, b);
+    }
+    return ptr_cmp_tb_tc(b->ptr, a);
+}
+
 #if defined(CONFIG_USER_ONLY)
 /* Currently it is not recommended to allocate big chunks of data in
    user mode. It will change when a dedicated libc will be used.  */
@@ -573,7 +619,7 @@ static inline void *split_cross_256mb(void *buf1, size_t size1)
         buf1 = buf2;
     }
 
-    tcg_ctx.code_gen_buffer_size = size1;
+    tcg_init_ctx.code_gen_buffer_size = size1;
     return buf1;
 }
 #endif
@@ -636,16 +682,16 @@ static inline void *alloc_code_gen_buffer(void)
     size = full_size - qemu_real_host_page_size;
 
     /* Honor a command-line option limiting the size of the buffer.  */
-    if (size > tcg_ctx.code_gen_buffer_size) {
-        size = (((uintptr_t)buf + tcg_ctx.code_gen_buffer_size)
+    if (size > tcg_init_ctx.code_gen_buffer_size) {
+        size = (((uintptr_t)buf + tcg_init_ctx.code_gen_buffer_size)
                 & qemu_real_host_page_mask) - (uintptr_t)buf;
     }
-    tcg_ctx.code_gen_buffer_size = size;
+    tcg_init_ctx.code_gen_buffer_size = size;
 
 #ifdef __mips__
     if (cross_256mb(buf, size)) {
         buf = split_cross_256mb(buf, size);
-        size = tcg_ctx.code_gen_buffer_size;
+        size = tcg_init_ctx.code_gen_buffer_size;
     }
 #endif
 
@@ -658,7 +704,7 @@ static inline void *alloc_code_gen_buffer(void)
 #elif defined(_WIN32)
 static inline void *alloc_code_gen_buffer(void)
 {
-    size_t size = tcg_ctx.code_gen_buffer_size;
+    size_t size = tcg_init_ctx.code_gen_buffer_size;
     void *buf1, *buf2;
 
     /* Perform the allocation in two steps, so that the guard page
@@ -677,7 +723,7 @@ static inline void *alloc_code_gen_buffer(void)
 {
     int flags = MAP_PRIVATE | MAP_ANONYMOUS;
     uintptr_t start = 0;
-    size_t size = tcg_ctx.code_gen_buffer_size;
+    size_t size = tcg_init_ctx.code_gen_buffer_size;
     void *buf;
 
     /* Constrain the position of the buffer based on the host cpu.
@@ -694,7 +740,7 @@ static inline void *alloc_code_gen_buffer(void)
     flags |= MAP_32BIT;
     /* Cannot expect to map more than 800MB in low memory.  */
     if (size > 800u * 1024 * 1024) {
-        tcg_ctx.code_gen_buffer_size = size = 800u * 1024 * 1024;
+        tcg_init_ctx.code_gen_buffer_size = size = 800u * 1024 * 1024;
     }
 # elif defined(__sparc__)
     start = 0x40000000ul;
@@ -734,7 +780,7 @@ static inline void *alloc_code_gen_buffer(void)
         default:
             /* Split the original buffer.  Free the smaller half.  */
             buf2 = split_cross_256mb(buf, size);
-            size2 = tcg_ctx.code_gen_buffer_size;
+            size2 = tcg_init_ctx.code_gen_buffer_size;
             if (buf == buf2) {
                 munmap(buf + size2 + qemu_real_host_page_size, size - size2);
             } else {
@@ -760,29 +806,21 @@ static inline void *alloc_code_gen_buffer(void)
 
 static inline void code_gen_alloc(size_t tb_size)
 {
-    tcg_ctx.code_gen_buffer_size = size_code_gen_buffer(tb_size);
-    tcg_ctx.code_gen_buffer = alloc_code_gen_buffer();
-    if (tcg_ctx.code_gen_buffer == NULL) {
+    tcg_init_ctx.code_gen_buffer_size = size_code_gen_buffer(tb_size);
+    tcg_init_ctx.code_gen_buffer = alloc_code_gen_buffer();
+    if (tcg_init_ctx.code_gen_buffer == NULL) {
         fprintf(stderr, "Could not allocate dynamic translator buffer\n");
         exit(1);
     }
-
-    /* size this conservatively -- realloc later if needed */
-    tcg_ctx.tb_ctx.tbs_size =
-        tcg_ctx.code_gen_buffer_size / CODE_GEN_AVG_BLOCK_SIZE / 8;
-    if (unlikely(!tcg_ctx.tb_ctx.tbs_size)) {
-        tcg_ctx.tb_ctx.tbs_size = 64 * 1024;
-    }
-    tcg_ctx.tb_ctx.tbs = g_new(TranslationBlock *, tcg_ctx.tb_ctx.tbs_size);
-
-    qemu_mutex_init(&tcg_ctx.tb_ctx.tb_lock);
+    tb_ctx.tb_tree = g_tree_new(tb_tc_cmp);
+    qemu_mutex_init(&tb_ctx.tb_lock);
 }
 
 static void tb_htable_init(void)
 {
     unsigned int mode = QHT_MODE_AUTO_RESIZE;
 
-    qht_init(&tcg_ctx.tb_ctx.htable, CODE_GEN_HTABLE_SIZE, mode);
+    qht_init(&tb_ctx.htable, CODE_GEN_HTABLE_SIZE, mode);
 }
 
 /* Must be called before using the QEMU cpus. 'tb_size' is the size
@@ -798,34 +836,37 @@ void tcg_exec_init(unsigned long tb_size)
 #if defined(CONFIG_SOFTMMU)
     /* There's no guest base to take into account, so go ahead and
        initialize the prologue now.  */
-    tcg_prologue_init(&tcg_ctx);
+    tcg_prologue_init(&tcg_init_ctx);
 #endif
 }
 
 /*
- * Allocate a new translation block. Flush the translation buffer if
- * too many translation blocks or too much generated code.
+ * Allocate a new translation block from the calling thread's code region.
+ * Returns NULL when all regions are full and the translation buffer must
+ * be flushed.
  *
- * Called with tb_lock held.
+ * Called with mmap_lock held for user-mode emulation.  In system
+ * emulation the region is private to the calling thread, so no
+ * lock is needed.
  */
 static TranslationBlock *tb_alloc(target_ulong pc)
 {
-    TranslationBlock *tb;
-    TBContext *ctx;
+    return tcg_tb_alloc(tcg_ctx);
+}
 
-    assert_tb_locked();
+/* Give back the space used by TB if it is the last one generated by
+ * the calling thread's TCGContext.
+ */
+static void tb_free_space(TranslationBlock *tb)
+{
+    uintptr_t end = ROUND_UP((uintptr_t)tb->tc.ptr + tb->tc.size,
+                             CODE_GEN_ALIGN);
 
-    tb = tcg_tb_alloc(&tcg_ctx);
-    if (unlikely(tb == NULL)) {
-        return NULL;
-    }
-    ctx = &tcg_ctx.tb_ctx;
-    if (unlikely(ctx->nb_tbs == ctx->tbs_size)) {
-        ctx->tbs_size *= 2;
-        ctx->tbs = g_renew(TranslationBlock *, ctx->tbs, ctx->tbs_size);
+    if (end == (uintptr_t)tcg_ctx->code_gen_ptr) {
+        size_t struct_size = ROUND_UP(sizeof(*tb), qemu_icache_linesize);
+
+        atomic_set(&tcg_ctx->code_gen_ptr, tb->tc.ptr - struct_size);
     }
-    ctx->tbs[ctx->nb_tbs++] = tb;
-    return tb;
 }
 
 /* Called with tb_lock held.  */
@@ -833,16 +874,12 @@ void tb_free(TranslationBlock *tb)
 {
     assert_tb_locked();
 
+    g_tree_remove(tb_ctx.tb_tree, &tb->tc);
+
     /* In practice this is mostly used for single use temporary TB
        Ignore the hard cases and just back up if this TB happens to
        be the last one generated.  */
-    if (tcg_ctx.tb_ctx.nb_tbs > 0 &&
-            tb == tcg_ctx.tb_ctx.tbs[tcg_ctx.tb_ctx.nb_tbs - 1]) {
-        size_t struct_size = ROUND_UP(sizeof(*tb), qemu_icache_linesize);
-
-        tcg_ctx.code_gen_ptr = tb->tc_ptr - struct_size;
-        tcg_ctx.tb_ctx.nb_tbs--;
-    }
+    tb_free_space(tb);
 }
 
 static inline void invalidate_page_bitmap(PageDesc *p)
@@ -887,6 +924,17 @@ static void page_flush_tb(void)
     }
 }
 
+#if defined(DEBUG_TB_FLUSH)
+static gboolean tb_host_size_iter(gpointer key, gpointer value, gpointer data)
+{
+    const TranslationBlock *tb = value;
+    size_t *size = data;
+
+    *size += tb->tc.size;
+    return false;
+}
+#endif
+
 /* flush all the translation blocks */
 static void do_tb_flush(CPUState *cpu, run_on_cpu_data tb_flush_count)
 {
@@ -895,35 +943,39 @@ static void do_tb_flush(CPUState *cpu, run_on_cpu_data tb_flush_count)
     /* If it is already been done on request of another CPU,
      * just retry.
      */
-    if (tcg_ctx.tb_ctx.tb_flush_count != tb_flush_count.host_int) {
+    if (tb_ctx.tb_flush_count != tb_flush_count.host_int) {
         goto done;
     }
 
 #if defined(DEBUG_TB_FLUSH)
-    printf("qemu: flush code_size=%ld nb_tbs=%d avg_tb_size=%ld\n",
-           (unsigned long)(tcg_ctx.code_gen_ptr - tcg_ctx.code_gen_buffer),
-           tcg_ctx.tb_ctx.nb_tbs, tcg_ctx.tb_ctx.nb_tbs > 0 ?
-           ((unsigned long)(tcg_ctx.code_gen_ptr - tcg_ctx.code_gen_buffer)) /
-           tcg_ctx.tb_ctx.nb_tbs : 0);
-#endif
-    if ((unsigned long)(tcg_ctx.code_gen_ptr - tcg_ctx.code_gen_buffer)
-        > tcg_ctx.code_gen_buffer_size) {
-        cpu_abort(cpu, "Internal error: code buffer overflow\n");
+    {
+        size_t nb_tbs = g_tree_nnodes(tb_ctx.tb_tree);
+        size_t host_size = 0;
+
+        g_tree_foreach(tb_ctx.tb_tree, tb_host_size_iter, &host_size);
+        printf("qemu: flush code_size=%zu nb_tbs=%zu avg_tb_size=%zu\n",
+               tcg_code_size(), nb_tbs, nb_tbs > 0 ? host_size / nb_tbs : 0);
     }
+#endif
 
     CPU_FOREACH(cpu) {
         cpu_tb_jmp_cache_clear(cpu);
     }
 
-    tcg_ctx.tb_ctx.nb_tbs = 0;
-    qht_reset_size(&tcg_ctx.tb_ctx.htable, CODE_GEN_HTABLE_SIZE);
+    /* Increment the refcount first so that destroy acts as a reset */
+    g_tree_ref(tb_ctx.tb_tree);
+    g_tree_destroy(tb_ctx.tb_tree);
+
+    qht_reset_size(&tb_ctx.htable, CODE_GEN_HTABLE_SIZE);
     page_flush_tb();
 
-    tcg_ctx.code_gen_ptr = tcg_ctx.code_gen_buffer;
+    /* All vCPUs are stopped, so every TCG thread can restart from the
+       beginning of a region.  */
+    tcg_region_reset_all();
     /* XXX: flush processor icache at this point if cache flush is
        expensive */
-    atomic_mb_set(&tcg_ctx.tb_ctx.tb_flush_count,
-                  tcg_ctx.tb_ctx.tb_flush_count + 1);
+    atomic_mb_set(&tb_ctx.tb_flush_count,
+                  tb_ctx.tb_flush_count + 1);
 
 done:
     tb_unlock();
@@ -932,7 +984,7 @@ done:
 void tb_flush(CPUState *cpu)
 {
     if (tcg_enabled()) {
-        unsigned tb_flush_count = atomic_mb_read(&tcg_ctx.tb_ctx.tb_flush_count);
+        unsigned tb_flush_count = atomic_mb_read(&tb_ctx.tb_flush_count);
         async_safe_run_on_cpu(cpu, do_tb_flush,
                               RUN_ON_CPU_HOST_INT(tb_flush_count));
     }
@@ -959,7 +1011,7 @@ do_tb_invalidate_check(struct qht *ht, void *p, uint32_t hash, void *userp)
 static void tb_invalidate_check(target_ulong address)
 {
     address &= TARGET_PAGE_MASK;
-    qht_iter(&tcg_ctx.tb_ctx.htable, do_tb_invalidate_check, &address);
+    qht_iter(&tb_ctx.htable, do_tb_invalidate_check, &address);
 }
 
 static void
@@ -979,7 +1031,7 @@ do_tb_page_check(struct qht *ht, void *p, uint32_t hash, void *userp)
 /* verify that all the pages have correct rights for code */
 static void tb_page_check(void)
 {
-    qht_iter(&tcg_ctx.tb_ctx.htable, do_tb_page_check, NULL);
+    qht_iter(&tb_ctx.htable, do_tb_page_check, NULL);
 }
 
 #endif
@@ -1035,7 +1087,7 @@ static inline void tb_remove_from_jmp_list(TranslationBlock *tb, int n)
    another TB */
 static inline void tb_reset_jump(TranslationBlock *tb, int n)
 {
-    uintptr_t addr = (uintptr_t)(tb->tc_ptr + tb->jmp_reset_offset[n]);
+    uintptr_t addr = (uintptr_t)(tb->tc.ptr + tb->jmp_reset_offset[n]);
     tb_set_jmp_target(tb, n, addr);
 }
 
@@ -1078,7 +1130,7 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
     /* remove the TB from the hash list */
     phys_pc = tb->page_addr[0] + (tb->pc & ~TARGET_PAGE_MASK);
     h = tb_hash_func(phys_pc, tb->pc, tb->flags, tb->trace_vcpu_dstate);
-    qht_remove(&tcg_ctx.tb_ctx.htable, tb, h);
+    qht_remove(&tb_ctx.htable, tb, h);
 
     /* remove the TB from the page list */
     if (tb->page_addr[0] != page_addr) {
@@ -1107,7 +1159,7 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
     /* suppress any remaining jumps to this TB */
     tb_jmp_unlink(tb);
 
-    tcg_ctx.tb_ctx.tb_phys_invalidate_count++;
+    tb_ctx.tb_phys_invalidate_count++;
 }
 
 #ifdef CONFIG_SOFTMMU
@@ -1123,7 +1175,11 @@ static void build_page_bitmap(PageDesc *p)
         n = (uintptr_t)tb & 3;
         tb = (TranslationBlock *)((uintptr_t)tb & ~3);
         /* NOTE: this is subtle as a TB may span two physical pages */
-        if (n == 0) {
+        if (tb->cflags & CF_TRACE) {
+            /* The blocks of a trace may lie anywhere in its page.  */
+            tb_start = 0;
+            tb_end = TARGET_PAGE_SIZE;
+        } else if (n == 0) {
             /* NOTE: tb_end may be after the end of the page, but
                it is not a problem */
             tb_start = tb->pc & ~TARGET_PAGE_MASK;
@@ -1223,28 +1279,41 @@ static void tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
 
     /* add in the hash table */
     h = tb_hash_func(phys_pc, tb->pc, tb->flags, tb->trace_vcpu_dstate);
-    qht_insert(&tcg_ctx.tb_ctx.htable, tb, h);
+    qht_insert(&tb_ctx.htable, tb, h);
 
 #ifdef DEBUG_TB_CHECK
     tb_page_check();
 #endif
 }
 
-/* Called with mmap_lock held for user mode emulation.  */
+/* Called with mmap_lock held for user mode emulation.
+ *
+ * tb_lock may or may not be held by the caller.  In system emulation each
+ * TCG thread translates into its own TCGContext and code region, so the
+ * lock is only needed (and taken here if the caller does not hold it) to
+ * make the new TB visible.  In user mode all threads share one TCGContext,
+ * so the whole translation runs under tb_lock.
+ */
 TranslationBlock *tb_gen_code(CPUState *cpu,
                               target_ulong pc, target_ulong cs_base,
                               uint32_t flags, int cflags)
 {
     CPUArchState *env = cpu->env_ptr;
-    TranslationBlock *tb;
+    TranslationBlock *tb, *existing_tb;
     tb_page_addr_t phys_pc, phys_page2;
     target_ulong virt_page2;
     tcg_insn_unit *gen_code_buf;
     int gen_code_size, search_size;
+    bool own_tb_lock = !have_tb_lock;
 #ifdef CONFIG_PROFILER
     int64_t ti;
 #endif
+#ifdef CONFIG_USER_ONLY
     assert_memory_lock();
+    if (own_tb_lock) {
+        tb_lock();
+    }
+#endif
 
     phys_pc = get_page_addr_code(env, pc);
     if (use_icount && !(cflags & CF_IGNORE_ICOUNT)) {
@@ -1262,45 +1331,57 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
         cpu_loop_exit(cpu);
     }
 
-    gen_code_buf = tcg_ctx.code_gen_ptr;
-    tb->tc_ptr = gen_code_buf;
+    gen_code_buf = tcg_ctx->code_gen_ptr;
+    tb->tc.ptr = gen_code_buf;
     tb->pc = pc;
     tb->cs_base = cs_base;
     tb->flags = flags;
     tb->cflags = cflags;
     tb->trace_vcpu_dstate = *cpu->trace_dstate;
     tb->invalid = false;
+    tb->exec_count = 0;
+    tb->exit_count[0] = tb->exit_count[1] = 0;
+    tb->exit_dest[0] = tb->exit_dest[1] = NULL;
+    tb->nb_temps = TCG_MAX_TEMPS;
+
+#ifdef CONFIG_USER_ONLY
+    if (tb_pcache_enabled
+        && tb_pcache_load(tb, &gen_code_size, &search_size)) {
+        goto generated;
+    }
+#endif
 
 #ifdef CONFIG_PROFILER
-    tcg_ctx.tb_count1++; /* includes aborted translations because of
+    tcg_ctx->tb_count1++; /* includes aborted translations because of
                        exceptions */
     ti = profile_getclock();
 #endif
 
-    tcg_func_start(&tcg_ctx);
+    tcg_func_start(tcg_ctx);
 
-    tcg_ctx.cpu = ENV_GET_CPU(env);
+    tcg_ctx->cpu = ENV_GET_CPU(env);
     gen_intermediate_code(cpu, tb);
-    tcg_ctx.cpu = NULL;
+    tcg_ctx->cpu = NULL;
+    tb->nb_temps = tcg_ctx->nb_temps - tcg_ctx->nb_globals;
 
-    trace_translate_block(tb, tb->pc, tb->tc_ptr);
+    trace_translate_block(tb, tb->pc, tb->tc.ptr);
 
     /* generate machine code */
     tb->jmp_reset_offset[0] = TB_JMP_RESET_OFFSET_INVALID;
     tb->jmp_reset_offset[1] = TB_JMP_RESET_OFFSET_INVALID;
-    tcg_ctx.tb_jmp_reset_offset = tb->jmp_reset_offset;
+    tcg_ctx->tb_jmp_reset_offset = tb->jmp_reset_offset;
     if (TCG_TARGET_HAS_direct_jump) {
-        tcg_ctx.tb_jmp_insn_offset = tb->jmp_target_arg;
-        tcg_ctx.tb_jmp_target_addr = NULL;
+        tcg_ctx->tb_jmp_insn_offset = tb->jmp_target_arg;
+        tcg_ctx->tb_jmp_target_addr = NULL;
     } else {
-        tcg_ctx.tb_jmp_insn_offset = NULL;
-        tcg_ctx.tb_jmp_target_addr = tb->jmp_target_arg;
+        tcg_ctx->tb_jmp_insn_offset = NULL;
+        tcg_ctx->tb_jmp_target_addr = tb->jmp_target_arg;
     }
 
 #ifdef CONFIG_PROFILER
-    tcg_ctx.tb_count++;
-    tcg_ctx.interm_time += profile_getclock() - ti;
-    tcg_ctx.code_time -= profile_getclock();
+    tcg_ctx->tb_count++;
+    tcg_ctx->interm_time += profile_getclock() - ti;
+    tcg_ctx->code_time -= profile_getclock();
 #endif
 
     /* ??? Overflow could be handled better here.  In particular, we
@@ -1308,7 +1389,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
        the tcg optimization currently hidden inside tcg_gen_code.  All
        that should be required is to flush the TBs, allocate a new TB,
        re-initialize it per above, and re-do the actual code generation.  */
-    gen_code_size = tcg_gen_code(&tcg_ctx, tb);
+    gen_code_size = tcg_gen_code(tcg_ctx, tb);
     if (unlikely(gen_code_size < 0)) {
         goto buffer_overflow;
     }
@@ -1316,12 +1397,17 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     if (unlikely(search_size < 0)) {
         goto buffer_overflow;
     }
+#ifdef CONFIG_USER_ONLY
+    if (tb_pcache_enabled) {
+        tb_pcache_store(tb, gen_code_size, search_size);
+    }
+#endif
 
 #ifdef CONFIG_PROFILER
-    tcg_ctx.code_time += profile_getclock();
-    tcg_ctx.code_in_len += tb->size;
-    tcg_ctx.code_out_len += gen_code_size;
-    tcg_ctx.search_out_len += search_size;
+    tcg_ctx->code_time += profile_getclock();
+    tcg_ctx->code_in_len += tb->size;
+    tcg_ctx->code_out_len += gen_code_size;
+    tcg_ctx->search_out_len += search_size;
 #endif
 
 #ifdef DEBUG_DISAS
@@ -1329,26 +1415,26 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
         qemu_log_in_addr_range(tb->pc)) {
         qemu_log_lock();
         qemu_log("OUT: [size=%d]\n", gen_code_size);
-        if (tcg_ctx.data_gen_ptr) {
-            size_t code_size = tcg_ctx.data_gen_ptr - tb->tc_ptr;
+        if (tcg_ctx->data_gen_ptr) {
+            size_t code_size = tcg_ctx->data_gen_ptr - tb->tc.ptr;
             size_t data_size = gen_code_size - code_size;
             size_t i;
 
-            log_disas(tb->tc_ptr, code_size);
+            log_disas(tb->tc.ptr, code_size);
 
             for (i = 0; i < data_size; i += sizeof(tcg_target_ulong)) {
                 if (sizeof(tcg_target_ulong) == 8) {
                     qemu_log("0x%08" PRIxPTR ":  .quad  0x%016" PRIx64 "\n",
-                             (uintptr_t)tcg_ctx.data_gen_ptr + i,
-                             *(uint64_t *)(tcg_ctx.data_gen_ptr + i));
+                             (uintptr_t)tcg_ctx->data_gen_ptr + i,
+                             *(uint64_t *)(tcg_ctx->data_gen_ptr + i));
                 } else {
                     qemu_log("0x%08" PRIxPTR ":  .long  0x%08x\n",
-                             (uintptr_t)tcg_ctx.data_gen_ptr + i,
-                             *(uint32_t *)(tcg_ctx.data_gen_ptr + i));
+                             (uintptr_t)tcg_ctx->data_gen_ptr + i,
+                             *(uint32_t *)(tcg_ctx->data_gen_ptr + i));
                 }
             }
         } else {
-            log_disas(tb->tc_ptr, gen_code_size);
+            log_disas(tb->tc.ptr, gen_code_size);
         }
         qemu_log("\n");
         qemu_log_flush();
@@ -1356,9 +1442,13 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     }
 #endif
 
-    tcg_ctx.code_gen_ptr = (void *)
+#ifdef CONFIG_USER_ONLY
+ generated:
+#endif
+    tb->tc.size = gen_code_size + search_size;
+    atomic_set(&tcg_ctx->code_gen_ptr, (void *)
         ROUND_UP((uintptr_t)gen_code_buf + gen_code_size + search_size,
-                 CODE_GEN_ALIGN);
+                 CODE_GEN_ALIGN));
 
     /* init jump list */
     assert(((uintptr_t)tb & 3) == 0);
@@ -1380,15 +1470,406 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     if ((pc & TARGET_PAGE_MASK) != virt_page2) {
         phys_page2 = get_page_addr_code(env, virt_page2);
     }
-    /* As long as consistency of the TB stuff is provided by tb_lock in user
-     * mode and is implicit in single-threaded softmmu emulation, no explicit
-     * memory barrier is required before tb_link_page() makes the TB visible
-     * through the physical hash table and physical page list.
+
+#ifndef CONFIG_USER_ONLY
+    if (own_tb_lock) {
+        tb_lock();
+    }
+#endif
+
+    /* Another vCPU may have translated the same block while we were not
+     * holding tb_lock.  If so, use its TB and give our space back; ours
+     * is still the last one in this thread's region.  One-shot and
+     * recompiled TBs are always kept, since the caller relies on them.
+     */
+    if (!(cflags & (CF_NOCACHE | CF_LAST_IO | CF_COUNT_MASK))) {
+        existing_tb = tb_htable_lookup(cpu, pc, cs_base, flags);
+        if (unlikely(existing_tb)) {
+            tb_free_space(tb);
+            tb = existing_tb;
+            goto out;
+        }
+    }
+
+    /* tb_lock orders the writes above with the lookups of other threads
+     * that also take the lock; threads that find the TB through the
+     * physical hash table without holding tb_lock rely on the barrier
+     * implied by qht_insert().
      */
     tb_link_page(tb, phys_pc, phys_page2);
+    g_tree_insert(tb_ctx.tb_tree, &tb->tc, tb);
+
+ out:
+    if (own_tb_lock) {
+        tb_unlock();
+    }
     return tb;
 }
 
+/* Maximum number of TBs that are retranslated together as a trace.  */
+#define TB_TRACE_MAX_BLOCKS 8
+
+unsigned int tb_trace_threshold;
+
+/* Return the exit through which TB left on at least 7/8 of its profiled
+ * executions, or -1 if there is none or TB has not been profiled enough.
+ */
+static int tb_trace_hot_exit(TranslationBlock *tb)
+{
+    uint64_t count = atomic_read(&tb->exec_count);
+    int k;
+
+    if (count < MAX(tb_trace_threshold / 2, 1)) {
+        return -1;
+    }
+    for (k = 0; k < ARRAY_SIZE(tb->exit_count); k++) {
+        if ((uint64_t)atomic_read(&tb->exit_count[k]) * 8 >= count * 7) {
+            return k;
+        }
+    }
+    return -1;
+}
+
+/* A trace is retranslated as straight-line code and invalidated as a
+ * whole page, so all of its blocks must lie in the page of its head.
+ */
+static bool tb_trace_member_ok(TranslationBlock *head, TranslationBlock *tb)
+{
+    return !atomic_read(&tb->invalid)
+        && !(tb->cflags & (CF_COUNT_MASK | CF_LAST_IO | CF_NOCACHE |
+                           CF_USE_ICOUNT | CF_TRACE))
+        && tb->cflags == head->cflags
+        && tb->page_addr[1] == -1
+        && tb->page_addr[0] == head->page_addr[0]
+        && (tb->pc & TARGET_PAGE_MASK) == (head->pc & TARGET_PAGE_MASK)
+        && tb->trace_vcpu_dstate == head->trace_vcpu_dstate;
+}
+
+/* Return whether OP may be left in the cold path of a trace block, see
+ * tb_gen_trace().  Moves, stores to the CPU state, labels and exits
+ * cannot fault or call helpers that restore the CPU state.
+ */
+static bool tb_trace_cold_op_ok(TCGContext *s, TCGOp *op)
+{
+    TCGArg *args = &s->gen_opparam_buf[op->args];
+
+    switch (op->opc) {
+    case INDEX_op_discard:
+    case INDEX_op_set_label:
+    case INDEX_op_br:
+    case INDEX_op_mov_i32:
+    case INDEX_op_movi_i32:
+    case INDEX_op_mov_i64:
+    case INDEX_op_movi_i64:
+    case INDEX_op_exit_tb:
+    case INDEX_op_goto_ptr:
+        return true;
+    case INDEX_op_st8_i32:
+    case INDEX_op_st16_i32:
+    case INDEX_op_st_i32:
+    case INDEX_op_st8_i64:
+    case INDEX_op_st16_i64:
+    case INDEX_op_st32_i64:
+    case INDEX_op_st_i64:
+        return args[1] == GET_TCGV_PTR(s->tcg_env);
+    default:
+        return false;
+    }
+}
+
+/* Retranslate HEAD together with the blocks reached through its hot
+ * exits as a single TB, so that the optimizer sees them as one unit.
+ * Each block is translated again from guest code, and its hot goto_tb
+ * is replaced by the ops of the next block.  The cold exits return to
+ * the main loop; only the exits of the last block can be chained.  The
+ * new TB replaces HEAD in the hash table.
+ *
+ * Called with mmap_lock held for user mode emulation.
+ */
+void tb_gen_trace(CPUState *cpu, TranslationBlock *head)
+{
+    TCGContext *s = tcg_ctx;
+    TranslationBlock *members[TB_TRACE_MAX_BLOCKS];
+    int hot_idx[TB_TRACE_MAX_BLOCKS];
+    int seg_first[TB_TRACE_MAX_BLOCKS], seg_last[TB_TRACE_MAX_BLOCKS];
+    TCGOp *hot_goto[TB_TRACE_MAX_BLOCKS], *hot_exit[TB_TRACE_MAX_BLOCKS];
+    TranslationBlock *tb, *m, scratch;
+    tcg_insn_unit *gen_code_buf;
+    tb_page_addr_t phys_pc;
+    int gen_code_size, search_size;
+    int i, k, n, oi, icount, nb_temps;
+    bool own_tb_lock = !have_tb_lock;
+    CPUState *other;
+    uint32_t h;
+
+    if (cpu->singlestep_enabled || singlestep) {
+        return;
+    }
+    if (own_tb_lock) {
+        tb_lock();
+    }
+
+    /* Follow the hot exits.  */
+    if (!tb_trace_member_ok(head, head)) {
+        goto out;
+    }
+    members[0] = head;
+    icount = head->icount;
+    nb_temps = s->nb_globals + head->nb_temps;
+    for (n = 1; n < TB_TRACE_MAX_BLOCKS; n++) {
+        k = tb_trace_hot_exit(members[n - 1]);
+        if (k < 0) {
+            break;
+        }
+        m = atomic_read(&members[n - 1]->exit_dest[k]);
+        if (!m || !tb_trace_member_ok(head, m)
+            || icount + m->icount > TCG_MAX_INSNS
+            || nb_temps + m->nb_temps > TCG_MAX_TEMPS) {
+            break;
+        }
+        for (i = 0; i < n && members[i] != m; i++) {
+            continue;
+        }
+        if (i < n) {
+            break;
+        }
+        hot_idx[n - 1] = k;
+        members[n] = m;
+        icount += m->icount;
+        nb_temps += m->nb_temps;
+    }
+    if (n < 2) {
+        goto out;
+    }
+
+    tb = tb_alloc(head->pc);
+    if (unlikely(!tb)) {
+        goto out;
+    }
+    gen_code_buf = s->code_gen_ptr;
+    tb->tc.ptr = gen_code_buf;
+    tb->tc.size = 0;
+    tb->pc = head->pc;
+    tb->cs_base = head->cs_base;
+    tb->flags = head->flags;
+    tb->cflags = head->cflags | CF_TRACE;
+    tb->trace_vcpu_dstate = head->trace_vcpu_dstate;
+    tb->invalid = false;
+    tb->exec_count = 0;
+    tb->exit_count[0] = tb->exit_count[1] = 0;
+    tb->exit_dest[0] = tb->exit_dest[1] = NULL;
+    tb->nb_temps = TCG_MAX_TEMPS;
+
+    /* Translate the blocks one after the other into the same op list.
+     * The exits of each block name the scratch TB; they are redirected
+     * below.
+     */
+    tcg_func_start(s);
+    s->cpu = cpu;
+    icount = 0;
+    for (i = 0; i < n; i++) {
+        int first = s->gen_next_op_idx;
+        int first_parm = s->gen_next_parm_idx;
+
+        m = members[i];
+        if (i > 0) {
+            /* Translating the block again needs at most as many new
+               temporaries as the first time.  */
+            if (s->nb_temps + m->nb_temps > TCG_MAX_TEMPS) {
+                break;
+            }
+            /* gen_tb_end terminated the list.  */
+            s->gen_op_buf[first - 1].next = first;
+            s->trace_tail = true;
+        }
+#ifdef CONFIG_DEBUG_TCG
+        s->goto_tb_issue_mask = 0;
+#endif
+        memset(&scratch, 0, sizeof(scratch));
+        scratch.pc = m->pc;
+        scratch.cs_base = m->cs_base;
+        scratch.flags = m->flags;
+        scratch.cflags = m->cflags;
+        scratch.trace_vcpu_dstate = m->trace_vcpu_dstate;
+        gen_intermediate_code(cpu, &scratch);
+
+        if (scratch.size != m->size || scratch.icount != m->icount) {
+            /* The op buffer filled up before the end of the block.  */
+            s->gen_next_op_idx = first;
+            s->gen_next_parm_idx = first_parm;
+            s->gen_op_buf[0].prev = first - 1;
+            s->gen_op_buf[first - 1].next = 0;
+            break;
+        }
+        seg_first[i] = first;
+        seg_last[i] = s->gen_op_buf[0].prev;
+        icount += m->icount;
+    }
+    s->cpu = NULL;
+    n = i;
+    if (n < 2) {
+        goto fail;
+    }
+
+    /* Redirect the exits.  Those of the last block are kept as in a
+     * normal TB; in the other blocks the hot goto_tb/exit_tb pair is
+     * remembered for splicing and the cold exits go to the main loop.
+     */
+    for (i = 0; i < n; i++) {
+        bool last = i == n - 1;
+
+        hot_goto[i] = hot_exit[i] = NULL;
+        for (oi = seg_first[i]; oi <= seg_last[i]; oi++) {
+            TCGOp *op = &s->gen_op_buf[oi];
+            TCGArg *arg = &s->gen_opparam_buf[op->args];
+
+            if (op->opc == INDEX_op_goto_tb && !last) {
+                if (*arg != hot_idx[i]) {
+                    tcg_op_remove(s, op);
+                } else if (hot_goto[i]) {
+                    goto fail;
+                } else {
+                    hot_goto[i] = op;
+                }
+            } else if (op->opc == INDEX_op_exit_tb
+                       && *arg - (uintptr_t)&scratch <= TB_EXIT_MASK) {
+                k = *arg - (uintptr_t)&scratch;
+                if (last || k > TB_EXIT_IDX1) {
+                    *arg = (uintptr_t)tb + k;
+                } else if (k != hot_idx[i]) {
+                    *arg = 0;
+                } else if (hot_exit[i]) {
+                    goto fail;
+                } else {
+                    hot_exit[i] = op;
+                }
+            }
+        }
+        if (!last && (!hot_goto[i] || !hot_exit[i])) {
+            goto fail;
+        }
+    }
+
+    /* The ops that follow the hot exit of a block, i.e. its cold path,
+     * end up after all the blocks spliced in after it.  tcg_gen_code()
+     * charges their host code to the last guest instruction of the
+     * trace, so cpu_restore_state() would compute a wrong guest state
+     * if they faulted.  Give up on traces whose cold paths contain
+     * anything but ops that cannot fault; see tb_trace_cold_op_ok().
+     */
+    for (i = 0; i < n - 1; i++) {
+        for (oi = hot_exit[i]->next; oi != 0 && oi < seg_first[i + 1];
+             oi = s->gen_op_buf[oi].next) {
+            if (!tb_trace_cold_op_ok(s, &s->gen_op_buf[oi])) {
+                goto fail;
+            }
+        }
+    }
+
+    /* Splice each block in place of the hot exit of its predecessor,
+     * starting from the end so that the block being moved is always
+     * at the tail of the list.
+     */
+    for (i = n - 2; i >= 0; i--) {
+        int first = seg_first[i + 1];
+        int last = seg_last[i + 1];
+        int prev, next;
+
+        prev = s->gen_op_buf[first].prev;
+        s->gen_op_buf[prev].next = 0;
+        s->gen_op_buf[0].prev = prev;
+
+        tcg_op_remove(s, hot_goto[i]);
+        prev = hot_exit[i]->prev;
+        next = hot_exit[i]->next;
+        if (seg_last[i] == hot_exit[i] - s->gen_op_buf) {
+            seg_last[i] = last;
+        }
+        tcg_op_remove(s, hot_exit[i]);
+
+        s->gen_op_buf[prev].next = first;
+        s->gen_op_buf[first].prev = prev;
+        s->gen_op_buf[last].next = next;
+        s->gen_op_buf[next].prev = last;
+    }
+
+    /* generate machine code */
+    tb->size = head->size;
+    tb->icount = icount;
+    tb->jmp_reset_offset[0] = TB_JMP_RESET_OFFSET_INVALID;
+    tb->jmp_reset_offset[1] = TB_JMP_RESET_OFFSET_INVALID;
+    s->tb_jmp_reset_offset = tb->jmp_reset_offset;
+    if (TCG_TARGET_HAS_direct_jump) {
+        s->tb_jmp_insn_offset = tb->jmp_target_arg;
+        s->tb_jmp_target_addr = NULL;
+    } else {
+        s->tb_jmp_insn_offset = NULL;
+        s->tb_jmp_target_addr = tb->jmp_target_arg;
+    }
+    gen_code_size = tcg_gen_code(s, tb);
+    if (unlikely(gen_code_size < 0)) {
+        goto fail;
+    }
+    search_size = encode_search(tb, (void *)gen_code_buf + gen_code_size);
+    if (unlikely(search_size < 0)) {
+        goto fail;
+    }
+
+    tb->tc.size = gen_code_size + search_size;
+    atomic_set(&s->code_gen_ptr, (void *)
+        ROUND_UP((uintptr_t)gen_code_buf + gen_code_size + search_size,
+                 CODE_GEN_ALIGN));
+
+    /* init jump list */
+    tb->jmp_list_first = (uintptr_t)tb | 2;
+    tb->jmp_list_next[0] = (uintptr_t)NULL;
+    tb->jmp_list_next[1] = (uintptr_t)NULL;
+    if (tb->jmp_reset_offset[0] != TB_JMP_RESET_OFFSET_INVALID) {
+        tb_reset_jump(tb, 0);
+    }
+    if (tb->jmp_reset_offset[1] != TB_JMP_RESET_OFFSET_INVALID) {
+        tb_reset_jump(tb, 1);
+    }
+
+    qemu_log_mask_and_addr(CPU_LOG_EXEC, tb->pc,
+                           "Trace %p [" TARGET_FMT_lx "] of %d blocks\n",
+                           tb->tc.ptr, tb->pc, n);
+
+    phys_pc = head->page_addr[0] + (head->pc & ~TARGET_PAGE_MASK);
+    tb_link_page(tb, phys_pc, -1);
+    g_tree_insert(tb_ctx.tb_tree, &tb->tc, tb);
+
+    /* Retire the head.  It stays on its page list, so that it is still
+     * invalidated along with the page, but new lookups find the trace
+     * and TBs that jumped to the head are relinked the next time they
+     * exit.
+     */
+    h = tb_hash_func(phys_pc, head->pc, head->flags, head->trace_vcpu_dstate);
+    qht_remove(&tb_ctx.htable, head, h);
+    h = tb_jmp_cache_hash_func(head->pc);
+    CPU_FOREACH(other) {
+        if (atomic_read(&other->tb_jmp_cache[h]) == head) {
+            atomic_set(&other->tb_jmp_cache[h], NULL);
+        }
+    }
+    tb_jmp_unlink(head);
+
+    /* The other blocks are entered from the trace now; stop profiling
+     * them so that they do not start traces of their own.
+     */
+    for (i = 1; i < n; i++) {
+        atomic_set(&members[i]->exec_count, tb_trace_threshold);
+    }
+    goto out;
+
+ fail:
+    tb_free_space(tb);
+ out:
+    if (own_tb_lock) {
+        tb_unlock();
+    }
+}
+
 /*
  * Invalidate all TBs which intersect with the target physical address range
  * [start;end[. NOTE: start and end may refer to *different* physical pages.
@@ -1475,7 +1956,11 @@ void tb_invalidate_phys_page_range(tb_page_addr_t start, tb_page_addr_t end,
         tb = (TranslationBlock *)((uintptr_t)tb & ~3);
         tb_next = tb->page_next[n];
         /* NOTE: this is subtle as a TB may span two physical pages */
-        if (n == 0) {
+        if (tb->cflags & CF_TRACE) {
+            /* The blocks of a trace may lie anywhere in its page.  */
+            tb_start = tb->page_addr[0];
+            tb_end = tb_start + TARGET_PAGE_SIZE;
+        } else if (n == 0) {
             /* NOTE: tb_end may be after the end of the page, but
                it is not a problem */
             tb_start = tb->page_addr[0] + (tb->pc & ~TARGET_PAGE_MASK);
@@ -1654,37 +2139,18 @@ static bool tb_invalidate_phys_page(tb_page_addr_t addr, uintptr_t pc)
 }
 #endif
 
-/* find the TB 'tb' such that tb[0].tc_ptr <= tc_ptr <
-   tb[1].tc_ptr. Return NULL if not found */
+/*
+ * Find the TB 'tb' such that
+ * tb->tc.ptr <= tc_ptr < tb->tc.ptr + tb->tc.size
+ * Return NULL if not found.
+ *
+ * Called with tb_lock held.
+ */
 static TranslationBlock *tb_find_pc(uintptr_t tc_ptr)
 {
-    int m_min, m_max, m;
-    uintptr_t v;
-    TranslationBlock *tb;
+    struct tb_tc s = { .ptr = (void *)tc_ptr };
 
-    if (tcg_ctx.tb_ctx.nb_tbs <= 0) {
-        return NULL;
-    }
-    if (tc_ptr < (uintptr_t)tcg_ctx.code_gen_buffer ||
-        tc_ptr >= (uintptr_t)tcg_ctx.code_gen_ptr) {
-        return NULL;
-    }
-    /* binary search (cf Knuth) */
-    m_min = 0;
-    m_max = tcg_ctx.tb_ctx.nb_tbs - 1;
-    while (m_min <= m_max) {
-        m = (m_min + m_max) >> 1;
-        tb = tcg_ctx.tb_ctx.tbs[m];
-        v = (uintptr_t)tb->tc_ptr;
-        if (v == tc_ptr) {
-            return tb;
-        } else if (tc_ptr < v) {
-            m_max = m - 1;
-        } else {
-            m_min = m + 1;
-        }
-    }
-    return tcg_ctx.tb_ctx.tbs[m_max];
+    return g_tree_lookup(tb_ctx.tb_tree, &s);
 }
 
 #if !defined(CONFIG_USER_ONLY)
@@ -1869,73 +2335,80 @@ static void print_qht_statistics(FILE *f, fprintf_function cpu_fprintf,
     g_free(hgram);
 }
 
+struct tb_tree_stats {
+    size_t host_size;
+    size_t target_size;
+    size_t max_target_size;
+    size_t direct_jmp_count;
+    size_t direct_jmp2_count;
+    size_t cross_page;
+};
+
+static gboolean tb_tree_stats_iter(gpointer key, gpointer value, gpointer data)
+{
+    const TranslationBlock *tb = value;
+    struct tb_tree_stats *tst = data;
+
+    tst->host_size += tb->tc.size;
+    tst->target_size += tb->size;
+    if (tb->size > tst->max_target_size) {
+        tst->max_target_size = tb->size;
+    }
+    if (tb->page_addr[1] != -1) {
+        tst->cross_page++;
+    }
+    if (tb->jmp_reset_offset[0] != TB_JMP_RESET_OFFSET_INVALID) {
+        tst->direct_jmp_count++;
+        if (tb->jmp_reset_offset[1] != TB_JMP_RESET_OFFSET_INVALID) {
+            tst->direct_jmp2_count++;
+        }
+    }
+    return false;
+}
+
 void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
 {
-    int i, target_code_size, max_target_code_size;
-    int direct_jmp_count, direct_jmp2_count, cross_page;
-    TranslationBlock *tb;
+    struct tb_tree_stats tst = {};
     struct qht_stats hst;
+    size_t nb_tbs;
 
     tb_lock();
 
-    target_code_size = 0;
-    max_target_code_size = 0;
-    cross_page = 0;
-    direct_jmp_count = 0;
-    direct_jmp2_count = 0;
-    for (i = 0; i < tcg_ctx.tb_ctx.nb_tbs; i++) {
-        tb = tcg_ctx.tb_ctx.tbs[i];
-        target_code_size += tb->size;
-        if (tb->size > max_target_code_size) {
-            max_target_code_size = tb->size;
-        }
-        if (tb->page_addr[1] != -1) {
-            cross_page++;
-        }
-        if (tb->jmp_reset_offset[0] != TB_JMP_RESET_OFFSET_INVALID) {
-            direct_jmp_count++;
-            if (tb->jmp_reset_offset[1] != TB_JMP_RESET_OFFSET_INVALID) {
-                direct_jmp2_count++;
-            }
-        }
-    }
+    nb_tbs = g_tree_nnodes(tb_ctx.tb_tree);
+    g_tree_foreach(tb_ctx.tb_tree, tb_tree_stats_iter, &tst);
     /* XXX: avoid using doubles ? */
     cpu_fprintf(f, "Translation buffer state:\n");
-    cpu_fprintf(f, "gen code size       %td/%zd\n",
-                tcg_ctx.code_gen_ptr - tcg_ctx.code_gen_buffer,
-                tcg_ctx.code_gen_highwater - tcg_ctx.code_gen_buffer);
-    cpu_fprintf(f, "TB count            %d\n", tcg_ctx.tb_ctx.nb_tbs);
-    cpu_fprintf(f, "TB avg target size  %d max=%d bytes\n",
-            tcg_ctx.tb_ctx.nb_tbs ? target_code_size /
-                    tcg_ctx.tb_ctx.nb_tbs : 0,
-            max_target_code_size);
-    cpu_fprintf(f, "TB avg host size    %td bytes (expansion ratio: %0.1f)\n",
-            tcg_ctx.tb_ctx.nb_tbs ? (tcg_ctx.code_gen_ptr -
-                                     tcg_ctx.code_gen_buffer) /
-                                     tcg_ctx.tb_ctx.nb_tbs : 0,
-                target_code_size ? (double) (tcg_ctx.code_gen_ptr -
-                                             tcg_ctx.code_gen_buffer) /
-                                             target_code_size : 0);
-    cpu_fprintf(f, "cross page TB count %d (%d%%)\n", cross_page,
-            tcg_ctx.tb_ctx.nb_tbs ? (cross_page * 100) /
-                                    tcg_ctx.tb_ctx.nb_tbs : 0);
-    cpu_fprintf(f, "direct jump count   %d (%d%%) (2 jumps=%d %d%%)\n",
-                direct_jmp_count,
-                tcg_ctx.tb_ctx.nb_tbs ? (direct_jmp_count * 100) /
-                        tcg_ctx.tb_ctx.nb_tbs : 0,
-                direct_jmp2_count,
-                tcg_ctx.tb_ctx.nb_tbs ? (direct_jmp2_count * 100) /
-                        tcg_ctx.tb_ctx.nb_tbs : 0);
-
-    qht_statistics_init(&tcg_ctx.tb_ctx.htable, &hst);
+    /*
+     * Report total code size including the padding and TB structs;
+     * otherwise users might think "-tb-size" is not honoured.
+     * For avg host size we use the precise numbers from tb_tree_stats though.
+     */
+    cpu_fprintf(f, "gen code size       %zu/%zu\n",
+                tcg_code_size(), tcg_code_capacity());
+    cpu_fprintf(f, "TB count            %zu\n", nb_tbs);
+    cpu_fprintf(f, "TB avg target size  %zu max=%zu bytes\n",
+                nb_tbs ? tst.target_size / nb_tbs : 0,
+                tst.max_target_size);
+    cpu_fprintf(f, "TB avg host size    %zu bytes (expansion ratio: %0.1f)\n",
+                nb_tbs ? tst.host_size / nb_tbs : 0,
+                tst.target_size ? (double)tst.host_size / tst.target_size : 0);
+    cpu_fprintf(f, "cross page TB count %zu (%zu%%)\n", tst.cross_page,
+            nb_tbs ? (tst.cross_page * 100) / nb_tbs : 0);
+    cpu_fprintf(f, "direct jump count   %zu (%zu%%) (2 jumps=%zu %zu%%)\n",
+                tst.direct_jmp_count,
+                nb_tbs ? (tst.direct_jmp_count * 100) / nb_tbs : 0,
+                tst.direct_jmp2_count,
+                nb_tbs ? (tst.direct_jmp2_count * 100) / nb_tbs : 0);
+
+    qht_statistics_init(&tb_ctx.htable, &hst);
     print_qht_statistics(f, cpu_fprintf, hst);
     qht_statistics_destroy(&hst);
 
     cpu_fprintf(f, "\nStatistics:\n");
     cpu_fprintf(f, "TB flush count      %u\n",
-            atomic_read(&tcg_ctx.tb_ctx.tb_flush_count));
+            atomic_read(&tb_ctx.tb_flush_count));
     cpu_fprintf(f, "TB invalidate count %d\n",
-            tcg_ctx.tb_ctx.tb_phys_invalidate_count);
+            tb_ctx.tb_phys_invalidate_count);
     cpu_fprintf(f, "TLB flush count     %d\n", tlb_flush_count);
     tcg_dump_info(f, cpu_fprintf);
 
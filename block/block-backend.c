@@ -66,6 +66,12 @@ struct BlockBackend {
 
     bool allow_write_beyond_eof;
 
+    /* If true, AIO requests run in the AioContext of the submitting thread
+     * rather than in the BlockBackend's AioContext.  Accessed with atomic
+     * ops.
+     */
+    bool multiqueue;
+
     NotifierList remove_bs_notifiers, insert_bs_notifiers;
 
     int quiesce_counter;
@@ -999,6 +1005,28 @@ void blk_set_allow_write_beyond_eof(BlockBackend *blk, bool allow)
     blk->allow_write_beyond_eof = allow;
 }
 
+/*
+ * Let AIO requests be submitted from several AioContexts at once.  Each
+ * request then runs, and completes, in the AioContext of the thread that
+ * submitted it instead of being bounced to blk_get_aio_context().
+ *
+ * The caller must still hold the BlockBackend's AioContext lock while
+ * submitting requests.
+ */
+void blk_set_multiqueue(BlockBackend *blk, bool multiqueue)
+{
+    atomic_set(&blk->multiqueue, multiqueue);
+}
+
+/* Return the AioContext in which an AIO request submitted now should run */
+static AioContext *blk_get_request_aio_context(BlockBackend *blk)
+{
+    if (atomic_read(&blk->multiqueue)) {
+        return qemu_get_current_aio_context();
+    }
+    return blk_get_aio_context(blk);
+}
+
 static int blk_check_byte_request(BlockBackend *blk, int64_t offset,
                                   size_t size)
 {
@@ -1193,7 +1221,8 @@ BlockAIOCB *blk_abort_aio_request(BlockBackend *blk,
     acb->blk = blk;
     acb->ret = ret;
 
-    aio_bh_schedule_oneshot(blk_get_aio_context(blk), error_callback_bh, acb);
+    aio_bh_schedule_oneshot(blk_get_request_aio_context(blk),
+                            error_callback_bh, acb);
     return &acb->common;
 }
 
@@ -1231,6 +1260,7 @@ static BlockAIOCB *blk_aio_prwv(BlockBackend *blk, int64_t offset, int bytes,
 {
     BlkAioEmAIOCB *acb;
     Coroutine *co;
+    AioContext *ctx = blk_get_request_aio_context(blk);
 
     bdrv_inc_in_flight(blk_bs(blk));
     acb = blk_aio_get(&blk_aio_em_aiocb_info, blk, cb, opaque);
@@ -1245,12 +1275,11 @@ static BlockAIOCB *blk_aio_prwv(BlockBackend *blk, int64_t offset, int bytes,
     acb->has_returned = false;
 
     co = qemu_coroutine_create(co_entry, acb);
-    bdrv_coroutine_enter(blk_bs(blk), co);
+    aio_co_enter(ctx, co);
 
     acb->has_returned = true;
     if (acb->rwco.ret != NOT_DONE) {
-        aio_bh_schedule_oneshot(blk_get_aio_context(blk),
-                                blk_aio_complete_bh, acb);
+        aio_bh_schedule_oneshot(ctx, blk_aio_complete_bh, acb);
     }
 
     return &acb->common;
@@ -503,9 +503,17 @@ static void dummy_bh_cb(void *opaque)
 
 void bdrv_wakeup(BlockDriverState *bs)
 {
+    AioContext *ctx = bdrv_get_aio_context(bs);
+
     /* The barrier (or an atomic op) is in the caller.  */
     if (atomic_read(&bs->wakeup)) {
         aio_bh_schedule_oneshot(qemu_get_aio_context(), dummy_bh_cb, NULL);
+    } else if (ctx != qemu_get_current_aio_context()) {
+        /* Requests submitted from another AioContext (see
+         * blk_set_multiqueue) complete there; BDRV_POLL_WHILE may be
+         * sleeping in the home AioContext, so kick it.
+         */
+        aio_notify(ctx);
     }
 }
 
@@ -2605,30 +2613,31 @@ void bdrv_add_before_write_notifier(BlockDriverState *bs,
 
 void bdrv_io_plug(BlockDriverState *bs)
 {
+    BlockDriver *drv = bs->drv;
     BdrvChild *child;
 
     QLIST_FOREACH(child, &bs->children, next) {
         bdrv_io_plug(child->bs);
     }
 
-    if (atomic_fetch_inc(&bs->io_plugged) == 0) {
-        BlockDriver *drv = bs->drv;
-        if (drv && drv->bdrv_io_plug) {
-            drv->bdrv_io_plug(bs);
-        }
+    /* Drivers count nesting themselves, per AioContext: with multiqueue
+     * BlockBackends, plug sections of different threads can overlap.
+     */
+    atomic_inc(&bs->io_plugged);
+    if (drv && drv->bdrv_io_plug) {
+        drv->bdrv_io_plug(bs);
     }
 }
 
 void bdrv_io_unplug(BlockDriverState *bs)
 {
+    BlockDriver *drv = bs->drv;
     BdrvChild *child;
 
     assert(bs->io_plugged);
-    if (atomic_fetch_dec(&bs->io_plugged) == 1) {
-        BlockDriver *drv = bs->drv;
-        if (drv && drv->bdrv_io_unplug) {
-            drv->bdrv_io_unplug(bs);
-        }
+    atomic_dec(&bs->io_plugged);
+    if (drv && drv->bdrv_io_unplug) {
+        drv->bdrv_io_unplug(bs);
     }
 
     QLIST_FOREACH(child, &bs->children, next) {
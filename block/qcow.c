@@ -496,6 +496,16 @@ static int get_cluster_offset(BlockDriverState *bs,
                     }
                 }
             } else if (allocate == 2) {
+                /* extend the file now, under s->lock, so that concurrent
+                   compressed writes get distinct offsets */
+                if (cluster_offset + compressed_size > INT64_MAX) {
+                    return -E2BIG;
+                }
+                ret = bdrv_truncate(bs->file, cluster_offset + compressed_size,
+                                    PREALLOC_MODE_OFF, NULL);
+                if (ret < 0) {
+                    return ret;
+                }
                 cluster_offset |= QCOW_OFLAG_COMPRESSED |
                     (uint64_t)compressed_size << (63 - s->cluster_bits);
             }
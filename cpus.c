@@ -196,6 +196,8 @@ static bool default_mttcg_enabled(void)
 void qemu_tcg_configure(QemuOpts *opts, Error **errp)
 {
     const char *t = qemu_opt_get(opts, "thread");
+    uint64_t traces;
+
     if (t) {
         if (strcmp(t, "multi") == 0) {
             if (TCG_OVERSIZED_GUEST) {
@@ -222,6 +224,13 @@ void qemu_tcg_configure(QemuOpts *opts, Error **errp)
     } else {
         mttcg_enabled = default_mttcg_enabled();
     }
+
+    traces = qemu_opt_get_number(opts, "traces", 0);
+    if (traces > UINT_MAX) {
+        error_setg(errp, "Invalid 'traces' setting %" PRIu64, traces);
+    } else {
+        tb_trace_threshold = traces;
+    }
 }
 
 /* The current number of executed instructions is based on what we
@@ -662,23 +671,35 @@ static const VMStateDescription vmstate_timers = {
     }
 };
 
+/* The largest throttle percentage in effect for any vcpu */
+static int cpu_throttle_max_percentage(void)
+{
+    CPUState *cpu;
+    int max = cpu_throttle_get_percentage();
+
+    CPU_FOREACH(cpu) {
+        max = MAX(max, atomic_read(&cpu->throttle_percentage));
+    }
+    return max;
+}
+
+/* @opaque is the timer period in ns.  It is computed from the largest
+ * percentage, so that vcpus with a smaller one sleep for a smaller part
+ * of the same period.
+ */
 static void cpu_throttle_thread(CPUState *cpu, run_on_cpu_data opaque)
 {
     double pct;
-    double throttle_ratio;
     long sleeptime_ns;
 
-    if (!cpu_throttle_get_percentage()) {
-        return;
-    }
-
-    pct = (double)cpu_throttle_get_percentage()/100;
-    throttle_ratio = pct / (1 - pct);
-    sleeptime_ns = (long)(throttle_ratio * CPU_THROTTLE_TIMESLICE_NS);
+    pct = (double)cpu_throttle_get_vcpu_percentage(cpu)/100;
+    sleeptime_ns = (long)(pct * opaque.host_ulong);
 
-    qemu_mutex_unlock_iothread();
-    g_usleep(sleeptime_ns / 1000); /* Convert ns to us for usleep call */
-    qemu_mutex_lock_iothread();
+    if (sleeptime_ns) {
+        qemu_mutex_unlock_iothread();
+        g_usleep(sleeptime_ns / 1000); /* Convert ns to us for usleep call */
+        qemu_mutex_lock_iothread();
+    }
     atomic_set(&cpu->throttle_thread_scheduled, 0);
 }
 
@@ -686,21 +707,27 @@ static void cpu_throttle_timer_tick(void *opaque)
 {
     CPUState *cpu;
     double pct;
+    unsigned long period_ns;
 
     /* Stop the timer if needed */
-    if (!cpu_throttle_get_percentage()) {
+    pct = (double)cpu_throttle_max_percentage()/100;
+    if (!pct) {
         return;
     }
+    period_ns = CPU_THROTTLE_TIMESLICE_NS / (1-pct);
+
     CPU_FOREACH(cpu) {
+        if (!cpu_throttle_get_vcpu_percentage(cpu)) {
+            continue;
+        }
         if (!atomic_xchg(&cpu->throttle_thread_scheduled, 1)) {
             async_run_on_cpu(cpu, cpu_throttle_thread,
-                             RUN_ON_CPU_NULL);
+                             RUN_ON_CPU_HOST_ULONG(period_ns));
         }
     }
 
-    pct = (double)cpu_throttle_get_percentage()/100;
     timer_mod(throttle_timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL_RT) +
-                                   CPU_THROTTLE_TIMESLICE_NS / (1-pct));
+                                   period_ns);
 }
 
 void cpu_throttle_set(int new_throttle_pct)
@@ -715,14 +742,34 @@ void cpu_throttle_set(int new_throttle_pct)
                                        CPU_THROTTLE_TIMESLICE_NS);
 }
 
+void cpu_throttle_set_vcpu(CPUState *cpu, int new_throttle_pct)
+{
+    if (new_throttle_pct) {
+        new_throttle_pct = MIN(new_throttle_pct, CPU_THROTTLE_PCT_MAX);
+        new_throttle_pct = MAX(new_throttle_pct, CPU_THROTTLE_PCT_MIN);
+    }
+
+    atomic_set(&cpu->throttle_percentage, new_throttle_pct);
+
+    if (new_throttle_pct && !timer_pending(throttle_timer)) {
+        timer_mod(throttle_timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL_RT) +
+                                           CPU_THROTTLE_TIMESLICE_NS);
+    }
+}
+
 void cpu_throttle_stop(void)
 {
+    CPUState *cpu;
+
     atomic_set(&throttle_percentage, 0);
+    CPU_FOREACH(cpu) {
+        atomic_set(&cpu->throttle_percentage, 0);
+    }
 }
 
 bool cpu_throttle_active(void)
 {
-    return (cpu_throttle_get_percentage() != 0);
+    return (cpu_throttle_max_percentage() != 0);
 }
 
 int cpu_throttle_get_percentage(void)
@@ -730,6 +777,12 @@ int cpu_throttle_get_percentage(void)
     return atomic_read(&throttle_percentage);
 }
 
+int cpu_throttle_get_vcpu_percentage(CPUState *cpu)
+{
+    return MAX(cpu_throttle_get_percentage(),
+               atomic_read(&cpu->throttle_percentage));
+}
+
 void cpu_ticks_init(void)
 {
     seqlock_init(&timers_state.vm_clock_seqlock);
@@ -1307,6 +1360,7 @@ static void *qemu_tcg_rr_cpu_thread_fn(void *arg)
     CPUState *cpu = arg;
 
     rcu_register_thread();
+    tcg_register_thread();
 
     qemu_mutex_lock_iothread();
     qemu_thread_get_self(cpu->thread);
@@ -1454,6 +1508,7 @@ static void *qemu_tcg_cpu_thread_fn(void *arg)
     g_assert(!use_icount);
 
     rcu_register_thread();
+    tcg_register_thread();
 
     qemu_mutex_lock_iothread();
     qemu_thread_get_self(cpu->thread);
@@ -1664,6 +1719,18 @@ static void qemu_tcg_init_vcpu(CPUState *cpu)
     char thread_name[VCPU_THREAD_NAME_SIZE];
     static QemuCond *single_tcg_halt_cond;
     static QemuThread *single_tcg_cpu_thread;
+    static int tcg_region_inited;
+
+    /*
+     * Initialize TCG regions--once. Now is a good time, because:
+     * (1) TCG's init context, prologue and target globals have been set up.
+     * (2) qemu_tcg_mttcg_enabled() works now (TCG init code runs before the
+     *     -accel flag is processed, so the check doesn't work then).
+     */
+    if (!tcg_region_inited) {
+        tcg_region_inited = 1;
+        tcg_region_init();
+    }
 
     if (qemu_tcg_mttcg_enabled() || !single_tcg_cpu_thread) {
         cpu->thread = g_malloc0(sizeof(QemuThread));
@@ -728,6 +728,7 @@ void cpu_exec_unrealizefn(CPUState *cpu)
     CPUClass *cc = CPU_GET_CLASS(cpu);
 
     cpu_list_remove(cpu);
+    tlb_destroy(cpu);
 
     if (cc->vmsd != NULL) {
         vmstate_unregister(NULL, cc->vmsd, cpu);
@@ -768,6 +769,7 @@ void cpu_exec_realizefn(CPUState *cpu, Error **errp)
     CPUClass *cc ATTRIBUTE_UNUSED = CPU_GET_CLASS(cpu);
 
     cpu_list_add(cpu);
+    tlb_init(cpu);
 
 #ifndef CONFIG_USER_ONLY
     if (qdev_get_vmsd(DEVICE(cpu)) == NULL) {
@@ -1119,6 +1121,13 @@ bool cpu_physical_memory_test_and_clear_dirty(ram_addr_t start,
         page += num;
     }
 
+    if (dirty && client == DIRTY_MEMORY_VGA) {
+        /* Migration re-arms its own pages, see migration_bitmap_clear_dirty */
+        RAMBlock *rb = qemu_get_ram_block(start);
+
+        memory_region_clear_dirty_bitmap(rb->mr, start - rb->offset, length);
+    }
+
     rcu_read_unlock();
 
     if (dirty && tcg_enabled()) {
@@ -1167,6 +1176,12 @@ DirtyBitmapSnapshot *cpu_physical_memory_snapshot_and_clear_dirty
         dest += num >> BITS_PER_LEVEL;
     }
 
+    if (client == DIRTY_MEMORY_VGA) {
+        RAMBlock *rb = qemu_get_ram_block(start);
+
+        memory_region_clear_dirty_bitmap(rb->mr, start - rb->offset, length);
+    }
+
     rcu_read_unlock();
 
     if (tcg_enabled()) {
@@ -2358,6 +2373,14 @@ static void notdirty_mem_write(void *opaque, hwaddr ram_addr,
         tb_unlock();
     }
 
+    /* Account the page to the vcpu that dirtied it first, for the
+     * migration dirty rate estimate.
+     */
+    if (!cpu_physical_memory_get_dirty_flag(ram_addr,
+                                            DIRTY_MEMORY_MIGRATION)) {
+        atomic_inc(&current_cpu->dirty_pages);
+    }
+
     /* Set both VGA and migration bits for simplicity and to remove
      * the notdirty callback faster.
      */
@@ -3136,53 +3159,43 @@ void cpu_flush_icache_range(hwaddr start, int len)
                                            start, NULL, len, FLUSH_CACHE);
 }
 
-typedef struct {
+struct BounceBuffer {
     MemoryRegion *mr;
-    void *buffer;
     hwaddr addr;
-    hwaddr len;
-    bool in_use;
-} BounceBuffer;
-
-static BounceBuffer bounce;
-
-typedef struct MapClient {
-    QEMUBH *bh;
-    QLIST_ENTRY(MapClient) link;
-} MapClient;
-
-QemuMutex map_client_list_lock;
-static QLIST_HEAD(map_client_list, MapClient) map_client_list
-    = QLIST_HEAD_INITIALIZER(map_client_list);
+    size_t len;
+    QLIST_ENTRY(BounceBuffer) link;
+    uint8_t buffer[];
+};
 
-static void cpu_unregister_map_client_do(MapClient *client)
+static void
+address_space_unregister_map_client_do(AddressSpaceMapClient *client)
 {
     QLIST_REMOVE(client, link);
     g_free(client);
 }
 
-static void cpu_notify_map_clients_locked(void)
+static void address_space_notify_map_clients_locked(AddressSpace *as)
 {
-    MapClient *client;
+    AddressSpaceMapClient *client;
 
-    while (!QLIST_EMPTY(&map_client_list)) {
-        client = QLIST_FIRST(&map_client_list);
+    while (!QLIST_EMPTY(&as->map_client_list)) {
+        client = QLIST_FIRST(&as->map_client_list);
         qemu_bh_schedule(client->bh);
-        cpu_unregister_map_client_do(client);
+        address_space_unregister_map_client_do(client);
     }
 }
 
-void cpu_register_map_client(QEMUBH *bh)
+void address_space_register_map_client(AddressSpace *as, QEMUBH *bh)
 {
-    MapClient *client = g_malloc(sizeof(*client));
+    AddressSpaceMapClient *client = g_malloc(sizeof(*client));
 
-    qemu_mutex_lock(&map_client_list_lock);
+    qemu_mutex_lock(&as->map_client_list_lock);
     client->bh = bh;
-    QLIST_INSERT_HEAD(&map_client_list, client, link);
-    if (!atomic_read(&bounce.in_use)) {
-        cpu_notify_map_clients_locked();
+    QLIST_INSERT_HEAD(&as->map_client_list, client, link);
+    if (as->bounce_buffer_size < as->max_bounce_buffer_size) {
+        address_space_notify_map_clients_locked(as);
     }
-    qemu_mutex_unlock(&map_client_list_lock);
+    qemu_mutex_unlock(&as->map_client_list_lock);
 }
 
 void cpu_exec_init_all(void)
@@ -3198,28 +3211,20 @@ void cpu_exec_init_all(void)
     finalize_target_page_bits();
     io_mem_init();
     memory_map_init();
-    qemu_mutex_init(&map_client_list_lock);
 }
 
-void cpu_unregister_map_client(QEMUBH *bh)
+void address_space_unregister_map_client(AddressSpace *as, QEMUBH *bh)
 {
-    MapClient *client;
+    AddressSpaceMapClient *client;
 
-    qemu_mutex_lock(&map_client_list_lock);
-    QLIST_FOREACH(client, &map_client_list, link) {
+    qemu_mutex_lock(&as->map_client_list_lock);
+    QLIST_FOREACH(client, &as->map_client_list, link) {
         if (client->bh == bh) {
-            cpu_unregister_map_client_do(client);
+            address_space_unregister_map_client_do(client);
             break;
         }
     }
-    qemu_mutex_unlock(&map_client_list_lock);
-}
-
-static void cpu_notify_map_clients(void)
-{
-    qemu_mutex_lock(&map_client_list_lock);
-    cpu_notify_map_clients_locked();
-    qemu_mutex_unlock(&map_client_list_lock);
+    qemu_mutex_unlock(&as->map_client_list_lock);
 }
 
 static bool flatview_access_valid(FlatView *fv, hwaddr addr, int len,
@@ -3285,8 +3290,8 @@ flatview_extend_translation(FlatView *fv, hwaddr addr,
  * May map a subset of the requested range, given by and returned in *plen.
  * May return NULL if resources needed to perform the mapping are exhausted.
  * Use only for reads OR writes - not for read-modify-write operations.
- * Use cpu_register_map_client() to know when retrying the map operation is
- * likely to succeed.
+ * Use address_space_register_map_client() to know when retrying the map
+ * operation is likely to succeed.
  */
 void *address_space_map(AddressSpace *as,
                         hwaddr addr,
@@ -3308,26 +3313,39 @@ void *address_space_map(AddressSpace *as,
     mr = flatview_translate(fv, addr, &xlat, &l, is_write);
 
     if (!memory_access_is_direct(mr, is_write)) {
-        if (atomic_xchg(&bounce.in_use, true)) {
+        BounceBuffer *bounce;
+
+        /* Take what is left of the bounce buffer budget; a shorter
+         * mapping is better than none at all.
+         */
+        qemu_mutex_lock(&as->map_client_list_lock);
+        if (as->bounce_buffer_size >= as->max_bounce_buffer_size) {
+            qemu_mutex_unlock(&as->map_client_list_lock);
             rcu_read_unlock();
             return NULL;
         }
-        /* Avoid unbounded allocations */
-        l = MIN(l, TARGET_PAGE_SIZE);
-        bounce.buffer = qemu_memalign(TARGET_PAGE_SIZE, l);
-        bounce.addr = addr;
-        bounce.len = l;
+        l = MIN(l, as->max_bounce_buffer_size - as->bounce_buffer_size);
+        atomic_set(&as->bounce_buffer_size, as->bounce_buffer_size + l);
+        qemu_mutex_unlock(&as->map_client_list_lock);
+
+        bounce = g_malloc(sizeof(*bounce) + l);
+        bounce->addr = addr;
+        bounce->len = l;
 
         memory_region_ref(mr);
-        bounce.mr = mr;
+        bounce->mr = mr;
         if (!is_write) {
             flatview_read(fv, addr, MEMTXATTRS_UNSPECIFIED,
-                               bounce.buffer, l);
+                               bounce->buffer, l);
         }
 
+        qemu_mutex_lock(&as->map_client_list_lock);
+        QLIST_INSERT_HEAD(&as->bounce_buffers, bounce, link);
+        qemu_mutex_unlock(&as->map_client_list_lock);
+
         rcu_read_unlock();
         *plen = l;
-        return bounce.buffer;
+        return bounce->buffer;
     }
 
 
@@ -3340,6 +3358,29 @@ void *address_space_map(AddressSpace *as,
     return ptr;
 }
 
+/* Look up and detach the bounce buffer that @buffer points to, if any.
+ * The common case of no outstanding bounce buffers avoids the lock.
+ */
+static BounceBuffer *address_space_take_bounce_buffer(AddressSpace *as,
+                                                      void *buffer)
+{
+    BounceBuffer *bounce;
+
+    if (!atomic_read(&as->bounce_buffer_size)) {
+        return NULL;
+    }
+
+    qemu_mutex_lock(&as->map_client_list_lock);
+    QLIST_FOREACH(bounce, &as->bounce_buffers, link) {
+        if (bounce->buffer == buffer) {
+            QLIST_REMOVE(bounce, link);
+            break;
+        }
+    }
+    qemu_mutex_unlock(&as->map_client_list_lock);
+    return bounce;
+}
+
 /* Unmaps a memory region previously mapped by address_space_map().
  * Will also mark the memory as dirty if is_write == 1.  access_len gives
  * the amount of memory that was actually read or written by the caller.
@@ -3347,7 +3388,9 @@ void *address_space_map(AddressSpace *as,
 void address_space_unmap(AddressSpace *as, void *buffer, hwaddr len,
                          int is_write, hwaddr access_len)
 {
-    if (buffer != bounce.buffer) {
+    BounceBuffer *bounce = address_space_take_bounce_buffer(as, buffer);
+
+    if (!bounce) {
         MemoryRegion *mr;
         ram_addr_t addr1;
 
@@ -3363,14 +3406,17 @@ void address_space_unmap(AddressSpace *as, void *buffer, hwaddr len,
         return;
     }
     if (is_write) {
-        address_space_write(as, bounce.addr, MEMTXATTRS_UNSPECIFIED,
-                            bounce.buffer, access_len);
-    }
-    qemu_vfree(bounce.buffer);
-    bounce.buffer = NULL;
-    memory_region_unref(bounce.mr);
-    atomic_mb_set(&bounce.in_use, false);
-    cpu_notify_map_clients();
+        address_space_write(as, bounce->addr, MEMTXATTRS_UNSPECIFIED,
+                            bounce->buffer, access_len);
+    }
+    memory_region_unref(bounce->mr);
+
+    qemu_mutex_lock(&as->map_client_list_lock);
+    atomic_set(&as->bounce_buffer_size, as->bounce_buffer_size - bounce->len);
+    address_space_notify_map_clients_locked(as);
+    qemu_mutex_unlock(&as->map_client_list_lock);
+
+    g_free(bounce);
 }
 
 void *cpu_physical_memory_map(hwaddr addr,
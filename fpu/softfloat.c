@@ -88,6 +88,10 @@ this code that are retained.
 
 /* We only need stdlib for abort() */
 
+/* ...and the host FPU for the hardfloat fast paths.  */
+#include <math.h>
+#include <float.h>
+
 /*----------------------------------------------------------------------------
 | Primitive arithmetic functions, including multi-word arithmetic, and
 | division and square root approximations.  (Can be specialized to target if
@@ -2183,7 +2187,8 @@ static float32 subFloat32Sigs(float32 a, float32 b, flag zSign,
 | Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float32 float32_add(float32 a, float32 b, float_status *status)
+static float32 soft_float32_add(float32 a, float32 b,
+                                 float_status *status)
 {
     flag aSign, bSign;
     a = float32_squash_input_denormal(a, status);
@@ -2206,7 +2211,8 @@ float32 float32_add(float32 a, float32 b, float_status *status)
 | for Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float32 float32_sub(float32 a, float32 b, float_status *status)
+static float32 soft_float32_sub(float32 a, float32 b,
+                                 float_status *status)
 {
     flag aSign, bSign;
     a = float32_squash_input_denormal(a, status);
@@ -2229,7 +2235,8 @@ float32 float32_sub(float32 a, float32 b, float_status *status)
 | for Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float32 float32_mul(float32 a, float32 b, float_status *status)
+static float32 soft_float32_mul(float32 a, float32 b,
+                                 float_status *status)
 {
     flag aSign, bSign, zSign;
     int aExp, bExp, zExp;
@@ -2294,7 +2301,8 @@ float32 float32_mul(float32 a, float32 b, float_status *status)
 | IEC/IEEE Standard for Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float32 float32_div(float32 a, float32 b, float_status *status)
+static float32 soft_float32_div(float32 a, float32 b,
+                                 float_status *status)
 {
     flag aSign, bSign, zSign;
     int aExp, bExp, zExp;
@@ -2692,7 +2700,7 @@ float32 float32_muladd(float32 a, float32 b, float32 c, int flags,
 | Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float32 float32_sqrt(float32 a, float_status *status)
+static float32 soft_float32_sqrt(float32 a, float_status *status)
 {
     flag aSign;
     int aExp, zExp;
@@ -3978,7 +3986,8 @@ static float64 subFloat64Sigs(float64 a, float64 b, flag zSign,
 | Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float64 float64_add(float64 a, float64 b, float_status *status)
+static float64 soft_float64_add(float64 a, float64 b,
+                                 float_status *status)
 {
     flag aSign, bSign;
     a = float64_squash_input_denormal(a, status);
@@ -4001,7 +4010,8 @@ float64 float64_add(float64 a, float64 b, float_status *status)
 | for Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float64 float64_sub(float64 a, float64 b, float_status *status)
+static float64 soft_float64_sub(float64 a, float64 b,
+                                 float_status *status)
 {
     flag aSign, bSign;
     a = float64_squash_input_denormal(a, status);
@@ -4024,7 +4034,8 @@ float64 float64_sub(float64 a, float64 b, float_status *status)
 | for Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float64 float64_mul(float64 a, float64 b, float_status *status)
+static float64 soft_float64_mul(float64 a, float64 b,
+                                 float_status *status)
 {
     flag aSign, bSign, zSign;
     int aExp, bExp, zExp;
@@ -4087,7 +4098,8 @@ float64 float64_mul(float64 a, float64 b, float_status *status)
 | the IEC/IEEE Standard for Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float64 float64_div(float64 a, float64 b, float_status *status)
+static float64 soft_float64_div(float64 a, float64 b,
+                                 float_status *status)
 {
     flag aSign, bSign, zSign;
     int aExp, bExp, zExp;
@@ -4500,7 +4512,7 @@ float64 float64_muladd(float64 a, float64 b, float64 c, int flags,
 | Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float64 float64_sqrt(float64 a, float_status *status)
+static float64 soft_float64_sqrt(float64 a, float_status *status)
 {
     flag aSign;
     int aExp, zExp;
@@ -4548,6 +4560,335 @@ float64 float64_sqrt(float64 a, float_status *status)
 
 }
 
+/*----------------------------------------------------------------------------
+| Hardfloat fast paths.
+|
+| For the common case of normal (or zero) operands under the default rounding
+| mode, the single- and double-precision add, sub, mul, div and sqrt below are
+| computed with the host FPU instead of the integer emulation above.  The
+| host result is bit-identical to the softfloat one; what we cannot get
+| cheaply is the set of exception flags it raised.  Thus:
+|
+| - The inexact flag must already be set in `status', so that we never need
+|   to know whether the host operation was exact.  The flag is sticky and is
+|   set very early by any non-trivial FP workload.
+| - Inputs must be zero or normal, so that no NaN or infinity handling (and
+|   no target-specific NaN propagation) is involved, and so that
+|   flush_inputs_to_zero has already been applied.
+| - An infinite result can only come from an overflow, which we raise.
+| - A result that is tiny (|r| <= the smallest normal) might have underflowed
+|   or need flushing to zero, so unless it is trivially exact it is recomputed
+|   in softfloat.
+|
+| Anything else is handed to the softfloat implementation.
+*----------------------------------------------------------------------------*/
+
+/* PowerPC clears the flags before every FP instruction, so the inexact flag
+ * would never be set on entry and the checks would only add overhead.  x87
+ * math on 32-bit x86 hosts computes in extended precision and would round
+ * twice.  -ffast-math throws IEEE semantics out of the window entirely.
+ */
+#if defined(TARGET_PPC) || defined(__FAST_MATH__) || \
+    (defined(__i386__) && !defined(__SSE2_MATH__))
+# define QEMU_NO_HARDFLOAT 1
+#else
+# define QEMU_NO_HARDFLOAT 0
+#endif
+
+typedef union {
+    float32 s;
+    float h;
+} union_float32;
+
+typedef union {
+    float64 s;
+    double h;
+} union_float64;
+
+typedef bool (*f32_check_fn)(union_float32 a, union_float32 b);
+typedef bool (*f64_check_fn)(union_float64 a, union_float64 b);
+
+typedef float32 (*soft_f32_op2_fn)(float32 a, float32 b, float_status *s);
+typedef float64 (*soft_f64_op2_fn)(float64 a, float64 b, float_status *s);
+typedef float (*hard_f32_op2_fn)(float a, float b);
+typedef double (*hard_f64_op2_fn)(double a, double b);
+
+static inline bool can_use_fpu(const float_status *s)
+{
+    if (QEMU_NO_HARDFLOAT) {
+        return false;
+    }
+    return likely(s->float_exception_flags & float_flag_inexact &&
+                  s->float_rounding_mode == float_round_nearest_even);
+}
+
+static inline bool float32_is_zero_or_normal(float32 a)
+{
+    int aExp = extractFloat32Exp(a);
+
+    return aExp != 0xFF && (aExp != 0 || extractFloat32Frac(a) == 0);
+}
+
+static inline bool float64_is_zero_or_normal(float64 a)
+{
+    int aExp = extractFloat64Exp(a);
+
+    return aExp != 0x7FF && (aExp != 0 || extractFloat64Frac(a) == 0);
+}
+
+static inline float32
+float32_gen2(float32 xa, float32 xb, float_status *s,
+             hard_f32_op2_fn hard, soft_f32_op2_fn soft,
+             f32_check_fn pre, f32_check_fn post)
+{
+    union_float32 ua, ub, ur;
+
+    ua.s = xa;
+    ub.s = xb;
+
+    if (unlikely(!can_use_fpu(s))) {
+        goto soft;
+    }
+
+    ua.s = float32_squash_input_denormal(ua.s, s);
+    ub.s = float32_squash_input_denormal(ub.s, s);
+
+    if (unlikely(!pre(ua, ub))) {
+        goto soft;
+    }
+
+    ur.h = hard(ua.h, ub.h);
+    if (unlikely(float32_is_infinity(ur.s))) {
+        float_raise(float_flag_overflow, s);
+    } else if (unlikely(fabsf(ur.h) <= FLT_MIN) && post(ua, ub)) {
+        goto soft;
+    }
+    return ur.s;
+
+ soft:
+    return soft(ua.s, ub.s, s);
+}
+
+static inline float64
+float64_gen2(float64 xa, float64 xb, float_status *s,
+             hard_f64_op2_fn hard, soft_f64_op2_fn soft,
+             f64_check_fn pre, f64_check_fn post)
+{
+    union_float64 ua, ub, ur;
+
+    ua.s = xa;
+    ub.s = xb;
+
+    if (unlikely(!can_use_fpu(s))) {
+        goto soft;
+    }
+
+    ua.s = float64_squash_input_denormal(ua.s, s);
+    ub.s = float64_squash_input_denormal(ub.s, s);
+
+    if (unlikely(!pre(ua, ub))) {
+        goto soft;
+    }
+
+    ur.h = hard(ua.h, ub.h);
+    if (unlikely(float64_is_infinity(ur.s))) {
+        float_raise(float_flag_overflow, s);
+    } else if (unlikely(fabs(ur.h) <= DBL_MIN) && post(ua, ub)) {
+        goto soft;
+    }
+    return ur.s;
+
+ soft:
+    return soft(ua.s, ub.s, s);
+}
+
+/* Both operands are zero or normal.  */
+static bool f32_is_zon2(union_float32 a, union_float32 b)
+{
+    return float32_is_zero_or_normal(a.s) && float32_is_zero_or_normal(b.s);
+}
+
+/* Add and sub: a tiny result is exact if both operands are zero.  */
+static bool f32_addsub_post(union_float32 a, union_float32 b)
+{
+    return !(float32_is_zero(a.s) && float32_is_zero(b.s));
+}
+
+static bool f64_is_zon2(union_float64 a, union_float64 b)
+{
+    return float64_is_zero_or_normal(a.s) && float64_is_zero_or_normal(b.s);
+}
+
+static bool f64_addsub_post(union_float64 a, union_float64 b)
+{
+    return !(float64_is_zero(a.s) && float64_is_zero(b.s));
+}
+
+static float hard_f32_add(float a, float b)
+{
+    return a + b;
+}
+
+static float hard_f32_sub(float a, float b)
+{
+    return a - b;
+}
+
+static double hard_f64_add(double a, double b)
+{
+    return a + b;
+}
+
+static double hard_f64_sub(double a, double b)
+{
+    return a - b;
+}
+
+float32 float32_add(float32 a, float32 b, float_status *status)
+{
+    return float32_gen2(a, b, status, hard_f32_add, soft_float32_add,
+                        f32_is_zon2, f32_addsub_post);
+}
+
+float32 float32_sub(float32 a, float32 b, float_status *status)
+{
+    return float32_gen2(a, b, status, hard_f32_sub, soft_float32_sub,
+                        f32_is_zon2, f32_addsub_post);
+}
+
+float64 float64_add(float64 a, float64 b, float_status *status)
+{
+    return float64_gen2(a, b, status, hard_f64_add, soft_float64_add,
+                        f64_is_zon2, f64_addsub_post);
+}
+
+float64 float64_sub(float64 a, float64 b, float_status *status)
+{
+    return float64_gen2(a, b, status, hard_f64_sub, soft_float64_sub,
+                        f64_is_zon2, f64_addsub_post);
+}
+
+/* Mul: a tiny result is exact if either operand is zero.  */
+static bool f32_mul_post(union_float32 a, union_float32 b)
+{
+    return !(float32_is_zero(a.s) || float32_is_zero(b.s));
+}
+
+static bool f64_mul_post(union_float64 a, union_float64 b)
+{
+    return !(float64_is_zero(a.s) || float64_is_zero(b.s));
+}
+
+static float hard_f32_mul(float a, float b)
+{
+    return a * b;
+}
+
+static double hard_f64_mul(double a, double b)
+{
+    return a * b;
+}
+
+float32 float32_mul(float32 a, float32 b, float_status *status)
+{
+    return float32_gen2(a, b, status, hard_f32_mul, soft_float32_mul,
+                        f32_is_zon2, f32_mul_post);
+}
+
+float64 float64_mul(float64 a, float64 b, float_status *status)
+{
+    return float64_gen2(a, b, status, hard_f64_mul, soft_float64_mul,
+                        f64_is_zon2, f64_mul_post);
+}
+
+/* Div: the divisor must be normal, so that division by zero is left to
+ * softfloat; a tiny result is exact if the dividend is zero.
+ */
+static bool f32_div_pre(union_float32 a, union_float32 b)
+{
+    return float32_is_zero_or_normal(a.s) &&
+           float32_is_zero_or_normal(b.s) && !float32_is_zero(b.s);
+}
+
+static bool f32_div_post(union_float32 a, union_float32 b)
+{
+    return !float32_is_zero(a.s);
+}
+
+static bool f64_div_pre(union_float64 a, union_float64 b)
+{
+    return float64_is_zero_or_normal(a.s) &&
+           float64_is_zero_or_normal(b.s) && !float64_is_zero(b.s);
+}
+
+static bool f64_div_post(union_float64 a, union_float64 b)
+{
+    return !float64_is_zero(a.s);
+}
+
+static float hard_f32_div(float a, float b)
+{
+    return a / b;
+}
+
+static double hard_f64_div(double a, double b)
+{
+    return a / b;
+}
+
+float32 float32_div(float32 a, float32 b, float_status *status)
+{
+    return float32_gen2(a, b, status, hard_f32_div, soft_float32_div,
+                        f32_div_pre, f32_div_post);
+}
+
+float64 float64_div(float64 a, float64 b, float_status *status)
+{
+    return float64_gen2(a, b, status, hard_f64_div, soft_float64_div,
+                        f64_div_pre, f64_div_post);
+}
+
+/* Sqrt of a positive normal can neither overflow nor underflow.  */
+float32 float32_sqrt(float32 xa, float_status *status)
+{
+    union_float32 ua, ur;
+
+    ua.s = xa;
+    if (unlikely(!can_use_fpu(status))) {
+        goto soft;
+    }
+
+    ua.s = float32_squash_input_denormal(ua.s, status);
+    if (unlikely(!float32_is_zero_or_normal(ua.s) || float32_is_neg(ua.s))) {
+        goto soft;
+    }
+    ur.h = sqrtf(ua.h);
+    return ur.s;
+
+ soft:
+    return soft_float32_sqrt(ua.s, status);
+}
+
+float64 float64_sqrt(float64 xa, float_status *status)
+{
+    union_float64 ua, ur;
+
+    ua.s = xa;
+    if (unlikely(!can_use_fpu(status))) {
+        goto soft;
+    }
+
+    ua.s = float64_squash_input_denormal(ua.s, status);
+    if (unlikely(!float64_is_zero_or_normal(ua.s) || float64_is_neg(ua.s))) {
+        goto soft;
+    }
+    ur.h = sqrt(ua.h);
+    return ur.s;
+
+ soft:
+    return soft_float64_sqrt(ua.s, status);
+}
+
 /*----------------------------------------------------------------------------
 | Returns the binary log of the double-precision floating-point value `a'.
 | The operation is performed according to the IEC/IEEE Standard for Binary
@@ -255,6 +255,12 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
                        info->xbzrle_cache->cache_miss);
         monitor_printf(mon, "xbzrle cache miss rate: %0.2f\n",
                        info->xbzrle_cache->cache_miss_rate);
+        monitor_printf(mon, "xbzrle cache hit: %" PRIu64 "\n",
+                       info->xbzrle_cache->cache_hit);
+        monitor_printf(mon, "xbzrle cache hit rate: %0.2f\n",
+                       info->xbzrle_cache->cache_hit_rate);
+        monitor_printf(mon, "xbzrle cache conflict: %" PRIu64 "\n",
+                       info->xbzrle_cache->cache_conflict);
         monitor_printf(mon, "xbzrle overflow : %" PRIu64 "\n",
                        info->xbzrle_cache->overflow);
     }
@@ -264,6 +270,55 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
                        info->cpu_throttle_percentage);
     }
 
+    if (info->has_vcpu_dirty_rate) {
+        VcpuDirtyRateList *rate;
+
+        for (rate = info->vcpu_dirty_rate; rate; rate = rate->next) {
+            VcpuDirtyRate *r = rate->value;
+
+            if (r->has_dirty_rate) {
+                monitor_printf(mon, "vcpu %" PRId64 " dirty rate: %" PRIu64
+                               " pages/s", r->cpu_index, r->dirty_rate);
+            } else {
+                monitor_printf(mon, "vcpu %" PRId64 " dirty rate estimate: %"
+                               PRIu64 " pages/s", r->cpu_index,
+                               r->dirty_rate_estimate);
+            }
+            monitor_printf(mon, ", throttle percentage: %" PRId64 "\n",
+                           r->throttle_percentage);
+        }
+    }
+
+    if (info->has_rdma) {
+        monitor_printf(mon, "rdma queue pairs: %" PRId64 "\n",
+                       info->rdma->qps);
+        monitor_printf(mon, "rdma registered chunks: %" PRId64 "\n",
+                       info->rdma->registered_chunks);
+        monitor_printf(mon, "rdma registration stalls: %" PRId64
+                       " (%" PRId64 " ms)\n",
+                       info->rdma->registration_stalls,
+                       info->rdma->registration_stall_time);
+        monitor_printf(mon, "rdma write stalls: %" PRId64 "\n",
+                       info->rdma->write_stalls);
+    }
+
+    if (info->has_postcopy_faults) {
+        intList *item;
+
+        monitor_printf(mon, "postcopy faults: %" PRIu64 "\n",
+                       info->postcopy_faults->faults);
+        monitor_printf(mon, "postcopy fault latency: avg %" PRIu64
+                       " us, max %" PRIu64 " us\n",
+                       info->postcopy_faults->latency_avg,
+                       info->postcopy_faults->latency_max);
+        monitor_printf(mon, "postcopy fault latency histogram (log2 us):");
+        for (item = info->postcopy_faults->latency_histogram; item;
+             item = item->next) {
+            monitor_printf(mon, " %" PRId64, item->value);
+        }
+        monitor_printf(mon, "\n");
+    }
+
     qapi_free_MigrationInfo(info);
     qapi_free_MigrationCapabilityStatusList(caps);
 }
@@ -342,6 +397,13 @@ void hmp_info_migrate_parameters(Monitor *mon, const QDict *qdict)
         monitor_printf(mon, "%s: %" PRId64 "\n",
             MigrationParameter_str(MIGRATION_PARAMETER_X_MULTIFD_PAGE_COUNT),
             params->x_multifd_page_count);
+        assert(params->has_x_multifd_compression);
+        monitor_printf(mon, "%s: %s\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_X_MULTIFD_COMPRESSION),
+            MultiFDCompression_str(params->x_multifd_compression));
+        monitor_printf(mon, "%s: %" PRId64 "\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_X_RDMA_QPS),
+            params->x_rdma_qps);
     }
 
     qapi_free_MigrationParameters(params);
@@ -1635,6 +1697,15 @@ void hmp_migrate_set_parameter(Monitor *mon, const QDict *qdict)
         p->has_x_multifd_page_count = true;
         visit_type_int(v, param, &p->x_multifd_page_count, &err);
         break;
+    case MIGRATION_PARAMETER_X_MULTIFD_COMPRESSION:
+        p->has_x_multifd_compression = true;
+        visit_type_MultiFDCompression(v, param, &p->x_multifd_compression,
+                                      &err);
+        break;
+    case MIGRATION_PARAMETER_X_RDMA_QPS:
+        p->has_x_rdma_qps = true;
+        visit_type_int(v, param, &p->x_rdma_qps, &err);
+        break;
     default:
         assert(0);
     }
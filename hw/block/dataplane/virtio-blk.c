@@ -26,14 +26,21 @@
 #include "hw/virtio/virtio-bus.h"
 #include "qom/object_interfaces.h"
 
+typedef struct VirtIOBlockDataPlaneVq {
+    VirtIOBlockDataPlane *s;
+    VirtQueue *vq;
+    AioContext *ctx;                /* processes requests from this vq */
+    QEMUBH *bh;                     /* bh for guest notification */
+} VirtIOBlockDataPlaneVq;
+
 struct VirtIOBlockDataPlane {
     bool starting;
     bool stopping;
+    bool drained;
 
     VirtIOBlkConf *conf;
     VirtIODevice *vdev;
-    QEMUBH *bh;                     /* bh for guest notification */
-    unsigned long *batch_notify_vqs;
+    VirtIOBlockDataPlaneVq *vqs;
 
     /* Note that these EventNotifiers are assigned by value.  This is
      * fine as long as you do not call event_notifier_cleanup on them
@@ -41,38 +48,100 @@ struct VirtIOBlockDataPlane {
      * use it).
      */
     IOThread *iothread;
-    AioContext *ctx;
+    AioContext *ctx;                /* AioContext of the BlockBackend */
+
+    /* With iothread-vq-mapping, virtqueues are spread over these IOThreads;
+     * the first one is also the BlockBackend's.
+     */
+    IOThread **iothreads;
+    unsigned num_iothreads;
 };
 
 /* Raise an interrupt to signal guest, if necessary */
 void virtio_blk_data_plane_notify(VirtIOBlockDataPlane *s, VirtQueue *vq)
 {
-    set_bit(virtio_get_queue_index(vq), s->batch_notify_vqs);
-    qemu_bh_schedule(s->bh);
+    qemu_bh_schedule(s->vqs[virtio_get_queue_index(vq)].bh);
 }
 
 static void notify_guest_bh(void *opaque)
 {
-    VirtIOBlockDataPlane *s = opaque;
-    unsigned nvqs = s->conf->num_queues;
-    unsigned long bitmap[BITS_TO_LONGS(nvqs)];
-    unsigned j;
+    VirtIOBlockDataPlaneVq *q = opaque;
 
-    memcpy(bitmap, s->batch_notify_vqs, sizeof(bitmap));
-    memset(s->batch_notify_vqs, 0, sizeof(bitmap));
+    virtio_notify_irqfd(q->s->vdev, q->vq);
+}
+
+/* Does any virtqueue live outside the BlockBackend's AioContext? */
+static bool virtio_blk_data_plane_is_multiqueue(VirtIOBlockDataPlane *s)
+{
+    return s->num_iothreads > 1;
+}
+
+/* Call @fn once for each AioContext, other than the BlockBackend's, that
+ * processes virtqueues.
+ */
+static void virtio_blk_data_plane_foreach_vq_ctx(VirtIOBlockDataPlane *s,
+                                                 void (*fn)(AioContext *ctx))
+{
+    unsigned i, j;
+
+    for (i = 1; i < s->num_iothreads; i++) {
+        AioContext *ctx = iothread_get_aio_context(s->iothreads[i]);
+
+        for (j = 0; j < i; j++) {
+            if (iothread_get_aio_context(s->iothreads[j]) == ctx) {
+                break;
+            }
+        }
+        if (j == i && ctx != s->ctx) {
+            fn(ctx);
+        }
+    }
+}
 
-    for (j = 0; j < nvqs; j += BITS_PER_LONG) {
-        unsigned long bits = bitmap[j];
+/* Parse the colon-separated list of IOThread ids in iothread-vq-mapping */
+static bool virtio_blk_data_plane_parse_mapping(VirtIOBlockDataPlane *s,
+                                                const char *mapping,
+                                                Error **errp)
+{
+    gchar **ids = g_strsplit(mapping, ":", -1);
+    unsigned n = g_strv_length(ids);
+    unsigned i;
 
-        while (bits != 0) {
-            unsigned i = j + ctzl(bits);
-            VirtQueue *vq = virtio_get_queue(s->vdev, i);
+    if (n == 0) {
+        error_setg(errp, "iothread-vq-mapping must list at least one "
+                   "iothread");
+        goto fail;
+    }
+    if (n > s->conf->num_queues) {
+        error_setg(errp, "iothread-vq-mapping lists %u iothreads but the "
+                   "device only has %u virtqueues", n, s->conf->num_queues);
+        goto fail;
+    }
 
-            virtio_notify_irqfd(s->vdev, vq);
+    s->iothreads = g_new0(IOThread *, n);
+    for (i = 0; i < n; i++) {
+        IOThread *iothread = iothread_by_id(ids[i]);
 
-            bits &= bits - 1; /* clear right-most bit */
+        if (!iothread) {
+            error_setg(errp, "iothread \"%s\" not found", ids[i]);
+            goto fail;
         }
+        object_ref(OBJECT(iothread));
+        s->iothreads[s->num_iothreads++] = iothread;
     }
+
+    g_strfreev(ids);
+    return true;
+
+fail:
+    for (i = 0; i < s->num_iothreads; i++) {
+        object_unref(OBJECT(s->iothreads[i]));
+    }
+    g_free(s->iothreads);
+    s->iothreads = NULL;
+    s->num_iothreads = 0;
+    g_strfreev(ids);
+    return false;
 }
 
 /* Context: QEMU global mutex held */
@@ -83,10 +152,11 @@ void virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
     VirtIOBlockDataPlane *s;
     BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(vdev)));
     VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    unsigned i;
 
     *dataplane = NULL;
 
-    if (conf->iothread) {
+    if (conf->iothread || conf->iothread_vq_mapping) {
         if (!k->set_guest_notifiers || !k->ioeventfd_assign) {
             error_setg(errp,
                        "device is incompatible with iothread "
@@ -115,15 +185,38 @@ void virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
     s->vdev = vdev;
     s->conf = conf;
 
-    if (conf->iothread) {
+    if (conf->iothread_vq_mapping) {
+        if (!virtio_blk_data_plane_parse_mapping(s, conf->iothread_vq_mapping,
+                                                 errp)) {
+            g_free(s);
+            return;
+        }
+        s->iothread = s->iothreads[0];
+        object_ref(OBJECT(s->iothread));
+        s->ctx = iothread_get_aio_context(s->iothread);
+    } else if (conf->iothread) {
         s->iothread = conf->iothread;
         object_ref(OBJECT(s->iothread));
         s->ctx = iothread_get_aio_context(s->iothread);
     } else {
         s->ctx = qemu_get_aio_context();
     }
-    s->bh = aio_bh_new(s->ctx, notify_guest_bh, s);
-    s->batch_notify_vqs = bitmap_new(conf->num_queues);
+
+    /* Virtqueue i is processed by IOThread i % num_iothreads */
+    s->vqs = g_new0(VirtIOBlockDataPlaneVq, conf->num_queues);
+    for (i = 0; i < conf->num_queues; i++) {
+        VirtIOBlockDataPlaneVq *q = &s->vqs[i];
+
+        q->s = s;
+        q->vq = virtio_get_queue(vdev, i);
+        if (s->num_iothreads) {
+            q->ctx = iothread_get_aio_context(
+                         s->iothreads[i % s->num_iothreads]);
+        } else {
+            q->ctx = s->ctx;
+        }
+        q->bh = aio_bh_new(q->ctx, notify_guest_bh, q);
+    }
 
     *dataplane = s;
 }
@@ -132,6 +225,7 @@ void virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
 void virtio_blk_data_plane_destroy(VirtIOBlockDataPlane *s)
 {
     VirtIOBlock *vblk;
+    unsigned i;
 
     if (!s) {
         return;
@@ -139,11 +233,17 @@ void virtio_blk_data_plane_destroy(VirtIOBlockDataPlane *s)
 
     vblk = VIRTIO_BLK(s->vdev);
     assert(!vblk->dataplane_started);
-    g_free(s->batch_notify_vqs);
-    qemu_bh_delete(s->bh);
+    for (i = 0; i < s->conf->num_queues; i++) {
+        qemu_bh_delete(s->vqs[i].bh);
+    }
+    g_free(s->vqs);
     if (s->iothread) {
         object_unref(OBJECT(s->iothread));
     }
+    for (i = 0; i < s->num_iothreads; i++) {
+        object_unref(OBJECT(s->iothreads[i]));
+    }
+    g_free(s->iothreads);
     g_free(s);
 }
 
@@ -158,6 +258,54 @@ static bool virtio_blk_data_plane_handle_output(VirtIODevice *vdev,
     return virtio_blk_handle_vq(s, vq);
 }
 
+static void virtio_blk_data_plane_disable_external(AioContext *ctx)
+{
+    aio_disable_external(ctx);
+}
+
+static void virtio_blk_data_plane_enable_external(AioContext *ctx)
+{
+    aio_enable_external(ctx);
+}
+
+/* Wait for virtqueue handlers that may still be running in @ctx */
+static void virtio_blk_data_plane_sync_ctx(AioContext *ctx)
+{
+    aio_context_acquire(ctx);
+    aio_context_release(ctx);
+}
+
+/* bdrv_drained_begin() only quiesces the BlockBackend's AioContext; stop
+ * new requests from virtqueues that are processed elsewhere, too.
+ *
+ * Context: BlockBackend AioContext lock held
+ */
+void virtio_blk_data_plane_drained_begin(VirtIOBlockDataPlane *s)
+{
+    VirtIOBlock *vblk = VIRTIO_BLK(s->vdev);
+
+    if (!vblk->dataplane_started || vblk->dataplane_disabled ||
+        !virtio_blk_data_plane_is_multiqueue(s) || s->drained) {
+        return;
+    }
+
+    s->drained = true;
+    virtio_blk_data_plane_foreach_vq_ctx(s,
+                                         virtio_blk_data_plane_disable_external);
+}
+
+/* Context: BlockBackend AioContext lock held */
+void virtio_blk_data_plane_drained_end(VirtIOBlockDataPlane *s)
+{
+    if (!s->drained) {
+        return;
+    }
+
+    s->drained = false;
+    virtio_blk_data_plane_foreach_vq_ctx(s,
+                                         virtio_blk_data_plane_enable_external);
+}
+
 /* Context: QEMU global mutex held */
 int virtio_blk_data_plane_start(VirtIODevice *vdev)
 {
@@ -201,6 +349,13 @@ int virtio_blk_data_plane_start(VirtIODevice *vdev)
 
     blk_set_aio_context(s->conf->conf.blk, s->ctx);
 
+    /* Requests from virtqueues in other IOThreads run and complete there */
+    if (virtio_blk_data_plane_is_multiqueue(s)) {
+        aio_context_acquire(s->ctx);
+        blk_set_multiqueue(s->conf->conf.blk, true);
+        aio_context_release(s->ctx);
+    }
+
     /* Kick right away to begin processing requests already in vring */
     for (i = 0; i < nvqs; i++) {
         VirtQueue *vq = virtio_get_queue(s->vdev, i);
@@ -209,14 +364,14 @@ int virtio_blk_data_plane_start(VirtIODevice *vdev)
     }
 
     /* Get this show started by hooking up our callbacks */
-    aio_context_acquire(s->ctx);
     for (i = 0; i < nvqs; i++) {
-        VirtQueue *vq = virtio_get_queue(s->vdev, i);
+        VirtIOBlockDataPlaneVq *q = &s->vqs[i];
 
-        virtio_queue_aio_set_host_notifier_handler(vq, s->ctx,
+        aio_context_acquire(q->ctx);
+        virtio_queue_aio_set_host_notifier_handler(q->vq, q->ctx,
                 virtio_blk_data_plane_handle_output);
+        aio_context_release(q->ctx);
     }
-    aio_context_release(s->ctx);
     return 0;
 
   fail_guest_notifiers:
@@ -249,20 +404,29 @@ void virtio_blk_data_plane_stop(VirtIODevice *vdev)
     s->stopping = true;
     trace_virtio_blk_data_plane_stop(s);
 
-    aio_context_acquire(s->ctx);
-
     /* Stop notifications for new requests from guest */
     for (i = 0; i < nvqs; i++) {
-        VirtQueue *vq = virtio_get_queue(s->vdev, i);
+        VirtIOBlockDataPlaneVq *q = &s->vqs[i];
 
-        virtio_queue_aio_set_host_notifier_handler(vq, s->ctx, NULL);
+        aio_context_acquire(q->ctx);
+        virtio_queue_aio_set_host_notifier_handler(q->vq, q->ctx, NULL);
+        aio_context_release(q->ctx);
     }
 
+    aio_context_acquire(s->ctx);
+
     /* Drain and switch bs back to the QEMU main loop */
     blk_set_aio_context(s->conf->conf.blk, qemu_get_aio_context());
+    blk_set_multiqueue(s->conf->conf.blk, false);
 
     aio_context_release(s->ctx);
 
+    /* Completion callbacks in other IOThreads may still be finishing after
+     * the drain saw no requests in flight; wait for them before tearing
+     * down the notifiers.
+     */
+    virtio_blk_data_plane_foreach_vq_ctx(s, virtio_blk_data_plane_sync_ctx);
+
     for (i = 0; i < nvqs; i++) {
         virtio_bus_set_host_notifier(VIRTIO_BUS(qbus), i, false);
     }
@@ -605,6 +605,20 @@ const PropertyInfo qdev_prop_losttickpolicy = {
     .set_default_value = set_default_value_enum,
 };
 
+/* --- Multifd compression method --- */
+
+QEMU_BUILD_BUG_ON(sizeof(MultiFDCompression) != sizeof(int));
+
+const PropertyInfo qdev_prop_multifd_compression = {
+    .name = "MultiFDCompression",
+    .description = "multifd_compression values, "
+                   "none/zlib/zstd",
+    .enum_table = &MultiFDCompression_lookup,
+    .get = get_enum,
+    .set = set_enum,
+    .set_default_value = set_default_value_enum,
+};
+
 /* --- Block device error handling policy --- */
 
 QEMU_BUILD_BUG_ON(sizeof(BlockdevOnError) != sizeof(int));
@@ -57,6 +57,7 @@
 #define BLOCK_OPT_NOCOW             "nocow"
 #define BLOCK_OPT_OBJECT_SIZE       "object_size"
 #define BLOCK_OPT_REFCOUNT_BITS     "refcount_bits"
+#define BLOCK_OPT_COMPRESSION_TYPE  "compression_type"
 
 #define BLOCK_PROBE_BUF_SIZE        512
 
@@ -697,7 +698,8 @@ struct BlockDriverState {
      */
     bool wakeup;
 
-    /* counter for nested bdrv_io_plug.
+    /* counter for nested bdrv_io_plug.  The driver callbacks are invoked
+     * for every nested call and must do their own nesting accounting.
      * Accessed with atomic ops.
     */
     unsigned io_plugged;
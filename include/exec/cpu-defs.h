@@ -25,6 +25,7 @@
 
 #include "qemu/host-utils.h"
 #include "qemu/queue.h"
+#include "qemu/thread.h"
 #ifdef CONFIG_TCG
 #include "tcg-target.h"
 #endif
@@ -66,6 +67,28 @@ typedef uint64_t target_ulong;
 #define CPU_TLB_ENTRY_BITS 5
 #endif
 
+#if TCG_TARGET_IMPLEMENTS_DYN_TLB
+/* The TLB of each MMU mode is allocated separately and resized at flush
+ * time according to how much of it was used since the previous flush;
+ * see tlb_mmu_resize_locked() in accel/tcg/cputlb.c.  The generated code
+ * loads the index mask from env->tlb_mask[] instead of using a constant.
+ */
+#define CPU_TLB_DYN_MIN_BITS 6
+#define CPU_TLB_DYN_DEFAULT_BITS 8
+
+# if HOST_LONG_BITS == 32
+/* Make sure we do not require a double-word shift for the TLB load */
+#  define CPU_TLB_DYN_MAX_BITS (32 - TARGET_PAGE_BITS)
+# else
+/* 2**22 entries is already 128MB of host memory per MMU mode; there is
+ * no point in going past the size of the guest virtual address space.
+ */
+#  define CPU_TLB_DYN_MAX_BITS \
+    MIN(22, TARGET_VIRT_ADDR_SPACE_BITS - TARGET_PAGE_BITS)
+# endif
+
+#else /* !TCG_TARGET_IMPLEMENTS_DYN_TLB */
+
 /* TCG_TARGET_TLB_DISPLACEMENT_BITS is used in CPU_TLB_BITS to ensure that
  * the TLB is not unnecessarily small, but still small enough for the
  * TLB lookup instruction sequence used by the TCG target.
@@ -98,6 +121,8 @@ typedef uint64_t target_ulong;
 
 #define CPU_TLB_SIZE (1 << CPU_TLB_BITS)
 
+#endif /* TCG_TARGET_IMPLEMENTS_DYN_TLB */
+
 typedef struct CPUTLBEntry {
     /* bit TARGET_LONG_BITS to TARGET_PAGE_BITS : virtual address
        bit TARGET_PAGE_BITS-1..4  : Nonzero for accesses that should not
@@ -131,11 +156,40 @@ typedef struct CPUIOTLBEntry {
     MemTxAttrs attrs;
 } CPUIOTLBEntry;
 
+#if TCG_TARGET_IMPLEMENTS_DYN_TLB
+typedef struct CPUTLBDesc {
+    /* Start of the current use-rate window, and the largest number of
+     * entries in use at any flush within it.  Both drive the resizing
+     * of the TLB done by tlb_mmu_resize_locked().
+     */
+    int64_t window_begin_ns;
+    size_t window_max_entries;
+    /* Number of valid entries in the TLB since it was last flushed.  */
+    size_t n_used_entries;
+} CPUTLBDesc;
+
+#define CPU_COMMON_TLB_TABLES                                           \
+    CPUTLBDesc tlb_d[NB_MMU_MODES];                                     \
+    /* (number of entries - 1) << CPU_TLB_ENTRY_BITS, for the fast path */ \
+    uintptr_t tlb_mask[NB_MMU_MODES];                                   \
+    CPUTLBEntry *tlb_table[NB_MMU_MODES];                               \
+    CPUIOTLBEntry *iotlb[NB_MMU_MODES];                                 \
+
+#else
+
+#define CPU_COMMON_TLB_TABLES                                           \
+    CPUTLBEntry tlb_table[NB_MMU_MODES][CPU_TLB_SIZE];                  \
+    CPUIOTLBEntry iotlb[NB_MMU_MODES][CPU_TLB_SIZE];                    \
+
+#endif
+
 #define CPU_COMMON_TLB \
     /* The meaning of the MMU modes is defined in the target code. */   \
-    CPUTLBEntry tlb_table[NB_MMU_MODES][CPU_TLB_SIZE];                  \
+    /* Protects the TLB tables against tlb_reset_dirty() from other   \
+       threads, since the owning vCPU may reallocate them on a flush. */ \
+    QemuSpin tlb_lock;                                                  \
+    CPU_COMMON_TLB_TABLES                                               \
     CPUTLBEntry tlb_v_table[NB_MMU_MODES][CPU_VTLB_SIZE];               \
-    CPUIOTLBEntry iotlb[NB_MMU_MODES][CPU_TLB_SIZE];                    \
     CPUIOTLBEntry iotlb_v[NB_MMU_MODES][CPU_VTLB_SIZE];                 \
     target_ulong tlb_flush_addr;                                        \
     target_ulong tlb_flush_mask;                                        \
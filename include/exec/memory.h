@@ -283,6 +283,8 @@ struct MemoryListener {
     void (*log_stop)(MemoryListener *listener, MemoryRegionSection *section,
                      int old, int new);
     void (*log_sync)(MemoryListener *listener, MemoryRegionSection *section);
+    /* Re-arm dirty tracking for pages of @section reported by log_sync */
+    void (*log_clear)(MemoryListener *listener, MemoryRegionSection *section);
     void (*log_global_start)(MemoryListener *listener);
     void (*log_global_stop)(MemoryListener *listener);
     void (*eventfd_add)(MemoryListener *listener, MemoryRegionSection *section,
@@ -303,6 +305,15 @@ struct MemoryListener {
 /**
  * AddressSpace: describes a mapping of addresses to #MemoryRegion objects
  */
+typedef struct AddressSpaceMapClient {
+    QEMUBH *bh;
+    QLIST_ENTRY(AddressSpaceMapClient) link;
+} AddressSpaceMapClient;
+
+typedef struct BounceBuffer BounceBuffer;
+
+#define DEFAULT_MAX_BOUNCE_BUFFER_SIZE (64 * 1024)
+
 struct AddressSpace {
     /* All fields are private. */
     struct rcu_head rcu;
@@ -316,6 +327,18 @@ struct AddressSpace {
     struct MemoryRegionIoeventfd *ioeventfds;
     QTAILQ_HEAD(memory_listeners_as, MemoryListener) listeners;
     QTAILQ_ENTRY(AddressSpace) address_spaces_link;
+
+    /* Maximum total size of the bounce buffers used by address_space_map() */
+    size_t max_bounce_buffer_size;
+    /* Total size of the bounce buffers currently mapped; atomic */
+    size_t bounce_buffer_size;
+    /* Protects bounce_buffers, map_client_list and bounce_buffer_size
+     * updates
+     */
+    QemuMutex map_client_list_lock;
+    QLIST_HEAD(, BounceBuffer) bounce_buffers;
+    /* Bottom halves to run when bounce buffer space frees up */
+    QLIST_HEAD(, AddressSpaceMapClient) map_client_list;
 };
 
 FlatView *address_space_to_flatview(AddressSpace *as);
@@ -1138,6 +1161,23 @@ bool memory_region_snapshot_get_dirty(MemoryRegion *mr,
  */
 void memory_region_sync_dirty_bitmap(MemoryRegion *mr);
 
+/**
+ * memory_region_clear_dirty_bitmap: Re-arm dirty tracking in accelerators
+ *                                   for a range of a region
+ *
+ * Accelerators such as kvm may leave pages that a previous
+ * memory_region_sync_dirty_bitmap() reported dirty unprotected until the
+ * users of the dirty information have consumed them; this call lets them
+ * start tracking writes to such pages in the subrange again.  It must be
+ * called before the contents of the pages are read.
+ *
+ * @mr: the region being cleared.
+ * @start: the start of the subrange, relative to the region.
+ * @len: the size of the subrange.
+ */
+void memory_region_clear_dirty_bitmap(MemoryRegion *mr, hwaddr start,
+                                      hwaddr len);
+
 /**
  * memory_region_reset_dirty: Mark a range of pages as clean, for a specified
  *                            client.
@@ -1860,8 +1900,12 @@ bool address_space_access_valid(AddressSpace *as, hwaddr addr, int len, bool is_
  * May map a subset of the requested range, given by and returned in @plen.
  * May return %NULL if resources needed to perform the mapping are exhausted.
  * Use only for reads OR writes - not for read-modify-write operations.
- * Use cpu_register_map_client() to know when retrying the map operation is
- * likely to succeed.
+ * Use address_space_register_map_client() to know when retrying the map
+ * operation is likely to succeed.
+ *
+ * Regions that cannot be accessed directly go through a bounce buffer;
+ * each #AddressSpace can have up to its max_bounce_buffer_size bytes of
+ * those in flight at the same time.
  *
  * @as: #AddressSpace to be accessed
  * @addr: address within that address space
@@ -1885,6 +1929,27 @@ void *address_space_map(AddressSpace *as, hwaddr addr,
 void address_space_unmap(AddressSpace *as, void *buffer, hwaddr len,
                          int is_write, hwaddr access_len);
 
+/* address_space_register_map_client: Register a callback to invoke when
+ * resources for address_space_map() are available again.
+ *
+ * address_space_map may fail when there are not enough resources available,
+ * such as when bounce buffer memory would exceed the limit. The callback can
+ * be used to retry the address_space_map operation. Note that the callback
+ * gets automatically removed after firing.
+ *
+ * @as: #AddressSpace to be accessed
+ * @bh: callback to invoke when address_space_map() retry is appropriate
+ */
+void address_space_register_map_client(AddressSpace *as, QEMUBH *bh);
+
+/* address_space_unregister_map_client: Unregister a callback that has
+ * previously been registered and not fired yet.
+ *
+ * @as: #AddressSpace to be accessed
+ * @bh: callback to unregister
+ */
+void address_space_unregister_map_client(AddressSpace *as, QEMUBH *bh);
+
 
 /* Internal functions, part of the implementation of address_space_read.  */
 MemTxResult flatview_read_continue(FlatView *fv, hwaddr addr,
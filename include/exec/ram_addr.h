@@ -22,6 +22,7 @@
 #ifndef CONFIG_USER_ONLY
 #include "hw/xen/xen.h"
 #include "exec/ramlist.h"
+#include "exec/memory.h"
 
 struct RAMBlock {
     struct rcu_head rcu;
@@ -47,6 +48,17 @@ struct RAMBlock {
      * of the postcopy phase
      */
     unsigned long *unsentmap;
+    /* Chunks of 1 << clear_bmap_shift pages of bmap whose dirty tracking
+     * still has to be re-armed in the accelerator before they are sent
+     */
+    unsigned long *clear_bmap;
+    uint8_t clear_bmap_shift;
+    /* With mapped-ram, pages present in the file, and where in the file
+     * that bitmap and the pages of this block are stored
+     */
+    unsigned long *file_bmap;
+    off_t bitmap_offset;
+    off_t pages_offset;
 };
 
 static inline bool offset_in_ramblock(RAMBlock *b, ram_addr_t offset)
@@ -54,6 +66,30 @@ static inline bool offset_in_ramblock(RAMBlock *b, ram_addr_t offset)
     return (b && b->host && offset < b->used_length) ? true : false;
 }
 
+/* Number of bits of a clear_bmap covering @pages pages */
+static inline long clear_bmap_size(uint64_t pages, uint8_t shift)
+{
+    return DIV_ROUND_UP(pages, 1UL << shift);
+}
+
+/* Mark the chunks covering [@start, @start + @npages) as to be re-armed */
+static inline void clear_bmap_set(RAMBlock *rb, uint64_t start,
+                                  uint64_t npages)
+{
+    uint8_t shift = rb->clear_bmap_shift;
+
+    bitmap_set_atomic(rb->clear_bmap, start >> shift,
+                      clear_bmap_size(npages, shift));
+}
+
+/* Test and clear the clear_bmap bit of the chunk that @page belongs to */
+static inline bool clear_bmap_test_and_clear(RAMBlock *rb, uint64_t page)
+{
+    uint8_t shift = rb->clear_bmap_shift;
+
+    return bitmap_test_and_clear_atomic(rb->clear_bmap, page >> shift, 1);
+}
+
 static inline void *ramblock_ptr(RAMBlock *block, ram_addr_t offset)
 {
     assert(offset_in_ramblock(block, offset));
@@ -432,6 +468,16 @@ uint64_t cpu_physical_memory_sync_dirty_bitmap(RAMBlock *rb,
         }
     }
 
+    if (rb->clear_bmap) {
+        /* Postpone re-arming dirty tracking until the pages are sent,
+         * one chunk at a time, see migration_bitmap_clear_dirty()
+         */
+        clear_bmap_set(rb, start >> TARGET_PAGE_BITS,
+                       length >> TARGET_PAGE_BITS);
+    } else {
+        memory_region_clear_dirty_bitmap(rb->mr, start, length);
+    }
+
     return num_dirty;
 }
 #endif
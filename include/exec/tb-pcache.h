@@ -0,0 +1,56 @@
+/*
+ * Persistent translation block cache for user mode emulation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EXEC_TB_PCACHE_H
+#define EXEC_TB_PCACHE_H
+
+#ifdef CONFIG_USER_ONLY
+
+extern bool tb_pcache_enabled;
+
+/**
+ * tb_pcache_init:
+ * @dir: directory holding the cache files
+ * @fd: file descriptor of the guest executable
+ * @cpu_model: the guest CPU model
+ *
+ * Enable the persistent TB cache.  The cache file is named after a hash
+ * of the contents of @fd, and is mapped the first time a TB is generated.
+ * Must be called before the guest executable is loaded, which closes @fd.
+ */
+void tb_pcache_init(const char *dir, int fd, const char *cpu_model);
+
+/**
+ * tb_pcache_save:
+ *
+ * Write the TBs translated by this process back to the cache file.
+ * Called when the process exits or executes another program.
+ */
+void tb_pcache_save(void);
+
+/* Called by tb_gen_code() with tb_lock held.  tb_pcache_load() fills in
+ * @tb from the cache and returns true, or prepares the TCGContext to
+ * record the TB that is about to be generated and returns false.
+ */
+bool tb_pcache_load(TranslationBlock *tb, int *gen_code_size,
+                    int *search_size);
+void tb_pcache_store(TranslationBlock *tb, int gen_code_size,
+                     int search_size);
+
+#endif /* CONFIG_USER_ONLY */
+
+#endif /* EXEC_TB_PCACHE_H */
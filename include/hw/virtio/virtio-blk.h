@@ -34,6 +34,7 @@ struct VirtIOBlkConf
 {
     BlockConf conf;
     IOThread *iothread;
+    char *iothread_vq_mapping;
     char *serial;
     uint32_t scsi;
     uint32_t config_wce;
@@ -39,12 +39,15 @@ typedef struct QIOChannelClass QIOChannelClass;
 
 #define QIO_CHANNEL_ERR_BLOCK -2
 
+#define QIO_CHANNEL_WRITE_FLAG_ZERO_COPY 0x1
+
 typedef enum QIOChannelFeature QIOChannelFeature;
 
 enum QIOChannelFeature {
     QIO_CHANNEL_FEATURE_FD_PASS,
     QIO_CHANNEL_FEATURE_SHUTDOWN,
     QIO_CHANNEL_FEATURE_LISTEN,
+    QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY,
 };
 
 
@@ -110,6 +113,7 @@ struct QIOChannelClass {
                          size_t niov,
                          int *fds,
                          size_t nfds,
+                         int flags,
                          Error **errp);
     ssize_t (*io_readv)(QIOChannel *ioc,
                         const struct iovec *iov,
@@ -142,6 +146,18 @@ struct QIOChannelClass {
                                   IOHandler *io_read,
                                   IOHandler *io_write,
                                   void *opaque);
+    int (*io_flush)(QIOChannel *ioc,
+                    Error **errp);
+    ssize_t (*io_pwrite)(QIOChannel *ioc,
+                         const char *buf,
+                         size_t buflen,
+                         off_t offset,
+                         Error **errp);
+    ssize_t (*io_pread)(QIOChannel *ioc,
+                        char *buf,
+                        size_t buflen,
+                        off_t offset,
+                        Error **errp);
 };
 
 /* General I/O handling functions */
@@ -234,6 +250,7 @@ ssize_t qio_channel_readv_full(QIOChannel *ioc,
  * @niov: the length of the @iov array
  * @fds: an array of file handles to send
  * @nfds: number of file handles in @fds
+ * @flags: write flags (QIO_CHANNEL_WRITE_FLAG_*)
  * @errp: pointer to a NULL-initialized error object
  *
  * Write data to the IO channel, reading it from the
@@ -242,6 +259,14 @@ ssize_t qio_channel_readv_full(QIOChannel *ioc,
  * one is used. The @niov parameter specifies the
  * total number of elements in @iov.
  *
+ * If @flags contains QIO_CHANNEL_WRITE_FLAG_ZERO_COPY, the data
+ * may still be read from @iov after the call returns, so the
+ * memory must not be freed or reused until qio_channel_flush()
+ * has returned; if it is modified in the meantime, either the old
+ * or the new contents may be sent.  It is an error to pass this
+ * flag unless qio_channel_has_feature() returns a true value for
+ * the QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY constant.
+ *
  * It is not required for all @iov data to be fully
  * sent. If the channel is in blocking mode, at least
  * one byte of data will be sent, but no more is
@@ -266,6 +291,7 @@ ssize_t qio_channel_writev_full(QIOChannel *ioc,
                                 size_t niov,
                                 int *fds,
                                 size_t nfds,
+                                int flags,
                                 Error **errp);
 
 /**
@@ -350,6 +376,42 @@ int qio_channel_writev_all(QIOChannel *ioc,
                            size_t niov,
                            Error **erp);
 
+/**
+ * qio_channel_writev_full_all:
+ * @ioc: the channel object
+ * @iov: the array of memory regions to write data from
+ * @niov: the length of the @iov array
+ * @flags: write flags (QIO_CHANNEL_WRITE_FLAG_*)
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Behaves as qio_channel_writev_all(), passing @flags to
+ * qio_channel_writev_full(); see there for the constraints of
+ * QIO_CHANNEL_WRITE_FLAG_ZERO_COPY.
+ *
+ * Returns: 0 if all bytes were written, or -1 on error
+ */
+int qio_channel_writev_full_all(QIOChannel *ioc,
+                                const struct iovec *iov,
+                                size_t niov,
+                                int flags,
+                                Error **errp);
+
+/**
+ * qio_channel_flush:
+ * @ioc: the channel object
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Wait until all the data written so far with
+ * QIO_CHANNEL_WRITE_FLAG_ZERO_COPY has been sent, so that the
+ * memory it came from can be reused.  Does nothing on channels
+ * that do not support zero copy writes.
+ *
+ * Returns: 1 if some of the data was copied by the kernel anyway,
+ *          0 if it was all sent without copying, or -1 on error
+ */
+int qio_channel_flush(QIOChannel *ioc,
+                      Error **errp);
+
 /**
  * qio_channel_readv:
  * @ioc: the channel object
@@ -602,6 +664,55 @@ off_t qio_channel_io_seek(QIOChannel *ioc,
                           int whence,
                           Error **errp);
 
+/**
+ * qio_channel_pwrite:
+ * @ioc: the channel object
+ * @buf: the memory region to write data from
+ * @buflen: the number of bytes in @buf
+ * @offset: the position in the channel to write at
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Write up to @buflen bytes from @buf at position @offset of
+ * the channel, without moving its current I/O position.  This
+ * may be called from several threads at once on the same
+ * channel.
+ *
+ * Not all implementations will support this facility,
+ * so may report an error.
+ *
+ * Returns: the number of bytes written, or -1 on error
+ */
+ssize_t qio_channel_pwrite(QIOChannel *ioc,
+                           const char *buf,
+                           size_t buflen,
+                           off_t offset,
+                           Error **errp);
+
+/**
+ * qio_channel_pread:
+ * @ioc: the channel object
+ * @buf: the memory region to read data into
+ * @buflen: the number of bytes to read
+ * @offset: the position in the channel to read from
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Read up to @buflen bytes into @buf from position @offset
+ * of the channel, without moving its current I/O position.
+ * This may be called from several threads at once on the
+ * same channel.
+ *
+ * Not all implementations will support this facility,
+ * so may report an error.
+ *
+ * Returns: the number of bytes read, 0 at end of file, or -1
+ * on error
+ */
+ssize_t qio_channel_pread(QIOChannel *ioc,
+                          char *buf,
+                          size_t buflen,
+                          off_t offset,
+                          Error **errp);
+
 
 /**
  * qio_channel_create_watch:
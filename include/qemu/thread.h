@@ -59,6 +59,8 @@ void qemu_thread_create(QemuThread *thread, const char *name,
 void *qemu_thread_join(QemuThread *thread);
 void qemu_thread_get_self(QemuThread *thread);
 bool qemu_thread_is_self(QemuThread *thread);
+/* CPU time consumed by @thread so far in ns, or -1 if unavailable */
+int64_t qemu_thread_get_cpu_time_ns(QemuThread *thread);
 void qemu_thread_exit(void *retval);
 void qemu_thread_naming(bool enable);
 
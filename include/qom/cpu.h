@@ -400,6 +400,18 @@ struct CPUState {
      * autoconverge
      */
     bool throttle_thread_scheduled;
+    /* Per-vcpu throttle percentage, on top of the global one */
+    int throttle_percentage;
+
+    /* Pages this vcpu dirtied since the last dirty rate sample, for
+     * accelerators that can tell which vcpu wrote a page (TCG).
+     */
+    unsigned long dirty_pages;
+    /* Last dirty rate estimate in pages per second, and the vcpu thread
+     * CPU time at that point, see migration_vcpu_dirty_rate_update()
+     */
+    uint64_t dirty_rate;
+    int64_t dirty_cpu_time_ns;
 
     bool ignore_memory_transaction_failures;
 
@@ -835,6 +847,27 @@ bool cpu_throttle_active(void);
  */
 int cpu_throttle_get_percentage(void);
 
+/**
+ * cpu_throttle_set_vcpu:
+ * @cpu: The vCPU to throttle.
+ * @new_throttle_pct: Percent of sleep time. Valid range is 1 to 99, or 0
+ * to stop throttling this vCPU.
+ *
+ * Like cpu_throttle_set, but only for @cpu.  The vCPU sleeps for the
+ * larger of its own and the global throttle percentage.  cpu_throttle_stop
+ * also stops per-vCPU throttling.
+ */
+void cpu_throttle_set_vcpu(CPUState *cpu, int new_throttle_pct);
+
+/**
+ * cpu_throttle_get_vcpu_percentage:
+ * @cpu: The vCPU to query.
+ *
+ * Returns: The throttle percentage in effect for @cpu, 0 if it is not
+ * throttled.
+ */
+int cpu_throttle_get_vcpu_percentage(CPUState *cpu);
+
 #ifndef CONFIG_USER_ONLY
 
 typedef void (*CPUInterruptHandler)(CPUState *, int);
@@ -55,4 +55,6 @@ IOThread *iothread_create(const char *id, Error **errp);
 void iothread_stop(IOThread *iothread);
 void iothread_destroy(IOThread *iothread);
 
+IOThread *iothread_by_id(const char *id);
+
 #endif /* IOTHREAD_H */
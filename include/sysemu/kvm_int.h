@@ -20,6 +20,10 @@ typedef struct KVMSlot
     void *ram;
     int slot;
     int flags;
+    /* Dirty bitmap from the last KVM_GET_DIRTY_LOG, one bit per host page;
+     * with manual dirty log protection, the pages not yet re-protected
+     */
+    unsigned long *dirty_bmap;
 } KVMSlot;
 
 typedef struct KVMMemoryListener {
@@ -34,6 +34,7 @@
 #include "qemu/envlist.h"
 #include "elf.h"
 #include "exec/log.h"
+#include "exec/tb-pcache.h"
 #include "trace/control.h"
 #include "glib-compat.h"
 
@@ -114,7 +115,7 @@ int cpu_get_pic_interrupt(CPUX86State *env)
 void fork_start(void)
 {
     cpu_list_lock();
-    qemu_mutex_lock(&tcg_ctx.tb_ctx.tb_lock);
+    qemu_mutex_lock(&tb_ctx.tb_lock);
     mmap_fork_start();
 }
 
@@ -130,11 +131,11 @@ void fork_end(int child)
                 QTAILQ_REMOVE(&cpus, cpu, node);
             }
         }
-        qemu_mutex_init(&tcg_ctx.tb_ctx.tb_lock);
+        qemu_mutex_init(&tb_ctx.tb_lock);
         qemu_init_cpu_list();
         gdbserver_fork(thread_cpu);
     } else {
-        qemu_mutex_unlock(&tcg_ctx.tb_ctx.tb_lock);
+        qemu_mutex_unlock(&tb_ctx.tb_lock);
         cpu_list_unlock();
     }
 }
@@ -4010,6 +4011,23 @@ static void handle_arg_version(const char *arg)
     exit(EXIT_SUCCESS);
 }
 
+static const char *tb_cache_dir;
+static void handle_arg_tb_cache(const char *arg)
+{
+    tb_cache_dir = arg;
+}
+
+static void handle_arg_tb_traces(const char *arg)
+{
+    unsigned long long count;
+
+    if (parse_uint_full(arg, &count, 0) != 0 || count > UINT_MAX) {
+        fprintf(stderr, "Invalid trace threshold: %s\n", arg);
+        exit(EXIT_FAILURE);
+    }
+    tb_trace_threshold = count;
+}
+
 static char *trace_file;
 static void handle_arg_trace(const char *arg)
 {
@@ -4066,6 +4084,10 @@ static const struct qemu_argument arg_table[] = {
      "",           "Seed for pseudo-random number generator"},
     {"trace",      "QEMU_TRACE",       true,  handle_arg_trace,
      "",           "[[enable=]<pattern>][,events=<file>][,file=<file>]"},
+    {"tb-cache",   "QEMU_TB_CACHE",    true,  handle_arg_tb_cache,
+     "dir",        "keep translated code across runs in directory 'dir'"},
+    {"tb-traces",  "QEMU_TB_TRACES",   true,  handle_arg_tb_traces,
+     "count",      "retranslate blocks run 'count' times as traces"},
     {"version",    "QEMU_VERSION",     false, handle_arg_version,
      "",           "display version information and exit"},
     {NULL, NULL, false, NULL, NULL, NULL}
@@ -4419,6 +4441,10 @@ int main(int argc, char **argv, char **envp)
         }
     }
 
+    if (tb_cache_dir) {
+        tb_pcache_init(tb_cache_dir, execfd, cpu_model);
+    }
+
     ret = loader_exec(execfd, filename, target_argv, target_environ, regs,
         info, &bprm);
     if (ret != 0) {
@@ -4457,7 +4483,8 @@ int main(int argc, char **argv, char **envp)
     /* Now that we've loaded the binary, GUEST_BASE is fixed.  Delay
        generating the prologue until now so that the prologue can take
        the real value of GUEST_BASE into account.  */
-    tcg_prologue_init(&tcg_ctx);
+    tcg_prologue_init(tcg_ctx);
+    tcg_region_init();
 
 #if defined(TARGET_I386)
     env->cr[0] = CR0_PG_MASK | CR0_WP_MASK | CR0_PE_MASK;
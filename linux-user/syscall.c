@@ -115,6 +115,8 @@ int __clone2(int (*fn)(void *), void *child_stack_base,
 #include "uname.h"
 
 #include "qemu.h"
+#include "tcg.h"
+#include "exec/tb-pcache.h"
 
 #ifndef CLONE_IO
 #define CLONE_IO                0x80000000      /* Clone io context */
@@ -6215,6 +6217,7 @@ static void *clone_func(void *arg)
     TaskState *ts;
 
     rcu_register_thread();
+    tcg_register_thread();
     env = info->env;
     cpu = ENV_GET_CPU(env);
     thread_cpu = cpu;
@@ -7765,6 +7768,7 @@ abi_long do_syscall(void *cpu_env, int num, abi_long arg1,
         _mcleanup();
 #endif
         gdb_exit(cpu_env, arg1);
+        tb_pcache_save();
         _exit(arg1);
         ret = 0; /* avoid warning */
         break;
@@ -7993,6 +7997,7 @@ abi_long do_syscall(void *cpu_env, int num, abi_long arg1,
              * before the execve completes and makes it the other
              * program's problem.
              */
+            tb_pcache_save();
             ret = get_errno(safe_execve(p, argp, envp));
             unlock_user(p, arg1, 0);
 
@@ -9821,6 +9826,7 @@ abi_long do_syscall(void *cpu_env, int num, abi_long arg1,
         _mcleanup();
 #endif
         gdb_exit(cpu_env, arg1);
+        tb_pcache_save();
         ret = get_errno(exit_group(arg1));
         break;
 #endif
@@ -0,0 +1,67 @@
+/*
+ * QEMU live migration to/from a file
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "channel.h"
+#include "file.h"
+#include "migration.h"
+#include "io/channel-file.h"
+#include "trace.h"
+
+
+void file_start_outgoing_migration(MigrationState *s, const char *path,
+                                   Error **errp)
+{
+    QIOChannelFile *ioc;
+
+    trace_migration_file_outgoing(path);
+    ioc = qio_channel_file_new_path(path, O_WRONLY | O_CREAT | O_TRUNC,
+                                    0600, errp);
+    if (!ioc) {
+        return;
+    }
+
+    /* The mapped-ram writers open their own channels on the same file */
+    g_free(s->file_path);
+    s->file_path = g_strdup(path);
+
+    qio_channel_set_name(QIO_CHANNEL(ioc), "migration-file-outgoing");
+    migration_channel_connect(s, QIO_CHANNEL(ioc), NULL);
+    object_unref(OBJECT(ioc));
+}
+
+static gboolean file_accept_incoming_migration(QIOChannel *ioc,
+                                               GIOCondition condition,
+                                               gpointer opaque)
+{
+    migration_channel_process_incoming(ioc);
+    object_unref(OBJECT(ioc));
+    return G_SOURCE_REMOVE;
+}
+
+void file_start_incoming_migration(const char *path, Error **errp)
+{
+    MigrationIncomingState *mis = migration_incoming_get_current();
+    QIOChannelFile *ioc;
+
+    trace_migration_file_incoming(path);
+    ioc = qio_channel_file_new_path(path, O_RDONLY, 0, errp);
+    if (!ioc) {
+        return;
+    }
+
+    g_free(mis->file_path);
+    mis->file_path = g_strdup(path);
+
+    qio_channel_set_name(QIO_CHANNEL(ioc), "migration-file-incoming");
+    qio_channel_add_watch(QIO_CHANNEL(ioc),
+                          G_IO_IN,
+                          file_accept_incoming_migration,
+                          NULL,
+                          NULL);
+}
@@ -0,0 +1,14 @@
+/*
+ * QEMU live migration to/from a file
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_MIGRATION_FILE_H
+#define QEMU_MIGRATION_FILE_H
+void file_start_incoming_migration(const char *path, Error **errp);
+
+void file_start_outgoing_migration(MigrationState *s, const char *path,
+                                   Error **errp);
+#endif
@@ -14,11 +14,13 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu-common.h"
 #include "qemu/cutils.h"
 #include "qemu/error-report.h"
 #include "migration/blocker.h"
 #include "exec.h"
 #include "fd.h"
+#include "file.h"
 #include "socket.h"
 #include "rdma.h"
 #include "ram.h"
@@ -30,6 +32,7 @@
 #include "qemu-file.h"
 #include "migration/vmstate.h"
 #include "block/block.h"
+#include "sysemu/cpus.h"
 #include "qapi/qmp/qerror.h"
 #include "qemu/rcu.h"
 #include "block.h"
@@ -79,6 +82,7 @@
 #define DEFAULT_MIGRATE_X_CHECKPOINT_DELAY 200
 #define DEFAULT_MIGRATE_MULTIFD_CHANNELS 2
 #define DEFAULT_MIGRATE_MULTIFD_PAGE_COUNT 16
+#define DEFAULT_MIGRATE_RDMA_QPS 1
 
 static NotifierList migration_state_notifiers =
     NOTIFIER_LIST_INITIALIZER(migration_state_notifiers);
@@ -146,6 +150,8 @@ MigrationIncomingState *migration_incoming_get_current(void)
         mis_current.state = MIGRATION_STATUS_NONE;
         memset(&mis_current, 0, sizeof(MigrationIncomingState));
         qemu_mutex_init(&mis_current.rp_mutex);
+        qemu_mutex_init(&mis_current.postcopy_faults.mutex);
+        qemu_mutex_init(&mis_current.postcopy_faults.req_mutex);
         qemu_event_init(&mis_current.main_thread_load_event, false);
         once = true;
     }
@@ -168,6 +174,9 @@ void migration_incoming_state_destroy(void)
         mis->from_src_file = NULL;
     }
 
+    g_free(mis->file_path);
+    mis->file_path = NULL;
+
     qemu_event_reset(&mis->main_thread_load_event);
 }
 
@@ -241,6 +250,12 @@ void qemu_start_incoming_migration(const char *uri, Error **errp)
 {
     const char *p;
 
+    if (migrate_mapped_ram() && strcmp(uri, "defer") &&
+        !strstart(uri, "file:", NULL)) {
+        error_setg(errp, "mapped-ram needs a file: migration URI");
+        return;
+    }
+
     qapi_event_send_migration(MIGRATION_STATUS_SETUP, &error_abort);
     if (!strcmp(uri, "defer")) {
         deferred_incoming_migration(errp);
@@ -256,6 +271,8 @@ void qemu_start_incoming_migration(const char *uri, Error **errp)
         unix_start_incoming_migration(p, errp);
     } else if (strstart(uri, "fd:", &p)) {
         fd_start_incoming_migration(p, errp);
+    } else if (strstart(uri, "file:", &p)) {
+        file_start_incoming_migration(p, errp);
     } else {
         error_setg(errp, "unknown migration protocol: %s", uri);
     }
@@ -405,10 +422,17 @@ void migration_ioc_process_incoming(QIOChannel *ioc)
     MigrationIncomingState *mis = migration_incoming_get_current();
 
     if (!mis->from_src_file) {
+        /* The main channel is always the first one to connect */
         QEMUFile *f = qemu_fopen_channel_input(ioc);
-        migration_fd_process_incoming(f);
+        migration_incoming_setup(f);
+    } else {
+        /* Multiple connections only happen with multifd */
+        multifd_recv_new_channel(ioc);
+    }
+
+    if (migration_has_all_channels()) {
+        migration_incoming_process();
     }
-    /* We still only have a single channel.  Nothing to do here yet */
 }
 
 /**
@@ -419,7 +443,9 @@ void migration_ioc_process_incoming(QIOChannel *ioc)
  */
 bool migration_has_all_channels(void)
 {
-    return true;
+    MigrationIncomingState *mis = migration_incoming_get_current();
+
+    return mis->from_src_file && multifd_recv_all_channels_created();
 }
 
 /*
@@ -512,6 +538,10 @@ MigrationParameters *qmp_query_migrate_parameters(Error **errp)
     params->x_multifd_channels = s->parameters.x_multifd_channels;
     params->has_x_multifd_page_count = true;
     params->x_multifd_page_count = s->parameters.x_multifd_page_count;
+    params->has_x_multifd_compression = true;
+    params->x_multifd_compression = s->parameters.x_multifd_compression;
+    params->has_x_rdma_qps = true;
+    params->x_rdma_qps = s->parameters.x_rdma_qps;
 
     return params;
 }
@@ -559,6 +589,9 @@ static void populate_ram_info(MigrationInfo *info, MigrationState *s)
         info->xbzrle_cache->pages = xbzrle_counters.pages;
         info->xbzrle_cache->cache_miss = xbzrle_counters.cache_miss;
         info->xbzrle_cache->cache_miss_rate = xbzrle_counters.cache_miss_rate;
+        info->xbzrle_cache->cache_hit = xbzrle_counters.cache_hit;
+        info->xbzrle_cache->cache_hit_rate = xbzrle_counters.cache_hit_rate;
+        info->xbzrle_cache->cache_conflict = xbzrle_counters.cache_conflict;
         info->xbzrle_cache->overflow = xbzrle_counters.overflow;
     }
 
@@ -568,9 +601,35 @@ static void populate_ram_info(MigrationInfo *info, MigrationState *s)
     }
 
     if (s->state != MIGRATION_STATUS_COMPLETED) {
+        VcpuDirtyRateList *rates = NULL;
+        CPUState *cpu;
+
         info->ram->remaining = ram_bytes_remaining();
         info->ram->dirty_pages_rate = ram_counters.dirty_pages_rate;
+
+        CPU_FOREACH_REVERSE(cpu) {
+            VcpuDirtyRateList *entry = g_malloc0(sizeof(*entry));
+
+            entry->value = g_malloc0(sizeof(*entry->value));
+            entry->value->cpu_index = cpu->cpu_index;
+            if (tcg_enabled()) {
+                entry->value->has_dirty_rate = true;
+                entry->value->dirty_rate = cpu->dirty_rate;
+            } else {
+                entry->value->has_dirty_rate_estimate = true;
+                entry->value->dirty_rate_estimate = cpu->dirty_rate;
+            }
+            entry->value->throttle_percentage =
+                cpu_throttle_get_vcpu_percentage(cpu);
+            entry->next = rates;
+            rates = entry;
+        }
+        info->has_vcpu_dirty_rate = rates != NULL;
+        info->vcpu_dirty_rate = rates;
     }
+
+    info->rdma = rdma_migration_stats();
+    info->has_rdma = info->rdma != NULL;
 }
 
 static void populate_disk_info(MigrationInfo *info)
@@ -641,6 +700,10 @@ MigrationInfo *qmp_query_migrate(Error **errp)
     }
     info->status = s->state;
 
+    info->postcopy_faults =
+        postcopy_fault_stats(migration_incoming_get_current());
+    info->has_postcopy_faults = info->postcopy_faults != NULL;
+
     return info;
 }
 
@@ -659,9 +722,11 @@ static bool migrate_caps_check(bool *cap_list,
 {
     MigrationCapabilityStatusList *cap;
     bool old_postcopy_cap;
+    bool old_bg_snapshot_cap;
     MigrationIncomingState *mis = migration_incoming_get_current();
 
     old_postcopy_cap = cap_list[MIGRATION_CAPABILITY_POSTCOPY_RAM];
+    old_bg_snapshot_cap = cap_list[MIGRATION_CAPABILITY_BACKGROUND_SNAPSHOT];
 
     for (cap = params; cap; cap = cap->next) {
         cap_list[cap->value->capability] = cap->value->state;
@@ -676,6 +741,82 @@ static bool migrate_caps_check(bool *cap_list,
     }
 #endif
 
+    if (cap_list[MIGRATION_CAPABILITY_X_MULTIFD] &&
+        cap_list[MIGRATION_CAPABILITY_COMPRESS]) {
+        /* Multifd channels compress on their own, see x-multifd-compression */
+        error_setg(errp, "Multifd is not compatible with compression");
+        return false;
+    }
+
+    if (cap_list[MIGRATION_CAPABILITY_ZERO_COPY_SEND]) {
+#ifndef CONFIG_LINUX
+        error_setg(errp, "Zero copy send is only supported on Linux");
+        return false;
+#endif
+        if (!cap_list[MIGRATION_CAPABILITY_X_MULTIFD]) {
+            error_setg(errp, "Zero copy send is only supported with multifd");
+            return false;
+        }
+    }
+
+    if (cap_list[MIGRATION_CAPABILITY_MAPPED_RAM]) {
+#ifdef _WIN32
+        error_setg(errp, "mapped-ram is not supported on Windows");
+        return false;
+#endif
+        /* Pages are written in place in the file, not into the stream */
+        if (cap_list[MIGRATION_CAPABILITY_XBZRLE] ||
+            cap_list[MIGRATION_CAPABILITY_COMPRESS] ||
+            cap_list[MIGRATION_CAPABILITY_X_MULTIFD] ||
+            cap_list[MIGRATION_CAPABILITY_POSTCOPY_RAM] ||
+            cap_list[MIGRATION_CAPABILITY_RDMA_PIN_ALL]) {
+            error_setg(errp, "mapped-ram is not compatible with xbzrle, "
+                       "compress, x-multifd, postcopy-ram or rdma-pin-all");
+            return false;
+        }
+    }
+
+    if (cap_list[MIGRATION_CAPABILITY_BACKGROUND_SNAPSHOT]) {
+        /* Every page is sent exactly once, from a stopped-in-time image */
+        if (cap_list[MIGRATION_CAPABILITY_POSTCOPY_RAM] ||
+            cap_list[MIGRATION_CAPABILITY_X_COLO] ||
+            cap_list[MIGRATION_CAPABILITY_XBZRLE] ||
+            cap_list[MIGRATION_CAPABILITY_COMPRESS] ||
+            cap_list[MIGRATION_CAPABILITY_X_MULTIFD] ||
+            cap_list[MIGRATION_CAPABILITY_RELEASE_RAM] ||
+            cap_list[MIGRATION_CAPABILITY_BLOCK] ||
+            cap_list[MIGRATION_CAPABILITY_AUTO_CONVERGE] ||
+            cap_list[MIGRATION_CAPABILITY_MAPPED_RAM] ||
+            cap_list[MIGRATION_CAPABILITY_RDMA_PIN_ALL]) {
+            error_setg(errp, "Background snapshot is not compatible with "
+                       "postcopy-ram, x-colo, xbzrle, compress, x-multifd, "
+                       "release-ram, block, auto-converge, mapped-ram or "
+                       "rdma-pin-all");
+            return false;
+        }
+
+        if (!old_bg_snapshot_cap && !ram_write_tracking_available()) {
+            error_setg(errp, "Background snapshot is not supported by the "
+                       "host kernel (no userfaultfd write protection)");
+            return false;
+        }
+    }
+
+    if (cap_list[MIGRATION_CAPABILITY_VCPU_THROTTLE] &&
+        !cap_list[MIGRATION_CAPABILITY_AUTO_CONVERGE]) {
+        error_setg(errp, "vCPU throttling needs auto-converge");
+        return false;
+    }
+
+    /* Other accelerators only report dirty pages for the whole guest, so
+     * there is no per-vCPU rate to pick the vCPUs to throttle from.
+     */
+    if (cap_list[MIGRATION_CAPABILITY_VCPU_THROTTLE] && !tcg_enabled()) {
+        error_setg(errp, "vCPU throttling needs per-vCPU dirty page "
+                   "tracking, which is only available with TCG");
+        return false;
+    }
+
     if (cap_list[MIGRATION_CAPABILITY_POSTCOPY_RAM]) {
         if (cap_list[MIGRATION_CAPABILITY_COMPRESS]) {
             /* The decompression threads asynchronously write into RAM
@@ -809,6 +950,23 @@ static bool migrate_params_check(MigrationParameters *params, Error **errp)
                    "is invalid, it should be in the range of 1 to 10000");
         return false;
     }
+    if (params->has_x_rdma_qps &&
+        (params->x_rdma_qps < 1 || params->x_rdma_qps > RDMA_MAX_QPS)) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE,
+                   "rdma_qps",
+                   "is invalid, it should be in the range of 1 to "
+                   stringify(RDMA_MAX_QPS));
+        return false;
+    }
+#ifndef CONFIG_ZSTD
+    if (params->has_x_multifd_compression &&
+        params->x_multifd_compression == MULTIFD_COMPRESSION_ZSTD) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE,
+                   "multifd_compression",
+                   "zstd is not supported by this QEMU binary");
+        return false;
+    }
+#endif
 
     return true;
 }
@@ -865,6 +1023,18 @@ static void migrate_params_test_apply(MigrateSetParameters *params,
     if (params->has_block_incremental) {
         dest->block_incremental = params->block_incremental;
     }
+    if (params->has_x_multifd_channels) {
+        dest->x_multifd_channels = params->x_multifd_channels;
+    }
+    if (params->has_x_multifd_page_count) {
+        dest->x_multifd_page_count = params->x_multifd_page_count;
+    }
+    if (params->has_x_multifd_compression) {
+        dest->x_multifd_compression = params->x_multifd_compression;
+    }
+    if (params->has_x_rdma_qps) {
+        dest->x_rdma_qps = params->x_rdma_qps;
+    }
 }
 
 static void migrate_params_apply(MigrateSetParameters *params)
@@ -933,6 +1103,12 @@ static void migrate_params_apply(MigrateSetParameters *params)
     if (params->has_x_multifd_page_count) {
         s->parameters.x_multifd_page_count = params->x_multifd_page_count;
     }
+    if (params->has_x_multifd_compression) {
+        s->parameters.x_multifd_compression = params->x_multifd_compression;
+    }
+    if (params->has_x_rdma_qps) {
+        s->parameters.x_rdma_qps = params->x_rdma_qps;
+    }
 }
 
 void qmp_migrate_set_parameters(MigrateSetParameters *params, Error **errp)
@@ -1216,6 +1392,9 @@ MigrationState *migrate_init(void)
     s->migration_thread_running = false;
     error_free(s->error);
     s->error = NULL;
+    g_free(s->file_path);
+    s->file_path = NULL;
+    rdma_migration_stats_reset();
 
     migrate_set_state(&s->state, MIGRATION_STATUS_NONE, MIGRATION_STATUS_SETUP);
 
@@ -1328,6 +1507,11 @@ void qmp_migrate(const char *uri, bool has_blk, bool blk,
         migrate_set_block_incremental(s, true);
     }
 
+    if (migrate_mapped_ram() && !strstart(uri, "file:", NULL)) {
+        error_setg(errp, "mapped-ram needs a file: migration URI");
+        return;
+    }
+
     s = migrate_init();
 
     if (strstart(uri, "tcp:", &p)) {
@@ -1342,6 +1526,8 @@ void qmp_migrate(const char *uri, bool has_blk, bool blk,
         unix_start_outgoing_migration(s, p, &local_err);
     } else if (strstart(uri, "fd:", &p)) {
         fd_start_outgoing_migration(s, p, &local_err);
+    } else if (strstart(uri, "file:", &p)) {
+        file_start_outgoing_migration(s, p, &local_err);
     } else {
         error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "uri",
                    "a valid migration protocol");
@@ -1458,6 +1644,33 @@ bool migrate_auto_converge(void)
     return s->enabled_capabilities[MIGRATION_CAPABILITY_AUTO_CONVERGE];
 }
 
+bool migrate_vcpu_throttle(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_VCPU_THROTTLE];
+}
+
+bool migrate_mapped_ram(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_MAPPED_RAM];
+}
+
+bool migrate_background_snapshot(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_BACKGROUND_SNAPSHOT];
+}
+
 bool migrate_zero_blocks(void)
 {
     MigrationState *s;
@@ -1539,6 +1752,33 @@ int migrate_multifd_page_count(void)
     return s->parameters.x_multifd_page_count;
 }
 
+MultiFDCompression migrate_multifd_compression(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->parameters.x_multifd_compression;
+}
+
+int migrate_rdma_qps(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->parameters.x_rdma_qps;
+}
+
+bool migrate_use_zero_copy_send(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_ZERO_COPY_SEND];
+}
+
 int migrate_use_xbzrle(void)
 {
     MigrationState *s;
@@ -2234,6 +2474,154 @@ static void *migration_thread(void *opaque)
     return NULL;
 }
 
+/*
+ * Migration thread for background snapshots.
+ * The device state is saved with the VM briefly stopped, at the same
+ * moment RAM is write protected; RAM is then saved while the guest runs,
+ * and the buffered device state is appended once every page has gone.
+ */
+static void *bg_migration_thread(void *opaque)
+{
+    MigrationState *s = opaque;
+    int64_t initial_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+    int64_t setup_start = qemu_clock_get_ms(QEMU_CLOCK_HOST);
+    int64_t initial_bytes = 0;
+    int64_t start_time;
+    int64_t end_time;
+    bool old_vm_running;
+    QIOChannelBuffer *bioc;
+    QEMUFile *fb;
+    int ret;
+
+    rcu_register_thread();
+
+    qemu_savevm_state_header(s->to_dst_file);
+    qemu_savevm_state_setup(s->to_dst_file);
+
+    s->setup_time = qemu_clock_get_ms(QEMU_CLOCK_HOST) - setup_start;
+    migrate_set_state(&s->state, MIGRATION_STATUS_SETUP,
+                      MIGRATION_STATUS_ACTIVE);
+
+    trace_migration_thread_setup_complete();
+
+    /* Fault in every page now so the write protection covers all of RAM */
+    if (ram_write_tracking_prepare()) {
+        migrate_set_state(&s->state, MIGRATION_STATUS_ACTIVE,
+                          MIGRATION_STATUS_FAILED);
+        goto out;
+    }
+
+    bioc = qio_channel_buffer_new(4096);
+    qio_channel_set_name(QIO_CHANNEL(bioc), "migration-snapshot-buffer");
+    fb = qemu_fopen_channel_output(QIO_CHANNEL(bioc));
+    object_unref(OBJECT(bioc));
+
+    qemu_mutex_lock_iothread();
+    start_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+    qemu_system_wakeup_request(QEMU_WAKEUP_REASON_OTHER);
+    old_vm_running = runstate_is_running();
+    ret = global_state_store();
+    if (!ret) {
+        ret = vm_stop_force_state(RUN_STATE_PAUSED);
+    }
+    if (!ret) {
+        ret = ram_write_tracking_start();
+    }
+    if (!ret) {
+        cpu_synchronize_all_states();
+        ret = qemu_savevm_state_complete_precopy_non_iterable(fb, false,
+                                                              false);
+    }
+    if (old_vm_running) {
+        vm_start();
+    }
+    s->downtime = qemu_clock_get_ms(QEMU_CLOCK_REALTIME) - start_time;
+    qemu_mutex_unlock_iothread();
+
+    if (ret < 0 || qemu_file_get_error(fb)) {
+        error_report("%s: failed to save the device state (%d)",
+                     __func__, ret);
+        migrate_set_state(&s->state, MIGRATION_STATUS_ACTIVE,
+                          MIGRATION_STATUS_FAILED);
+        qemu_fclose(fb);
+        goto out;
+    }
+
+    while (s->state == MIGRATION_STATUS_ACTIVE) {
+        int64_t current_time;
+
+        if (!qemu_file_rate_limit(s->to_dst_file)) {
+            uint64_t pend_post, pend_nonpost;
+
+            qemu_savevm_state_pending(s->to_dst_file, 0,
+                                      &pend_nonpost, &pend_post);
+            trace_migrate_pending(pend_nonpost + pend_post, 0,
+                                  pend_post, pend_nonpost);
+            if (pend_nonpost + pend_post) {
+                qemu_savevm_state_iterate(s->to_dst_file, false);
+            } else {
+                trace_migration_thread_low_pending(0);
+                qemu_file_set_rate_limit(s->to_dst_file, INT64_MAX);
+                qemu_savevm_state_complete_precopy_iterable(s->to_dst_file,
+                                                            false);
+                qemu_put_buffer(s->to_dst_file, bioc->data, bioc->usage);
+                qemu_fflush(s->to_dst_file);
+                if (!qemu_file_get_error(s->to_dst_file)) {
+                    migrate_set_state(&s->state, MIGRATION_STATUS_ACTIVE,
+                                      MIGRATION_STATUS_COMPLETED);
+                }
+            }
+        }
+
+        if (qemu_file_get_error(s->to_dst_file)) {
+            migrate_set_state(&s->state, MIGRATION_STATUS_ACTIVE,
+                              MIGRATION_STATUS_FAILED);
+            trace_migration_thread_file_err();
+            break;
+        }
+        current_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+        if (current_time >= initial_time + BUFFER_DELAY) {
+            uint64_t transferred_bytes = qemu_ftell(s->to_dst_file) -
+                                         initial_bytes;
+            uint64_t time_spent = current_time - initial_time;
+
+            s->mbps = (((double) transferred_bytes * 8.0) /
+                    ((double) time_spent / 1000.0)) / 1000.0 / 1000.0;
+
+            qemu_file_reset_rate_limit(s->to_dst_file);
+            initial_time = current_time;
+            initial_bytes = qemu_ftell(s->to_dst_file);
+        }
+        if (qemu_file_rate_limit(s->to_dst_file)) {
+            /* usleep expects microseconds */
+            g_usleep((initial_time + BUFFER_DELAY - current_time) * 1000);
+        }
+    }
+
+    qemu_fclose(fb);
+
+out:
+    trace_migration_thread_after_loop();
+    end_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+
+    qemu_mutex_lock_iothread();
+    /* This also stops the write tracking, through ram_save_cleanup() */
+    qemu_savevm_state_cleanup();
+    if (s->state == MIGRATION_STATUS_COMPLETED) {
+        uint64_t transferred_bytes = qemu_ftell(s->to_dst_file);
+        s->total_time = end_time - s->total_time;
+        if (s->total_time) {
+            s->mbps = (((double) transferred_bytes * 8.0) /
+                       ((double) s->total_time)) / 1000;
+        }
+    }
+    qemu_bh_schedule(s->cleanup_bh);
+    qemu_mutex_unlock_iothread();
+
+    rcu_unregister_thread();
+    return NULL;
+}
+
 void migrate_fd_connect(MigrationState *s)
 {
     s->expected_downtime = s->parameters.downtime_limit;
@@ -2267,8 +2655,13 @@ void migrate_fd_connect(MigrationState *s)
         migrate_fd_cleanup(s);
         return;
     }
-    qemu_thread_create(&s->thread, "live_migration", migration_thread, s,
-                       QEMU_THREAD_JOINABLE);
+    if (migrate_background_snapshot()) {
+        qemu_thread_create(&s->thread, "bg_snapshot", bg_migration_thread, s,
+                           QEMU_THREAD_JOINABLE);
+    } else {
+        qemu_thread_create(&s->thread, "live_migration", migration_thread, s,
+                           QEMU_THREAD_JOINABLE);
+    }
     s->migration_thread_running = true;
 }
 
@@ -2324,6 +2717,12 @@ static Property migration_properties[] = {
     DEFINE_PROP_INT64("x-multifd-page-count", MigrationState,
                       parameters.x_multifd_page_count,
                       DEFAULT_MIGRATE_MULTIFD_PAGE_COUNT),
+    DEFINE_PROP_MULTIFD_COMPRESSION("x-multifd-compression", MigrationState,
+                      parameters.x_multifd_compression,
+                      MULTIFD_COMPRESSION_NONE),
+    DEFINE_PROP_INT64("x-rdma-qps", MigrationState,
+                      parameters.x_rdma_qps,
+                      DEFAULT_MIGRATE_RDMA_QPS),
 
     /* Migration capabilities */
     DEFINE_PROP_MIG_CAP("x-xbzrle", MIGRATION_CAPABILITY_XBZRLE),
@@ -2383,6 +2782,8 @@ static void migration_instance_init(Object *obj)
     params->has_block_incremental = true;
     params->has_x_multifd_channels = true;
     params->has_x_multifd_page_count = true;
+    params->has_x_multifd_compression = true;
+    params->has_x_rdma_qps = true;
 }
 
 /*
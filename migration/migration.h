@@ -22,6 +22,25 @@
 #include "hw/qdev.h"
 #include "io/channel.h"
 
+/* Fault latency histogram buckets, in log2 microseconds */
+#define POSTCOPY_FAULT_HIST_BUCKETS 24
+
+/* Userfault accounting on the destination, protected by its mutex */
+typedef struct PostcopyFaultState {
+    QemuMutex mutex;
+    /* Orders page requests from the fault threads, protects last_rb */
+    QemuMutex req_mutex;
+    /* Last RAMBlock named in a page request on the return path */
+    RAMBlock *last_rb;
+    bool      enabled;
+    /* Host page address -> time (ns) its first fault was read */
+    GHashTable *pending;
+    uint64_t  faults;
+    uint64_t  latency_total;
+    uint64_t  latency_max;
+    uint64_t  latency_hist[POSTCOPY_FAULT_HIST_BUCKETS];
+} PostcopyFaultState;
+
 /* State for the incoming migration */
 struct MigrationIncomingState {
     QEMUFile *from_src_file;
@@ -34,8 +53,10 @@ struct MigrationIncomingState {
 
     size_t         largest_page_size;
     bool           have_fault_thread;
-    QemuThread     fault_thread;
+    int            nb_fault_threads;
+    QemuThread     *fault_threads;
     QemuSemaphore  fault_thread_sem;
+    PostcopyFaultState postcopy_faults;
 
     bool           have_listen_thread;
     QemuThread     listen_thread;
@@ -43,7 +64,7 @@ struct MigrationIncomingState {
 
     /* For the kernel to send us notifications */
     int       userfault_fd;
-    /* To tell the fault_thread to quit */
+    /* To tell the fault threads to quit */
     int       userfault_quit_fd;
     QEMUFile *to_src_file;
     QemuMutex rp_mutex;    /* We send replies from multiple threads */
@@ -52,6 +73,9 @@ struct MigrationIncomingState {
 
     QEMUBH *bh;
 
+    /* Path of a file: migration source, for the mapped-ram readers */
+    char *file_path;
+
     int state;
 
     bool have_colo_incoming_thread;
@@ -148,6 +172,9 @@ struct MigrationState
     bool send_configuration;
     /* Whether we send section footer during migration */
     bool send_section_footer;
+
+    /* Path of a file: migration target, for the mapped-ram writers */
+    char *file_path;
 };
 
 void migrate_set_state(int *state, int old_state, int new_state);
@@ -174,11 +201,17 @@ bool migrate_postcopy(void);
 bool migrate_release_ram(void);
 bool migrate_postcopy_ram(void);
 bool migrate_zero_blocks(void);
+bool migrate_mapped_ram(void);
+bool migrate_background_snapshot(void);
 
 bool migrate_auto_converge(void);
+bool migrate_vcpu_throttle(void);
 bool migrate_use_multifd(void);
 int migrate_multifd_channels(void);
 int migrate_multifd_page_count(void);
+MultiFDCompression migrate_multifd_compression(void);
+int migrate_rdma_qps(void);
+bool migrate_use_zero_copy_send(void);
 
 int migrate_use_xbzrle(void);
 int64_t migrate_xbzrle_cache_size(void);
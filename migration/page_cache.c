@@ -1,6 +1,6 @@
 /*
  * Page cache for QEMU
- * The cache is base on a hash of the page address
+ * The cache is set-associative, indexed by the page address
  *
  * Copyright 2012 Red Hat, Inc. and/or its affiliates
  *
@@ -29,6 +29,12 @@
 /* the page in cache will not be replaced in two cycles */
 #define CACHED_PAGE_LIFETIME 2
 
+/* Number of ways in each set.  Pages whose addresses map to the same set
+ * no longer evict each other until all the ways are in use; the linear
+ * search of a set stays within a few host cache lines.
+ */
+#define CACHE_WAYS 8
+
 typedef struct CacheItem CacheItem;
 
 struct CacheItem {
@@ -43,6 +49,8 @@ struct PageCache {
     int64_t max_num_items;
     uint64_t max_item_age;
     int64_t num_items;
+    unsigned int num_ways;
+    int64_t num_sets;
 };
 
 PageCache *cache_init(int64_t num_pages, unsigned int page_size)
@@ -71,8 +79,11 @@ PageCache *cache_init(int64_t num_pages, unsigned int page_size)
     cache->num_items = 0;
     cache->max_item_age = 0;
     cache->max_num_items = num_pages;
+    cache->num_ways = MIN(num_pages, CACHE_WAYS);
+    cache->num_sets = num_pages / cache->num_ways;
 
-    DPRINTF("Setting cache buckets to %" PRId64 "\n", cache->max_num_items);
+    DPRINTF("Setting cache buckets to %" PRId64 " (%" PRId64 " sets of %u)\n",
+            cache->max_num_items, cache->num_sets, cache->num_ways);
 
     /* We prefer not to abort if there is no memory */
     cache->page_cache = g_try_malloc((cache->max_num_items) *
@@ -108,28 +119,37 @@ void cache_fini(PageCache *cache)
     g_free(cache);
 }
 
-static size_t cache_get_cache_pos(const PageCache *cache,
-                                  uint64_t address)
-{
-    g_assert(cache->max_num_items);
-    return (address / cache->page_size) & (cache->max_num_items - 1);
-}
-
-static CacheItem *cache_get_by_addr(const PageCache *cache, uint64_t addr)
+/* Return the first way of the set @address maps to */
+static CacheItem *cache_get_set(const PageCache *cache, uint64_t address)
 {
     size_t pos;
 
     g_assert(cache);
     g_assert(cache->page_cache);
+    g_assert(cache->num_sets);
 
-    pos = cache_get_cache_pos(cache, addr);
+    pos = (address / cache->page_size) & (cache->num_sets - 1);
+    return &cache->page_cache[pos * cache->num_ways];
+}
 
-    return &cache->page_cache[pos];
+static CacheItem *cache_get_by_addr(const PageCache *cache, uint64_t addr)
+{
+    CacheItem *set = cache_get_set(cache, addr);
+    unsigned int i;
+
+    for (i = 0; i < cache->num_ways; i++) {
+        if (set[i].it_addr == addr) {
+            return &set[i];
+        }
+    }
+    return NULL;
 }
 
 uint8_t *get_cached_data(const PageCache *cache, uint64_t addr)
 {
-    return cache_get_by_addr(cache, addr)->it_data;
+    CacheItem *it = cache_get_by_addr(cache, addr);
+
+    return it ? it->it_data : NULL;
 }
 
 bool cache_is_cached(const PageCache *cache, uint64_t addr,
@@ -139,7 +159,7 @@ bool cache_is_cached(const PageCache *cache, uint64_t addr,
 
     it = cache_get_by_addr(cache, addr);
 
-    if (it->it_addr == addr) {
+    if (it) {
         /* update the it_age when the cache hit */
         it->it_age = current_age;
         return true;
@@ -147,19 +167,49 @@ bool cache_is_cached(const PageCache *cache, uint64_t addr,
     return false;
 }
 
+/* Pick the way of @addr's set that should hold @addr: the way already
+ * holding it, else an unused way, else the least recently used one.
+ */
+static CacheItem *cache_get_victim(const PageCache *cache, uint64_t addr)
+{
+    CacheItem *set = cache_get_set(cache, addr);
+    CacheItem *victim = NULL;
+    unsigned int i;
+
+    for (i = 0; i < cache->num_ways; i++) {
+        CacheItem *it = &set[i];
+
+        if (it->it_addr == addr) {
+            return it;
+        }
+        if (!it->it_data) {
+            if (!victim || victim->it_data) {
+                victim = it;
+            }
+        } else if (!victim ||
+                   (victim->it_data && it->it_age < victim->it_age)) {
+            victim = it;
+        }
+    }
+    return victim;
+}
+
 int cache_insert(PageCache *cache, uint64_t addr, const uint8_t *pdata,
                  uint64_t current_age)
 {
 
     CacheItem *it;
+    bool evicted = false;
 
     /* actual update of entry */
-    it = cache_get_by_addr(cache, addr);
+    it = cache_get_victim(cache, addr);
 
-    if (it->it_data && it->it_addr != addr &&
-        it->it_age + CACHED_PAGE_LIFETIME > current_age) {
-        /* the cache page is fresh, don't replace it */
-        return -1;
+    if (it->it_data && it->it_addr != addr) {
+        if (it->it_age + CACHED_PAGE_LIFETIME > current_age) {
+            /* every page in the set is fresh, don't replace any */
+            return -1;
+        }
+        evicted = true;
     }
     /* allocate page */
     if (!it->it_data) {
@@ -176,5 +226,5 @@ int cache_insert(PageCache *cache, uint64_t addr, const uint8_t *pdata,
     it->it_age = current_age;
     it->it_addr = addr;
 
-    return 0;
+    return evicted;
 }
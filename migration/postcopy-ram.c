@@ -26,6 +26,8 @@
 #include "sysemu/sysemu.h"
 #include "sysemu/balloon.h"
 #include "qemu/error-report.h"
+#include "qemu/host-utils.h"
+#include "qemu/timer.h"
 #include "trace.h"
 
 /* Arbitrary limit on size of each discard command,
@@ -33,6 +35,9 @@
  */
 #define MAX_DISCARDS_PER_COMMAND 12
 
+/* Upper bound on the number of threads reading the userfaultfd */
+#define MAX_FAULT_THREADS 4
+
 struct PostcopyDiscardState {
     const char *ramblock_name;
     uint16_t cur_entry;
@@ -378,18 +383,22 @@ int postcopy_ram_incoming_cleanup(MigrationIncomingState *mis)
 
     if (mis->have_fault_thread) {
         uint64_t tmp64;
+        int i;
 
         if (qemu_ram_foreach_block(cleanup_range, mis)) {
             return -1;
         }
         /*
-         * Tell the fault_thread to exit, it's an eventfd that should
-         * currently be at 0, we're going to increment it to 1
+         * Tell the fault threads to exit, it's an eventfd that should
+         * currently be at 0, we're going to increment it to 1; nobody
+         * reads it so it stays readable until every thread has seen it.
          */
         tmp64 = 1;
         if (write(mis->userfault_quit_fd, &tmp64, 8) == 8) {
             trace_postcopy_ram_incoming_cleanup_join();
-            qemu_thread_join(&mis->fault_thread);
+            for (i = 0; i < mis->nb_fault_threads; i++) {
+                qemu_thread_join(&mis->fault_threads[i]);
+            }
         } else {
             /* Not much we can do here, but may as well report it */
             error_report("%s: incrementing userfault_quit_fd: %s", __func__,
@@ -398,7 +407,15 @@ int postcopy_ram_incoming_cleanup(MigrationIncomingState *mis)
         trace_postcopy_ram_incoming_cleanup_closeuf();
         close(mis->userfault_fd);
         close(mis->userfault_quit_fd);
+        g_free(mis->fault_threads);
+        mis->fault_threads = NULL;
+        mis->nb_fault_threads = 0;
         mis->have_fault_thread = false;
+
+        qemu_mutex_lock(&mis->postcopy_faults.mutex);
+        g_hash_table_destroy(mis->postcopy_faults.pending);
+        mis->postcopy_faults.pending = NULL;
+        qemu_mutex_unlock(&mis->postcopy_faults.mutex);
     }
 
     qemu_balloon_inhibit(false);
@@ -495,7 +512,79 @@ static int ram_block_enable_notify(const char *block_name, void *host_addr,
 }
 
 /*
- * Handle faults detected by the USERFAULT markings
+ * Ask the source for the host page at @rb_offset of @rb, unless a fault
+ * on the same page is already waiting for it; @haddr is the host address
+ * of the page.
+ */
+static void postcopy_request_page(MigrationIncomingState *mis, RAMBlock *rb,
+                                  ram_addr_t rb_offset, uint64_t haddr)
+{
+    PostcopyFaultState *pf = &mis->postcopy_faults;
+    gpointer key = (gpointer)(uintptr_t)haddr;
+    int64_t *start;
+
+    qemu_mutex_lock(&pf->mutex);
+    if (g_hash_table_lookup(pf->pending, key)) {
+        qemu_mutex_unlock(&pf->mutex);
+        return;
+    }
+    start = g_new(int64_t, 1);
+    *start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    g_hash_table_insert(pf->pending, key, start);
+    qemu_mutex_unlock(&pf->mutex);
+
+    /*
+     * Send the request to the source - we want to request one
+     * of our host page sizes (which is >= TPS).  The source remembers
+     * the last RAMBlock it was told about, so naming and sending must
+     * be atomic across the fault threads.
+     */
+    qemu_mutex_lock(&pf->req_mutex);
+    if (rb != pf->last_rb) {
+        pf->last_rb = rb;
+        migrate_send_rp_req_pages(mis, qemu_ram_get_idstr(rb),
+                                 rb_offset, qemu_ram_pagesize(rb));
+    } else {
+        /* Save some space */
+        migrate_send_rp_req_pages(mis, NULL,
+                                 rb_offset, qemu_ram_pagesize(rb));
+    }
+    qemu_mutex_unlock(&pf->req_mutex);
+}
+
+/*
+ * Account the latency of any fault waiting for the host page at @host,
+ * which has just been placed.
+ */
+static void postcopy_fault_done(MigrationIncomingState *mis, void *host)
+{
+    PostcopyFaultState *pf = &mis->postcopy_faults;
+    gpointer key = host;
+    int64_t *start;
+    uint64_t us;
+    int bucket;
+
+    qemu_mutex_lock(&pf->mutex);
+    start = pf->pending ? g_hash_table_lookup(pf->pending, key) : NULL;
+    if (start) {
+        us = (qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - *start) / SCALE_US;
+        bucket = us ? 63 - clz64(us) : 0;
+        bucket = MIN(bucket, POSTCOPY_FAULT_HIST_BUCKETS - 1);
+
+        pf->faults++;
+        pf->latency_total += us;
+        pf->latency_max = MAX(pf->latency_max, us);
+        pf->latency_hist[bucket]++;
+        g_hash_table_remove(pf->pending, key);
+        trace_postcopy_fault_done(host, us);
+    }
+    qemu_mutex_unlock(&pf->mutex);
+}
+
+/*
+ * Handle faults detected by the USERFAULT markings; several of these
+ * threads read the same userfaultfd so that simultaneous faults from
+ * different vCPUs are turned into page requests in parallel.
  */
 static void *postcopy_ram_fault_thread(void *opaque)
 {
@@ -503,13 +592,13 @@ static void *postcopy_ram_fault_thread(void *opaque)
     struct uffd_msg msg;
     int ret;
     RAMBlock *rb = NULL;
-    RAMBlock *last_rb = NULL; /* last RAMBlock we sent part of */
 
     trace_postcopy_ram_fault_thread_entry();
     qemu_sem_post(&mis->fault_thread_sem);
 
     while (true) {
         ram_addr_t rb_offset;
+        uint64_t haddr;
         struct pollfd pfd[2];
 
         /*
@@ -539,7 +628,8 @@ static void *postcopy_ram_fault_thread(void *opaque)
             if (errno == EAGAIN) {
                 /*
                  * if a wake up happens on the other thread just after
-                 * the poll, there is nothing to read.
+                 * the poll, or another fault thread got the message,
+                 * there is nothing to read.
                  */
                 continue;
             }
@@ -569,23 +659,12 @@ static void *postcopy_ram_fault_thread(void *opaque)
         }
 
         rb_offset &= ~(qemu_ram_pagesize(rb) - 1);
+        haddr = msg.arg.pagefault.address & ~(qemu_ram_pagesize(rb) - 1);
         trace_postcopy_ram_fault_thread_request(msg.arg.pagefault.address,
                                                 qemu_ram_get_idstr(rb),
                                                 rb_offset);
 
-        /*
-         * Send the request to the source - we want to request one
-         * of our host page sizes (which is >= TPS)
-         */
-        if (rb != last_rb) {
-            last_rb = rb;
-            migrate_send_rp_req_pages(mis, qemu_ram_get_idstr(rb),
-                                     rb_offset, qemu_ram_pagesize(rb));
-        } else {
-            /* Save some space */
-            migrate_send_rp_req_pages(mis, NULL,
-                                     rb_offset, qemu_ram_pagesize(rb));
-        }
+        postcopy_request_page(mis, rb, rb_offset, haddr);
     }
     trace_postcopy_ram_fault_thread_exit();
     return NULL;
@@ -593,6 +672,8 @@ static void *postcopy_ram_fault_thread(void *opaque)
 
 int postcopy_ram_enable_notify(MigrationIncomingState *mis)
 {
+    int i;
+
     /* Open the fd for the kernel to give us userfaults */
     mis->userfault_fd = syscall(__NR_userfaultfd, O_CLOEXEC | O_NONBLOCK);
     if (mis->userfault_fd == -1) {
@@ -618,10 +699,38 @@ int postcopy_ram_enable_notify(MigrationIncomingState *mis)
         return -1;
     }
 
+    qemu_mutex_lock(&mis->postcopy_faults.mutex);
+    mis->postcopy_faults.enabled = true;
+    mis->postcopy_faults.pending = g_hash_table_new_full(g_direct_hash,
+                                                         g_direct_equal,
+                                                         NULL, g_free);
+    mis->postcopy_faults.faults = 0;
+    mis->postcopy_faults.latency_total = 0;
+    mis->postcopy_faults.latency_max = 0;
+    memset(mis->postcopy_faults.latency_hist, 0,
+           sizeof(mis->postcopy_faults.latency_hist));
+    qemu_mutex_unlock(&mis->postcopy_faults.mutex);
+
+    /*
+     * The threads all read the one userfaultfd, so the kernel hands each
+     * fault to whichever thread is free; they are not tied to vCPUs.
+     * More threads than vCPUs could never be busy at the same time.
+     * Pages are still placed only by the listen thread, in the order
+     * they arrive on the migration stream.
+     */
+    mis->nb_fault_threads = MIN(smp_cpus, MAX_FAULT_THREADS);
+    mis->fault_threads = g_new0(QemuThread, mis->nb_fault_threads);
+    mis->postcopy_faults.last_rb = NULL;
     qemu_sem_init(&mis->fault_thread_sem, 0);
-    qemu_thread_create(&mis->fault_thread, "postcopy/fault",
-                       postcopy_ram_fault_thread, mis, QEMU_THREAD_JOINABLE);
-    qemu_sem_wait(&mis->fault_thread_sem);
+    for (i = 0; i < mis->nb_fault_threads; i++) {
+        char name[16];
+
+        snprintf(name, sizeof(name), "postcopy/fault%d", i);
+        qemu_thread_create(&mis->fault_threads[i], name,
+                           postcopy_ram_fault_thread, mis,
+                           QEMU_THREAD_JOINABLE);
+        qemu_sem_wait(&mis->fault_thread_sem);
+    }
     qemu_sem_destroy(&mis->fault_thread_sem);
     mis->have_fault_thread = true;
 
@@ -669,6 +778,7 @@ int postcopy_place_page(MigrationIncomingState *mis, void *host, void *from,
     }
 
     trace_postcopy_place_page(host);
+    postcopy_fault_done(mis, host);
     return 0;
 }
 
@@ -694,6 +804,7 @@ int postcopy_place_page_zero(MigrationIncomingState *mis, void *host,
 
             return -e;
         }
+        postcopy_fault_done(mis, host);
     } else {
         /* The kernel can't use UFFDIO_ZEROPAGE for hugepages */
         if (!mis->postcopy_tmp_zero_page) {
@@ -795,6 +906,38 @@ void *postcopy_get_tmp_page(MigrationIncomingState *mis)
 
 #endif
 
+/*
+ * Returns the fault statistics of the destination side of a postcopy
+ * migration, or NULL if this QEMU never received one.
+ */
+PostcopyFaultStats *postcopy_fault_stats(MigrationIncomingState *mis)
+{
+    PostcopyFaultState *pf = &mis->postcopy_faults;
+    PostcopyFaultStats *stats;
+    intList **next;
+    int i;
+
+    qemu_mutex_lock(&pf->mutex);
+    if (!pf->enabled) {
+        qemu_mutex_unlock(&pf->mutex);
+        return NULL;
+    }
+
+    stats = g_new0(PostcopyFaultStats, 1);
+    stats->faults = pf->faults;
+    stats->latency_avg = pf->faults ? pf->latency_total / pf->faults : 0;
+    stats->latency_max = pf->latency_max;
+    next = &stats->latency_histogram;
+    for (i = 0; i < POSTCOPY_FAULT_HIST_BUCKETS; i++) {
+        *next = g_new0(intList, 1);
+        (*next)->value = pf->latency_hist[i];
+        next = &(*next)->next;
+    }
+    qemu_mutex_unlock(&pf->mutex);
+
+    return stats;
+}
+
 /* ------------------------------------------------------------------------- */
 
 /**
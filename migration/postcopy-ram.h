@@ -110,6 +110,13 @@ typedef enum {
  */
 void *postcopy_get_tmp_page(MigrationIncomingState *mis);
 
+/*
+ * Returns the userfault latency statistics of an incoming postcopy
+ * migration, or NULL if postcopy was never entered.  Free with
+ * qapi_free_PostcopyFaultStats().
+ */
+PostcopyFaultStats *postcopy_fault_stats(MigrationIncomingState *mis);
+
 PostcopyState postcopy_state_get(void);
 /* Set the state and return the old state */
 PostcopyState postcopy_state_set(PostcopyState new_state);
@@ -31,7 +31,7 @@
 #include "trace.h"
 
 #define IO_BUF_SIZE 32768
-#define MAX_IOV_SIZE MIN(IOV_MAX, 64)
+#define MAX_IOV_SIZE MIN(IOV_MAX, 256)
 
 struct QEMUFile {
     const QEMUFileOps *ops;
@@ -202,6 +202,42 @@ void qemu_fflush(QEMUFile *f)
     f->iovcnt = 0;
 }
 
+/*
+ * Move the position of a random access QEMUFile to @pos
+ *
+ * Pending output is flushed first, and buffered input is dropped, so
+ * the next read or write happens at @pos.  Used to lay out data at
+ * fixed offsets of a file.
+ *
+ * Returns 0 on success, negative errno otherwise
+ */
+int qemu_file_seek(QEMUFile *f, int64_t pos)
+{
+    int ret;
+
+    if (!f->ops->seek) {
+        qemu_file_set_error(f, -ENOTSUP);
+        return -ENOTSUP;
+    }
+
+    qemu_fflush(f);
+    ret = qemu_file_get_error(f);
+    if (ret) {
+        return ret;
+    }
+
+    ret = f->ops->seek(f->opaque, pos);
+    if (ret < 0) {
+        qemu_file_set_error(f, ret);
+        return ret;
+    }
+
+    f->pos = pos;
+    f->buf_index = 0;
+    f->buf_size = 0;
+    return 0;
+}
+
 void ram_control_before_iterate(QEMUFile *f, uint64_t flags)
 {
     int ret = 0;
@@ -612,6 +648,15 @@ void qemu_file_reset_rate_limit(QEMUFile *f)
     f->bytes_xfer = 0;
 }
 
+/*
+ * Account for data that was sent on behalf of @f through another
+ * channel, so that it counts against the rate limit.
+ */
+void qemu_file_update_transfer(QEMUFile *f, int64_t len)
+{
+    f->bytes_xfer += len;
+}
+
 void qemu_put_be16(QEMUFile *f, unsigned int v)
 {
     qemu_put_byte(f, v >> 8);
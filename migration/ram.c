@@ -28,6 +28,9 @@
 #include "qemu/osdep.h"
 #include "cpu.h"
 #include <zlib.h>
+#ifdef CONFIG_ZSTD
+#include <zstd.h>
+#endif
 #include "qapi-event.h"
 #include "qemu/cutils.h"
 #include "qemu/bitops.h"
@@ -47,6 +50,36 @@
 #include "qemu/rcu_queue.h"
 #include "migration/colo.h"
 #include "migration/block.h"
+#include "sysemu/sysemu.h"
+#include "qemu/uuid.h"
+#include "io/channel.h"
+#include "io/channel-file.h"
+#include "socket.h"
+
+#if defined(__linux__)
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#if defined(__linux__) && defined(__NR_userfaultfd) && defined(CONFIG_EVENTFD)
+#include <linux/userfaultfd.h>
+
+/* Definitions from Linux 5.7 <linux/userfaultfd.h>, for builds whose
+ * headers predate userfaultfd write protection.
+ */
+#ifndef UFFDIO_WRITEPROTECT
+#define _UFFDIO_WRITEPROTECT            (0x06)
+#define UFFDIO_WRITEPROTECT     _IOWR(UFFDIO, _UFFDIO_WRITEPROTECT, \
+                                      struct uffdio_writeprotect)
+
+struct uffdio_writeprotect {
+    struct uffdio_range range;
+#define UFFDIO_WRITEPROTECT_MODE_WP             ((__u64)1 << 0)
+#define UFFDIO_WRITEPROTECT_MODE_DONTWAKE       ((__u64)1 << 1)
+    __u64 mode;
+};
+#endif
+#endif
 
 /***********************************************************/
 /* ram save/restore */
@@ -67,6 +100,12 @@
 /* 0x80 is reserved in migration.h start with 0x100 next */
 #define RAM_SAVE_FLAG_COMPRESS_PAGE    0x100
 
+/* Dirty tracking is re-armed in chunks of 1 << CLEAR_BITMAP_SHIFT target
+ * pages (1GB with 4K pages).  Must be at least 6, the granularity of
+ * KVM_CLEAR_DIRTY_LOG.
+ */
+#define CLEAR_BITMAP_SHIFT 18
+
 static inline bool is_zero_range(uint8_t *p, uint64_t size)
 {
     return buffer_is_zero(p, size);
@@ -185,6 +224,8 @@ struct RAMState {
     uint64_t num_dirty_pages_period;
     /* xbzrle misses since the beginning of the period */
     uint64_t xbzrle_cache_miss_prev;
+    /* xbzrle hits since the beginning of the period */
+    uint64_t xbzrle_cache_hit_prev;
     /* number of iterations at the beginning of period */
     uint64_t iterations_prev;
     /* Iterations since start */
@@ -359,237 +400,1622 @@ static void compress_threads_save_setup(void)
 
 /* Multiple fd's */
 
+#define MULTIFD_MAGIC 0x11223344U
+#define MULTIFD_VERSION 1
+
+#define MULTIFD_FLAG_SYNC (1 << 0)
+
+/* We reserve 3 bits for compression methods */
+#define MULTIFD_FLAG_COMPRESSION_MASK (7 << 1)
+/* we need to be compatible. Before compression value was 0 */
+#define MULTIFD_FLAG_NOCOMP (0 << 1)
+#define MULTIFD_FLAG_ZLIB (1 << 1)
+#define MULTIFD_FLAG_ZSTD (2 << 1)
+
+/* Sent once on each channel right after it is connected */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    unsigned char uuid[16]; /* QemuUUID */
+    uint8_t id;
+} __attribute__((packed)) MultiFDInit_t;
+
+/*
+ * Header of each batch of pages.  All the pages of a packet belong to
+ * the same RAMBlock; the page contents follow the header on the wire,
+ * in the same order as @offset.
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t flags;
+    /* maximum number of pages in a packet, must match on both sides */
+    uint32_t size;
+    /* number of pages actually sent in this packet */
+    uint32_t used;
+    /* size of the data that follows the header */
+    uint32_t next_packet_size;
+    uint64_t packet_num;
+    char ramblock[256];
+    uint64_t offset[];
+} __attribute__((packed)) MultiFDPacket_t;
+
+typedef struct {
+    /* number of used pages */
+    uint32_t used;
+    /* number of allocated pages */
+    uint32_t allocated;
+    /* offset of each page */
+    ram_addr_t *offset;
+    /* pointer to each page */
+    struct iovec *iov;
+    RAMBlock *block;
+} MultiFDPages_t;
+
 struct MultiFDSendParams {
     uint8_t id;
     char *name;
     QemuThread thread;
+    /* true once the thread has been created */
+    bool running;
+    QIOChannel *c;
     QemuSemaphore sem;
     QemuMutex mutex;
+    /* the fields below are protected by @mutex */
     bool quit;
+    /* there is a batch of pages (or a sync) waiting to be sent */
+    bool pending_job;
+    uint32_t flags;
+    uint64_t packet_num;
+    /* pages to be sent; owned by the thread while @pending_job is set */
+    MultiFDPages_t *pages;
+    /* only used by the thread */
+    uint32_t packet_len;
+    MultiFDPacket_t *packet;
+    /* size of the data that follows the header */
+    uint32_t next_packet_size;
+    uint64_t num_packets;
+    uint64_t num_pages;
+    /* compression method private data */
+    void *data;
 };
 typedef struct MultiFDSendParams MultiFDSendParams;
 
-struct {
-    MultiFDSendParams *params;
-    /* number of created threads */
-    int count;
-} *multifd_send_state;
+struct MultiFDRecvParams {
+    uint8_t id;
+    char *name;
+    QemuThread thread;
+    /* true once the thread has been created */
+    bool running;
+    QIOChannel *c;
+    QemuSemaphore sem_sync;
+    QemuMutex mutex;
+    /* only used by the thread */
+    uint32_t flags;
+    uint64_t packet_num;
+    MultiFDPages_t *pages;
+    uint32_t packet_len;
+    MultiFDPacket_t *packet;
+    /* size of the data that follows the header */
+    uint32_t next_packet_size;
+    uint64_t num_packets;
+    uint64_t num_pages;
+    /* compression method private data */
+    void *data;
+};
+typedef struct MultiFDRecvParams MultiFDRecvParams;
 
-static void terminate_multifd_send_threads(Error *errp)
+/* Multifd compression methods */
+
+typedef struct {
+    /* Setup for sending side */
+    int (*send_setup)(MultiFDSendParams *p, Error **errp);
+    /* Cleanup for sending side */
+    void (*send_cleanup)(MultiFDSendParams *p);
+    /* Prepare the pages of a packet; sets next_packet_size */
+    int (*send_prepare)(MultiFDSendParams *p, uint32_t used, Error **errp);
+    /* Write the data that follows the packet header */
+    int (*send_write)(MultiFDSendParams *p, uint32_t used, Error **errp);
+    /* Setup for receiving side */
+    int (*recv_setup)(MultiFDRecvParams *p, Error **errp);
+    /* Cleanup for receiving side */
+    void (*recv_cleanup)(MultiFDRecvParams *p);
+    /* Read the data that follows the packet header into the pages */
+    int (*recv_pages)(MultiFDRecvParams *p, uint32_t used, Error **errp);
+} MultiFDMethods;
+
+/* Multifd without compression */
+
+static int nocomp_send_setup(MultiFDSendParams *p, Error **errp)
 {
-    int i;
+    return 0;
+}
 
-    for (i = 0; i < multifd_send_state->count; i++) {
-        MultiFDSendParams *p = &multifd_send_state->params[i];
+static void nocomp_send_cleanup(MultiFDSendParams *p)
+{
+}
 
-        qemu_mutex_lock(&p->mutex);
-        p->quit = true;
-        qemu_sem_post(&p->sem);
-        qemu_mutex_unlock(&p->mutex);
-    }
+static int nocomp_send_prepare(MultiFDSendParams *p, uint32_t used,
+                               Error **errp)
+{
+    p->next_packet_size = used * TARGET_PAGE_SIZE;
+    p->flags |= MULTIFD_FLAG_NOCOMP;
+    return 0;
 }
 
-int multifd_save_cleanup(Error **errp)
+static int nocomp_send_write(MultiFDSendParams *p, uint32_t used,
+                             Error **errp)
 {
-    int i;
-    int ret = 0;
+    int flags = 0;
 
-    if (!migrate_use_multifd()) {
-        return 0;
+    if (migrate_use_zero_copy_send()) {
+        /* Guest pages stay mapped, so the kernel can read them later;
+         * the send thread flushes before each sync point.
+         */
+        flags |= QIO_CHANNEL_WRITE_FLAG_ZERO_COPY;
     }
-    terminate_multifd_send_threads(NULL);
-    for (i = 0; i < multifd_send_state->count; i++) {
-        MultiFDSendParams *p = &multifd_send_state->params[i];
 
-        qemu_thread_join(&p->thread);
-        qemu_mutex_destroy(&p->mutex);
-        qemu_sem_destroy(&p->sem);
-        g_free(p->name);
-        p->name = NULL;
-    }
-    g_free(multifd_send_state->params);
-    multifd_send_state->params = NULL;
-    g_free(multifd_send_state);
-    multifd_send_state = NULL;
-    return ret;
+    return qio_channel_writev_full_all(p->c, p->pages->iov, used, flags, errp);
 }
 
-static void *multifd_send_thread(void *opaque)
+static int nocomp_recv_setup(MultiFDRecvParams *p, Error **errp)
 {
-    MultiFDSendParams *p = opaque;
-
-    while (true) {
-        qemu_mutex_lock(&p->mutex);
-        if (p->quit) {
-            qemu_mutex_unlock(&p->mutex);
-            break;
-        }
-        qemu_mutex_unlock(&p->mutex);
-        qemu_sem_wait(&p->sem);
-    }
+    return 0;
+}
 
-    return NULL;
+static void nocomp_recv_cleanup(MultiFDRecvParams *p)
+{
 }
 
-int multifd_save_setup(void)
+static int nocomp_recv_pages(MultiFDRecvParams *p, uint32_t used,
+                             Error **errp)
 {
-    int thread_count;
-    uint8_t i;
+    uint32_t flags = p->flags & MULTIFD_FLAG_COMPRESSION_MASK;
 
-    if (!migrate_use_multifd()) {
-        return 0;
+    if (flags != MULTIFD_FLAG_NOCOMP) {
+        error_setg(errp, "multifd %d: flags received %x flags expected %x",
+                   p->id, flags, MULTIFD_FLAG_NOCOMP);
+        return -1;
     }
-    thread_count = migrate_multifd_channels();
-    multifd_send_state = g_malloc0(sizeof(*multifd_send_state));
-    multifd_send_state->params = g_new0(MultiFDSendParams, thread_count);
-    multifd_send_state->count = 0;
-    for (i = 0; i < thread_count; i++) {
-        MultiFDSendParams *p = &multifd_send_state->params[i];
+    if (p->next_packet_size != used * TARGET_PAGE_SIZE) {
+        error_setg(errp, "multifd %d: packet size %d expected %d",
+                   p->id, p->next_packet_size, used * TARGET_PAGE_SIZE);
+        return -1;
+    }
+    return qio_channel_readv_all(p->c, p->pages->iov, used, errp);
+}
 
-        qemu_mutex_init(&p->mutex);
-        qemu_sem_init(&p->sem, 0);
-        p->quit = false;
-        p->id = i;
-        p->name = g_strdup_printf("multifdsend_%d", i);
-        qemu_thread_create(&p->thread, p->name, multifd_send_thread, p,
-                           QEMU_THREAD_JOINABLE);
+/* Multifd zlib compression */
+
+struct zlib_data {
+    /* stream for compression */
+    z_stream zs;
+    /* compressed buffer */
+    uint8_t *zbuff;
+    /* size of compressed buffer */
+    uint32_t zbuff_len;
+};
+
+static int zlib_send_setup(MultiFDSendParams *p, Error **errp)
+{
+    struct zlib_data *z = g_new0(struct zlib_data, 1);
+    z_stream *zs = &z->zs;
 
-        multifd_send_state->count++;
+    if (deflateInit(zs, migrate_compress_level()) != Z_OK) {
+        g_free(z);
+        error_setg(errp, "multifd %d: deflate init failed", p->id);
+        return -1;
     }
+    /* To be safe, we reserve twice the size of the packet */
+    z->zbuff_len = migrate_multifd_page_count() * TARGET_PAGE_SIZE * 2;
+    z->zbuff = g_try_malloc(z->zbuff_len);
+    if (!z->zbuff) {
+        deflateEnd(zs);
+        g_free(z);
+        error_setg(errp, "multifd %d: out of memory for zbuff", p->id);
+        return -1;
+    }
+    p->data = z;
     return 0;
 }
 
-struct MultiFDRecvParams {
-    uint8_t id;
-    char *name;
-    QemuThread thread;
-    QemuSemaphore sem;
-    QemuMutex mutex;
-    bool quit;
-};
-typedef struct MultiFDRecvParams MultiFDRecvParams;
+static void zlib_send_cleanup(MultiFDSendParams *p)
+{
+    struct zlib_data *z = p->data;
 
-struct {
-    MultiFDRecvParams *params;
-    /* number of created threads */
-    int count;
-} *multifd_recv_state;
+    if (!z) {
+        return;
+    }
+    deflateEnd(&z->zs);
+    g_free(z->zbuff);
+    g_free(z);
+    p->data = NULL;
+}
 
-static void terminate_multifd_recv_threads(Error *errp)
+/*
+ * The stream is never reset, so later packets use the dictionary built
+ * by the earlier ones; Z_SYNC_FLUSH on the last page makes the packet
+ * decodable on its own once the previous ones have been decoded.
+ */
+static int zlib_send_prepare(MultiFDSendParams *p, uint32_t used,
+                             Error **errp)
 {
-    int i;
+    struct zlib_data *z = p->data;
+    z_stream *zs = &z->zs;
+    uint32_t out_size = 0;
+    int ret;
+    uint32_t i;
 
-    for (i = 0; i < multifd_recv_state->count; i++) {
-        MultiFDRecvParams *p = &multifd_recv_state->params[i];
+    for (i = 0; i < used; i++) {
+        uint32_t available = z->zbuff_len - out_size;
+        int flush = Z_NO_FLUSH;
 
-        qemu_mutex_lock(&p->mutex);
-        p->quit = true;
-        qemu_sem_post(&p->sem);
-        qemu_mutex_unlock(&p->mutex);
+        if (i == used - 1) {
+            flush = Z_SYNC_FLUSH;
+        }
+
+        zs->avail_in = p->pages->iov[i].iov_len;
+        zs->next_in = p->pages->iov[i].iov_base;
+
+        zs->avail_out = available;
+        zs->next_out = z->zbuff + out_size;
+
+        /*
+         * Welcome to deflate semantics
+         *
+         * We need to loop while:
+         * - return is Z_OK
+         * - there are stuff to be compressed
+         * - there are output space free
+         */
+        do {
+            ret = deflate(zs, flush);
+        } while (ret == Z_OK && zs->avail_in && zs->avail_out);
+        if (ret == Z_OK && zs->avail_in) {
+            error_setg(errp, "multifd %d: deflate failed to compress all input",
+                       p->id);
+            return -1;
+        }
+        if (ret != Z_OK) {
+            error_setg(errp, "multifd %d: deflate returned %d instead of Z_OK",
+                       p->id, ret);
+            return -1;
+        }
+        out_size += available - zs->avail_out;
     }
+    p->next_packet_size = out_size;
+    p->flags |= MULTIFD_FLAG_ZLIB;
+
+    return 0;
 }
 
-int multifd_load_cleanup(Error **errp)
+static int zlib_send_write(MultiFDSendParams *p, uint32_t used, Error **errp)
 {
-    int i;
-    int ret = 0;
+    struct zlib_data *z = p->data;
 
-    if (!migrate_use_multifd()) {
-        return 0;
-    }
-    terminate_multifd_recv_threads(NULL);
-    for (i = 0; i < multifd_recv_state->count; i++) {
-        MultiFDRecvParams *p = &multifd_recv_state->params[i];
+    return qio_channel_write_all(p->c, (void *)z->zbuff, p->next_packet_size,
+                                 errp);
+}
 
-        qemu_thread_join(&p->thread);
-        qemu_mutex_destroy(&p->mutex);
-        qemu_sem_destroy(&p->sem);
-        g_free(p->name);
-        p->name = NULL;
+static int zlib_recv_setup(MultiFDRecvParams *p, Error **errp)
+{
+    struct zlib_data *z = g_new0(struct zlib_data, 1);
+    z_stream *zs = &z->zs;
+
+    zs->next_in = Z_NULL;
+    zs->avail_in = 0;
+    zs->total_in = 0;
+    if (inflateInit(zs) != Z_OK) {
+        g_free(z);
+        error_setg(errp, "multifd %d: inflate init failed", p->id);
+        return -1;
     }
-    g_free(multifd_recv_state->params);
-    multifd_recv_state->params = NULL;
-    g_free(multifd_recv_state);
-    multifd_recv_state = NULL;
-
-    return ret;
+    /* To be safe, we reserve twice the size of the packet */
+    z->zbuff_len = migrate_multifd_page_count() * TARGET_PAGE_SIZE * 2;
+    z->zbuff = g_try_malloc(z->zbuff_len);
+    if (!z->zbuff) {
+        inflateEnd(zs);
+        g_free(z);
+        error_setg(errp, "multifd %d: out of memory for zbuff", p->id);
+        return -1;
+    }
+    p->data = z;
+    return 0;
 }
 
-static void *multifd_recv_thread(void *opaque)
+static void zlib_recv_cleanup(MultiFDRecvParams *p)
 {
-    MultiFDRecvParams *p = opaque;
+    struct zlib_data *z = p->data;
 
-    while (true) {
-        qemu_mutex_lock(&p->mutex);
-        if (p->quit) {
-            qemu_mutex_unlock(&p->mutex);
-            break;
-        }
-        qemu_mutex_unlock(&p->mutex);
-        qemu_sem_wait(&p->sem);
+    if (!z) {
+        return;
     }
-
-    return NULL;
+    inflateEnd(&z->zs);
+    g_free(z->zbuff);
+    g_free(z);
+    p->data = NULL;
 }
 
-int multifd_load_setup(void)
+static int zlib_recv_pages(MultiFDRecvParams *p, uint32_t used, Error **errp)
 {
-    int thread_count;
-    uint8_t i;
+    struct zlib_data *z = p->data;
+    z_stream *zs = &z->zs;
+    uint32_t in_size = p->next_packet_size;
+    /* we measure the change of total_out */
+    uint32_t out_size = zs->total_out;
+    uint32_t expected_size = used * TARGET_PAGE_SIZE;
+    uint32_t flags = p->flags & MULTIFD_FLAG_COMPRESSION_MASK;
+    int ret;
+    uint32_t i;
 
-    if (!migrate_use_multifd()) {
-        return 0;
+    if (flags != MULTIFD_FLAG_ZLIB) {
+        error_setg(errp, "multifd %d: flags received %x flags expected %x",
+                   p->id, flags, MULTIFD_FLAG_ZLIB);
+        return -1;
+    }
+    if (in_size > z->zbuff_len) {
+        error_setg(errp, "multifd %d: packet of %d bytes does not fit "
+                   "the %d bytes buffer", p->id, in_size, z->zbuff_len);
+        return -1;
+    }
+    ret = qio_channel_read_all(p->c, (void *)z->zbuff, in_size, errp);
+    if (ret != 0) {
+        return ret;
     }
-    thread_count = migrate_multifd_channels();
-    multifd_recv_state = g_malloc0(sizeof(*multifd_recv_state));
-    multifd_recv_state->params = g_new0(MultiFDRecvParams, thread_count);
-    multifd_recv_state->count = 0;
-    for (i = 0; i < thread_count; i++) {
-        MultiFDRecvParams *p = &multifd_recv_state->params[i];
 
-        qemu_mutex_init(&p->mutex);
-        qemu_sem_init(&p->sem, 0);
-        p->quit = false;
-        p->id = i;
-        p->name = g_strdup_printf("multifdrecv_%d", i);
-        qemu_thread_create(&p->thread, p->name, multifd_recv_thread, p,
-                           QEMU_THREAD_JOINABLE);
-        multifd_recv_state->count++;
+    zs->avail_in = in_size;
+    zs->next_in = z->zbuff;
+
+    for (i = 0; i < used; i++) {
+        struct iovec *iov = &p->pages->iov[i];
+        int flush = Z_NO_FLUSH;
+        unsigned long start = zs->total_out;
+
+        if (i == used - 1) {
+            flush = Z_SYNC_FLUSH;
+        }
+
+        zs->avail_out = iov->iov_len;
+        zs->next_out = iov->iov_base;
+
+        /*
+         * Welcome to inflate semantics
+         *
+         * We need to loop while:
+         * - return is Z_OK
+         * - there are input available
+         * - we haven't completed a full page
+         */
+        do {
+            ret = inflate(zs, flush);
+        } while (ret == Z_OK && zs->avail_in
+                             && (zs->total_out - start) < iov->iov_len);
+        if (ret == Z_OK && (zs->total_out - start) < iov->iov_len) {
+            error_setg(errp, "multifd %d: inflate generated too few output",
+                       p->id);
+            return -1;
+        }
+        if (ret != Z_OK) {
+            error_setg(errp, "multifd %d: inflate returned %d instead of Z_OK",
+                       p->id, ret);
+            return -1;
+        }
+    }
+    out_size = zs->total_out - out_size;
+    if (out_size != expected_size) {
+        error_setg(errp, "multifd %d: packet size received %d size expected %d",
+                   p->id, out_size, expected_size);
+        return -1;
     }
     return 0;
 }
 
-/**
- * save_page_header: write page header to wire
- *
- * If this is the 1st block, it also writes the block identification
- *
- * Returns the number of bytes written
- *
- * @f: QEMUFile where to send the data
- * @block: block that contains the page we want to send
- * @offset: offset inside the block for the page
- *          in the lower bits, it contains flags
- */
-static size_t save_page_header(RAMState *rs, QEMUFile *f,  RAMBlock *block,
-                               ram_addr_t offset)
+#ifdef CONFIG_ZSTD
+/* Multifd zstd compression */
+
+struct zstd_data {
+    /* stream for compression */
+    ZSTD_CStream *zcs;
+    /* stream for decompression */
+    ZSTD_DStream *zds;
+    /* buffers */
+    ZSTD_inBuffer in;
+    ZSTD_outBuffer out;
+    /* compressed buffer */
+    uint8_t *zbuff;
+    /* size of compressed buffer */
+    uint32_t zbuff_len;
+};
+
+static int zstd_send_setup(MultiFDSendParams *p, Error **errp)
 {
-    size_t size, len;
+    struct zstd_data *z = g_new0(struct zstd_data, 1);
+    size_t res;
 
-    if (block == rs->last_sent_block) {
-        offset |= RAM_SAVE_FLAG_CONTINUE;
+    z->zcs = ZSTD_createCStream();
+    if (!z->zcs) {
+        g_free(z);
+        error_setg(errp, "multifd %d: zstd createCStream failed", p->id);
+        return -1;
     }
-    qemu_put_be64(f, offset);
-    size = 8;
+    /* Level 0 selects the zstd default level */
+    res = ZSTD_initCStream(z->zcs, migrate_compress_level());
+    if (ZSTD_isError(res)) {
+        ZSTD_freeCStream(z->zcs);
+        g_free(z);
+        error_setg(errp, "multifd %d: initCStream failed with error %s",
+                   p->id, ZSTD_getErrorName(res));
+        return -1;
+    }
+    /* To be safe, we reserve twice the size of the packet */
+    z->zbuff_len = migrate_multifd_page_count() * TARGET_PAGE_SIZE * 2;
+    z->zbuff = g_try_malloc(z->zbuff_len);
+    if (!z->zbuff) {
+        ZSTD_freeCStream(z->zcs);
+        g_free(z);
+        error_setg(errp, "multifd %d: out of memory for zbuff", p->id);
+        return -1;
+    }
+    p->data = z;
+    return 0;
+}
 
-    if (!(offset & RAM_SAVE_FLAG_CONTINUE)) {
-        len = strlen(block->idstr);
-        qemu_put_byte(f, len);
-        qemu_put_buffer(f, (uint8_t *)block->idstr, len);
-        size += 1 + len;
-        rs->last_sent_block = block;
+static void zstd_send_cleanup(MultiFDSendParams *p)
+{
+    struct zstd_data *z = p->data;
+
+    if (!z) {
+        return;
     }
-    return size;
+    ZSTD_freeCStream(z->zcs);
+    g_free(z->zbuff);
+    g_free(z);
+    p->data = NULL;
+}
+
+static int zstd_send_prepare(MultiFDSendParams *p, uint32_t used,
+                             Error **errp)
+{
+    struct zstd_data *z = p->data;
+    size_t ret = 0;
+    uint32_t i;
+
+    z->out.dst = z->zbuff;
+    z->out.size = z->zbuff_len;
+    z->out.pos = 0;
+
+    for (i = 0; i < used; i++) {
+        ZSTD_EndDirective flush = ZSTD_e_continue;
+
+        if (i == used - 1) {
+            flush = ZSTD_e_flush;
+        }
+        z->in.src = p->pages->iov[i].iov_base;
+        z->in.size = p->pages->iov[i].iov_len;
+        z->in.pos = 0;
+
+        /*
+         * Welcome to compressStream2 semantics
+         *
+         * We need to loop while:
+         * - return is > 0 (there is still data to consume or flush)
+         * - there is input left, or we are flushing
+         * - there is output space free
+         */
+        do {
+            ret = ZSTD_compressStream2(z->zcs, &z->out, &z->in, flush);
+        } while (ret > 0 && !ZSTD_isError(ret) &&
+                 (z->in.size - z->in.pos > 0 || flush == ZSTD_e_flush) &&
+                 (z->out.size - z->out.pos > 0));
+        if (ZSTD_isError(ret)) {
+            error_setg(errp, "multifd %d: compressStream error %s",
+                       p->id, ZSTD_getErrorName(ret));
+            return -1;
+        }
+        if (ret > 0 || z->in.size - z->in.pos > 0) {
+            error_setg(errp, "multifd %d: compressStream buffer too small",
+                       p->id);
+            return -1;
+        }
+    }
+    p->next_packet_size = z->out.pos;
+    p->flags |= MULTIFD_FLAG_ZSTD;
+
+    return 0;
+}
+
+static int zstd_send_write(MultiFDSendParams *p, uint32_t used, Error **errp)
+{
+    struct zstd_data *z = p->data;
+
+    return qio_channel_write_all(p->c, (void *)z->zbuff, p->next_packet_size,
+                                 errp);
+}
+
+static int zstd_recv_setup(MultiFDRecvParams *p, Error **errp)
+{
+    struct zstd_data *z = g_new0(struct zstd_data, 1);
+    size_t ret;
+
+    z->zds = ZSTD_createDStream();
+    if (!z->zds) {
+        g_free(z);
+        error_setg(errp, "multifd %d: create DStream failed", p->id);
+        return -1;
+    }
+    ret = ZSTD_initDStream(z->zds);
+    if (ZSTD_isError(ret)) {
+        ZSTD_freeDStream(z->zds);
+        g_free(z);
+        error_setg(errp, "multifd %d: initDStream failed with error %s",
+                   p->id, ZSTD_getErrorName(ret));
+        return -1;
+    }
+    /* To be safe, we reserve twice the size of the packet */
+    z->zbuff_len = migrate_multifd_page_count() * TARGET_PAGE_SIZE * 2;
+    z->zbuff = g_try_malloc(z->zbuff_len);
+    if (!z->zbuff) {
+        ZSTD_freeDStream(z->zds);
+        g_free(z);
+        error_setg(errp, "multifd %d: out of memory for zbuff", p->id);
+        return -1;
+    }
+    p->data = z;
+    return 0;
+}
+
+static void zstd_recv_cleanup(MultiFDRecvParams *p)
+{
+    struct zstd_data *z = p->data;
+
+    if (!z) {
+        return;
+    }
+    ZSTD_freeDStream(z->zds);
+    g_free(z->zbuff);
+    g_free(z);
+    p->data = NULL;
+}
+
+static int zstd_recv_pages(MultiFDRecvParams *p, uint32_t used, Error **errp)
+{
+    struct zstd_data *z = p->data;
+    uint32_t in_size = p->next_packet_size;
+    uint32_t out_size = 0;
+    uint32_t expected_size = used * TARGET_PAGE_SIZE;
+    uint32_t flags = p->flags & MULTIFD_FLAG_COMPRESSION_MASK;
+    size_t ret;
+    int err;
+    uint32_t i;
+
+    if (flags != MULTIFD_FLAG_ZSTD) {
+        error_setg(errp, "multifd %d: flags received %x flags expected %x",
+                   p->id, flags, MULTIFD_FLAG_ZSTD);
+        return -1;
+    }
+    if (in_size > z->zbuff_len) {
+        error_setg(errp, "multifd %d: packet of %d bytes does not fit "
+                   "the %d bytes buffer", p->id, in_size, z->zbuff_len);
+        return -1;
+    }
+    err = qio_channel_read_all(p->c, (void *)z->zbuff, in_size, errp);
+    if (err != 0) {
+        return err;
+    }
+
+    z->in.src = z->zbuff;
+    z->in.size = in_size;
+    z->in.pos = 0;
+
+    for (i = 0; i < used; i++) {
+        struct iovec *iov = &p->pages->iov[i];
+
+        z->out.dst = iov->iov_base;
+        z->out.size = iov->iov_len;
+        z->out.pos = 0;
+
+        /*
+         * Welcome to decompressStream semantics
+         *
+         * We need to loop while:
+         * - return is > 0
+         * - there is input available
+         * - we haven't put out a full page
+         */
+        do {
+            ret = ZSTD_decompressStream(z->zds, &z->out, &z->in);
+        } while (ret > 0 && !ZSTD_isError(ret) &&
+                 (z->in.size - z->in.pos > 0) &&
+                 (z->out.pos < iov->iov_len));
+        if (ZSTD_isError(ret)) {
+            error_setg(errp, "multifd %d: decompressStream returned %s",
+                       p->id, ZSTD_getErrorName(ret));
+            return -1;
+        }
+        if (z->out.pos < iov->iov_len) {
+            error_setg(errp, "multifd %d: decompressStream generated too "
+                       "few output", p->id);
+            return -1;
+        }
+        out_size += z->out.pos;
+    }
+    if (out_size != expected_size) {
+        error_setg(errp, "multifd %d: packet size received %d size expected %d",
+                   p->id, out_size, expected_size);
+        return -1;
+    }
+    return 0;
+}
+#endif /* CONFIG_ZSTD */
+
+static MultiFDMethods multifd_methods[MULTIFD_COMPRESSION__MAX] = {
+    [MULTIFD_COMPRESSION_NONE] = {
+        .send_setup = nocomp_send_setup,
+        .send_cleanup = nocomp_send_cleanup,
+        .send_prepare = nocomp_send_prepare,
+        .send_write = nocomp_send_write,
+        .recv_setup = nocomp_recv_setup,
+        .recv_cleanup = nocomp_recv_cleanup,
+        .recv_pages = nocomp_recv_pages,
+    },
+    [MULTIFD_COMPRESSION_ZLIB] = {
+        .send_setup = zlib_send_setup,
+        .send_cleanup = zlib_send_cleanup,
+        .send_prepare = zlib_send_prepare,
+        .send_write = zlib_send_write,
+        .recv_setup = zlib_recv_setup,
+        .recv_cleanup = zlib_recv_cleanup,
+        .recv_pages = zlib_recv_pages,
+    },
+#ifdef CONFIG_ZSTD
+    [MULTIFD_COMPRESSION_ZSTD] = {
+        .send_setup = zstd_send_setup,
+        .send_cleanup = zstd_send_cleanup,
+        .send_prepare = zstd_send_prepare,
+        .send_write = zstd_send_write,
+        .recv_setup = zstd_recv_setup,
+        .recv_cleanup = zstd_recv_cleanup,
+        .recv_pages = zstd_recv_pages,
+    },
+#endif
+};
+
+/* Set at setup time from the x-multifd-compression parameter */
+static MultiFDMethods *multifd_ops;
+
+struct {
+    MultiFDSendParams *params;
+    /* number of created threads */
+    int count;
+    /* pages being filled by the migration thread */
+    MultiFDPages_t *pages;
+    /* one token per idle channel */
+    QemuSemaphore channels_ready;
+    /* posted by each channel once it has sent a sync packet */
+    QemuSemaphore sem_sync;
+    /* global number of generated multifd packets */
+    uint64_t packet_num;
+    /* set when a channel failed and the migration must be aborted */
+    int exiting;
+} *multifd_send_state;
+
+static MultiFDPages_t *multifd_pages_init(size_t size)
+{
+    MultiFDPages_t *pages = g_new0(MultiFDPages_t, 1);
+
+    pages->allocated = size;
+    pages->iov = g_new0(struct iovec, size);
+    pages->offset = g_new0(ram_addr_t, size);
+
+    return pages;
+}
+
+static void multifd_pages_clear(MultiFDPages_t *pages)
+{
+    pages->used = 0;
+    pages->allocated = 0;
+    pages->block = NULL;
+    g_free(pages->iov);
+    pages->iov = NULL;
+    g_free(pages->offset);
+    pages->offset = NULL;
+    g_free(pages);
+}
+
+static int multifd_send_initial_packet(MultiFDSendParams *p, Error **errp)
+{
+    MultiFDInit_t msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.magic = cpu_to_be32(MULTIFD_MAGIC);
+    msg.version = cpu_to_be32(MULTIFD_VERSION);
+    msg.id = p->id;
+    memcpy(msg.uuid, &qemu_uuid.data, sizeof(msg.uuid));
+
+    return qio_channel_write_all(p->c, (char *)&msg, sizeof(msg), errp);
+}
+
+static int multifd_recv_initial_packet(QIOChannel *c, Error **errp)
+{
+    MultiFDInit_t msg;
+    int ret;
+
+    ret = qio_channel_read_all(c, (char *)&msg, sizeof(msg), errp);
+    if (ret != 0) {
+        return -1;
+    }
+
+    msg.magic = be32_to_cpu(msg.magic);
+    msg.version = be32_to_cpu(msg.version);
+
+    if (msg.magic != MULTIFD_MAGIC) {
+        error_setg(errp, "multifd: received packet magic %x "
+                   "expected %x", msg.magic, MULTIFD_MAGIC);
+        return -1;
+    }
+
+    if (msg.version != MULTIFD_VERSION) {
+        error_setg(errp, "multifd: received packet version %d "
+                   "expected %d", msg.version, MULTIFD_VERSION);
+        return -1;
+    }
+
+    if (memcmp(msg.uuid, &qemu_uuid, sizeof(qemu_uuid))) {
+        char *uuid = qemu_uuid_unparse_strdup(&qemu_uuid);
+        char *msg_uuid = qemu_uuid_unparse_strdup((const QemuUUID *)msg.uuid);
+
+        error_setg(errp, "multifd: received uuid '%s' and expected "
+                   "uuid '%s' for channel %hhd", msg_uuid, uuid, msg.id);
+        g_free(uuid);
+        g_free(msg_uuid);
+        return -1;
+    }
+
+    if (msg.id >= migrate_multifd_channels()) {
+        error_setg(errp, "multifd: received channel id %d is greater "
+                   "than number of channels %d", msg.id,
+                   migrate_multifd_channels());
+        return -1;
+    }
+
+    return msg.id;
+}
+
+static void multifd_send_fill_packet(MultiFDSendParams *p)
+{
+    MultiFDPacket_t *packet = p->packet;
+    int i;
+
+    packet->magic = cpu_to_be32(MULTIFD_MAGIC);
+    packet->version = cpu_to_be32(MULTIFD_VERSION);
+    packet->flags = cpu_to_be32(p->flags);
+    packet->size = cpu_to_be32(migrate_multifd_page_count());
+    packet->used = cpu_to_be32(p->pages->used);
+    packet->next_packet_size = cpu_to_be32(p->next_packet_size);
+    packet->packet_num = cpu_to_be64(p->packet_num);
+
+    if (p->pages->block) {
+        strncpy(packet->ramblock, p->pages->block->idstr, 256);
+    } else {
+        packet->ramblock[0] = '\0';
+    }
+
+    for (i = 0; i < p->pages->used; i++) {
+        packet->offset[i] = cpu_to_be64(p->pages->offset[i]);
+    }
+}
+
+static void terminate_multifd_send_threads(Error *err)
+{
+    int i;
+
+    if (err) {
+        error_report_err(err);
+    }
+
+    if (err) {
+        atomic_set(&multifd_send_state->exiting, 1);
+    }
+    for (i = 0; i < migrate_multifd_channels(); i++) {
+        MultiFDSendParams *p = &multifd_send_state->params[i];
+
+        qemu_mutex_lock(&p->mutex);
+        p->quit = true;
+        /* Don't leave a thread blocked in a write to a dead peer */
+        if (p->c) {
+            qio_channel_shutdown(p->c, QIO_CHANNEL_SHUTDOWN_BOTH, NULL);
+        }
+        qemu_sem_post(&p->sem);
+        qemu_mutex_unlock(&p->mutex);
+    }
+    /* Wake up the migration thread if it is waiting for a channel */
+    for (i = 0; i < migrate_multifd_channels(); i++) {
+        qemu_sem_post(&multifd_send_state->channels_ready);
+        qemu_sem_post(&multifd_send_state->sem_sync);
+    }
+}
+
+int multifd_save_cleanup(Error **errp)
+{
+    int i;
+    int ret = 0;
+
+    if (!migrate_use_multifd() || !multifd_send_state) {
+        return 0;
+    }
+    terminate_multifd_send_threads(NULL);
+    for (i = 0; i < migrate_multifd_channels(); i++) {
+        MultiFDSendParams *p = &multifd_send_state->params[i];
+
+        if (p->running) {
+            qemu_thread_join(&p->thread);
+            p->running = false;
+        }
+        if (p->c) {
+            socket_send_channel_destroy(p->c);
+            p->c = NULL;
+        }
+        multifd_ops->send_cleanup(p);
+        qemu_mutex_destroy(&p->mutex);
+        qemu_sem_destroy(&p->sem);
+        g_free(p->name);
+        p->name = NULL;
+        multifd_pages_clear(p->pages);
+        p->pages = NULL;
+        p->packet_len = 0;
+        g_free(p->packet);
+        p->packet = NULL;
+    }
+    qemu_sem_destroy(&multifd_send_state->channels_ready);
+    qemu_sem_destroy(&multifd_send_state->sem_sync);
+    g_free(multifd_send_state->params);
+    multifd_send_state->params = NULL;
+    multifd_pages_clear(multifd_send_state->pages);
+    multifd_send_state->pages = NULL;
+    g_free(multifd_send_state);
+    multifd_send_state = NULL;
+    return ret;
+}
+
+/**
+ * multifd_send_pages: hand the pending pages over to an idle channel
+ *
+ * Returns 0 for success or -1 if the channels are shutting down because
+ * of an error.
+ *
+ * Called from the migration thread.  Blocks until one of the channels
+ * has finished sending its previous batch.
+ */
+static int multifd_send_pages(void)
+{
+    int i;
+    static int next_channel;
+    MultiFDSendParams *p = NULL;
+    MultiFDPages_t *pages = multifd_send_state->pages;
+    uint64_t transferred;
+
+    if (atomic_read(&multifd_send_state->exiting)) {
+        return -1;
+    }
+
+    qemu_sem_wait(&multifd_send_state->channels_ready);
+    /* The number of channels may have changed since the last migration */
+    next_channel %= migrate_multifd_channels();
+    for (i = next_channel;; i = (i + 1) % migrate_multifd_channels()) {
+        p = &multifd_send_state->params[i];
+
+        qemu_mutex_lock(&p->mutex);
+        if (p->quit) {
+            qemu_mutex_unlock(&p->mutex);
+            return -1;
+        }
+        if (!p->pending_job) {
+            p->pending_job = true;
+            next_channel = (i + 1) % migrate_multifd_channels();
+            break;
+        }
+        qemu_mutex_unlock(&p->mutex);
+    }
+
+    /* Swap the filled page array with the idle one of the channel */
+    p->pages->used = 0;
+    p->pages->block = NULL;
+    multifd_send_state->pages = p->pages;
+    p->pages = pages;
+    p->packet_num = multifd_send_state->packet_num++;
+    transferred = ((uint64_t) pages->used) * TARGET_PAGE_SIZE + p->packet_len;
+    qemu_mutex_unlock(&p->mutex);
+    qemu_sem_post(&p->sem);
+
+    ram_counters.transferred += transferred;
+    qemu_file_update_transfer(ram_state->f, transferred);
+
+    return 0;
+}
+
+/**
+ * multifd_queue_page: add a page to the batch being built
+ *
+ * Returns 0 for success or -1 on error
+ *
+ * Pages of a batch must all come from the same RAMBlock, so the batch
+ * is sent as soon as it is full or the block changes.
+ *
+ * @block: block that contains the page
+ * @offset: offset of the page inside @block
+ */
+static int multifd_queue_page(RAMBlock *block, ram_addr_t offset)
+{
+    MultiFDPages_t *pages = multifd_send_state->pages;
+
+    if (pages->block && pages->block != block) {
+        if (multifd_send_pages() < 0) {
+            return -1;
+        }
+        pages = multifd_send_state->pages;
+    }
+
+    pages->block = block;
+    pages->offset[pages->used] = offset;
+    pages->iov[pages->used].iov_base = block->host + offset;
+    pages->iov[pages->used].iov_len = TARGET_PAGE_SIZE;
+    pages->used++;
+
+    if (pages->used == pages->allocated) {
+        return multifd_send_pages();
+    }
+    return 0;
+}
+
+/**
+ * multifd_send_sync_main: make all channels send a sync packet
+ *
+ * Returns 0 for success or -1 on error
+ *
+ * Flushes the pending batch and waits until every channel has put all
+ * its pages and a sync packet on the wire.  The destination does not go
+ * past the RAM_SAVE_FLAG_EOS that follows until it has received every
+ * page sent before the sync, which keeps pages that are resent in a
+ * later round from being overwritten by stale contents.
+ *
+ * @rs: current RAM state
+ */
+static int multifd_send_sync_main(RAMState *rs)
+{
+    int i;
+
+    if (!migrate_use_multifd() || !multifd_send_state) {
+        return 0;
+    }
+    if (multifd_send_state->pages->used) {
+        if (multifd_send_pages() < 0) {
+            return -1;
+        }
+    }
+
+    /* Take every channel: once we hold all tokens, they are all idle */
+    for (i = 0; i < migrate_multifd_channels(); i++) {
+        qemu_sem_wait(&multifd_send_state->channels_ready);
+    }
+    if (atomic_read(&multifd_send_state->exiting)) {
+        return -1;
+    }
+
+    for (i = 0; i < migrate_multifd_channels(); i++) {
+        MultiFDSendParams *p = &multifd_send_state->params[i];
+
+        trace_multifd_send_sync_main_signal(p->id);
+
+        qemu_mutex_lock(&p->mutex);
+        if (p->quit) {
+            qemu_mutex_unlock(&p->mutex);
+            return -1;
+        }
+        p->packet_num = multifd_send_state->packet_num++;
+        p->flags |= MULTIFD_FLAG_SYNC;
+        p->pending_job = true;
+        qemu_mutex_unlock(&p->mutex);
+        qemu_sem_post(&p->sem);
+
+        ram_counters.transferred += p->packet_len;
+        qemu_file_update_transfer(rs->f, p->packet_len);
+    }
+    for (i = 0; i < migrate_multifd_channels(); i++) {
+        trace_multifd_send_sync_main_wait(i);
+        qemu_sem_wait(&multifd_send_state->sem_sync);
+    }
+    trace_multifd_send_sync_main(multifd_send_state->packet_num);
+
+    if (atomic_read(&multifd_send_state->exiting)) {
+        return -1;
+    }
+    return 0;
+}
+
+static void *multifd_send_thread(void *opaque)
+{
+    MultiFDSendParams *p = opaque;
+    Error *local_err = NULL;
+
+    trace_multifd_send_thread_start(p->id);
+
+    if (multifd_send_initial_packet(p, &local_err) < 0) {
+        goto out;
+    }
+    p->num_packets = 1;
+
+    while (true) {
+        qemu_sem_post(&multifd_send_state->channels_ready);
+        qemu_sem_wait(&p->sem);
+        qemu_mutex_lock(&p->mutex);
+
+        while (!p->pending_job && !p->quit) {
+            /* spurious wakeup, e.g. left over from a previous job */
+            qemu_mutex_unlock(&p->mutex);
+            qemu_sem_wait(&p->sem);
+            qemu_mutex_lock(&p->mutex);
+        }
+
+        if (p->pending_job) {
+            uint32_t used = p->pages->used;
+            uint64_t packet_num = p->packet_num;
+            uint32_t flags;
+
+            p->next_packet_size = 0;
+            qemu_mutex_unlock(&p->mutex);
+
+            /* Compress outside of the lock */
+            if (used && multifd_ops->send_prepare(p, used, &local_err) < 0) {
+                break;
+            }
+
+            qemu_mutex_lock(&p->mutex);
+            flags = p->flags;
+            multifd_send_fill_packet(p);
+            p->flags = 0;
+            p->num_packets++;
+            p->num_pages += used;
+            qemu_mutex_unlock(&p->mutex);
+
+            trace_multifd_send(p->id, packet_num, used, flags,
+                               p->next_packet_size);
+
+            if (qio_channel_write_all(p->c, (void *)p->packet,
+                                      p->packet_len, &local_err) < 0) {
+                break;
+            }
+            if (used && multifd_ops->send_write(p, used, &local_err) < 0) {
+                break;
+            }
+
+            qemu_mutex_lock(&p->mutex);
+            p->pages->used = 0;
+            p->pages->block = NULL;
+            p->pending_job = false;
+            qemu_mutex_unlock(&p->mutex);
+
+            if (flags & MULTIFD_FLAG_SYNC) {
+                /* The pages must really be on the wire before the sync
+                 * point, or a later dirtying may be lost at the target.
+                 */
+                if (migrate_use_zero_copy_send() &&
+                    qio_channel_flush(p->c, &local_err) < 0) {
+                    break;
+                }
+                qemu_sem_post(&multifd_send_state->sem_sync);
+            }
+        } else {
+            /* p->quit */
+            qemu_mutex_unlock(&p->mutex);
+            break;
+        }
+    }
+
+out:
+    if (local_err) {
+        terminate_multifd_send_threads(local_err);
+    }
+
+    trace_multifd_send_thread_end(p->id, p->num_packets, p->num_pages);
+
+    return NULL;
+}
+
+static void multifd_new_send_channel_async(QIOTask *task, gpointer opaque)
+{
+    uint8_t id = GPOINTER_TO_UINT(opaque);
+    QIOChannel *sioc = QIO_CHANNEL(qio_task_get_source(task));
+    MultiFDSendParams *p;
+    Error *local_err = NULL;
+
+    if (!multifd_send_state) {
+        /* The migration was cleaned up while we were connecting */
+        object_unref(OBJECT(sioc));
+        return;
+    }
+
+    if (qio_task_propagate_error(task, &local_err)) {
+        object_unref(OBJECT(sioc));
+        terminate_multifd_send_threads(local_err);
+        return;
+    }
+
+    if (migrate_use_zero_copy_send() &&
+        !qio_channel_has_feature(sioc, QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY)) {
+        error_setg(&local_err, "multifd: channel does not support zero copy");
+        object_unref(OBJECT(sioc));
+        terminate_multifd_send_threads(local_err);
+        return;
+    }
+
+    p = &multifd_send_state->params[id];
+    qemu_mutex_lock(&p->mutex);
+    p->c = sioc;
+    qemu_mutex_unlock(&p->mutex);
+    qio_channel_set_delay(p->c, false);
+    p->running = true;
+    qemu_thread_create(&p->thread, p->name, multifd_send_thread, p,
+                       QEMU_THREAD_JOINABLE);
+    multifd_send_state->count++;
+}
+
+int multifd_save_setup(void)
+{
+    MigrationState *s = migrate_get_current();
+    int thread_count;
+    uint32_t page_count = migrate_multifd_page_count();
+    uint8_t i;
+
+    if (!migrate_use_multifd()) {
+        return 0;
+    }
+    if (s->parameters.tls_creds && *s->parameters.tls_creds) {
+        error_report("multifd: TLS is not supported yet");
+        return -1;
+    }
+    if (migrate_use_zero_copy_send() &&
+        migrate_multifd_compression() != MULTIFD_COMPRESSION_NONE) {
+        error_report("multifd: zero copy send needs compression 'none'");
+        return -1;
+    }
+    multifd_ops = &multifd_methods[migrate_multifd_compression()];
+    if (!multifd_ops->send_setup) {
+        error_report("multifd: compression method %s is not supported",
+                     MultiFDCompression_str(migrate_multifd_compression()));
+        return -1;
+    }
+    thread_count = migrate_multifd_channels();
+    multifd_send_state = g_malloc0(sizeof(*multifd_send_state));
+    multifd_send_state->params = g_new0(MultiFDSendParams, thread_count);
+    multifd_send_state->count = 0;
+    multifd_send_state->pages = multifd_pages_init(page_count);
+    qemu_sem_init(&multifd_send_state->channels_ready, 0);
+    qemu_sem_init(&multifd_send_state->sem_sync, 0);
+    for (i = 0; i < thread_count; i++) {
+        MultiFDSendParams *p = &multifd_send_state->params[i];
+
+        qemu_mutex_init(&p->mutex);
+        qemu_sem_init(&p->sem, 0);
+        p->quit = false;
+        p->pending_job = false;
+        p->id = i;
+        p->pages = multifd_pages_init(page_count);
+        p->packet_len = sizeof(MultiFDPacket_t)
+                      + sizeof(uint64_t) * page_count;
+        p->packet = g_malloc0(p->packet_len);
+        p->name = g_strdup_printf("multifdsend_%d", i);
+    }
+    for (i = 0; i < thread_count; i++) {
+        MultiFDSendParams *p = &multifd_send_state->params[i];
+        Error *local_err = NULL;
+
+        if (multifd_ops->send_setup(p, &local_err) < 0) {
+            error_report_err(local_err);
+            multifd_save_cleanup(NULL);
+            return -1;
+        }
+    }
+    for (i = 0; i < thread_count; i++) {
+        if (socket_send_channel_create(multifd_new_send_channel_async,
+                                       GUINT_TO_POINTER(i)) < 0) {
+            error_report("multifd: only tcp and unix migration "
+                         "URIs are supported");
+            multifd_save_cleanup(NULL);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+struct {
+    MultiFDRecvParams *params;
+    /* number of created threads */
+    int count;
+    /* posted by each channel once it has received a sync packet */
+    QemuSemaphore sem_sync;
+    /* global number of received multifd packets */
+    uint64_t packet_num;
+    /* set when a channel failed and the migration must be aborted */
+    int exiting;
+} *multifd_recv_state;
+
+static void terminate_multifd_recv_threads(Error *err)
+{
+    int i;
+
+    if (err) {
+        error_report_err(err);
+        atomic_set(&multifd_recv_state->exiting, 1);
+    }
+
+    for (i = 0; i < migrate_multifd_channels(); i++) {
+        MultiFDRecvParams *p = &multifd_recv_state->params[i];
+
+        qemu_mutex_lock(&p->mutex);
+        /*
+         * We get here either because everything went fine and we are
+         * done, or because of an error.  In both cases closing the
+         * channel makes the thread leave qio_channel_read_all_eof().
+         */
+        if (p->c) {
+            qio_channel_shutdown(p->c, QIO_CHANNEL_SHUTDOWN_BOTH, NULL);
+        }
+        qemu_sem_post(&p->sem_sync);
+        qemu_mutex_unlock(&p->mutex);
+        if (err) {
+            qemu_sem_post(&multifd_recv_state->sem_sync);
+        }
+    }
+}
+
+int multifd_load_cleanup(Error **errp)
+{
+    int i;
+    int ret = 0;
+
+    if (!migrate_use_multifd() || !multifd_recv_state) {
+        return 0;
+    }
+    terminate_multifd_recv_threads(NULL);
+    for (i = 0; i < migrate_multifd_channels(); i++) {
+        MultiFDRecvParams *p = &multifd_recv_state->params[i];
+
+        if (p->running) {
+            qemu_thread_join(&p->thread);
+            p->running = false;
+        }
+        if (p->c) {
+            object_unref(OBJECT(p->c));
+            p->c = NULL;
+        }
+        multifd_ops->recv_cleanup(p);
+        qemu_mutex_destroy(&p->mutex);
+        qemu_sem_destroy(&p->sem_sync);
+        g_free(p->name);
+        p->name = NULL;
+        multifd_pages_clear(p->pages);
+        p->pages = NULL;
+        p->packet_len = 0;
+        g_free(p->packet);
+        p->packet = NULL;
+    }
+    if (atomic_read(&multifd_recv_state->exiting)) {
+        error_setg(errp, "multifd: a receive channel failed");
+        ret = -1;
+    }
+    qemu_sem_destroy(&multifd_recv_state->sem_sync);
+    g_free(multifd_recv_state->params);
+    multifd_recv_state->params = NULL;
+    g_free(multifd_recv_state);
+    multifd_recv_state = NULL;
+
+    return ret;
+}
+
+static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
+{
+    MultiFDPacket_t *packet = p->packet;
+    uint32_t size = migrate_multifd_page_count();
+    RAMBlock *block;
+    uint32_t used;
+    int i;
+
+    packet->magic = be32_to_cpu(packet->magic);
+    if (packet->magic != MULTIFD_MAGIC) {
+        error_setg(errp, "multifd: received packet "
+                   "magic %x and expected magic %x",
+                   packet->magic, MULTIFD_MAGIC);
+        return -1;
+    }
+
+    packet->version = be32_to_cpu(packet->version);
+    if (packet->version != MULTIFD_VERSION) {
+        error_setg(errp, "multifd: received packet "
+                   "version %d and expected version %d",
+                   packet->version, MULTIFD_VERSION);
+        return -1;
+    }
+
+    p->flags = be32_to_cpu(packet->flags);
+
+    packet->size = be32_to_cpu(packet->size);
+    if (packet->size != size) {
+        error_setg(errp, "multifd: received packet "
+                   "with size %d and expected size %d "
+                   "(x-multifd-page-count must match on both sides)",
+                   packet->size, size);
+        return -1;
+    }
+
+    used = be32_to_cpu(packet->used);
+    if (used > size) {
+        error_setg(errp, "multifd: received packet "
+                   "with %d pages and expected maximum pages are %d",
+                   used, size);
+        return -1;
+    }
+
+    p->next_packet_size = be32_to_cpu(packet->next_packet_size);
+    p->packet_num = be64_to_cpu(packet->packet_num);
+    p->pages->used = used;
+    if (!used) {
+        return 0;
+    }
+
+    /* make sure that ramblock is 0 terminated */
+    packet->ramblock[255] = 0;
+    rcu_read_lock();
+    block = qemu_ram_block_by_name(packet->ramblock);
+    rcu_read_unlock();
+    if (!block) {
+        error_setg(errp, "multifd: unknown ram block %s",
+                   packet->ramblock);
+        return -1;
+    }
+
+    for (i = 0; i < used; i++) {
+        ram_addr_t offset = be64_to_cpu(packet->offset[i]);
+
+        if (offset > (block->used_length - TARGET_PAGE_SIZE)) {
+            error_setg(errp, "multifd: offset too long " RAM_ADDR_FMT
+                       " (max " RAM_ADDR_FMT ")",
+                       offset, block->used_length);
+            return -1;
+        }
+        p->pages->iov[i].iov_base = block->host + offset;
+        p->pages->iov[i].iov_len = TARGET_PAGE_SIZE;
+    }
+
+    return 0;
+}
+
+/**
+ * multifd_recv_sync_main: wait for all channels to reach the sync point
+ *
+ * Returns 0 for success or -1 if a channel failed
+ *
+ * Called when RAM_SAVE_FLAG_EOS is found on the main stream; pairs with
+ * multifd_send_sync_main() on the source.
+ */
+static int multifd_recv_sync_main(void)
+{
+    int i;
+
+    if (!migrate_use_multifd() || !multifd_recv_state) {
+        return 0;
+    }
+    for (i = 0; i < migrate_multifd_channels(); i++) {
+        trace_multifd_recv_sync_main_wait(i);
+        qemu_sem_wait(&multifd_recv_state->sem_sync);
+    }
+    if (atomic_read(&multifd_recv_state->exiting)) {
+        return -1;
+    }
+    for (i = 0; i < migrate_multifd_channels(); i++) {
+        MultiFDRecvParams *p = &multifd_recv_state->params[i];
+
+        qemu_mutex_lock(&p->mutex);
+        if (multifd_recv_state->packet_num < p->packet_num) {
+            multifd_recv_state->packet_num = p->packet_num;
+        }
+        qemu_mutex_unlock(&p->mutex);
+        trace_multifd_recv_sync_main_signal(p->id);
+        qemu_sem_post(&p->sem_sync);
+    }
+    trace_multifd_recv_sync_main(multifd_recv_state->packet_num);
+    return 0;
+}
+
+static void *multifd_recv_thread(void *opaque)
+{
+    MultiFDRecvParams *p = opaque;
+    Error *local_err = NULL;
+    int ret;
+
+    rcu_register_thread();
+    trace_multifd_recv_thread_start(p->id);
+
+    while (true) {
+        uint32_t used;
+        uint32_t flags;
+
+        ret = qio_channel_read_all_eof(p->c, (void *)p->packet,
+                                       p->packet_len, &local_err);
+        if (ret <= 0) {
+            /* 0: EOF, -1: error */
+            break;
+        }
+
+        qemu_mutex_lock(&p->mutex);
+        ret = multifd_recv_unfill_packet(p, &local_err);
+        if (ret) {
+            qemu_mutex_unlock(&p->mutex);
+            break;
+        }
+
+        used = p->pages->used;
+        flags = p->flags;
+        trace_multifd_recv(p->id, p->packet_num, used, flags,
+                           p->next_packet_size);
+        p->num_packets++;
+        p->num_pages += used;
+        qemu_mutex_unlock(&p->mutex);
+
+        if (used) {
+            ret = multifd_ops->recv_pages(p, used, &local_err);
+            if (ret != 0) {
+                break;
+            }
+        }
+
+        if (flags & MULTIFD_FLAG_SYNC) {
+            qemu_sem_post(&multifd_recv_state->sem_sync);
+            qemu_sem_wait(&p->sem_sync);
+        }
+    }
+
+    if (local_err) {
+        terminate_multifd_recv_threads(local_err);
+    }
+
+    trace_multifd_recv_thread_end(p->id, p->num_packets, p->num_pages);
+    rcu_unregister_thread();
+
+    return NULL;
+}
+
+int multifd_load_setup(void)
+{
+    int thread_count;
+    uint32_t page_count = migrate_multifd_page_count();
+    uint8_t i;
+
+    if (!migrate_use_multifd()) {
+        return 0;
+    }
+    multifd_ops = &multifd_methods[migrate_multifd_compression()];
+    if (!multifd_ops->recv_setup) {
+        error_report("multifd: compression method %s is not supported",
+                     MultiFDCompression_str(migrate_multifd_compression()));
+        return -1;
+    }
+    thread_count = migrate_multifd_channels();
+    multifd_recv_state = g_malloc0(sizeof(*multifd_recv_state));
+    multifd_recv_state->params = g_new0(MultiFDRecvParams, thread_count);
+    multifd_recv_state->count = 0;
+    qemu_sem_init(&multifd_recv_state->sem_sync, 0);
+    for (i = 0; i < thread_count; i++) {
+        MultiFDRecvParams *p = &multifd_recv_state->params[i];
+
+        qemu_mutex_init(&p->mutex);
+        qemu_sem_init(&p->sem_sync, 0);
+        p->id = i;
+        p->pages = multifd_pages_init(page_count);
+        p->packet_len = sizeof(MultiFDPacket_t)
+                      + sizeof(uint64_t) * page_count;
+        p->packet = g_malloc0(p->packet_len);
+        p->name = g_strdup_printf("multifdrecv_%d", i);
+    }
+    for (i = 0; i < thread_count; i++) {
+        MultiFDRecvParams *p = &multifd_recv_state->params[i];
+        Error *local_err = NULL;
+
+        if (multifd_ops->recv_setup(p, &local_err) < 0) {
+            error_report_err(local_err);
+            multifd_load_cleanup(NULL);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+bool multifd_recv_all_channels_created(void)
+{
+    int thread_count = migrate_multifd_channels();
+
+    if (!migrate_use_multifd()) {
+        return true;
+    }
+
+    return multifd_recv_state &&
+           thread_count == atomic_read(&multifd_recv_state->count);
+}
+
+/**
+ * multifd_recv_new_channel: start receiving on an extra channel
+ *
+ * Called from the main loop when a connection other than the main
+ * migration stream is accepted.  The channel identifies itself with a
+ * MultiFDInit_t packet before any page is sent.
+ *
+ * @ioc: the accepted channel
+ */
+void multifd_recv_new_channel(QIOChannel *ioc)
+{
+    MultiFDRecvParams *p;
+    Error *local_err = NULL;
+    int id;
+
+    if (!migrate_use_multifd() || !multifd_recv_state) {
+        error_report("multifd: unexpected migration connection");
+        return;
+    }
+
+    id = multifd_recv_initial_packet(ioc, &local_err);
+    if (id < 0) {
+        terminate_multifd_recv_threads(local_err);
+        return;
+    }
+
+    p = &multifd_recv_state->params[id];
+    if (p->c != NULL) {
+        error_setg(&local_err, "multifd: received id '%d' already setup'",
+                   id);
+        terminate_multifd_recv_threads(local_err);
+        return;
+    }
+    qemu_mutex_lock(&p->mutex);
+    p->c = ioc;
+    object_ref(OBJECT(ioc));
+    qemu_mutex_unlock(&p->mutex);
+
+    p->running = true;
+    qemu_thread_create(&p->thread, p->name, multifd_recv_thread, p,
+                       QEMU_THREAD_JOINABLE);
+    atomic_inc(&multifd_recv_state->count);
+}
+
+/**
+ * save_page_header: write page header to wire
+ *
+ * If this is the 1st block, it also writes the block identification
+ *
+ * Returns the number of bytes written
+ *
+ * @f: QEMUFile where to send the data
+ * @block: block that contains the page we want to send
+ * @offset: offset inside the block for the page
+ *          in the lower bits, it contains flags
+ */
+static size_t save_page_header(RAMState *rs, QEMUFile *f,  RAMBlock *block,
+                               ram_addr_t offset)
+{
+    size_t size, len;
+
+    if (block == rs->last_sent_block) {
+        offset |= RAM_SAVE_FLAG_CONTINUE;
+    }
+    qemu_put_be64(f, offset);
+    size = 8;
+
+    if (!(offset & RAM_SAVE_FLAG_CONTINUE)) {
+        len = strlen(block->idstr);
+        qemu_put_byte(f, len);
+        qemu_put_buffer(f, (uint8_t *)block->idstr, len);
+        size += 1 + len;
+        rs->last_sent_block = block;
+    }
+    return size;
 }
 
 /**
@@ -607,6 +2033,38 @@ static void mig_throttle_guest_down(void)
     uint64_t pct_initial = s->parameters.cpu_throttle_initial;
     uint64_t pct_icrement = s->parameters.cpu_throttle_increment;
 
+    /* migrate_caps_check() only allows vcpu-throttle with TCG, where
+     * the per-vcpu rates are measured.
+     */
+    if (migrate_vcpu_throttle()) {
+        CPUState *cpu;
+        uint64_t total_rate = 0;
+        int nr_cpus = 0;
+
+        CPU_FOREACH(cpu) {
+            total_rate += cpu->dirty_rate;
+            nr_cpus++;
+        }
+
+        /* Only slow down the vcpus that dirty at least as fast as the
+         * average one; without an estimate, fall back to all of them.
+         */
+        if (total_rate) {
+            CPU_FOREACH(cpu) {
+                int pct = cpu_throttle_get_vcpu_percentage(cpu);
+
+                if (cpu->dirty_rate * nr_cpus < total_rate) {
+                    continue;
+                }
+                pct = pct ? pct + pct_icrement : pct_initial;
+                cpu_throttle_set_vcpu(cpu, pct);
+                trace_migration_throttle_vcpu(cpu->cpu_index, cpu->dirty_rate,
+                                              pct);
+            }
+            return;
+        }
+    }
+
     /* We have not started throttling yet. Let's start it. */
     if (!cpu_throttle_active()) {
         cpu_throttle_set(pct_initial);
@@ -636,8 +2094,10 @@ static void xbzrle_cache_zero_page(RAMState *rs, ram_addr_t current_addr)
 
     /* We don't care if this fails to allocate a new cache page
      * as long as it updated an old one */
-    cache_insert(XBZRLE.cache, current_addr, XBZRLE.zero_target_page,
-                 ram_counters.dirty_sync_count);
+    if (cache_insert(XBZRLE.cache, current_addr, XBZRLE.zero_target_page,
+                     ram_counters.dirty_sync_count) == 1) {
+        xbzrle_counters.cache_conflict++;
+    }
 }
 
 #define ENCODING_FLAG_XBZRLE 0x1
@@ -662,22 +2122,27 @@ static int save_xbzrle_page(RAMState *rs, uint8_t **current_data,
 {
     int encoded_len = 0, bytes_xbzrle;
     uint8_t *prev_cached_page;
+    int ret;
 
     if (!cache_is_cached(XBZRLE.cache, current_addr,
                          ram_counters.dirty_sync_count)) {
         xbzrle_counters.cache_miss++;
         if (!last_stage) {
-            if (cache_insert(XBZRLE.cache, current_addr, *current_data,
-                             ram_counters.dirty_sync_count) == -1) {
+            ret = cache_insert(XBZRLE.cache, current_addr, *current_data,
+                               ram_counters.dirty_sync_count);
+            if (ret == -1) {
                 return -1;
-            } else {
-                /* update *current_data when the page has been
-                   inserted into cache */
-                *current_data = get_cached_data(XBZRLE.cache, current_addr);
             }
+            if (ret == 1) {
+                xbzrle_counters.cache_conflict++;
+            }
+            /* update *current_data when the page has been
+               inserted into cache */
+            *current_data = get_cached_data(XBZRLE.cache, current_addr);
         }
         return -1;
     }
+    xbzrle_counters.cache_hit++;
 
     prev_cached_page = get_cached_data(XBZRLE.cache, current_addr);
 
@@ -718,57 +2183,257 @@ static int save_xbzrle_page(RAMState *rs, uint8_t **current_data,
     xbzrle_counters.bytes += bytes_xbzrle;
     ram_counters.transferred += bytes_xbzrle;
 
-    return 1;
+    return 1;
+}
+
+/**
+ * migration_bitmap_find_dirty: find the next dirty page from start
+ *
+ * Called with rcu_read_lock() to protect migration_bitmap
+ *
+ * Returns the byte offset within memory region of the start of a dirty page
+ *
+ * @rs: current RAM state
+ * @rb: RAMBlock where to search for dirty pages
+ * @start: page where we start the search
+ */
+static inline
+unsigned long migration_bitmap_find_dirty(RAMState *rs, RAMBlock *rb,
+                                          unsigned long start)
+{
+    unsigned long size = rb->used_length >> TARGET_PAGE_BITS;
+    unsigned long *bitmap = rb->bmap;
+    unsigned long next;
+
+    if (rs->ram_bulk_stage && start > 0) {
+        next = start + 1;
+    } else {
+        next = find_next_bit(bitmap, size, start);
+    }
+
+    return next;
+}
+
+static inline bool migration_bitmap_clear_dirty(RAMState *rs,
+                                                RAMBlock *rb,
+                                                unsigned long page)
+{
+    bool ret;
+
+    /*
+     * Re-arm dirty tracking for the whole chunk around @page the first
+     * time one of its pages is sent after a sync, so that the cost of
+     * write-protecting guest memory is spread over the iteration rather
+     * than paid for all of RAM inside migration_bitmap_sync().  This must
+     * happen before the page is read, or writes racing with the send
+     * would be lost.
+     */
+    if (rb->clear_bmap && clear_bmap_test_and_clear(rb, page)) {
+        uint8_t shift = rb->clear_bmap_shift;
+        hwaddr size = 1ULL << (TARGET_PAGE_BITS + shift);
+        hwaddr start = ((ram_addr_t)page << TARGET_PAGE_BITS) & -size;
+
+        memory_region_clear_dirty_bitmap(rb->mr, start, size);
+    }
+
+    ret = test_and_clear_bit(page, rb->bmap);
+
+    if (ret) {
+        rs->migration_dirty_pages--;
+    }
+    return ret;
+}
+
+static void migration_bitmap_sync_range(RAMState *rs, RAMBlock *rb,
+                                        ram_addr_t start, ram_addr_t length)
+{
+    rs->migration_dirty_pages +=
+        cpu_physical_memory_sync_dirty_bitmap(rb, start, length,
+                                              &rs->num_dirty_pages_period);
+}
+
+/* Bitmap sync threads */
+
+/* Guest RAM that justifies one more thread syncing the dirty bitmap */
+#define BITMAP_SYNC_BYTES_PER_THREAD (64ULL << 30)
+/* Threads syncing the dirty bitmap, including the migration thread */
+#define BITMAP_SYNC_THREADS_MAX 8
+/* Unit of work of the sync threads, in target pages; whole words of the
+ * bitmaps so that no two threads ever write the same word
+ */
+#define BITMAP_SYNC_CHUNK_PAGES (1UL << 18)
+
+typedef struct {
+    RAMBlock *block;
+    ram_addr_t start;
+    ram_addr_t length;
+} BitmapSyncChunk;
+
+static struct {
+    QemuThread *threads;
+    int nb_threads;
+    /* Protects all the fields below */
+    QemuMutex mutex;
+    /* Wakes up the threads when generation changes or quit is set */
+    QemuCond cond;
+    /* Wakes up the migration thread when active drops to zero */
+    QemuCond done_cond;
+    unsigned generation;
+    int active;
+    bool quit;
+    uint64_t num_dirty;
+    uint64_t real_dirty;
+    /* The current sync; next_chunk is accessed atomically */
+    BitmapSyncChunk *chunks;
+    int nb_chunks;
+    int next_chunk;
+} bitmap_sync;
+
+/* Sync chunks of the current generation until none is left */
+static void bitmap_sync_run_chunks(void)
+{
+    uint64_t num_dirty = 0, real_dirty = 0;
+    int i;
+
+    while ((i = atomic_fetch_inc(&bitmap_sync.next_chunk)) <
+           bitmap_sync.nb_chunks) {
+        BitmapSyncChunk *c = &bitmap_sync.chunks[i];
+
+        num_dirty += cpu_physical_memory_sync_dirty_bitmap(c->block, c->start,
+                                                           c->length,
+                                                           &real_dirty);
+    }
+
+    qemu_mutex_lock(&bitmap_sync.mutex);
+    bitmap_sync.num_dirty += num_dirty;
+    bitmap_sync.real_dirty += real_dirty;
+    qemu_mutex_unlock(&bitmap_sync.mutex);
+}
+
+static void *bitmap_sync_thread(void *opaque)
+{
+    unsigned generation = 0;
+
+    rcu_register_thread();
+
+    qemu_mutex_lock(&bitmap_sync.mutex);
+    while (!bitmap_sync.quit) {
+        if (generation != bitmap_sync.generation) {
+            generation = bitmap_sync.generation;
+            qemu_mutex_unlock(&bitmap_sync.mutex);
+
+            bitmap_sync_run_chunks();
+
+            qemu_mutex_lock(&bitmap_sync.mutex);
+            if (--bitmap_sync.active == 0) {
+                qemu_cond_signal(&bitmap_sync.done_cond);
+            }
+        } else {
+            qemu_cond_wait(&bitmap_sync.cond, &bitmap_sync.mutex);
+        }
+    }
+    qemu_mutex_unlock(&bitmap_sync.mutex);
+
+    rcu_unregister_thread();
+    return NULL;
 }
 
-/**
- * migration_bitmap_find_dirty: find the next dirty page from start
- *
- * Called with rcu_read_lock() to protect migration_bitmap
- *
- * Returns the byte offset within memory region of the start of a dirty page
- *
- * @rs: current RAM state
- * @rb: RAMBlock where to search for dirty pages
- * @start: page where we start the search
- */
-static inline
-unsigned long migration_bitmap_find_dirty(RAMState *rs, RAMBlock *rb,
-                                          unsigned long start)
+static void bitmap_sync_threads_setup(void)
 {
-    unsigned long size = rb->used_length >> TARGET_PAGE_BITS;
-    unsigned long *bitmap = rb->bmap;
-    unsigned long next;
+    int i, nb_threads;
 
-    if (rs->ram_bulk_stage && start > 0) {
-        next = start + 1;
-    } else {
-        next = find_next_bit(bitmap, size, start);
+    nb_threads = MIN(ram_bytes_total() / BITMAP_SYNC_BYTES_PER_THREAD,
+                     BITMAP_SYNC_THREADS_MAX) - 1;
+    if (nb_threads <= 0) {
+        return;
     }
 
-    return next;
+    qemu_mutex_init(&bitmap_sync.mutex);
+    qemu_cond_init(&bitmap_sync.cond);
+    qemu_cond_init(&bitmap_sync.done_cond);
+    bitmap_sync.generation = 0;
+    bitmap_sync.quit = false;
+    bitmap_sync.nb_threads = nb_threads;
+    bitmap_sync.threads = g_new0(QemuThread, nb_threads);
+    for (i = 0; i < nb_threads; i++) {
+        qemu_thread_create(bitmap_sync.threads + i, "bitmap-sync",
+                           bitmap_sync_thread, NULL, QEMU_THREAD_JOINABLE);
+    }
 }
 
-static inline bool migration_bitmap_clear_dirty(RAMState *rs,
-                                                RAMBlock *rb,
-                                                unsigned long page)
+static void bitmap_sync_threads_cleanup(void)
 {
-    bool ret;
+    int i;
 
-    ret = test_and_clear_bit(page, rb->bmap);
+    if (!bitmap_sync.threads) {
+        return;
+    }
 
-    if (ret) {
-        rs->migration_dirty_pages--;
+    qemu_mutex_lock(&bitmap_sync.mutex);
+    bitmap_sync.quit = true;
+    qemu_cond_broadcast(&bitmap_sync.cond);
+    qemu_mutex_unlock(&bitmap_sync.mutex);
+
+    for (i = 0; i < bitmap_sync.nb_threads; i++) {
+        qemu_thread_join(bitmap_sync.threads + i);
     }
-    return ret;
+    qemu_mutex_destroy(&bitmap_sync.mutex);
+    qemu_cond_destroy(&bitmap_sync.cond);
+    qemu_cond_destroy(&bitmap_sync.done_cond);
+    g_free(bitmap_sync.threads);
+    bitmap_sync.threads = NULL;
+    bitmap_sync.nb_threads = 0;
 }
 
-static void migration_bitmap_sync_range(RAMState *rs, RAMBlock *rb,
-                                        ram_addr_t start, ram_addr_t length)
+/*
+ * Sync the dirty bitmap of every RAMBlock, split in chunks shared between
+ * the migration thread and the bitmap sync threads.  Called with the RCU
+ * read lock held.
+ */
+static void migration_bitmap_sync_parallel(RAMState *rs)
 {
-    rs->migration_dirty_pages +=
-        cpu_physical_memory_sync_dirty_bitmap(rb, start, length,
-                                              &rs->num_dirty_pages_period);
+    RAMBlock *block;
+    GArray *chunks = g_array_new(false, false, sizeof(BitmapSyncChunk));
+
+    RAMBLOCK_FOREACH(block) {
+        ram_addr_t chunk_size = (ram_addr_t)BITMAP_SYNC_CHUNK_PAGES <<
+                                TARGET_PAGE_BITS;
+        ram_addr_t start;
+
+        for (start = 0; start < block->used_length; start += chunk_size) {
+            BitmapSyncChunk c = {
+                .block = block,
+                .start = start,
+                .length = MIN(chunk_size, block->used_length - start),
+            };
+            g_array_append_val(chunks, c);
+        }
+    }
+
+    qemu_mutex_lock(&bitmap_sync.mutex);
+    bitmap_sync.chunks = (BitmapSyncChunk *)chunks->data;
+    bitmap_sync.nb_chunks = chunks->len;
+    bitmap_sync.next_chunk = 0;
+    bitmap_sync.num_dirty = 0;
+    bitmap_sync.real_dirty = 0;
+    bitmap_sync.active = bitmap_sync.nb_threads;
+    bitmap_sync.generation++;
+    qemu_cond_broadcast(&bitmap_sync.cond);
+    qemu_mutex_unlock(&bitmap_sync.mutex);
+
+    bitmap_sync_run_chunks();
+
+    qemu_mutex_lock(&bitmap_sync.mutex);
+    while (bitmap_sync.active) {
+        qemu_cond_wait(&bitmap_sync.done_cond, &bitmap_sync.mutex);
+    }
+    rs->migration_dirty_pages += bitmap_sync.num_dirty;
+    rs->num_dirty_pages_period += bitmap_sync.real_dirty;
+    bitmap_sync.chunks = NULL;
+    bitmap_sync.nb_chunks = 0;
+    qemu_mutex_unlock(&bitmap_sync.mutex);
+
+    g_array_free(chunks, true);
 }
 
 /**
@@ -792,6 +2457,86 @@ uint64_t ram_pagesize_summary(void)
     return summary;
 }
 
+/**
+ * migration_vcpu_dirty_rate_update: estimate the dirty rate of each vcpu
+ *
+ * With TCG, each vcpu counts the pages it dirtied itself.  Other
+ * accelerators only report dirty pages for the whole guest, so those are
+ * shared among the vcpus in proportion to the CPU time their threads
+ * used over the period; a vcpu that sat idle is not charged for them.
+ * That share cannot tell a vcpu that dirties memory from one that is
+ * only busy, so it is reported as an estimate and never used to pick
+ * the vcpus to throttle.
+ *
+ * @dirty_pages: pages dirtied by the whole guest over the period
+ * @period_ms: length of the period in ms
+ */
+static void migration_vcpu_dirty_rate_update(uint64_t dirty_pages,
+                                             int64_t period_ms)
+{
+    CPUState *cpu;
+    int64_t *cpu_time;
+    int64_t total_time = 0;
+    int nr_cpus = 0;
+    int i;
+
+    if (tcg_enabled()) {
+        CPU_FOREACH(cpu) {
+            cpu->dirty_rate = atomic_xchg(&cpu->dirty_pages, 0) * 1000 /
+                              period_ms;
+        }
+        return;
+    }
+
+    CPU_FOREACH(cpu) {
+        nr_cpus++;
+    }
+    if (!nr_cpus) {
+        return;
+    }
+
+    cpu_time = g_new0(int64_t, nr_cpus);
+    i = 0;
+    CPU_FOREACH(cpu) {
+        int64_t now = cpu->thread ? qemu_thread_get_cpu_time_ns(cpu->thread)
+                                  : -1;
+
+        if (now >= 0 && cpu->dirty_cpu_time_ns) {
+            cpu_time[i] = MAX(now - cpu->dirty_cpu_time_ns, 0);
+            total_time += cpu_time[i];
+        }
+        cpu->dirty_cpu_time_ns = MAX(now, 0);
+        i++;
+    }
+
+    i = 0;
+    CPU_FOREACH(cpu) {
+        uint64_t pages;
+
+        if (total_time) {
+            pages = (double)dirty_pages * cpu_time[i] / total_time;
+        } else {
+            pages = dirty_pages / nr_cpus;
+        }
+        cpu->dirty_rate = pages * 1000 / period_ms;
+        i++;
+    }
+    g_free(cpu_time);
+}
+
+/* Drop the estimates of a previous migration */
+static void migration_vcpu_dirty_rate_reset(void)
+{
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        atomic_set(&cpu->dirty_pages, 0);
+        cpu->dirty_rate = 0;
+        cpu->dirty_cpu_time_ns = cpu->thread ?
+            MAX(qemu_thread_get_cpu_time_ns(cpu->thread), 0) : 0;
+    }
+}
+
 static void migration_bitmap_sync(RAMState *rs)
 {
     RAMBlock *block;
@@ -809,8 +2554,12 @@ static void migration_bitmap_sync(RAMState *rs)
 
     qemu_mutex_lock(&rs->bitmap_mutex);
     rcu_read_lock();
-    RAMBLOCK_FOREACH(block) {
-        migration_bitmap_sync_range(rs, block, 0, block->used_length);
+    if (bitmap_sync.threads) {
+        migration_bitmap_sync_parallel(rs);
+    } else {
+        RAMBLOCK_FOREACH(block) {
+            migration_bitmap_sync_range(rs, block, 0, block->used_length);
+        }
     }
     rcu_read_unlock();
     qemu_mutex_unlock(&rs->bitmap_mutex);
@@ -824,6 +2573,8 @@ static void migration_bitmap_sync(RAMState *rs)
         /* calculate period counters */
         ram_counters.dirty_pages_rate = rs->num_dirty_pages_period * 1000
             / (end_time - rs->time_last_bitmap_sync);
+        migration_vcpu_dirty_rate_update(rs->num_dirty_pages_period,
+                                         end_time - rs->time_last_bitmap_sync);
         bytes_xfer_now = ram_counters.transferred;
 
         /* During block migration the auto-converge logic incorrectly detects
@@ -846,14 +2597,22 @@ static void migration_bitmap_sync(RAMState *rs)
         }
 
         if (migrate_use_xbzrle()) {
+            uint64_t hits = xbzrle_counters.cache_hit -
+                            rs->xbzrle_cache_hit_prev;
+            uint64_t misses = xbzrle_counters.cache_miss -
+                              rs->xbzrle_cache_miss_prev;
+
             if (rs->iterations_prev != rs->iterations) {
-                xbzrle_counters.cache_miss_rate =
-                   (double)(xbzrle_counters.cache_miss -
-                            rs->xbzrle_cache_miss_prev) /
+                xbzrle_counters.cache_miss_rate = (double)misses /
                    (rs->iterations - rs->iterations_prev);
             }
+            if (hits + misses) {
+                xbzrle_counters.cache_hit_rate = (double)hits /
+                                                 (hits + misses);
+            }
             rs->iterations_prev = rs->iterations;
             rs->xbzrle_cache_miss_prev = xbzrle_counters.cache_miss;
+            rs->xbzrle_cache_hit_prev = xbzrle_counters.cache_hit;
         }
 
         /* reset period counters */
@@ -922,7 +2681,8 @@ static int ram_save_page(RAMState *rs, PageSearchStatus *pss, bool last_stage)
     ram_addr_t current_addr;
     uint8_t *p;
     int ret;
-    bool send_async = true;
+    /* A background snapshot lifts the write protection once sent */
+    bool send_async = !migrate_background_snapshot();
     RAMBlock *block = pss->block;
     ram_addr_t offset = pss->page << TARGET_PAGE_BITS;
 
@@ -1209,6 +2969,305 @@ static bool find_dirty_block(RAMState *rs, PageSearchStatus *pss, bool *again)
     }
 }
 
+/* **** functions for background snapshot ***** */
+
+/*
+ * A background snapshot saves RAM as it was when the device state was
+ * saved.  RAM is write protected with userfaultfd at that point; a vCPU
+ * writing to a page that has not been saved yet blocks until the
+ * migration thread has copied the page into the stream, which only then
+ * lifts the protection.
+ */
+
+#if defined(__linux__) && defined(__NR_userfaultfd) && defined(CONFIG_EVENTFD)
+
+/* userfaultfd catching writes to RAM not saved yet, -1 when not tracking */
+static int write_tracking_fd = -1;
+
+/* Only guest-writable RAM needs protecting */
+static bool write_tracking_block(RAMBlock *block)
+{
+    return !memory_region_is_rom(block->mr) &&
+           !memory_region_is_ram_device(block->mr);
+}
+
+static int write_tracking_open(uint64_t features)
+{
+    struct uffdio_api api_struct = {0};
+    int fd;
+
+    fd = syscall(__NR_userfaultfd, O_CLOEXEC | O_NONBLOCK);
+    if (fd == -1) {
+        return -1;
+    }
+
+    api_struct.api = UFFD_API;
+    api_struct.features = features;
+    if (ioctl(fd, UFFDIO_API, &api_struct) ||
+        (api_struct.features & features) != features) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static int write_tracking_protect(int fd, RAMBlock *block, ram_addr_t offset,
+                                  size_t len, bool protect)
+{
+    struct uffdio_writeprotect wp;
+
+    wp.range.start = (uintptr_t)block->host + offset;
+    wp.range.len = len;
+    wp.mode = protect ? UFFDIO_WRITEPROTECT_MODE_WP : 0;
+    if (ioctl(fd, UFFDIO_WRITEPROTECT, &wp)) {
+        int ret = -errno;
+
+        error_report("%s: UFFDIO_WRITEPROTECT failed for %s: %s",
+                     __func__, block->idstr, strerror(errno));
+        return ret;
+    }
+
+    return 0;
+}
+
+/* Drop the protection and registration of every block, then @fd */
+static void write_tracking_release(int fd)
+{
+    RAMBlock *block;
+
+    rcu_read_lock();
+    RAMBLOCK_FOREACH(block) {
+        struct uffdio_writeprotect wp;
+
+        if (!write_tracking_block(block)) {
+            continue;
+        }
+        wp.range.start = (uintptr_t)block->host;
+        wp.range.len = block->max_length;
+        wp.mode = 0;
+        /* Blocks that never got registered fail here, which is fine */
+        ioctl(fd, UFFDIO_WRITEPROTECT, &wp);
+        ioctl(fd, UFFDIO_UNREGISTER, &wp.range);
+    }
+    rcu_read_unlock();
+
+    close(fd);
+}
+
+/**
+ * ram_write_tracking_available: check whether the host kernel can
+ * write protect anonymous memory with userfaultfd
+ */
+bool ram_write_tracking_available(void)
+{
+    int fd = write_tracking_open(UFFD_FEATURE_PAGEFAULT_FLAG_WP);
+
+    if (fd < 0) {
+        return false;
+    }
+    close(fd);
+    return true;
+}
+
+/**
+ * ram_write_tracking_prepare: fault in all of guest RAM
+ *
+ * Write protection only applies to pages that are mapped, so every page
+ * is read once before ram_write_tracking_start(); the read maps the
+ * shared zero page for untouched memory, which costs no RAM.
+ *
+ * Returns zero to indicate success and negative for error
+ */
+int ram_write_tracking_prepare(void)
+{
+    RAMBlock *block;
+
+    rcu_read_lock();
+    RAMBLOCK_FOREACH(block) {
+        size_t pagesize = qemu_ram_pagesize(block);
+        ram_addr_t offset;
+
+        if (!write_tracking_block(block)) {
+            continue;
+        }
+        for (offset = 0; offset < block->used_length; offset += pagesize) {
+            (void)*(volatile uint8_t *)(block->host + offset);
+        }
+    }
+    rcu_read_unlock();
+
+    return 0;
+}
+
+/**
+ * ram_write_tracking_start: write protect guest RAM
+ *
+ * Called with the VM stopped, right before the device state is saved.
+ *
+ * Returns zero to indicate success and negative for error
+ */
+int ram_write_tracking_start(void)
+{
+    RAMBlock *block;
+    int fd;
+
+    fd = write_tracking_open(UFFD_FEATURE_PAGEFAULT_FLAG_WP);
+    if (fd < 0) {
+        error_report("%s: userfaultfd write protection is not available",
+                     __func__);
+        return -1;
+    }
+
+    rcu_read_lock();
+    RAMBLOCK_FOREACH(block) {
+        struct uffdio_register reg;
+
+        if (!write_tracking_block(block)) {
+            continue;
+        }
+
+        reg.range.start = (uintptr_t)block->host;
+        reg.range.len = block->max_length;
+        reg.mode = UFFDIO_REGISTER_MODE_WP;
+        if (ioctl(fd, UFFDIO_REGISTER, &reg)) {
+            error_report("%s: UFFDIO_REGISTER failed for %s: %s",
+                         __func__, block->idstr, strerror(errno));
+            goto fail;
+        }
+        if (!(reg.ioctls & ((__u64)1 << _UFFDIO_WRITEPROTECT))) {
+            error_report("%s: %s can not be write protected",
+                         __func__, block->idstr);
+            goto fail;
+        }
+        if (write_tracking_protect(fd, block, 0, block->max_length, true)) {
+            goto fail;
+        }
+        trace_ram_write_tracking_start(block->idstr, block->max_length);
+    }
+    rcu_read_unlock();
+
+    write_tracking_fd = fd;
+    return 0;
+
+fail:
+    rcu_read_unlock();
+    write_tracking_release(fd);
+    return -1;
+}
+
+/**
+ * ram_write_tracking_stop: lift any remaining protection and stop
+ * tracking writes; a no-op if tracking was never started
+ */
+void ram_write_tracking_stop(void)
+{
+    if (write_tracking_fd < 0) {
+        return;
+    }
+    write_tracking_release(write_tracking_fd);
+    write_tracking_fd = -1;
+}
+
+/**
+ * write_tracking_get_fault: the host page a vCPU is blocked writing to
+ *
+ * Returns the RAMBlock, or NULL if no write is pending
+ *
+ * @offset: set to the host page aligned offset inside the block
+ */
+static RAMBlock *write_tracking_get_fault(ram_addr_t *offset)
+{
+    struct uffd_msg msg;
+    RAMBlock *block;
+    ssize_t res;
+
+    if (write_tracking_fd < 0) {
+        return NULL;
+    }
+
+    do {
+        res = read(write_tracking_fd, &msg, sizeof(msg));
+    } while (res < 0 && errno == EINTR);
+    if (res != sizeof(msg) || msg.event != UFFD_EVENT_PAGEFAULT ||
+        !(msg.arg.pagefault.flags & UFFD_PAGEFAULT_FLAG_WP)) {
+        return NULL;
+    }
+
+    block = qemu_ram_block_from_host(
+                (void *)(uintptr_t)msg.arg.pagefault.address, false, offset);
+    if (!block) {
+        return NULL;
+    }
+    *offset = QEMU_ALIGN_DOWN(*offset, qemu_ram_pagesize(block));
+    trace_ram_write_tracking_fault(block->idstr, (uint64_t)*offset);
+
+    return block;
+}
+
+/*
+ * Let the guest write to the host page at @page again once none of its
+ * target pages is left to save; this also wakes a vCPU blocked on it.
+ */
+static int write_tracking_page_saved(RAMBlock *block, unsigned long page)
+{
+    size_t pagesize = qemu_ram_pagesize(block);
+    unsigned long first, last;
+    ram_addr_t offset;
+
+    if (write_tracking_fd < 0) {
+        return 0;
+    }
+
+    offset = QEMU_ALIGN_DOWN((ram_addr_t)page << TARGET_PAGE_BITS, pagesize);
+    first = offset >> TARGET_PAGE_BITS;
+    last = MIN(offset + pagesize, block->used_length) >> TARGET_PAGE_BITS;
+    if (find_next_bit(block->bmap, last, first) < last) {
+        return 0;
+    }
+
+    return write_tracking_protect(write_tracking_fd, block, offset,
+                                  MIN(pagesize, block->max_length - offset),
+                                  false);
+}
+
+#else
+
+bool ram_write_tracking_available(void)
+{
+    return false;
+}
+
+int ram_write_tracking_prepare(void)
+{
+    error_report("%s: background snapshot is not supported on this host",
+                 __func__);
+    return -1;
+}
+
+int ram_write_tracking_start(void)
+{
+    error_report("%s: background snapshot is not supported on this host",
+                 __func__);
+    return -1;
+}
+
+void ram_write_tracking_stop(void)
+{
+}
+
+static RAMBlock *write_tracking_get_fault(ram_addr_t *offset)
+{
+    return NULL;
+}
+
+static int write_tracking_page_saved(RAMBlock *block, unsigned long page)
+{
+    return 0;
+}
+
+#endif
+
 /**
  * unqueue_page: gets a page of the queue
  *
@@ -1245,9 +3304,12 @@ static RAMBlock *unqueue_page(RAMState *rs, ram_addr_t *offset)
 }
 
 /**
- * get_queued_page: unqueue a page from the postocpy requests
+ * get_queued_page: unqueue a page that must be sent out of order
  *
- * Skips pages that are already sent (!dirty)
+ * Pages come from the postcopy requests of the destination, skipping
+ * pages that are already sent (!dirty), or, during a background
+ * snapshot, from the userfaultfd write faults of vCPUs blocked on a
+ * page that is not saved yet.  Postcopy requests are served first.
  *
  * Returns if a queued page is found
  *
@@ -1283,6 +3345,14 @@ static bool get_queued_page(RAMState *rs, PageSearchStatus *pss)
 
     } while (block && !dirty);
 
+    /*
+     * During a background snapshot, a vCPU blocked writing to a page
+     * that is not saved yet needs the page sent before anything else.
+     */
+    if (!block) {
+        block = write_tracking_get_fault(&offset);
+    }
+
     if (block) {
         /*
          * As soon as we start servicing pages out of order, then we have
@@ -1395,6 +3465,540 @@ err:
     return -1;
 }
 
+/**
+ * ram_save_multifd_page: queue a page to be sent over the multifd channels
+ *
+ * Returns the number of pages written or negative on error
+ *
+ * Zero pages are still sent inline on the main stream.
+ *
+ * @rs: current RAM state
+ * @block: block that contains the page we want to send
+ * @offset: offset inside the block for the page
+ */
+static int ram_save_multifd_page(RAMState *rs, RAMBlock *block,
+                                 ram_addr_t offset)
+{
+    uint8_t *p = block->host + offset;
+    int pages;
+
+    trace_ram_save_page(block->idstr, (uint64_t)offset, p);
+
+    pages = save_zero_page(rs, block, offset, p);
+    if (pages > 0) {
+        return pages;
+    }
+
+    if (multifd_queue_page(block, offset) < 0) {
+        return -1;
+    }
+    ram_counters.normal++;
+
+    return 1;
+}
+
+/* Mapped RAM
+ *
+ * With the mapped-ram capability each RAMBlock gets a fixed region of a
+ * file: migration target, laid out in ram_save_setup:
+ *
+ *   [bitmap of pages present][pages, at their offset in the block]
+ *
+ * Both parts start on a MAPPED_RAM_ALIGN boundary, and the migration
+ * stream resumes after the pages.  Pages are written in place by a pool
+ * of threads, so that resending a page overwrites its old copy, and the
+ * bitmaps are written once RAM is complete.  On load the same pool reads
+ * the pages straight into guest RAM.
+ */
+
+/* Alignment of the bitmap and page regions in the file */
+#define MAPPED_RAM_ALIGN (1ULL << 20)
+/* Largest run of contiguous pages handed over as a single I/O */
+#define MAPPED_RAM_IO_MAX (1ULL << 20)
+/* I/Os queued for the threads before the migration thread waits */
+#define MAPPED_RAM_QUEUE_LEN 256
+
+typedef struct {
+    uint8_t *host;
+    off_t offset;
+    size_t len;
+} MappedRamIO;
+
+typedef struct {
+    QemuThread thread;
+    QIOChannel *ioc;
+    /* Whether ioc was opened with O_DIRECT */
+    bool direct;
+} MappedRamThread;
+
+static struct {
+    MappedRamThread *threads;
+    int nb_threads;
+    char *path;
+    bool load;
+    /* Protects all the fields below */
+    QemuMutex mutex;
+    /* Wakes up the threads when an I/O is queued or quit is set */
+    QemuCond cond;
+    /* Wakes up the migration thread when the queue drains */
+    QemuCond done_cond;
+    MappedRamIO queue[MAPPED_RAM_QUEUE_LEN];
+    int head;
+    int count;
+    /* I/Os taken from the queue and not completed yet */
+    int busy;
+    bool quit;
+    bool failed;
+    /* Run of pages still being extended by the migration thread */
+    MappedRamIO pending;
+} mapped_ram;
+
+/* Size of the bitmap of @block in the file: 64-bit little endian words */
+static size_t mapped_ram_bitmap_size(RAMBlock *block)
+{
+    return DIV_ROUND_UP(block->used_length >> TARGET_PAGE_BITS, 64) * 8;
+}
+
+/* Size of the buffer for the bitmap of @block, valid for O_DIRECT */
+static size_t mapped_ram_bitmap_buf_size(RAMBlock *block)
+{
+    return ROUND_UP(mapped_ram_bitmap_size(block), qemu_real_host_page_size);
+}
+
+static int mapped_ram_open(MappedRamThread *t, bool direct, Error **errp)
+{
+    QIOChannelFile *fioc;
+    int flags = mapped_ram.load ? O_RDONLY : O_WRONLY;
+
+#ifdef O_DIRECT
+    if (direct) {
+        flags |= O_DIRECT;
+    }
+#else
+    direct = false;
+#endif
+    fioc = qio_channel_file_new_path(mapped_ram.path, flags, 0, errp);
+    if (!fioc) {
+        return -1;
+    }
+    t->ioc = QIO_CHANNEL(fioc);
+    t->direct = direct;
+    return 0;
+}
+
+static int mapped_ram_do_io(MappedRamThread *t, MappedRamIO *io,
+                            Error **errp)
+{
+    size_t done = 0;
+
+    if (!t->ioc && mapped_ram_open(t, false, errp) < 0) {
+        return -1;
+    }
+
+    while (done < io->len) {
+        Error *local_err = NULL;
+        ssize_t ret;
+
+        if (mapped_ram.load) {
+            ret = qio_channel_pread(t->ioc, (char *)io->host + done,
+                                    io->len - done, io->offset + done,
+                                    &local_err);
+        } else {
+            ret = qio_channel_pwrite(t->ioc, (char *)io->host + done,
+                                     io->len - done, io->offset + done,
+                                     &local_err);
+        }
+        if (ret < 0 && t->direct) {
+            /* The file system may refuse O_DIRECT for this buffer or
+             * size; go through the page cache from now on.
+             */
+            error_free(local_err);
+            object_unref(OBJECT(t->ioc));
+            t->ioc = NULL;
+            if (mapped_ram_open(t, false, errp) < 0) {
+                return -1;
+            }
+            continue;
+        }
+        if (ret < 0) {
+            error_propagate(errp, local_err);
+            return -1;
+        }
+        if (ret == 0) {
+            error_setg(errp, "Unexpected end of file at offset %lld",
+                       (long long int)(io->offset + done));
+            return -1;
+        }
+        done += ret;
+    }
+    return 0;
+}
+
+static void *mapped_ram_thread(void *opaque)
+{
+    MappedRamThread *t = opaque;
+
+    qemu_mutex_lock(&mapped_ram.mutex);
+    while (true) {
+        MappedRamIO io;
+        Error *local_err = NULL;
+        int ret;
+
+        if (!mapped_ram.count) {
+            if (mapped_ram.quit) {
+                break;
+            }
+            qemu_cond_wait(&mapped_ram.cond, &mapped_ram.mutex);
+            continue;
+        }
+
+        io = mapped_ram.queue[mapped_ram.head];
+        mapped_ram.head = (mapped_ram.head + 1) % MAPPED_RAM_QUEUE_LEN;
+        mapped_ram.count--;
+        mapped_ram.busy++;
+        qemu_cond_broadcast(&mapped_ram.done_cond);
+        qemu_mutex_unlock(&mapped_ram.mutex);
+
+        ret = mapped_ram_do_io(t, &io, &local_err);
+
+        qemu_mutex_lock(&mapped_ram.mutex);
+        if (ret < 0) {
+            if (!mapped_ram.failed) {
+                error_report_err(local_err);
+            } else {
+                error_free(local_err);
+            }
+            mapped_ram.failed = true;
+        }
+        if (--mapped_ram.busy == 0 && !mapped_ram.count) {
+            qemu_cond_broadcast(&mapped_ram.done_cond);
+        }
+    }
+    qemu_mutex_unlock(&mapped_ram.mutex);
+
+    return NULL;
+}
+
+/**
+ * mapped_ram_threads_setup: start the threads doing the file I/O
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @path: the file: migration target or source
+ * @load: whether the threads read the file rather than write it
+ */
+static int mapped_ram_threads_setup(const char *path, bool load)
+{
+    Error *local_err = NULL;
+    int nb_threads = migrate_multifd_channels();
+    int i;
+
+    if (!path) {
+        error_report("mapped-ram needs a file: migration URI");
+        return -1;
+    }
+
+    qemu_mutex_init(&mapped_ram.mutex);
+    qemu_cond_init(&mapped_ram.cond);
+    qemu_cond_init(&mapped_ram.done_cond);
+    mapped_ram.path = g_strdup(path);
+    mapped_ram.load = load;
+    mapped_ram.head = 0;
+    mapped_ram.count = 0;
+    mapped_ram.busy = 0;
+    mapped_ram.quit = false;
+    mapped_ram.failed = false;
+    mapped_ram.pending.len = 0;
+    mapped_ram.threads = g_new0(MappedRamThread, nb_threads);
+
+    for (i = 0; i < nb_threads; i++) {
+        MappedRamThread *t = &mapped_ram.threads[i];
+
+        if (mapped_ram_open(t, true, NULL) < 0 &&
+            mapped_ram_open(t, false, &local_err) < 0) {
+            error_report_err(local_err);
+            return -1;
+        }
+        qemu_thread_create(&t->thread, "mapped-ram", mapped_ram_thread, t,
+                           QEMU_THREAD_JOINABLE);
+        mapped_ram.nb_threads++;
+    }
+    return 0;
+}
+
+static void mapped_ram_threads_cleanup(void)
+{
+    int i;
+
+    if (!mapped_ram.threads) {
+        return;
+    }
+
+    qemu_mutex_lock(&mapped_ram.mutex);
+    mapped_ram.quit = true;
+    qemu_cond_broadcast(&mapped_ram.cond);
+    qemu_mutex_unlock(&mapped_ram.mutex);
+
+    for (i = 0; i < mapped_ram.nb_threads; i++) {
+        qemu_thread_join(&mapped_ram.threads[i].thread);
+        object_unref(OBJECT(mapped_ram.threads[i].ioc));
+    }
+    qemu_mutex_destroy(&mapped_ram.mutex);
+    qemu_cond_destroy(&mapped_ram.cond);
+    qemu_cond_destroy(&mapped_ram.done_cond);
+    g_free(mapped_ram.threads);
+    mapped_ram.threads = NULL;
+    mapped_ram.nb_threads = 0;
+    g_free(mapped_ram.path);
+    mapped_ram.path = NULL;
+}
+
+/* Queue one I/O, waiting for room if the threads are behind */
+static int mapped_ram_submit(MappedRamIO *io)
+{
+    int ret = 0;
+
+    qemu_mutex_lock(&mapped_ram.mutex);
+    while (mapped_ram.count == MAPPED_RAM_QUEUE_LEN && !mapped_ram.failed) {
+        qemu_cond_wait(&mapped_ram.done_cond, &mapped_ram.mutex);
+    }
+    if (mapped_ram.failed) {
+        ret = -EIO;
+    } else {
+        mapped_ram.queue[(mapped_ram.head + mapped_ram.count) %
+                         MAPPED_RAM_QUEUE_LEN] = *io;
+        mapped_ram.count++;
+        qemu_cond_signal(&mapped_ram.cond);
+    }
+    qemu_mutex_unlock(&mapped_ram.mutex);
+    return ret;
+}
+
+/* Queue @len bytes at @host for @offset of the file, merging the I/O
+ * with the previous one when both are contiguous
+ */
+static int mapped_ram_queue(uint8_t *host, off_t offset, size_t len)
+{
+    MappedRamIO *p = &mapped_ram.pending;
+    int ret;
+
+    if (p->len && p->host + p->len == host && p->offset + p->len == offset &&
+        p->len + len <= MAPPED_RAM_IO_MAX) {
+        p->len += len;
+        return 0;
+    }
+    if (p->len) {
+        ret = mapped_ram_submit(p);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+    p->host = host;
+    p->offset = offset;
+    p->len = len;
+    return 0;
+}
+
+/**
+ * mapped_ram_flush: wait until all queued I/O is complete
+ *
+ * Pages must not be queued twice between two flushes, otherwise an
+ * older copy could land in the file after a newer one.
+ *
+ * Returns 0 for success or negative errno if any I/O failed
+ */
+static int mapped_ram_flush(void)
+{
+    int ret = 0;
+
+    if (!mapped_ram.threads) {
+        return 0;
+    }
+
+    if (mapped_ram.pending.len) {
+        ret = mapped_ram_submit(&mapped_ram.pending);
+        mapped_ram.pending.len = 0;
+    }
+
+    qemu_mutex_lock(&mapped_ram.mutex);
+    while ((mapped_ram.count || mapped_ram.busy) && !mapped_ram.failed) {
+        qemu_cond_wait(&mapped_ram.done_cond, &mapped_ram.mutex);
+    }
+    if (mapped_ram.failed) {
+        ret = -EIO;
+    }
+    qemu_mutex_unlock(&mapped_ram.mutex);
+    return ret;
+}
+
+/* Reserve the file regions of @block, just after its header in @f */
+static void mapped_ram_save_block_setup(QEMUFile *f, RAMBlock *block)
+{
+    /* The stream position once the two offsets below are written */
+    int64_t pos = qemu_ftell(f) + 2 * sizeof(uint64_t);
+
+    block->bitmap_offset = ROUND_UP(pos, MAPPED_RAM_ALIGN);
+    block->pages_offset = ROUND_UP(block->bitmap_offset +
+                                   mapped_ram_bitmap_size(block),
+                                   MAPPED_RAM_ALIGN);
+    block->file_bmap = bitmap_new(block->used_length >> TARGET_PAGE_BITS);
+
+    qemu_put_be64(f, block->bitmap_offset);
+    qemu_put_be64(f, block->pages_offset);
+    qemu_file_seek(f, block->pages_offset + block->used_length);
+}
+
+/**
+ * ram_save_mapped_page: write a page at its place in the file
+ *
+ * Returns the number of pages written or negative on error
+ *
+ * @rs: current RAM state
+ * @block: block that contains the page
+ * @page: page to write, in target pages from the start of @block
+ */
+static int ram_save_mapped_page(RAMState *rs, RAMBlock *block,
+                                unsigned long page)
+{
+    ram_addr_t offset = page << TARGET_PAGE_BITS;
+    uint8_t *p = block->host + offset;
+
+    /* A page left out of the bitmap is not read back on load, where RAM
+     * starts out zeroed; this also drops an older copy of the page.
+     */
+    if (is_zero_range(p, TARGET_PAGE_SIZE)) {
+        clear_bit(page, block->file_bmap);
+        ram_counters.duplicate++;
+        return 1;
+    }
+
+    set_bit(page, block->file_bmap);
+    if (mapped_ram_queue(p, block->pages_offset + offset,
+                         TARGET_PAGE_SIZE) < 0) {
+        return -1;
+    }
+    ram_counters.normal++;
+    ram_counters.transferred += TARGET_PAGE_SIZE;
+    qemu_file_update_transfer(rs->f, TARGET_PAGE_SIZE);
+    return 1;
+}
+
+/* Write the bitmaps of all blocks once their pages are in the file */
+static int mapped_ram_save_bitmaps(void)
+{
+    GSList *bufs = NULL, *l;
+    RAMBlock *block;
+    int ret;
+
+    ret = mapped_ram_flush();
+    if (ret < 0) {
+        return ret;
+    }
+
+    RAMBLOCK_FOREACH(block) {
+        size_t size = mapped_ram_bitmap_buf_size(block);
+        uint8_t *buf = qemu_memalign(qemu_real_host_page_size, size);
+        MappedRamIO io = { .host = buf, .offset = block->bitmap_offset,
+                           .len = size };
+
+        memset(buf, 0, size);
+        bitmap_to_le((unsigned long *)buf, block->file_bmap,
+                     block->used_length >> TARGET_PAGE_BITS);
+        bufs = g_slist_prepend(bufs, buf);
+        ret = mapped_ram_submit(&io);
+        if (ret < 0) {
+            break;
+        }
+    }
+
+    if (!ret) {
+        ret = mapped_ram_flush();
+    } else {
+        mapped_ram_flush();
+    }
+    for (l = bufs; l; l = l->next) {
+        qemu_vfree(l->data);
+    }
+    g_slist_free(bufs);
+    return ret;
+}
+
+/**
+ * mapped_ram_load_block: read the pages of a block from the file
+ *
+ * Returns 0 for success or negative errno
+ *
+ * @f: QEMUFile positioned after the header of @block
+ * @block: block to load
+ * @length: length of the block in the file
+ */
+static int mapped_ram_load_block(QEMUFile *f, RAMBlock *block,
+                                 ram_addr_t length)
+{
+    MigrationIncomingState *mis = migration_incoming_get_current();
+    unsigned long pages = length >> TARGET_PAGE_BITS;
+    unsigned long start, end;
+    size_t size;
+    uint8_t *buf;
+    MappedRamIO io;
+    int ret;
+
+    block->bitmap_offset = qemu_get_be64(f);
+    block->pages_offset = qemu_get_be64(f);
+    if (length != block->used_length) {
+        return -EINVAL;
+    }
+
+    if (!mapped_ram.threads &&
+        mapped_ram_threads_setup(mis->file_path, true) < 0) {
+        return -EINVAL;
+    }
+
+    size = mapped_ram_bitmap_buf_size(block);
+    buf = qemu_memalign(qemu_real_host_page_size, size);
+    io = (MappedRamIO) { .host = buf, .offset = block->bitmap_offset,
+                         .len = size };
+    ret = mapped_ram_submit(&io);
+    if (!ret) {
+        ret = mapped_ram_flush();
+    }
+    if (ret < 0) {
+        qemu_vfree(buf);
+        return ret;
+    }
+    block->file_bmap = bitmap_new(pages);
+    bitmap_from_le(block->file_bmap, (unsigned long *)buf, pages);
+    qemu_vfree(buf);
+
+    /* Runs of present pages, cut so that the threads share them */
+    for (start = find_first_bit(block->file_bmap, pages); start < pages;
+         start = find_next_bit(block->file_bmap, pages, end)) {
+        ram_addr_t offset = start << TARGET_PAGE_BITS;
+
+        end = find_next_zero_bit(block->file_bmap, pages, start);
+        end = MIN(end, start + (MAPPED_RAM_IO_MAX >> TARGET_PAGE_BITS));
+        ret = mapped_ram_queue(block->host + offset,
+                               block->pages_offset + offset,
+                               (end - start) << TARGET_PAGE_BITS);
+        if (ret < 0) {
+            break;
+        }
+    }
+    if (!ret) {
+        ret = mapped_ram_flush();
+    } else {
+        mapped_ram_flush();
+    }
+
+    g_free(block->file_bmap);
+    block->file_bmap = NULL;
+    if (ret < 0) {
+        return ret;
+    }
+
+    return qemu_file_seek(f, block->pages_offset + length);
+}
+
 /**
  * ram_save_target_page: save one target page
  *
@@ -1417,9 +4021,15 @@ static int ram_save_target_page(RAMState *rs, PageSearchStatus *pss,
          * round of migration even if compression is enabled. In theory,
          * xbzrle can do better than compression.
          */
-        if (migrate_use_compression() &&
+        if (migrate_mapped_ram()) {
+            res = ram_save_mapped_page(rs, pss->block, pss->page);
+        } else if (migrate_use_compression() &&
             (rs->ram_bulk_stage || !migrate_use_xbzrle())) {
             res = ram_save_compressed_page(rs, pss, last_stage);
+        } else if (multifd_send_state && !migrate_use_xbzrle() &&
+                   !migration_in_postcopy()) {
+            res = ram_save_multifd_page(rs, pss->block,
+                                        pss->page << TARGET_PAGE_BITS);
         } else {
             res = ram_save_page(rs, pss, last_stage);
         }
@@ -1459,6 +4069,7 @@ static int ram_save_host_page(RAMState *rs, PageSearchStatus *pss,
     int tmppages, pages = 0;
     size_t pagesize_bits =
         qemu_ram_pagesize(pss->block) >> TARGET_PAGE_BITS;
+    unsigned long start_page = pss->page;
 
     do {
         tmppages = ram_save_target_page(rs, pss, last_stage);
@@ -1473,6 +4084,11 @@ static int ram_save_host_page(RAMState *rs, PageSearchStatus *pss,
 
     /* The offset we leave with is the last one we looked at */
     pss->page--;
+
+    tmppages = write_tracking_page_saved(pss->block, start_page);
+    if (tmppages < 0) {
+        return tmppages;
+    }
     return pages;
 }
 
@@ -1574,9 +4190,19 @@ static void ram_save_cleanup(void *opaque)
     /* caller have hold iothread lock or is in a bh, so there is
      * no writing race against this migration_bitmap
      */
-    memory_global_dirty_log_stop();
+    if (migrate_background_snapshot()) {
+        ram_write_tracking_stop();
+    } else {
+        memory_global_dirty_log_stop();
+    }
+    bitmap_sync_threads_cleanup();
+    mapped_ram_threads_cleanup();
 
     QLIST_FOREACH_RCU(block, &ram_list.blocks, next) {
+        g_free(block->file_bmap);
+        block->file_bmap = NULL;
+        g_free(block->clear_bmap);
+        block->clear_bmap = NULL;
         g_free(block->bmap);
         block->bmap = NULL;
         g_free(block->unsentmap);
@@ -2014,6 +4640,7 @@ static int ram_state_init(RAMState **rsp)
     qemu_mutex_init(&(*rsp)->bitmap_mutex);
     qemu_mutex_init(&(*rsp)->src_page_req_mutex);
     QSIMPLEQ_INIT(&(*rsp)->src_page_requests);
+    migration_vcpu_dirty_rate_reset();
 
     if (migrate_use_xbzrle()) {
         XBZRLE_cache_lock();
@@ -2066,6 +4693,11 @@ static int ram_state_init(RAMState **rsp)
 
             block->bmap = bitmap_new(pages);
             bitmap_set(block->bmap, 0, pages);
+            block->clear_bmap_shift = CLEAR_BITMAP_SHIFT;
+            if (!migrate_background_snapshot()) {
+                block->clear_bmap =
+                    bitmap_new(clear_bmap_size(pages, CLEAR_BITMAP_SHIFT));
+            }
             if (migrate_postcopy_ram()) {
                 block->unsentmap = bitmap_new(pages);
                 bitmap_set(block->unsentmap, 0, pages);
@@ -2079,8 +4711,12 @@ static int ram_state_init(RAMState **rsp)
      */
     (*rsp)->migration_dirty_pages = ram_bytes_total() >> TARGET_PAGE_BITS;
 
-    memory_global_dirty_log_start();
-    migration_bitmap_sync(*rsp);
+    bitmap_sync_threads_setup();
+    /* A snapshot sends every page once, writes are caught by write_tracking */
+    if (!migrate_background_snapshot()) {
+        memory_global_dirty_log_start();
+        migration_bitmap_sync(*rsp);
+    }
     qemu_mutex_unlock_ramlist();
     qemu_mutex_unlock_iothread();
     rcu_read_unlock();
@@ -2116,6 +4752,12 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
     }
     (*rsp)->f = f;
 
+    if (migrate_mapped_ram() &&
+        mapped_ram_threads_setup(migrate_get_current()->file_path,
+                                 false) < 0) {
+        return -1;
+    }
+
     rcu_read_lock();
 
     qemu_put_be64(f, ram_bytes_total() | RAM_SAVE_FLAG_MEM_SIZE);
@@ -2127,6 +4769,9 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
         if (migrate_postcopy_ram() && block->page_size != qemu_host_page_size) {
             qemu_put_be64(f, block->page_size);
         }
+        if (migrate_mapped_ram()) {
+            mapped_ram_save_block_setup(f, block);
+        }
     }
 
     rcu_read_unlock();
@@ -2135,6 +4780,9 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
     ram_control_before_iterate(f, RAM_CONTROL_SETUP);
     ram_control_after_iterate(f, RAM_CONTROL_SETUP);
 
+    if (multifd_send_sync_main(*rsp) < 0) {
+        return -1;
+    }
     qemu_put_be64(f, RAM_SAVE_FLAG_EOS);
 
     return 0;
@@ -2178,6 +4826,10 @@ static int ram_save_iterate(QEMUFile *f, void *opaque)
             done = 1;
             break;
         }
+        if (pages < 0) {
+            qemu_file_set_error(f, pages);
+            break;
+        }
         rs->iterations++;
 
         /* we want to check in the 1st loop, just in case it was the 1st time
@@ -2195,6 +4847,12 @@ static int ram_save_iterate(QEMUFile *f, void *opaque)
         i++;
     }
     flush_compressed_data(rs);
+    /* Pages queued for the file must not outlive the RCU critical section
+     * nor be queued again before they are written
+     */
+    if (mapped_ram_flush() < 0) {
+        qemu_file_set_error(f, -EIO);
+    }
     rcu_read_unlock();
 
     /*
@@ -2203,6 +4861,9 @@ static int ram_save_iterate(QEMUFile *f, void *opaque)
      */
     ram_control_after_iterate(f, RAM_CONTROL_ROUND);
 
+    if (!migration_in_postcopy() && multifd_send_sync_main(rs) < 0) {
+        qemu_file_set_error(f, -EIO);
+    }
     qemu_put_be64(f, RAM_SAVE_FLAG_EOS);
     ram_counters.transferred += 8;
 
@@ -2217,7 +4878,7 @@ static int ram_save_iterate(QEMUFile *f, void *opaque)
 /**
  * ram_save_complete: function called to send the remaining amount of ram
  *
- * Returns zero to indicate success
+ * Returns zero to indicate success and negative for error
  *
  * Called with iothread lock
  *
@@ -2228,10 +4889,11 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
 {
     RAMState **temp = opaque;
     RAMState *rs = *temp;
+    int ret = 0;
 
     rcu_read_lock();
 
-    if (!migration_in_postcopy()) {
+    if (!migration_in_postcopy() && !migrate_background_snapshot()) {
         migration_bitmap_sync(rs);
     }
 
@@ -2248,16 +4910,26 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
         if (pages == 0) {
             break;
         }
+        if (pages < 0) {
+            ret = pages;
+            break;
+        }
     }
 
     flush_compressed_data(rs);
+    if (!ret && migrate_mapped_ram()) {
+        ret = mapped_ram_save_bitmaps();
+    }
     ram_control_after_iterate(f, RAM_CONTROL_FINISH);
 
     rcu_read_unlock();
 
+    if (!ret && !migration_in_postcopy() && multifd_send_sync_main(rs) < 0) {
+        ret = -EIO;
+    }
     qemu_put_be64(f, RAM_SAVE_FLAG_EOS);
 
-    return 0;
+    return ret;
 }
 
 static void ram_save_pending(QEMUFile *f, void *opaque, uint64_t max_size,
@@ -2270,7 +4942,7 @@ static void ram_save_pending(QEMUFile *f, void *opaque, uint64_t max_size,
 
     remaining_size = rs->migration_dirty_pages * TARGET_PAGE_SIZE;
 
-    if (!migration_in_postcopy() &&
+    if (!migration_in_postcopy() && !migrate_background_snapshot() &&
         remaining_size < max_size) {
         qemu_mutex_lock_iothread();
         rcu_read_lock();
@@ -2541,6 +5213,7 @@ static int ram_load_cleanup(void *opaque)
 {
     xbzrle_load_cleanup();
     compress_threads_load_cleanup();
+    mapped_ram_threads_cleanup();
     return 0;
 }
 
@@ -2795,6 +5468,9 @@ static int ram_load(QEMUFile *f, void *opaque, int version_id)
                             ret = -EINVAL;
                         }
                     }
+                    if (!ret && migrate_mapped_ram()) {
+                        ret = mapped_ram_load_block(f, block, length);
+                    }
                     ram_control_load_hook(f, RAM_CONTROL_BLOCK_REG,
                                           block->idstr);
                 } else {
@@ -2836,6 +5512,9 @@ static int ram_load(QEMUFile *f, void *opaque, int version_id)
             break;
         case RAM_SAVE_FLAG_EOS:
             /* normal exit */
+            if (multifd_recv_sync_main() < 0) {
+                ret = -EIO;
+            }
             break;
         default:
             if (flags & RAM_SAVE_FLAG_HOOK) {
@@ -33,6 +33,19 @@
 #include <rdma/rdma_cma.h>
 #include "trace.h"
 
+/*
+ * Source side counters for query-migrate; they describe the migration
+ * in progress, or the last one.
+ */
+static struct {
+    bool     active;
+    int      qps;
+    uint64_t registered_chunks;
+    uint64_t registration_stalls;
+    uint64_t registration_stall_ns;
+    uint64_t write_stalls;
+} rdma_stats;
+
 /*
  * Print and error on both the Monitor and the Log file.
  */
@@ -52,6 +65,13 @@
 
 #define RDMA_REG_CHUNK_SHIFT 20 /* 1 MB */
 
+/*
+ * Chunks the source asks the destination to register in one round trip
+ * when it meets a chunk that is not registered yet, so that the bulk
+ * stage does not stall on a control message every megabyte.
+ */
+#define RDMA_REG_READAHEAD 8
+
 /*
  * This is only for non-live state being migrated.
  * Instead of RDMA_WRITE messages, we use RDMA_SEND
@@ -71,12 +91,18 @@
  * Capabilities for negotiation.
  */
 #define RDMA_CAPABILITY_PIN_ALL 0x01
+/* RAM is written through RDMACapabilities.nb_qps extra queue pairs */
+#define RDMA_CAPABILITY_MULTI_QP 0x02
+/* The destination answers every entry of a multi-chunk REGISTER_REQUEST */
+#define RDMA_CAPABILITY_REG_BATCH 0x04
 
 /*
  * Add the other flags above to this list of known capabilities
  * as they are introduced.
  */
-static uint32_t known_capabilities = RDMA_CAPABILITY_PIN_ALL;
+static uint32_t known_capabilities = RDMA_CAPABILITY_PIN_ALL |
+                                     RDMA_CAPABILITY_MULTI_QP |
+                                     RDMA_CAPABILITY_REG_BATCH;
 
 #define CHECK_ERROR_STATE() \
     do { \
@@ -179,22 +205,28 @@ typedef struct {
 
 /*
  * Negotiate RDMA capabilities during connection-setup time.
+ *
+ * nb_qps was added after the first two fields; the connection manager
+ * pads private data with zeroes, so it reads as 0 from older peers.
  */
 typedef struct {
     uint32_t version;
     uint32_t flags;
+    uint32_t nb_qps;
 } RDMACapabilities;
 
 static void caps_to_network(RDMACapabilities *cap)
 {
     cap->version = htonl(cap->version);
     cap->flags = htonl(cap->flags);
+    cap->nb_qps = htonl(cap->nb_qps);
 }
 
 static void network_to_caps(RDMACapabilities *cap)
 {
     cap->version = ntohl(cap->version);
     cap->flags = ntohl(cap->flags);
+    cap->nb_qps = ntohl(cap->nb_qps);
 }
 
 /*
@@ -302,6 +334,25 @@ typedef struct RDMALocalBlocks {
     RDMALocalBlock *block;
 } RDMALocalBlocks;
 
+/*
+ * An extra queue pair RAM is written through.  On the source each one
+ * has a thread reaping its completions, so that the migration thread
+ * only ever posts writes; on the destination it is passive.
+ */
+typedef struct RDMAChannel {
+    struct RDMAContext *rdma;
+    int id;
+    struct rdma_cm_id *cm_id;
+    struct ibv_qp *qp;
+    struct ibv_comp_channel *comp_channel;
+    struct ibv_cq *cq;
+    bool connected;
+    QemuThread thread;
+    bool thread_running;
+    /* Writes posted and not completed yet, protected by rdma->qp_mutex */
+    int nb_sent;
+} RDMAChannel;
+
 /*
  * Main data structure for RDMA state.
  * While there is only one copy of this structure being allocated right now,
@@ -336,6 +387,8 @@ typedef struct RDMAContext {
     int current_chunk;
 
     bool pin_all;
+    /* Register chunks RDMA_REG_READAHEAD at a time */
+    bool reg_batch;
 
     /*
      * infiniband-specific variables for opening the device
@@ -387,6 +440,21 @@ typedef struct RDMAContext {
     uint64_t unregistrations[RDMA_SIGNALED_SEND_MAX];
 
     GHashTable *blockmap;
+
+    /*
+     * Extra queue pairs RAM is written through; with none, RAM goes
+     * through the control queue pair as it always did.
+     */
+    int nb_channels;
+    RDMAChannel *channels;
+    /*
+     * With channels, protects their nb_sent and the transit_bitmap of
+     * the blocks, which the completion threads clear.
+     */
+    QemuMutex qp_mutex;
+    /* Signalled whenever writes complete or a channel fails */
+    QemuCond qp_cond;
+    bool qp_quit;
 } RDMAContext;
 
 #define TYPE_QIO_CHANNEL_RDMA "qio-channel-rdma"
@@ -1097,6 +1165,362 @@ static int qemu_rdma_alloc_qp(RDMAContext *rdma)
     return 0;
 }
 
+/*
+ * Create the queue pair of an extra channel.  It uses the protection
+ * domain of the control queue pair, so every memory registration is
+ * valid on every queue pair.  Only the source reaps RDMA write
+ * completions; the destination never gets any and shares its CQ.
+ */
+static int qemu_rdma_alloc_channel_qp(RDMAContext *rdma, RDMAChannel *ch,
+                                      bool source)
+{
+    struct ibv_qp_init_attr attr = { 0 };
+
+    if (ch->cm_id->verbs != rdma->verbs) {
+        error_report("rdma migration: queue pair %d is not on the device "
+                     "of the control queue pair", ch->id);
+        return -1;
+    }
+
+    if (source) {
+        ch->comp_channel = ibv_create_comp_channel(rdma->verbs);
+        if (!ch->comp_channel) {
+            error_report("failed to allocate completion channel");
+            return -1;
+        }
+        ch->cq = ibv_create_cq(rdma->verbs, RDMA_SIGNALED_SEND_MAX,
+                               NULL, ch->comp_channel, 0);
+        if (!ch->cq) {
+            error_report("failed to allocate completion queue");
+            return -1;
+        }
+    }
+
+    attr.cap.max_send_wr = RDMA_SIGNALED_SEND_MAX;
+    attr.cap.max_recv_wr = 1;
+    attr.cap.max_send_sge = 1;
+    attr.cap.max_recv_sge = 1;
+    attr.send_cq = source ? ch->cq : rdma->cq;
+    attr.recv_cq = attr.send_cq;
+    attr.qp_type = IBV_QPT_RC;
+
+    if (rdma_create_qp(ch->cm_id, rdma->pd, &attr)) {
+        error_report("rdma migration: error allocating queue pair %d", ch->id);
+        return -1;
+    }
+
+    ch->qp = ch->cm_id->qp;
+    return 0;
+}
+
+static void qemu_rdma_init_channels(RDMAContext *rdma, int nb_channels)
+{
+    int i;
+
+    rdma->nb_channels = nb_channels;
+    rdma->channels = g_new0(RDMAChannel, nb_channels);
+    for (i = 0; i < nb_channels; i++) {
+        rdma->channels[i].rdma = rdma;
+        rdma->channels[i].id = i;
+    }
+    qemu_mutex_init(&rdma->qp_mutex);
+    qemu_cond_init(&rdma->qp_cond);
+    rdma->qp_quit = false;
+}
+
+/*
+ * Wait for a completion thread to make progress.  They also wake us up
+ * when they time out waiting for completions, so that a cancelled
+ * migration does not hang here.
+ *
+ * Called with qp_mutex held.
+ */
+static int qemu_rdma_channel_wait(RDMAContext *rdma)
+{
+    qemu_cond_wait(&rdma->qp_cond, &rdma->qp_mutex);
+
+    if (migrate_get_current()->state == MIGRATION_STATUS_CANCELLING) {
+        return -EPIPE;
+    }
+    return rdma->error_state;
+}
+
+/*
+ * Reaps the RDMA write completions of one channel on the source.
+ */
+static void *qemu_rdma_channel_thread(void *opaque)
+{
+    RDMAChannel *ch = opaque;
+    RDMAContext *rdma = ch->rdma;
+    struct ibv_wc wc[16];
+    int i, n;
+
+    while (!atomic_read(&rdma->qp_quit)) {
+        n = ibv_poll_cq(ch->cq, ARRAY_SIZE(wc), wc);
+        if (n == 0) {
+            GPollFD pfd = {
+                .fd = ch->comp_channel->fd,
+                .events = G_IO_IN | G_IO_HUP | G_IO_ERR,
+            };
+            struct ibv_cq *cq;
+            void *cq_ctx;
+
+            /* Re-poll once armed, or a completion could be missed */
+            if (ibv_req_notify_cq(ch->cq, 0)) {
+                n = -1;
+            } else {
+                n = ibv_poll_cq(ch->cq, ARRAY_SIZE(wc), wc);
+            }
+            if (n == 0) {
+                if (qemu_poll_ns(&pfd, 1, 100 * 1000 * 1000) == 1 &&
+                    !ibv_get_cq_event(ch->comp_channel, &cq, &cq_ctx)) {
+                    ibv_ack_cq_events(cq, 1);
+                } else {
+                    /* Let waiters look for a cancellation */
+                    qemu_mutex_lock(&rdma->qp_mutex);
+                    qemu_cond_broadcast(&rdma->qp_cond);
+                    qemu_mutex_unlock(&rdma->qp_mutex);
+                }
+                continue;
+            }
+        }
+
+        qemu_mutex_lock(&rdma->qp_mutex);
+        if (n < 0) {
+            error_report("rdma migration: polling queue pair %d failed",
+                         ch->id);
+            rdma->error_state = -EIO;
+            qemu_cond_broadcast(&rdma->qp_cond);
+            qemu_mutex_unlock(&rdma->qp_mutex);
+            break;
+        }
+        for (i = 0; i < n; i++) {
+            uint64_t chunk =
+                (wc[i].wr_id & RDMA_WRID_CHUNK_MASK) >> RDMA_WRID_CHUNK_SHIFT;
+            uint64_t index =
+                (wc[i].wr_id & RDMA_WRID_BLOCK_MASK) >> RDMA_WRID_BLOCK_SHIFT;
+
+            if (wc[i].status != IBV_WC_SUCCESS) {
+                error_report("rdma migration: write on queue pair %d "
+                             "failed: %s", ch->id,
+                             ibv_wc_status_str(wc[i].status));
+                rdma->error_state = -EIO;
+            }
+            trace_qemu_rdma_channel_complete(ch->id, index, chunk);
+            clear_bit(chunk, rdma->local_ram_blocks.block[index].transit_bitmap);
+            ch->nb_sent--;
+        }
+        qemu_cond_broadcast(&rdma->qp_cond);
+        qemu_mutex_unlock(&rdma->qp_mutex);
+    }
+
+    return NULL;
+}
+
+/* Wait for the next connection manager event, which must be @expected */
+static int qemu_rdma_wait_cm_event(RDMAContext *rdma,
+                                   enum rdma_cm_event_type expected)
+{
+    struct rdma_cm_event *cm_event;
+    int ret;
+
+    ret = rdma_get_cm_event(rdma->channel, &cm_event);
+    if (ret) {
+        return ret;
+    }
+    if (cm_event->event != expected) {
+        error_report("rdma migration: got %s instead of %s",
+                     rdma_event_str(cm_event->event),
+                     rdma_event_str(expected));
+        ret = -EINVAL;
+    }
+    rdma_ack_cm_event(cm_event);
+
+    return ret;
+}
+
+/*
+ * Source: connect the extra queue pairs once the control queue pair is
+ * connected, and start their completion threads.
+ */
+static int qemu_rdma_connect_channels(RDMAContext *rdma, Error **errp)
+{
+    struct sockaddr *peer = rdma_get_peer_addr(rdma->cm_id);
+    int i;
+
+    for (i = 0; i < rdma->nb_channels; i++) {
+        RDMAChannel *ch = &rdma->channels[i];
+        RDMACapabilities cap = {
+                                    .version = RDMA_CONTROL_VERSION_CURRENT,
+                                    .flags = RDMA_CAPABILITY_MULTI_QP,
+                                    .nb_qps = rdma->nb_channels,
+                               };
+        struct rdma_conn_param conn_param = { .initiator_depth = 2,
+                                              .retry_count = 5,
+                                              .private_data = &cap,
+                                              .private_data_len = sizeof(cap),
+                                            };
+
+        caps_to_network(&cap);
+
+        if (rdma_create_id(rdma->channel, &ch->cm_id, NULL, RDMA_PS_TCP)) {
+            ERROR(errp, "could not create id for queue pair %d", i);
+            return -1;
+        }
+        if (rdma_resolve_addr(ch->cm_id, NULL, peer,
+                              RDMA_RESOLVE_TIMEOUT_MS) ||
+            qemu_rdma_wait_cm_event(rdma, RDMA_CM_EVENT_ADDR_RESOLVED) ||
+            rdma_resolve_route(ch->cm_id, RDMA_RESOLVE_TIMEOUT_MS) ||
+            qemu_rdma_wait_cm_event(rdma, RDMA_CM_EVENT_ROUTE_RESOLVED)) {
+            ERROR(errp, "could not resolve queue pair %d", i);
+            return -1;
+        }
+        if (qemu_rdma_alloc_channel_qp(rdma, ch, true)) {
+            ERROR(errp, "could not allocate queue pair %d", i);
+            return -1;
+        }
+        if (rdma_connect(ch->cm_id, &conn_param) ||
+            qemu_rdma_wait_cm_event(rdma, RDMA_CM_EVENT_ESTABLISHED)) {
+            ERROR(errp, "could not connect queue pair %d", i);
+            return -1;
+        }
+        ch->connected = true;
+    }
+
+    for (i = 0; i < rdma->nb_channels; i++) {
+        RDMAChannel *ch = &rdma->channels[i];
+
+        qemu_thread_create(&ch->thread, "rdma_qp", qemu_rdma_channel_thread,
+                           ch, QEMU_THREAD_JOINABLE);
+        ch->thread_running = true;
+    }
+
+    return 0;
+}
+
+/*
+ * Destination: accept the extra queue pairs the source opens after the
+ * control queue pair.  The request for the next one may come before the
+ * previous one is reported established, so take events as they come.
+ */
+static int qemu_rdma_accept_channels(RDMAContext *rdma)
+{
+    RDMACapabilities cap = {
+                                .version = RDMA_CONTROL_VERSION_CURRENT,
+                                .flags = RDMA_CAPABILITY_MULTI_QP,
+                                .nb_qps = rdma->nb_channels,
+                           };
+    struct rdma_conn_param conn_param = {
+                                            .responder_resources = 2,
+                                            .private_data = &cap,
+                                            .private_data_len = sizeof(cap),
+                                         };
+    struct rdma_cm_event *cm_event;
+    int requested = 0, established = 0;
+    int i, ret;
+
+    caps_to_network(&cap);
+
+    while (established < rdma->nb_channels) {
+        ret = rdma_get_cm_event(rdma->channel, &cm_event);
+        if (ret) {
+            return ret;
+        }
+
+        switch (cm_event->event) {
+        case RDMA_CM_EVENT_CONNECT_REQUEST:
+            if (requested == rdma->nb_channels) {
+                error_report("rdma migration: unexpected queue pair request");
+                rdma_ack_cm_event(cm_event);
+                return -EINVAL;
+            }
+            rdma->channels[requested].cm_id = cm_event->id;
+            rdma_ack_cm_event(cm_event);
+
+            ret = qemu_rdma_alloc_channel_qp(rdma, &rdma->channels[requested],
+                                             false);
+            if (!ret) {
+                ret = rdma_accept(rdma->channels[requested].cm_id,
+                                  &conn_param);
+            }
+            if (ret) {
+                error_report("rdma migration: could not accept queue pair %d",
+                             requested);
+                return -EINVAL;
+            }
+            requested++;
+            break;
+
+        case RDMA_CM_EVENT_ESTABLISHED:
+            for (i = 0; i < requested; i++) {
+                if (rdma->channels[i].cm_id == cm_event->id) {
+                    rdma->channels[i].connected = true;
+                    established++;
+                }
+            }
+            rdma_ack_cm_event(cm_event);
+            break;
+
+        default:
+            error_report("rdma migration: %s while accepting queue pairs",
+                         rdma_event_str(cm_event->event));
+            rdma_ack_cm_event(cm_event);
+            return -EINVAL;
+        }
+    }
+
+    return 0;
+}
+
+static void qemu_rdma_cleanup_channels(RDMAContext *rdma)
+{
+    int i;
+
+    if (!rdma->channels) {
+        return;
+    }
+
+    qemu_mutex_lock(&rdma->qp_mutex);
+    atomic_set(&rdma->qp_quit, true);
+    qemu_cond_broadcast(&rdma->qp_cond);
+    qemu_mutex_unlock(&rdma->qp_mutex);
+
+    for (i = 0; i < rdma->nb_channels; i++) {
+        RDMAChannel *ch = &rdma->channels[i];
+
+        if (ch->thread_running) {
+            qemu_thread_join(&ch->thread);
+            ch->thread_running = false;
+        }
+        if (ch->connected) {
+            rdma_disconnect(ch->cm_id);
+            ch->connected = false;
+        }
+        if (ch->qp) {
+            rdma_destroy_qp(ch->cm_id);
+            ch->qp = NULL;
+        }
+        if (ch->cq) {
+            ibv_destroy_cq(ch->cq);
+            ch->cq = NULL;
+        }
+        if (ch->comp_channel) {
+            ibv_destroy_comp_channel(ch->comp_channel);
+            ch->comp_channel = NULL;
+        }
+        if (ch->cm_id) {
+            rdma_destroy_id(ch->cm_id);
+            ch->cm_id = NULL;
+        }
+    }
+
+    g_free(rdma->channels);
+    rdma->channels = NULL;
+    rdma->nb_channels = 0;
+    qemu_cond_destroy(&rdma->qp_cond);
+    qemu_mutex_destroy(&rdma->qp_mutex);
+}
+
 static int qemu_rdma_reg_whole_ram_blocks(RDMAContext *rdma)
 {
     int i;
@@ -1931,11 +2355,15 @@ static int qemu_rdma_write_one(QEMUFile *f, RDMAContext *rdma,
     struct ibv_send_wr send_wr = { 0 };
     struct ibv_send_wr *bad_wr;
     int reg_result_idx, ret, count = 0;
+    int i, nb_regs;
     uint64_t chunk, chunks;
     uint8_t *chunk_start, *chunk_end;
     RDMALocalBlock *block = &(rdma->local_ram_blocks.block[current_index]);
-    RDMARegister reg;
+    RDMAChannel *ch = NULL;
+    RDMARegister reg[RDMA_REG_READAHEAD];
+    uint64_t reg_chunk[RDMA_REG_READAHEAD];
     RDMARegisterResult *reg_result;
+    int64_t reg_start;
     RDMAControlHeader resp = { .type = RDMA_CONTROL_REGISTER_RESULT };
     RDMAControlHeader head = { .len = sizeof(RDMARegister),
                                .type = RDMA_CONTROL_REGISTER_REQUEST,
@@ -1977,7 +2405,28 @@ retry:
 #endif
     }
 
-    while (test_bit(chunk, block->transit_bitmap)) {
+    if (rdma->nb_channels) {
+        ch = &rdma->channels[(current_index + chunk) % rdma->nb_channels];
+        ret = 0;
+
+        qemu_mutex_lock(&rdma->qp_mutex);
+        if (test_bit(chunk, block->transit_bitmap) ||
+            ch->nb_sent >= RDMA_SIGNALED_SEND_MAX) {
+            rdma_stats.write_stalls++;
+        }
+        while (!ret && (test_bit(chunk, block->transit_bitmap) ||
+                        ch->nb_sent >= RDMA_SIGNALED_SEND_MAX)) {
+            ret = qemu_rdma_channel_wait(rdma);
+        }
+        qemu_mutex_unlock(&rdma->qp_mutex);
+
+        if (ret < 0) {
+            error_report("Failed to wait for queue pair %d", ch->id);
+            return ret;
+        }
+    }
+
+    while (!ch && test_bit(chunk, block->transit_bitmap)) {
         (void)count;
         trace_qemu_rdma_write_one_block(count++, current_index, chunk,
                 sge.addr, length, rdma->nb_sent, block->nb_chunks);
@@ -2031,23 +2480,59 @@ retry:
             /*
              * Otherwise, tell other side to register.
              */
-            reg.current_index = current_index;
+            reg[0].current_index = current_index;
             if (block->is_ram_block) {
-                reg.key.current_addr = current_addr;
+                reg[0].key.current_addr = current_addr;
             } else {
-                reg.key.chunk = chunk;
+                reg[0].key.chunk = chunk;
+            }
+            reg[0].chunks = chunks;
+            reg_chunk[0] = chunk;
+            nb_regs = 1;
+
+            /*
+             * RAM is mostly sent in order, so register the chunks that
+             * follow in the same round trip, as long as they hold data.
+             */
+            if (rdma->reg_batch && block->is_ram_block) {
+                uint64_t next = chunk + chunks + 1;
+
+                while (nb_regs < RDMA_REG_READAHEAD &&
+                       next < block->nb_chunks &&
+                       !block->remote_keys[next] &&
+                       !buffer_is_zero(ram_chunk_start(block, next),
+                                       ram_chunk_end(block, next) -
+                                       ram_chunk_start(block, next))) {
+                    reg[nb_regs].current_index = current_index;
+                    reg[nb_regs].key.current_addr = block->offset +
+                        (next << RDMA_REG_CHUNK_SHIFT);
+                    reg[nb_regs].chunks = 0;
+                    reg_chunk[nb_regs] = next;
+                    nb_regs++;
+                    next++;
+                }
             }
-            reg.chunks = chunks;
 
             trace_qemu_rdma_write_one_sendreg(chunk, sge.length, current_index,
                                               current_addr);
 
-            register_to_network(rdma, &reg);
-            ret = qemu_rdma_exchange_send(rdma, &head, (uint8_t *) &reg,
+            for (i = 0; i < nb_regs; i++) {
+                register_to_network(rdma, &reg[i]);
+            }
+            head.len = nb_regs * sizeof(RDMARegister);
+            head.repeat = nb_regs;
+
+            reg_start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+            ret = qemu_rdma_exchange_send(rdma, &head, (uint8_t *) reg,
                                     &resp, &reg_result_idx, NULL);
             if (ret < 0) {
                 return ret;
             }
+            if (resp.len < nb_regs * sizeof(RDMARegisterResult)) {
+                error_report("rdma migration: short registration result "
+                             "(%u bytes for %d chunks)", resp.len, nb_regs);
+                return -EINVAL;
+            }
 
             /* try to overlap this single registration with the one we sent. */
             if (qemu_rdma_register_and_get_keys(rdma, block, sge.addr,
@@ -2060,13 +2545,21 @@ retry:
             reg_result = (RDMARegisterResult *)
                     rdma->wr_data[reg_result_idx].control_curr;
 
-            network_to_result(reg_result);
+            for (i = 0; i < nb_regs; i++) {
+                network_to_result(&reg_result[i]);
 
-            trace_qemu_rdma_write_one_recvregres(block->remote_keys[chunk],
-                                                 reg_result->rkey, chunk);
+                trace_qemu_rdma_write_one_recvregres(
+                    block->remote_keys[reg_chunk[i]], reg_result[i].rkey,
+                    reg_chunk[i]);
 
-            block->remote_keys[chunk] = reg_result->rkey;
-            block->remote_host_addr = reg_result->host_addr;
+                block->remote_keys[reg_chunk[i]] = reg_result[i].rkey;
+                block->remote_host_addr = reg_result[i].host_addr;
+            }
+
+            rdma_stats.registered_chunks += nb_regs;
+            rdma_stats.registration_stalls++;
+            rdma_stats.registration_stall_ns +=
+                qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - reg_start;
         } else {
             /* already registered before */
             if (qemu_rdma_register_and_get_keys(rdma, block, sge.addr,
@@ -2108,6 +2601,35 @@ retry:
     trace_qemu_rdma_write_one_post(chunk, sge.addr, send_wr.wr.rdma.remote_addr,
                                    sge.length);
 
+    if (ch) {
+        /* The completion thread may run as soon as the write is posted */
+        qemu_mutex_lock(&rdma->qp_mutex);
+        set_bit(chunk, block->transit_bitmap);
+        ch->nb_sent++;
+        qemu_mutex_unlock(&rdma->qp_mutex);
+
+        ret = ibv_post_send(ch->qp, &send_wr, &bad_wr);
+        if (ret) {
+            qemu_mutex_lock(&rdma->qp_mutex);
+            clear_bit(chunk, block->transit_bitmap);
+            ch->nb_sent--;
+            qemu_mutex_unlock(&rdma->qp_mutex);
+
+            if (ret == ENOMEM) {
+                /* Raced with our own accounting; wait for room again */
+                goto retry;
+            }
+            error_report("rdma migration: post rdma write on queue pair %d "
+                         "failed: %s", ch->id, strerror(ret));
+            return -ret;
+        }
+
+        acct_update_position(f, sge.length, false);
+        rdma->total_writes++;
+
+        return 0;
+    }
+
     /*
      * ibv_post_send() does not return negative error numbers,
      * per the specification they are positive - no idea why.
@@ -2158,7 +2680,8 @@ static int qemu_rdma_write_flush(QEMUFile *f, RDMAContext *rdma)
         return ret;
     }
 
-    if (ret == 0) {
+    /* Writes on extra queue pairs are counted per channel */
+    if (ret == 0 && !rdma->nb_channels) {
         rdma->nb_sent++;
         trace_qemu_rdma_write_flush(rdma->nb_sent);
     }
@@ -2292,6 +2815,8 @@ static void qemu_rdma_cleanup(RDMAContext *rdma)
         rdma->connected = false;
     }
 
+    qemu_rdma_cleanup_channels(rdma);
+
     g_free(rdma->dest_blocks);
     rdma->dest_blocks = NULL;
 
@@ -2407,7 +2932,7 @@ static int qemu_rdma_connect(RDMAContext *rdma, Error **errp)
 {
     RDMACapabilities cap = {
                                 .version = RDMA_CONTROL_VERSION_CURRENT,
-                                .flags = 0,
+                                .flags = RDMA_CAPABILITY_REG_BATCH,
                            };
     struct rdma_conn_param conn_param = { .initiator_depth = 2,
                                           .retry_count = 5,
@@ -2415,6 +2940,7 @@ static int qemu_rdma_connect(RDMAContext *rdma, Error **errp)
                                           .private_data_len = sizeof(cap),
                                         };
     struct rdma_cm_event *cm_event;
+    int nb_qps = migrate_rdma_qps();
     int ret;
 
     /*
@@ -2425,6 +2951,10 @@ static int qemu_rdma_connect(RDMAContext *rdma, Error **errp)
         trace_qemu_rdma_connect_pin_all_requested();
         cap.flags |= RDMA_CAPABILITY_PIN_ALL;
     }
+    if (nb_qps > 1) {
+        cap.flags |= RDMA_CAPABILITY_MULTI_QP;
+        cap.nb_qps = nb_qps;
+    }
 
     caps_to_network(&cap);
 
@@ -2472,8 +3002,28 @@ static int qemu_rdma_connect(RDMAContext *rdma, Error **errp)
 
     trace_qemu_rdma_connect_pin_all_outcome(rdma->pin_all);
 
+    rdma->reg_batch = !!(cap.flags & RDMA_CAPABILITY_REG_BATCH);
+    if (nb_qps > 1 && (!(cap.flags & RDMA_CAPABILITY_MULTI_QP) ||
+                       cap.nb_qps != nb_qps)) {
+        warn_report("rdma migration: destination does not support %d "
+                    "queue pairs, using one", nb_qps);
+        nb_qps = 1;
+    }
+
     rdma_ack_cm_event(cm_event);
 
+    memset(&rdma_stats, 0, sizeof(rdma_stats));
+    rdma_stats.active = true;
+    rdma_stats.qps = nb_qps;
+
+    if (nb_qps > 1) {
+        qemu_rdma_init_channels(rdma, nb_qps);
+        trace_qemu_rdma_connect_channels(nb_qps);
+        if (qemu_rdma_connect_channels(rdma, errp)) {
+            goto err_rdma_source_connect;
+        }
+    }
+
     rdma->control_ready_expected = 1;
     rdma->nb_sent = 0;
     return 0;
@@ -2597,6 +3147,7 @@ static ssize_t qio_channel_rdma_writev(QIOChannel *ioc,
                                        size_t niov,
                                        int *fds,
                                        size_t nfds,
+                                       int flags,
                                        Error **errp)
 {
     QIOChannelRDMA *rioc = QIO_CHANNEL_RDMA(ioc);
@@ -2756,6 +3307,24 @@ static int qemu_rdma_drain_cq(QEMUFile *f, RDMAContext *rdma)
         }
     }
 
+    if (rdma->nb_channels) {
+        int i;
+
+        ret = 0;
+        qemu_mutex_lock(&rdma->qp_mutex);
+        for (i = 0; i < rdma->nb_channels && !ret; i++) {
+            while (!ret && rdma->channels[i].nb_sent) {
+                ret = qemu_rdma_channel_wait(rdma);
+            }
+        }
+        qemu_mutex_unlock(&rdma->qp_mutex);
+
+        if (ret < 0) {
+            error_report("rdma migration: complete polling error!");
+            return -EIO;
+        }
+    }
+
     qemu_rdma_unregister_waiting(rdma);
 
     return 0;
@@ -3060,6 +3629,13 @@ static int qemu_rdma_accept(RDMAContext *rdma)
     if (cap.flags & RDMA_CAPABILITY_PIN_ALL) {
         rdma->pin_all = true;
     }
+    if (cap.flags & RDMA_CAPABILITY_MULTI_QP) {
+        if (cap.nb_qps > 1 && cap.nb_qps <= RDMA_MAX_QPS) {
+            qemu_rdma_init_channels(rdma, cap.nb_qps);
+        } else {
+            cap.flags &= ~RDMA_CAPABILITY_MULTI_QP;
+        }
+    }
 
     rdma->cm_id = cm_event->id;
     verbs = cm_event->id->verbs;
@@ -3131,6 +3707,15 @@ static int qemu_rdma_accept(RDMAContext *rdma)
     rdma_ack_cm_event(cm_event);
     rdma->connected = true;
 
+    if (rdma->nb_channels) {
+        trace_qemu_rdma_accept_channels(rdma->nb_channels);
+        ret = qemu_rdma_accept_channels(rdma);
+        if (ret) {
+            error_report("rdma migration: error accepting queue pairs");
+            goto err_rdma_dest_wait;
+        }
+    }
+
     ret = qemu_rdma_post_recv_control(rdma, RDMA_WRID_READY);
     if (ret) {
         error_report("rdma migration: error posting second control recv");
@@ -3298,6 +3883,7 @@ static int qemu_rdma_registration_handle(QEMUFile *f, void *opaque)
             trace_qemu_rdma_registration_handle_register(head.repeat);
 
             reg_resp.repeat = head.repeat;
+            reg_resp.len = head.repeat * sizeof(RDMARegisterResult);
             registers = (RDMARegister *) rdma->wr_data[idx].control_curr;
 
             for (count = 0; count < head.repeat; count++) {
@@ -3730,6 +4316,30 @@ err:
     g_free(rdma);
 }
 
+RdmaStats *rdma_migration_stats(void)
+{
+    RdmaStats *stats;
+
+    if (!rdma_stats.active) {
+        return NULL;
+    }
+
+    stats = g_new0(RdmaStats, 1);
+    stats->qps = rdma_stats.qps;
+    stats->registered_chunks = rdma_stats.registered_chunks;
+    stats->registration_stalls = rdma_stats.registration_stalls;
+    stats->registration_stall_time =
+        rdma_stats.registration_stall_ns / SCALE_MS;
+    stats->write_stalls = rdma_stats.write_stalls;
+
+    return stats;
+}
+
+void rdma_migration_stats_reset(void)
+{
+    memset(&rdma_stats, 0, sizeof(rdma_stats));
+}
+
 void rdma_start_outgoing_migration(void *opaque,
                             const char *host_port, Error **errp)
 {
@@ -17,9 +17,28 @@
 #ifndef QEMU_MIGRATION_RDMA_H
 #define QEMU_MIGRATION_RDMA_H
 
+#include "qapi-types.h"
+
+/* Upper bound of the x-rdma-qps parameter */
+#define RDMA_MAX_QPS 16
+
 void rdma_start_outgoing_migration(void *opaque, const char *host_port,
                                    Error **errp);
 
 void rdma_start_incoming_migration(const char *host_port, Error **errp);
 
+#ifdef CONFIG_RDMA
+RdmaStats *rdma_migration_stats(void);
+void rdma_migration_stats_reset(void);
+#else
+static inline RdmaStats *rdma_migration_stats(void)
+{
+    return NULL;
+}
+
+static inline void rdma_migration_stats_reset(void)
+{
+}
+#endif
+
 #endif
@@ -12,6 +12,7 @@
  */
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
+#include "qemu/host-utils.h"
 #include "xbzrle.h"
 
 /*
@@ -24,45 +25,87 @@
 
   length = uleb128 encoded integer
  */
-int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
-                         uint8_t *dst, int dlen)
-{
-    uint32_t zrun_len = 0, nzrun_len = 0;
-    int d = 0, i = 0;
-    long res;
-    uint8_t *nzrun_start = NULL;
 
-    g_assert(!(((uintptr_t)old_buf | (uintptr_t)new_buf | slen) %
-               sizeof(long)));
+/*
+ * The encoder is split into a generic loop that emits the runs and a pair
+ * of scanners, specialized for each ISA, that return the end of the zero
+ * run (first differing byte) or non-zero run (first equal byte) that starts
+ * at offset @i.  Every implementation produces the same output.
+ */
+static inline int zrun_end_int(const uint8_t *old_buf, const uint8_t *new_buf,
+                               int i, int slen)
+{
+    /* not aligned to sizeof(long) */
+    while ((i % sizeof(long)) && old_buf[i] == new_buf[i]) {
+        i++;
+    }
 
-    while (i < slen) {
-        /* overflow */
-        if (d + 2 > dlen) {
-            return -1;
+    /* word at a time for speed */
+    if (!(i % sizeof(long))) {
+        while (i < slen &&
+               (*(long *)(old_buf + i)) == (*(long *)(new_buf + i))) {
+            i += sizeof(long);
         }
 
-        /* not aligned to sizeof(long) */
-        res = (slen - i) % sizeof(long);
-        while (res && old_buf[i] == new_buf[i]) {
-            zrun_len++;
+        /* go over the rest */
+        while (i < slen && old_buf[i] == new_buf[i]) {
             i++;
-            res--;
         }
+    }
 
-        /* word at a time for speed */
-        if (!res) {
-            while (i < slen &&
-                   (*(long *)(old_buf + i)) == (*(long *)(new_buf + i))) {
-                i += sizeof(long);
-                zrun_len += sizeof(long);
-            }
+    return i;
+}
+
+static inline int nzrun_end_int(const uint8_t *old_buf, const uint8_t *new_buf,
+                                int i, int slen)
+{
+    /* not aligned to sizeof(long) */
+    while ((i % sizeof(long)) && old_buf[i] != new_buf[i]) {
+        i++;
+    }
 
-            /* go over the rest */
-            while (i < slen && old_buf[i] == new_buf[i]) {
-                zrun_len++;
-                i++;
+    /* word at a time for speed, use of 32-bit long okay */
+    if (!(i % sizeof(long))) {
+        /* truncation to 32-bit long okay */
+        unsigned long mask = (unsigned long)0x0101010101010101ULL;
+        while (i < slen) {
+            unsigned long xor;
+            xor = *(unsigned long *)(old_buf + i)
+                ^ *(unsigned long *)(new_buf + i);
+            if ((xor - mask) & ~xor & (mask << 7)) {
+                /* found the end of an nzrun within the current long */
+                while (old_buf[i] != new_buf[i]) {
+                    i++;
+                }
+                break;
             }
+            i += sizeof(long);
         }
+    }
+
+    return i;
+}
+
+typedef int (*xbzrle_scan_fn)(const uint8_t *old_buf, const uint8_t *new_buf,
+                              int i, int slen);
+
+static inline __attribute__((__always_inline__)) int
+xbzrle_encode_common(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                     uint8_t *dst, int dlen,
+                     xbzrle_scan_fn zrun_end, xbzrle_scan_fn nzrun_end)
+{
+    uint32_t zrun_len, nzrun_len;
+    int d = 0, i = 0, j;
+
+    while (i < slen) {
+        /* overflow */
+        if (d + 2 > dlen) {
+            return -1;
+        }
+
+        j = zrun_end(old_buf, new_buf, i, slen);
+        zrun_len = j - i;
+        i = j;
 
         /* buffer unchanged */
         if (zrun_len == slen) {
@@ -76,56 +119,247 @@ int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
 
         d += uleb128_encode_small(dst + d, zrun_len);
 
-        zrun_len = 0;
-        nzrun_start = new_buf + i;
-
         /* overflow */
         if (d + 2 > dlen) {
             return -1;
         }
-        /* not aligned to sizeof(long) */
-        res = (slen - i) % sizeof(long);
-        while (res && old_buf[i] != new_buf[i]) {
-            i++;
-            nzrun_len++;
-            res--;
-        }
-
-        /* word at a time for speed, use of 32-bit long okay */
-        if (!res) {
-            /* truncation to 32-bit long okay */
-            unsigned long mask = (unsigned long)0x0101010101010101ULL;
-            while (i < slen) {
-                unsigned long xor;
-                xor = *(unsigned long *)(old_buf + i)
-                    ^ *(unsigned long *)(new_buf + i);
-                if ((xor - mask) & ~xor & (mask << 7)) {
-                    /* found the end of an nzrun within the current long */
-                    while (old_buf[i] != new_buf[i]) {
-                        nzrun_len++;
-                        i++;
-                    }
-                    break;
-                } else {
-                    i += sizeof(long);
-                    nzrun_len += sizeof(long);
-                }
-            }
-        }
+
+        j = nzrun_end(old_buf, new_buf, i, slen);
+        nzrun_len = j - i;
 
         d += uleb128_encode_small(dst + d, nzrun_len);
         /* overflow */
         if (d + nzrun_len > dlen) {
             return -1;
         }
-        memcpy(dst + d, nzrun_start, nzrun_len);
+        memcpy(dst + d, new_buf + i, nzrun_len);
         d += nzrun_len;
-        nzrun_len = 0;
+        i = j;
     }
 
     return d;
 }
 
+static int xbzrle_encode_int(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                             uint8_t *dst, int dlen)
+{
+    return xbzrle_encode_common(old_buf, new_buf, slen, dst, dlen,
+                                zrun_end_int, nzrun_end_int);
+}
+
+#if defined(CONFIG_AVX2_OPT) || defined(__SSE2__)
+/* Do not use push_options pragmas unnecessarily, because clang
+ * does not support them.
+ */
+#ifdef CONFIG_AVX2_OPT
+#pragma GCC push_options
+#pragma GCC target("sse2")
+#endif
+#include <emmintrin.h>
+
+/* Compare 16 bytes at a time; bit n of the mask is set if byte n is equal */
+static inline unsigned xbzrle_eq_mask_sse2(const uint8_t *old_buf,
+                                           const uint8_t *new_buf, int i)
+{
+    __m128i a = _mm_loadu_si128((const __m128i *)(old_buf + i));
+    __m128i b = _mm_loadu_si128((const __m128i *)(new_buf + i));
+
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(a, b));
+}
+
+static inline int zrun_end_sse2(const uint8_t *old_buf, const uint8_t *new_buf,
+                                int i, int slen)
+{
+    for (; i + 16 <= slen; i += 16) {
+        unsigned mask = xbzrle_eq_mask_sse2(old_buf, new_buf, i);
+        if (mask != 0xffff) {
+            return i + ctz32(~mask);
+        }
+    }
+    while (i < slen && old_buf[i] == new_buf[i]) {
+        i++;
+    }
+    return i;
+}
+
+static inline int nzrun_end_sse2(const uint8_t *old_buf,
+                                 const uint8_t *new_buf, int i, int slen)
+{
+    for (; i + 16 <= slen; i += 16) {
+        unsigned mask = xbzrle_eq_mask_sse2(old_buf, new_buf, i);
+        if (mask) {
+            return i + ctz32(mask);
+        }
+    }
+    while (i < slen && old_buf[i] != new_buf[i]) {
+        i++;
+    }
+    return i;
+}
+
+static int xbzrle_encode_sse2(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                              uint8_t *dst, int dlen)
+{
+    return xbzrle_encode_common(old_buf, new_buf, slen, dst, dlen,
+                                zrun_end_sse2, nzrun_end_sse2);
+}
+#ifdef CONFIG_AVX2_OPT
+#pragma GCC pop_options
+#endif
+
+#ifdef CONFIG_AVX2_OPT
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#include <immintrin.h>
+
+/* Compare 32 bytes at a time; bit n of the mask is set if byte n is equal */
+static inline uint32_t xbzrle_eq_mask_avx2(const uint8_t *old_buf,
+                                           const uint8_t *new_buf, int i)
+{
+    __m256i a = _mm256_loadu_si256((const __m256i *)(old_buf + i));
+    __m256i b = _mm256_loadu_si256((const __m256i *)(new_buf + i));
+
+    return _mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b));
+}
+
+static inline int zrun_end_avx2(const uint8_t *old_buf, const uint8_t *new_buf,
+                                int i, int slen)
+{
+    for (; i + 32 <= slen; i += 32) {
+        uint32_t mask = xbzrle_eq_mask_avx2(old_buf, new_buf, i);
+        if (mask != UINT32_MAX) {
+            return i + ctz32(~mask);
+        }
+    }
+    while (i < slen && old_buf[i] == new_buf[i]) {
+        i++;
+    }
+    return i;
+}
+
+static inline int nzrun_end_avx2(const uint8_t *old_buf,
+                                 const uint8_t *new_buf, int i, int slen)
+{
+    for (; i + 32 <= slen; i += 32) {
+        uint32_t mask = xbzrle_eq_mask_avx2(old_buf, new_buf, i);
+        if (mask) {
+            return i + ctz32(mask);
+        }
+    }
+    while (i < slen && old_buf[i] != new_buf[i]) {
+        i++;
+    }
+    return i;
+}
+
+static int xbzrle_encode_avx2(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                              uint8_t *dst, int dlen)
+{
+    return xbzrle_encode_common(old_buf, new_buf, slen, dst, dlen,
+                                zrun_end_avx2, nzrun_end_avx2);
+}
+#pragma GCC pop_options
+#endif /* CONFIG_AVX2_OPT */
+
+/* Note that for test_xbzrle_encode_next_accel, the most preferred
+ * ISA must have the least significant bit.
+ */
+#define CACHE_AVX2    1
+#define CACHE_SSE2    2
+
+/* Make sure that these variables are appropriately initialized when
+ * SSE2 is enabled on the compiler command-line, but the compiler is
+ * too old to support CONFIG_AVX2_OPT.
+ */
+#ifdef CONFIG_AVX2_OPT
+# define INIT_CACHE 0
+# define INIT_ACCEL xbzrle_encode_int
+#else
+# ifndef __SSE2__
+#  error "ISA selection confusion"
+# endif
+# define INIT_CACHE CACHE_SSE2
+# define INIT_ACCEL xbzrle_encode_sse2
+#endif
+
+static unsigned cpuid_cache = INIT_CACHE;
+static int (*xbzrle_encode_accel)(uint8_t *, uint8_t *, int,
+                                  uint8_t *, int) = INIT_ACCEL;
+
+static void init_accel(unsigned cache)
+{
+    int (*fn)(uint8_t *, uint8_t *, int, uint8_t *, int) = xbzrle_encode_int;
+    if (cache & CACHE_SSE2) {
+        fn = xbzrle_encode_sse2;
+    }
+#ifdef CONFIG_AVX2_OPT
+    if (cache & CACHE_AVX2) {
+        fn = xbzrle_encode_avx2;
+    }
+#endif
+    xbzrle_encode_accel = fn;
+}
+
+#ifdef CONFIG_AVX2_OPT
+#include "qemu/cpuid.h"
+
+static void __attribute__((constructor)) init_cpuid_cache(void)
+{
+    int max = __get_cpuid_max(0, NULL);
+    int a, b, c, d;
+    unsigned cache = 0;
+
+    if (max >= 1) {
+        __cpuid(1, a, b, c, d);
+        if (d & bit_SSE2) {
+            cache |= CACHE_SSE2;
+        }
+
+        /* We must check that AVX is not just available, but usable.  */
+        if ((c & bit_OSXSAVE) && (c & bit_AVX) && max >= 7) {
+            int bv;
+            __asm("xgetbv" : "=a"(bv), "=d"(d) : "c"(0));
+            __cpuid_count(7, 0, a, b, c, d);
+            if ((bv & 6) == 6 && (b & bit_AVX2)) {
+                cache |= CACHE_AVX2;
+            }
+        }
+    }
+    cpuid_cache = cache;
+    init_accel(cache);
+}
+#endif /* CONFIG_AVX2_OPT */
+
+bool test_xbzrle_encode_next_accel(void)
+{
+    /* If no bits set, we just tested xbzrle_encode_int, and there
+       are no more acceleration options to test.  */
+    if (cpuid_cache == 0) {
+        return false;
+    }
+    /* Disable the accelerator we used before and select a new one.  */
+    cpuid_cache &= cpuid_cache - 1;
+    init_accel(cpuid_cache);
+    return true;
+}
+
+#else
+#define xbzrle_encode_accel  xbzrle_encode_int
+bool test_xbzrle_encode_next_accel(void)
+{
+    return false;
+}
+#endif
+
+int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                         uint8_t *dst, int dlen)
+{
+    g_assert(!(((uintptr_t)old_buf | (uintptr_t)new_buf | slen) %
+               sizeof(long)));
+
+    return xbzrle_encode_accel(old_buf, new_buf, slen, dst, dlen);
+}
+
 int xbzrle_decode_buffer(uint8_t *src, int slen, uint8_t *dst, int dlen)
 {
     int i = 0, d = 0;
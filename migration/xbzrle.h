@@ -18,4 +18,9 @@ int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
                          uint8_t *dst, int dlen);
 
 int xbzrle_decode_buffer(uint8_t *src, int slen, uint8_t *dst, int dlen);
+
+/* Switch xbzrle_encode_buffer() to the next less preferred accelerator;
+ * returns false once the generic implementation is selected.  For tests.
+ */
+bool test_xbzrle_encode_next_accel(void);
 #endif
@@ -40,8 +40,9 @@ struct tcg_temp_info {
     tcg_target_ulong mask;
 };
 
-static struct tcg_temp_info temps[TCG_MAX_TEMPS];
-static TCGTempSet temps_used;
+/* Several TCG threads may be optimizing different TBs at the same time.  */
+static __thread struct tcg_temp_info temps[TCG_MAX_TEMPS];
+static __thread TCGTempSet temps_used;
 
 static inline bool temp_is_const(TCGArg arg)
 {
@@ -70,6 +71,20 @@ static void reset_all_temps(int nb_temps)
     bitmap_zero(temps_used.l, nb_temps);
 }
 
+/* Reset the temporaries that are dead at the end of a basic block.
+   Globals and local temporaries keep their value on the fall-through
+   path of a conditional branch, which has no other predecessor.  */
+static void reset_bb_temps(TCGContext *s, int nb_temps)
+{
+    int i;
+
+    for (i = s->nb_globals; i < nb_temps; i++) {
+        if (test_bit(i, temps_used.l) && !s->temps[i].temp_local) {
+            reset_temp(i);
+        }
+    }
+}
+
 /* Initialize and activate a temporary.  */
 static void init_temp_info(TCGArg temp)
 {
@@ -1372,9 +1387,15 @@ void tcg_optimize(TCGContext *s)
             /* Default case: we know nothing about operation (or were unable
                to compute the operation result) so no propagation is done.
                We trash everything if the operation is the end of a basic
-               block, otherwise we only trash the output args.  "mask" is
+               block (but in a trace, keep what survives the fall-through
+               path of a conditional branch), otherwise we only trash the
+               output args.  "mask" is
                the non-zero bits mask for the first output arg.  */
-            if (def->flags & TCG_OPF_BB_END) {
+            if (s->trace_tail
+                && (opc == INDEX_op_brcond_i32 || opc == INDEX_op_brcond_i64
+                    || opc == INDEX_op_brcond2_i32)) {
+                reset_bb_temps(s, nb_temps);
+            } else if (def->flags & TCG_OPF_BB_END) {
                 reset_all_temps(nb_temps);
             } else {
         do_reset_output:
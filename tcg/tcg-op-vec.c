@@ -0,0 +1,228 @@
+/*
+ * Tiny Code Generator for QEMU
+ * Host vector operations
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu-common.h"
+#include "cpu.h"
+#include "exec/exec-all.h"
+#include "tcg.h"
+#include "tcg-op.h"
+
+/* Reduce the number of ifdefs below.  This assumes that all uses of
+   TCGV_HIGH and TCGV_LOW are properly protected by a conditional that
+   the compiler can eliminate.  */
+#if TCG_TARGET_REG_BITS == 64
+extern TCGv_i32 TCGV_LOW_link_error(TCGv_i64);
+extern TCGv_i32 TCGV_HIGH_link_error(TCGv_i64);
+#define TCGV_LOW  TCGV_LOW_link_error
+#define TCGV_HIGH TCGV_HIGH_link_error
+#endif
+
+static inline TCGType vec_type(TCGv_vec v)
+{
+    return tcg_ctx->temps[GET_TCGV_VEC(v)].base_type;
+}
+
+static void vec_gen_2(TCGOpcode opc, TCGType type, unsigned vece,
+                      TCGArg r, TCGArg a)
+{
+    tcg_gen_op4(tcg_ctx, opc, r, a, type - TCG_TYPE_V64, vece);
+}
+
+static void vec_gen_3(TCGOpcode opc, TCGType type, unsigned vece,
+                      TCGArg r, TCGArg a, TCGArg b)
+{
+    tcg_gen_op5(tcg_ctx, opc, r, a, b, type - TCG_TYPE_V64, vece);
+}
+
+static void vec_gen_op2(TCGOpcode opc, unsigned vece, TCGv_vec r, TCGv_vec a)
+{
+    TCGType type = vec_type(r);
+
+    tcg_debug_assert(vec_type(a) == type);
+    vec_gen_2(opc, type, vece, GET_TCGV_VEC(r), GET_TCGV_VEC(a));
+}
+
+static void vec_gen_op3(TCGOpcode opc, unsigned vece,
+                        TCGv_vec r, TCGv_vec a, TCGv_vec b)
+{
+    TCGType type = vec_type(r);
+
+    tcg_debug_assert(vec_type(a) == type);
+    tcg_debug_assert(vec_type(b) == type);
+    vec_gen_3(opc, type, vece, GET_TCGV_VEC(r),
+              GET_TCGV_VEC(a), GET_TCGV_VEC(b));
+}
+
+void tcg_gen_mov_vec(TCGv_vec r, TCGv_vec a)
+{
+    if (!TCGV_EQUAL_VEC(r, a)) {
+        vec_gen_op2(INDEX_op_mov_vec, 0, r, a);
+    }
+}
+
+void tcg_gen_dup_i64_vec(unsigned vece, TCGv_vec r, TCGv_i64 a)
+{
+    TCGType type = vec_type(r);
+
+    if (TCG_TARGET_REG_BITS == 64) {
+        vec_gen_2(INDEX_op_dup_vec, type, vece,
+                  GET_TCGV_VEC(r), GET_TCGV_I64(a));
+    } else {
+        /* A 32-bit host cannot replicate a 64-bit register pair.  */
+        tcg_debug_assert(vece < MO_64);
+        vec_gen_2(INDEX_op_dup_vec, type, vece,
+                  GET_TCGV_VEC(r), GET_TCGV_I32(TCGV_LOW(a)));
+    }
+}
+
+void tcg_gen_dup_i32_vec(unsigned vece, TCGv_vec r, TCGv_i32 a)
+{
+    tcg_debug_assert(vece < MO_64);
+    vec_gen_2(INDEX_op_dup_vec, vec_type(r), vece,
+              GET_TCGV_VEC(r), GET_TCGV_I32(a));
+}
+
+/* All hosts can materialize zero and all-ones directly; anything else
+   goes through a general register.  */
+static void do_dupi_vec(TCGv_vec r, unsigned vece, uint64_t a)
+{
+    if (a == 0 || a == -1) {
+        tcg_gen_op4(tcg_ctx, INDEX_op_dupi_vec, GET_TCGV_VEC(r), a,
+                    vec_type(r) - TCG_TYPE_V64, MO_64);
+    } else if (vece == MO_64) {
+        TCGv_i64 t = tcg_const_i64(a);
+        tcg_gen_dup_i64_vec(MO_64, r, t);
+        tcg_temp_free_i64(t);
+    } else {
+        TCGv_i32 t = tcg_const_i32(a);
+        tcg_gen_dup_i32_vec(vece, r, t);
+        tcg_temp_free_i32(t);
+    }
+}
+
+void tcg_gen_dup64i_vec(TCGv_vec r, uint64_t a)
+{
+    do_dupi_vec(r, MO_64, a);
+}
+
+void tcg_gen_dup32i_vec(TCGv_vec r, uint32_t a)
+{
+    do_dupi_vec(r, MO_32, a == (uint32_t)-1 ? -1 : a);
+}
+
+void tcg_gen_dup16i_vec(TCGv_vec r, uint32_t a)
+{
+    a &= 0xffff;
+    do_dupi_vec(r, MO_16, a == 0xffff ? -1 : a);
+}
+
+void tcg_gen_dup8i_vec(TCGv_vec r, uint32_t a)
+{
+    a &= 0xff;
+    do_dupi_vec(r, MO_8, a == 0xff ? -1 : a);
+}
+
+static void vec_gen_ldst(TCGOpcode opc, TCGv_vec r, TCGv_ptr b, TCGArg o)
+{
+    tcg_gen_op5(tcg_ctx, opc, GET_TCGV_VEC(r), GET_TCGV_PTR(b), o,
+                vec_type(r) - TCG_TYPE_V64, 0);
+}
+
+void tcg_gen_ld_vec(TCGv_vec r, TCGv_ptr b, TCGArg o)
+{
+    vec_gen_ldst(INDEX_op_ld_vec, r, b, o);
+}
+
+void tcg_gen_st_vec(TCGv_vec r, TCGv_ptr b, TCGArg o)
+{
+    vec_gen_ldst(INDEX_op_st_vec, r, b, o);
+}
+
+void tcg_gen_add_vec(unsigned vece, TCGv_vec r, TCGv_vec a, TCGv_vec b)
+{
+    vec_gen_op3(INDEX_op_add_vec, vece, r, a, b);
+}
+
+void tcg_gen_sub_vec(unsigned vece, TCGv_vec r, TCGv_vec a, TCGv_vec b)
+{
+    vec_gen_op3(INDEX_op_sub_vec, vece, r, a, b);
+}
+
+void tcg_gen_and_vec(unsigned vece, TCGv_vec r, TCGv_vec a, TCGv_vec b)
+{
+    vec_gen_op3(INDEX_op_and_vec, 0, r, a, b);
+}
+
+void tcg_gen_or_vec(unsigned vece, TCGv_vec r, TCGv_vec a, TCGv_vec b)
+{
+    vec_gen_op3(INDEX_op_or_vec, 0, r, a, b);
+}
+
+void tcg_gen_xor_vec(unsigned vece, TCGv_vec r, TCGv_vec a, TCGv_vec b)
+{
+    vec_gen_op3(INDEX_op_xor_vec, 0, r, a, b);
+}
+
+void tcg_gen_andc_vec(unsigned vece, TCGv_vec r, TCGv_vec a, TCGv_vec b)
+{
+    if (TCG_TARGET_HAS_andc_vec) {
+        vec_gen_op3(INDEX_op_andc_vec, 0, r, a, b);
+    } else {
+        TCGv_vec t = tcg_temp_new_vec_matching(r);
+        tcg_gen_not_vec(0, t, b);
+        tcg_gen_and_vec(0, r, a, t);
+        tcg_temp_free_vec(t);
+    }
+}
+
+void tcg_gen_orc_vec(unsigned vece, TCGv_vec r, TCGv_vec a, TCGv_vec b)
+{
+    if (TCG_TARGET_HAS_orc_vec) {
+        vec_gen_op3(INDEX_op_orc_vec, 0, r, a, b);
+    } else {
+        TCGv_vec t = tcg_temp_new_vec_matching(r);
+        tcg_gen_not_vec(0, t, b);
+        tcg_gen_or_vec(0, r, a, t);
+        tcg_temp_free_vec(t);
+    }
+}
+
+void tcg_gen_not_vec(unsigned vece, TCGv_vec r, TCGv_vec a)
+{
+    if (TCG_TARGET_HAS_not_vec) {
+        vec_gen_op2(INDEX_op_not_vec, 0, r, a);
+    } else {
+        TCGv_vec t = tcg_temp_new_vec_matching(r);
+        do_dupi_vec(t, MO_64, -1);
+        tcg_gen_xor_vec(0, r, a, t);
+        tcg_temp_free_vec(t);
+    }
+}
+
+void tcg_gen_neg_vec(unsigned vece, TCGv_vec r, TCGv_vec a)
+{
+    if (TCG_TARGET_HAS_neg_vec) {
+        vec_gen_op2(INDEX_op_neg_vec, vece, r, a);
+    } else {
+        TCGv_vec t = tcg_temp_new_vec_matching(r);
+        do_dupi_vec(t, MO_64, 0);
+        tcg_gen_sub_vec(vece, r, t, a);
+        tcg_temp_free_vec(t);
+    }
+}
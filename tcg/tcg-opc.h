@@ -185,6 +185,30 @@ DEF(muls2_i64, 2, 2, 0, IMPL64 | IMPL(TCG_TARGET_HAS_muls2_i64))
 DEF(muluh_i64, 1, 2, 0, IMPL(TCG_TARGET_HAS_muluh_i64))
 DEF(mulsh_i64, 1, 2, 0, IMPL(TCG_TARGET_HAS_mulsh_i64))
 
+/* Host vector support.  Each op carries two trailing constant arguments,
+   the vector length as (TCGType - TCG_TYPE_V64) and the element size as
+   a TCGMemOp MO_8..MO_64.  */
+
+#define IMPLVEC  TCG_OPF_VECTOR | IMPL(TCG_TARGET_MAYBE_vec)
+
+DEF(mov_vec, 1, 1, 2, TCG_OPF_VECTOR | TCG_OPF_NOT_PRESENT)
+DEF(dupi_vec, 1, 0, 3, IMPLVEC)
+
+DEF(ld_vec, 1, 1, 3, IMPLVEC)
+DEF(st_vec, 0, 2, 3, IMPLVEC)
+DEF(dup_vec, 1, 1, 2, IMPLVEC)
+
+DEF(add_vec, 1, 2, 2, IMPLVEC)
+DEF(sub_vec, 1, 2, 2, IMPLVEC)
+DEF(neg_vec, 1, 1, 2, IMPLVEC | IMPL(TCG_TARGET_HAS_neg_vec))
+
+DEF(and_vec, 1, 2, 2, IMPLVEC)
+DEF(or_vec, 1, 2, 2, IMPLVEC)
+DEF(xor_vec, 1, 2, 2, IMPLVEC)
+DEF(andc_vec, 1, 2, 2, IMPLVEC | IMPL(TCG_TARGET_HAS_andc_vec))
+DEF(orc_vec, 1, 2, 2, IMPLVEC | IMPL(TCG_TARGET_HAS_orc_vec))
+DEF(not_vec, 1, 1, 2, IMPLVEC | IMPL(TCG_TARGET_HAS_not_vec))
+
 #define TLADDR_ARGS  (TARGET_LONG_BITS <= TCG_TARGET_REG_BITS ? 1 : 2)
 #define DATA64_ARGS  (TCG_TARGET_REG_BITS == 64 ? 1 : 2)
 
@@ -208,4 +232,5 @@ DEF(qemu_st_i64, 0, TLADDR_ARGS + DATA64_ARGS, 1,
 #undef DATA64_ARGS
 #undef IMPL
 #undef IMPL64
+#undef IMPLVEC
 #undef DEF
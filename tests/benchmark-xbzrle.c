@@ -0,0 +1,99 @@
+/*
+ * XBZRLE encoder speed benchmark
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ */
+#include "qemu/osdep.h"
+#include "qemu-common.h"
+#include "qemu/cutils.h"
+#include "../migration/xbzrle.h"
+
+#define PAGE_SIZE 4096
+#define NUM_PAGES 1024
+
+/* Dirty @percent of each page, in runs of 1 to 64 bytes like a guest
+ * updating counters and small records would.
+ */
+static void fill_pages(uint8_t *old, uint8_t *new, int percent)
+{
+    int p, i;
+
+    for (p = 0; p < NUM_PAGES; p++) {
+        uint8_t *o = old + p * PAGE_SIZE;
+        uint8_t *n = new + p * PAGE_SIZE;
+
+        for (i = 0; i < PAGE_SIZE; i++) {
+            o[i] = n[i] = g_test_rand_int();
+        }
+
+        i = 0;
+        while (i < PAGE_SIZE) {
+            int nzrun = g_test_rand_int_range(1, 65);
+            int zrun = nzrun * (100 - percent) / MAX(percent, 1);
+
+            i += g_test_rand_int_range(0, 2 * zrun + 1);
+            for (; i < PAGE_SIZE && nzrun; i++, nzrun--) {
+                n[i] = o[i] ^ 0xff;
+            }
+        }
+    }
+}
+
+static const int dirty_percent[] = { 1, 10, 25, 50 };
+
+static void test_xbzrle_speed(void)
+{
+    size_t n = ARRAY_SIZE(dirty_percent);
+    uint8_t *old[ARRAY_SIZE(dirty_percent)];
+    uint8_t *new[ARRAY_SIZE(dirty_percent)];
+    uint8_t *dst = g_malloc(PAGE_SIZE);
+    int accel = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        old[i] = g_malloc(PAGE_SIZE * NUM_PAGES);
+        new[i] = g_malloc(PAGE_SIZE * NUM_PAGES);
+        fill_pages(old[i], new[i], dirty_percent[i]);
+    }
+
+    /* Measure the preferred accelerator first, then each fallback */
+    do {
+        for (i = 0; i < n; i++) {
+            double total = 0.0;
+            int p;
+
+            g_test_timer_start();
+            do {
+                for (p = 0; p < NUM_PAGES; p++) {
+                    xbzrle_encode_buffer(old[i] + p * PAGE_SIZE,
+                                         new[i] + p * PAGE_SIZE,
+                                         PAGE_SIZE, dst, PAGE_SIZE);
+                }
+                total += PAGE_SIZE * NUM_PAGES;
+            } while (g_test_timer_elapsed() < 2.0);
+
+            total /= 1024 * 1024; /* to MB */
+            g_print("xbzrle encode: accelerator %d, %d%% dirty: ",
+                    accel, dirty_percent[i]);
+            g_print("%.2f MB in %.2f secs: ", total, g_test_timer_last());
+            g_print("%.2f MB/sec\n", total / g_test_timer_last());
+        }
+        accel++;
+    } while (test_xbzrle_encode_next_accel());
+
+    for (i = 0; i < n; i++) {
+        g_free(new[i]);
+        g_free(old[i]);
+    }
+    g_free(dst);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/xbzrle/encode/speed", test_xbzrle_speed);
+
+    return g_test_run();
+}
@@ -0,0 +1,312 @@
+/*
+ * fp-bench.c - A collection of simple floating point microbenchmarks.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include <math.h>
+#include "qemu/timer.h"
+#include "fpu/softfloat.h"
+
+/* amortize the computation of random inputs */
+#define OPS_PER_ITER     50000
+
+#define MAX_OPERANDS 2
+
+#define SEED_A 0xdeadfacedeadface
+#define SEED_B 0xbadc0feebadc0fee
+
+enum op {
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_SQRT,
+};
+
+static const char * const op_names[] = {
+    [OP_ADD] = "add",
+    [OP_SUB] = "sub",
+    [OP_MUL] = "mul",
+    [OP_DIV] = "div",
+    [OP_SQRT] = "sqrt",
+};
+
+enum precision {
+    PREC_SINGLE,
+    PREC_DOUBLE,
+};
+
+static const char * const prec_names[] = {
+    [PREC_SINGLE] = "single",
+    [PREC_DOUBLE] = "double",
+};
+
+enum tester {
+    TESTER_SOFT,
+    TESTER_HARD,
+    TESTER_HOST,
+};
+
+static const char * const tester_names[] = {
+    [TESTER_SOFT] = "soft",
+    [TESTER_HARD] = "hard",
+    [TESTER_HOST] = "host",
+};
+
+static enum op op = OP_ADD;
+static enum precision precision = PREC_DOUBLE;
+static enum tester tester = TESTER_HARD;
+static unsigned int duration = 1;
+static uint64_t random_ops[MAX_OPERANDS] = { SEED_A, SEED_B };
+static float_status soft_status;
+
+static const char commands_string[] =
+    " -d = duration in seconds\n"
+    " -o = floating point operation (add, sub, mul, div, sqrt)\n"
+    " -p = precision (single, double)\n"
+    " -t = tester: soft = softfloat with the inexact flag cleared before\n"
+    "      each operation, which keeps the host FPU fast path out;\n"
+    "      hard = softfloat with its host FPU fast path;\n"
+    "      host = native C operations, for reference";
+
+static void usage_complete(char *argv[])
+{
+    fprintf(stderr, "Usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "options:\n%s\n", commands_string);
+}
+
+/*
+ * From: https://en.wikipedia.org/wiki/Xorshift
+ * This is faster than rand_r(), and gives us a wider range (RAND_MAX is only
+ * guaranteed to be >= INT_MAX).
+ */
+static uint64_t xorshift64star(uint64_t x)
+{
+    x ^= x >> 12; /* a */
+    x ^= x << 25; /* b */
+    x ^= x >> 27; /* c */
+    return x * UINT64_C(2685821657736338717);
+}
+
+/* Return a positive normal number with an exponent close to zero, so that
+ * no operation overflows or underflows.
+ */
+static uint64_t random_double(uint64_t r)
+{
+    return (r & ((1ull << 52) - 1)) | (0x3feull << 52) | ((r >> 63) << 52);
+}
+
+static uint32_t random_float(uint64_t r)
+{
+    return (r & ((1u << 23) - 1)) | (0x7eu << 23) | ((r >> 63) << 23);
+}
+
+static void update_random_ops(void)
+{
+    int i;
+
+    for (i = 0; i < MAX_OPERANDS; i++) {
+        random_ops[i] = xorshift64star(random_ops[i]);
+    }
+}
+
+static inline void prepare_status(void)
+{
+    if (tester == TESTER_SOFT) {
+        soft_status.float_exception_flags = 0;
+    } else {
+        soft_status.float_exception_flags = float_flag_inexact;
+    }
+}
+
+static uint64_t bench_float(void)
+{
+    union {
+        float h;
+        float32 s;
+    } a, b, res = { .h = 0 };
+    unsigned int i;
+
+    a.s = make_float32(random_float(random_ops[0]));
+    b.s = make_float32(random_float(random_ops[1]));
+    update_random_ops();
+
+    for (i = 0; i < OPS_PER_ITER; i++) {
+        if (tester == TESTER_HOST) {
+            switch (op) {
+            case OP_ADD:
+                res.h = a.h + b.h;
+                break;
+            case OP_SUB:
+                res.h = a.h - b.h;
+                break;
+            case OP_MUL:
+                res.h = a.h * b.h;
+                break;
+            case OP_DIV:
+                res.h = a.h / b.h;
+                break;
+            case OP_SQRT:
+                res.h = sqrtf(a.h);
+                break;
+            }
+        } else {
+            prepare_status();
+            switch (op) {
+            case OP_ADD:
+                res.s = float32_add(a.s, b.s, &soft_status);
+                break;
+            case OP_SUB:
+                res.s = float32_sub(a.s, b.s, &soft_status);
+                break;
+            case OP_MUL:
+                res.s = float32_mul(a.s, b.s, &soft_status);
+                break;
+            case OP_DIV:
+                res.s = float32_div(a.s, b.s, &soft_status);
+                break;
+            case OP_SQRT:
+                res.s = float32_sqrt(a.s, &soft_status);
+                break;
+            }
+        }
+        /* Keep the compiler from hoisting the operation out of the loop.  */
+        a.h += res.h * 0x1p-30f;
+    }
+    return float32_val(res.s);
+}
+
+static uint64_t bench_double(void)
+{
+    union {
+        double h;
+        float64 s;
+    } a, b, res = { .h = 0 };
+    unsigned int i;
+
+    a.s = make_float64(random_double(random_ops[0]));
+    b.s = make_float64(random_double(random_ops[1]));
+    update_random_ops();
+
+    for (i = 0; i < OPS_PER_ITER; i++) {
+        if (tester == TESTER_HOST) {
+            switch (op) {
+            case OP_ADD:
+                res.h = a.h + b.h;
+                break;
+            case OP_SUB:
+                res.h = a.h - b.h;
+                break;
+            case OP_MUL:
+                res.h = a.h * b.h;
+                break;
+            case OP_DIV:
+                res.h = a.h / b.h;
+                break;
+            case OP_SQRT:
+                res.h = sqrt(a.h);
+                break;
+            }
+        } else {
+            prepare_status();
+            switch (op) {
+            case OP_ADD:
+                res.s = float64_add(a.s, b.s, &soft_status);
+                break;
+            case OP_SUB:
+                res.s = float64_sub(a.s, b.s, &soft_status);
+                break;
+            case OP_MUL:
+                res.s = float64_mul(a.s, b.s, &soft_status);
+                break;
+            case OP_DIV:
+                res.s = float64_div(a.s, b.s, &soft_status);
+                break;
+            case OP_SQRT:
+                res.s = float64_sqrt(a.s, &soft_status);
+                break;
+            }
+        }
+        a.h += res.h * 0x1p-60;
+    }
+    return float64_val(res.s);
+}
+
+static void run_bench(void)
+{
+    int64_t t0, t1, ns;
+    uint64_t n_ops = 0;
+    uint64_t sink = 0;
+
+    set_float_rounding_mode(float_round_nearest_even, &soft_status);
+
+    t0 = get_clock_realtime();
+    do {
+        if (precision == PREC_SINGLE) {
+            sink ^= bench_float();
+        } else {
+            sink ^= bench_double();
+        }
+        n_ops += OPS_PER_ITER;
+        t1 = get_clock_realtime();
+    } while (t1 - t0 < duration * NANOSECONDS_PER_SECOND);
+    ns = t1 - t0;
+
+    printf("%s-%s-%s: %.2f MFlops (%016" PRIx64 ")\n",
+           tester_names[tester], prec_names[precision], op_names[op],
+           (double)n_ops / ns * 1e3, sink);
+}
+
+static int find_name(const char * const *names, size_t n, const char *name)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        if (!strcmp(names[i], name)) {
+            return i;
+        }
+    }
+    fprintf(stderr, "Unknown argument '%s'\n", name);
+    exit(EXIT_FAILURE);
+}
+
+static void parse_args(int argc, char *argv[])
+{
+    int c;
+
+    for (;;) {
+        c = getopt(argc, argv, "hd:o:p:t:");
+        if (c < 0) {
+            break;
+        }
+        switch (c) {
+        case 'h':
+            usage_complete(argv);
+            exit(0);
+        case 'd':
+            duration = atoi(optarg);
+            break;
+        case 'o':
+            op = find_name(op_names, ARRAY_SIZE(op_names), optarg);
+            break;
+        case 'p':
+            precision = find_name(prec_names, ARRAY_SIZE(prec_names), optarg);
+            break;
+        case 't':
+            tester = find_name(tester_names, ARRAY_SIZE(tester_names), optarg);
+            break;
+        default:
+            usage_complete(argv);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    parse_args(argc, argv);
+    run_bench();
+    return 0;
+}
@@ -72,6 +72,43 @@ static void test_io_channel_fd(void)
 
 
 #ifndef _WIN32
+static void test_io_channel_file_positioned(void)
+{
+    QIOChannel *ioc;
+    char buf[8];
+
+#define TEST_FILE "tests/test-io-channel-file.txt"
+    unlink(TEST_FILE);
+    ioc = QIO_CHANNEL(qio_channel_file_new_path(
+                          TEST_FILE,
+                          O_RDWR | O_CREAT | O_TRUNC | O_BINARY, 0600,
+                          &error_abort));
+
+    /* Writes out of order must land at their offsets */
+    g_assert_cmpint(qio_channel_pwrite(ioc, "world", 5, 4096, &error_abort),
+                    ==, 5);
+    g_assert_cmpint(qio_channel_pwrite(ioc, "hello", 5, 0, &error_abort),
+                    ==, 5);
+
+    /* ... without moving the current position */
+    g_assert_cmpint(qio_channel_io_seek(ioc, 0, SEEK_CUR, &error_abort),
+                    ==, 0);
+
+    memset(buf, 0, sizeof(buf));
+    g_assert_cmpint(qio_channel_pread(ioc, buf, 5, 4096, &error_abort),
+                    ==, 5);
+    g_assert_cmpstr(buf, ==, "world");
+    g_assert_cmpint(qio_channel_pread(ioc, buf, 5, 0, &error_abort),
+                    ==, 5);
+    g_assert_cmpstr(buf, ==, "hello");
+    g_assert_cmpint(qio_channel_pread(ioc, buf, 5, 8192, &error_abort),
+                    ==, 0);
+
+    unlink(TEST_FILE);
+    object_unref(OBJECT(ioc));
+}
+
+
 static void test_io_channel_pipe(bool async)
 {
     QIOChannel *src, *dst;
@@ -116,6 +153,8 @@ int main(int argc, char **argv)
     g_test_add_func("/io/channel/file", test_io_channel_file);
     g_test_add_func("/io/channel/file/fd", test_io_channel_fd);
 #ifndef _WIN32
+    g_test_add_func("/io/channel/file/positioned",
+                    test_io_channel_file_positioned);
     g_test_add_func("/io/channel/pipe/sync", test_io_channel_pipe_sync);
     g_test_add_func("/io/channel/pipe/async", test_io_channel_pipe_async);
 #endif
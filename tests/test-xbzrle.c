@@ -174,6 +174,77 @@ static void test_encode_decode(void)
     }
 }
 
+/* Pages with runs of random length, encoded with every accelerator */
+#define ACCEL_PAGES 256
+
+static void fill_accel_page(uint8_t *old, uint8_t *new)
+{
+    int i = 0;
+
+    memset(old, 0, PAGE_SIZE);
+    memset(new, 0, PAGE_SIZE);
+    while (i < PAGE_SIZE) {
+        int zrun = g_test_rand_int_range(0, 200);
+        int nzrun = g_test_rand_int_range(1, 100);
+
+        for (i += zrun; i < PAGE_SIZE && nzrun; i++, nzrun--) {
+            old[i] = g_test_rand_int();
+            new[i] = old[i] ^ g_test_rand_int_range(1, 256);
+        }
+    }
+}
+
+static void test_encode_accel(void)
+{
+    uint8_t *old = g_malloc(PAGE_SIZE * ACCEL_PAGES);
+    uint8_t *new = g_malloc(PAGE_SIZE * ACCEL_PAGES);
+    uint8_t *ref = g_malloc(PAGE_SIZE * ACCEL_PAGES);
+    int *ref_len = g_new(int, ACCEL_PAGES);
+    uint8_t *compressed = g_malloc(PAGE_SIZE);
+    uint8_t *decoded = g_malloc(PAGE_SIZE);
+    bool first = true;
+    int i;
+
+    for (i = 0; i < ACCEL_PAGES; i++) {
+        fill_accel_page(old + i * PAGE_SIZE, new + i * PAGE_SIZE);
+    }
+
+    /* Every implementation must produce exactly the same stream */
+    do {
+        for (i = 0; i < ACCEL_PAGES; i++) {
+            uint8_t *o = old + i * PAGE_SIZE;
+            uint8_t *n = new + i * PAGE_SIZE;
+            int dlen = xbzrle_encode_buffer(o, n, PAGE_SIZE, compressed,
+                                            PAGE_SIZE);
+
+            if (first) {
+                ref_len[i] = dlen;
+                if (dlen > 0) {
+                    memcpy(ref + i * PAGE_SIZE, compressed, dlen);
+                    memcpy(decoded, o, PAGE_SIZE);
+                    g_assert(xbzrle_decode_buffer(compressed, dlen, decoded,
+                                                  PAGE_SIZE) > 0);
+                    g_assert(memcmp(decoded, n, PAGE_SIZE) == 0);
+                }
+            } else {
+                g_assert_cmpint(dlen, ==, ref_len[i]);
+                if (dlen > 0) {
+                    g_assert(memcmp(ref + i * PAGE_SIZE, compressed,
+                                    dlen) == 0);
+                }
+            }
+        }
+        first = false;
+    } while (test_xbzrle_encode_next_accel());
+
+    g_free(decoded);
+    g_free(compressed);
+    g_free(ref_len);
+    g_free(ref);
+    g_free(new);
+    g_free(old);
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
@@ -186,6 +257,8 @@ int main(int argc, char **argv)
     g_test_add_func("/xbzrle/encode_decode_overflow",
                     test_encode_decode_overflow);
     g_test_add_func("/xbzrle/encode_decode", test_encode_decode);
+    /* last, because it leaves the generic encoder selected */
+    g_test_add_func("/xbzrle/encode_accel", test_encode_accel);
 
     return g_test_run();
 }
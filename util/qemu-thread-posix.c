@@ -534,6 +534,22 @@ bool qemu_thread_is_self(QemuThread *thread)
    return pthread_equal(pthread_self(), thread->thread);
 }
 
+int64_t qemu_thread_get_cpu_time_ns(QemuThread *thread)
+{
+#if defined(_POSIX_THREAD_CPUTIME) && _POSIX_THREAD_CPUTIME >= 0
+    clockid_t clock;
+    struct timespec ts;
+
+    if (pthread_getcpuclockid(thread->thread, &clock) ||
+        clock_gettime(clock, &ts)) {
+        return -1;
+    }
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+#else
+    return -1;
+#endif
+}
+
 void qemu_thread_exit(void *retval)
 {
     pthread_exit(retval);
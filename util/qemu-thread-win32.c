@@ -445,3 +445,24 @@ bool qemu_thread_is_self(QemuThread *thread)
 {
     return GetCurrentThreadId() == thread->tid;
 }
+
+int64_t qemu_thread_get_cpu_time_ns(QemuThread *thread)
+{
+    FILETIME creation, exit, kernel, user;
+    HANDLE handle;
+    BOOL ok;
+
+    handle = OpenThread(THREAD_QUERY_LIMITED_INFORMATION, FALSE, thread->tid);
+    if (!handle) {
+        return -1;
+    }
+    ok = GetThreadTimes(handle, &creation, &exit, &kernel, &user);
+    CloseHandle(handle);
+    if (!ok) {
+        return -1;
+    }
+
+    /* FILETIME counts in units of 100ns */
+    return ((((uint64_t)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime) +
+            (((uint64_t)user.dwHighDateTime << 32) | user.dwLowDateTime)) * 100;
+}
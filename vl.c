@@ -335,6 +335,11 @@ static QemuOptsList qemu_accel_opts = {
             .type = QEMU_OPT_STRING,
             .help = "Enable/disable multi-threaded TCG",
         },
+        {
+            .name = "traces",
+            .type = QEMU_OPT_NUMBER,
+            .help = "Form traces from TBs run this many times (0 = off)",
+        },
         { /* end of list */ }
     },
 };